@@ -0,0 +1,171 @@
+#!/bin/bash
+#
+#  Name        : bench.sh
+#  Author      : Edmund Luong <edmundvmluong@gmail.com>
+#  Version     : 1.0
+#  Copyright   : MIT 2014 © Edmund Luong
+#  Date        : November 16, 2014
+#  Description : End-to-end throughput benchmark for the Reliable File
+#                Transfer Protocol. Transfers files over loopback through
+#                the impairment proxy, across a matrix of file sizes,
+#                timeouts and loss rates, and prints one JSON object per
+#                configuration.
+#
+#  The matrix is configured through the environment:
+#
+#    BENCH_SIZES     File sizes, with K/M/G suffixes (1K 64K 1M 16M)
+#    BENCH_TIMEOUTS  Client retransmission timeouts, in msec (10 50)
+#    BENCH_LOSS      Random loss on the link, in percent (0 1)
+#    BENCH_DELAY     One-way delay on the link, in msec (0)
+#    BENCH_RUNS      Transfers per configuration (5)
+#    BENCH_PORT      First port to use (5600)
+#    BENCH_LIMIT     Time limit for a single transfer, in seconds (600)
+#
+#  CS 3357a Assignment 2
+
+cd "$(dirname "$0")" || exit 1
+
+SIZES=${BENCH_SIZES:-"1K 64K 1M 16M"}
+TIMEOUTS=${BENCH_TIMEOUTS:-"10 50"}
+LOSSES=${BENCH_LOSS:-"0 1"}
+DELAY=${BENCH_DELAY:-0}
+RUNS=${BENCH_RUNS:-5}
+PORT=${BENCH_PORT:-5600}
+LIMIT=${BENCH_LIMIT:-600}
+
+DATA_MSS=1464               # Data maximum segment size
+MAX_FSIZE=2000000000        # Maximum allowed filesize
+
+WORK=$(mktemp -d /tmp/rftp-bench.XXXXXX)
+trap 'rm -rf "$WORK"' EXIT
+TIMEFORMAT='%R %U %S'
+
+# Converts a size with a K, M or G suffix into bytes.
+to_bytes ()
+{
+    case $1 in
+        *K) echo $(( ${1%K} * 1000 )) ;;
+        *M) echo $(( ${1%M} * 1000000 )) ;;
+        *G) echo $(( ${1%G} * 1000000000 )) ;;
+        *)  echo "$1" ;;
+    esac
+}
+
+# Runs a single transfer, and prints its wall time, CPU time,
+# packets sent by the client and whether the file arrived intact.
+run_transfer ()
+{
+    local file=$1 timeout=$2 loss=$3
+    local proxy_port=$((PORT + 1))
+    local server_pid proxy_pid status cpu_server cpu_client sent
+
+    rm -rf "$WORK/out"
+
+    # Start the server and the proxy, timing the server's CPU use.
+    ( { time timeout "$LIMIT" ./rftpd -p "$PORT" "$WORK/out" > /dev/null ; } \
+        2> "$WORK/server.time" ) &
+    server_pid=$!
+    ./rftp-proxy -p "$proxy_port" -d "$DELAY" -l "$loss" -s "$RANDOM" \
+        localhost "$PORT" > "$WORK/proxy.log" &
+    proxy_pid=$!
+    sleep 0.1
+
+    # Transfer the file through the proxy, timing the client.
+    ( cd "$WORK" && { time timeout "$LIMIT" "$OLDPWD/rftp" -p "$proxy_port" \
+        -t "$timeout" localhost "$(basename "$file")" > /dev/null ; } \
+        2> "$WORK/client.time" )
+    status=$?
+
+    # Wait for the server to leave its wait state, stopping it if the
+    # transfer failed. Then stop the proxy, and collect the number of
+    # packets sent by the client.
+    [ "$status" -ne 0 ] && pkill -P "$server_pid" 2> /dev/null
+    wait "$server_pid" 2> /dev/null
+    kill -TERM "$proxy_pid"
+    wait "$proxy_pid"
+    sent=$(awk '/^Upstream/ { sub(",", "", $3); print $3 }' "$WORK/proxy.log")
+
+    # Check that the file arrived intact.
+    if [ "$status" -eq 0 ] && cmp -s "$file" "$WORK/out/$(basename "$file")"
+    then
+        status=0
+    else
+        status=1
+    fi
+
+    cpu_server=$(awk '{ print $2 + $3 }' "$WORK/server.time" 2> /dev/null)
+    read -r wall user sys < "$WORK/client.time"
+    cpu_client=$(awk -v u="$user" -v s="$sys" 'BEGIN { print u + s }')
+    echo "$wall $cpu_client ${cpu_server:-0} ${sent:-0} $status"
+}
+
+# Summarizes the runs of a configuration as a JSON object.
+summarize ()
+{
+    local size=$1 timeout=$2 loss=$3
+    sort -n -k1,1 "$WORK/runs" | awk -v size="$size" -v timeout="$timeout" \
+        -v loss="$loss" -v delay="$DELAY" -v mss="$DATA_MSS" '
+        {
+            wall[NR] = $1; cpu += $2 + $3; sent += $4; failed += $5
+            total_wall += $1
+        }
+        END {
+            n = NR
+            p50 = wall[int((n - 1) * 0.50) + 1]
+            p99 = wall[int((n - 1) * 0.99) + 1]
+            expected = int(size / mss) + 3
+            retransmits = sent / n - expected
+            if (retransmits < 0) retransmits = 0
+            printf("{\"size\": %d, \"timeout_ms\": %d, \"loss_pct\": %s, " \
+                   "\"delay_ms\": %s, \"runs\": %d, \"failures\": %d, " \
+                   "\"goodput_mbps\": %.3f, \"packets_per_sec\": %.1f, " \
+                   "\"cpu_sec_per_gb\": %.3f, \"retransmits\": %.1f, " \
+                   "\"p50_ms\": %.3f, \"p99_ms\": %.3f}\n",
+                   size, timeout, loss, delay, n, failed,
+                   (p50 > 0) ? size * 8 / p50 / 1e6 : 0,
+                   (total_wall > 0) ? sent / total_wall : 0,
+                   (size > 0) ? cpu / n / (size / 1e9) : 0,
+                   retransmits, p50 * 1000, p99 * 1000)
+        }'
+}
+
+# The executables must be built first, see make bench.
+for exe in rftp rftpd rftp-proxy
+do
+    if [ ! -x "$exe" ]
+    then
+        echo "ERROR: $exe has not been built." >&2
+        exit 1
+    fi
+done
+
+for size in $SIZES
+do
+    bytes=$(to_bytes "$size")
+
+    # Files are restricted to the maximum allowed size.
+    if [ "$bytes" -gt "$MAX_FSIZE" ]
+    then
+        printf '{"size": %d, "skipped": "exceeds the maximum file size"}\n' \
+            "$bytes"
+        continue
+    fi
+
+    file="$WORK/bench-$size.bin"
+    head -c "$bytes" /dev/urandom > "$file"
+
+    for timeout in $TIMEOUTS
+    do
+        for loss in $LOSSES
+        do
+            : > "$WORK/runs"
+            for run in $(seq "$RUNS")
+            do
+                run_transfer "$file" "$timeout" "$loss" >> "$WORK/runs"
+            done
+            summarize "$bytes" "$timeout" "$loss"
+        done
+    done
+
+    rm -f "$file"
+done
@@ -9,11 +9,15 @@
  *  CS 3357a Assignment 2
  */
 
+#define _GNU_SOURCE
+
 #include "file.h"
 
+#include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 #include <sys/stat.h>
 
 /*
@@ -65,9 +69,12 @@ FILE *get_file (char *filename, char *flag)
 }
 
 /*
- * Creates the specified directory, and creates a file in that directory.
+ * Joins the output directory and the filename into a full pathname.
+ *
+ * Returns the allocated pathname, if successful.
+ * Returns NULL if the pathname could not be allocated.
  */
-FILE *create_dir_and_file (char *output_dir, char *filename)
+char *get_output_path (char *output_dir, char *filename)
 {
     // Create the full pathname.
     char* path = malloc(strlen(output_dir) + strlen(filename) + 2);
@@ -79,9 +86,64 @@ FILE *create_dir_and_file (char *output_dir, char *filename)
         strcat(path, filename);
     }
 
+    return path;
+}
+
+/*
+ * Resolves a requested filename to a file under the served root directory.
+ * Symbolic links and ".." components are resolved first, so a request
+ * cannot name a file outside of the root.
+ *
+ * Returns the allocated real pathname of the file, if it is under the root.
+ * Returns NULL if the file does not exist or is outside of the root,
+ * with errno set.
+ */
+char *get_served_path (char *root, char *filename)
+{
+    char *real_root = NULL; // Real pathname of the root directory
+    char *path = NULL;      // Joined pathname of the file
+    char *real_path = NULL; // Real pathname of the file
+    size_t root_len = 0;    // Length of the real root pathname
+
+    // Resolve the root and the requested file.
+    if ((real_root = realpath(root, NULL))
+            && (path = get_output_path(root, filename)))
+    {
+        real_path = realpath(path, NULL);
+    }
+
+    // The file must be the root itself or lie beneath it.
+    if (real_path)
+    {
+        root_len = strlen(real_root);
+        if (strncmp(real_path, real_root, root_len)
+                || (real_path[root_len] != '/' && real_path[root_len] != '\0'
+                    && strcmp(real_root, "/")))
+        {
+            free(real_path);
+            real_path = NULL;
+            errno = EACCES;
+        }
+    }
+
+    free(real_root);
+    free(path);
+    return real_path;
+}
+
+/*
+ * Creates the specified directory, and creates a file in that directory.
+ */
+FILE *create_dir_and_file (char *output_dir, char *filename)
+{
+    FILE *file = NULL; // The created file
+
+    // Create the full pathname.
+    char *path = get_output_path(output_dir, filename);
+
     // Create the directory and return the file pointer.
     mkdir(output_dir, 0700);
-    FILE* file = fopen(path, "wb");
+    if (path) file = fopen(path, "wb");
     free(path);
 
     return file;
@@ -104,6 +166,32 @@ int get_filesize (FILE *file)
     return size;
 }
 
+/*
+ * Finds the next extent of data in a file, at or after an offset and
+ * before a limit, skipping the holes of a sparse file. On filesystems
+ * that do not report holes, the whole file is data.
+ *
+ * Returns the offset of the extent, and sets the offset of its end.
+ * Returns the limit if only holes remain before it.
+ */
+off_t next_data_extent (int fd, off_t offset, off_t limit, off_t *end)
+{
+    off_t start = offset; // Offset of the extent
+
+    // Find the start of the extent.
+    if ((start = lseek(fd, offset, SEEK_DATA)) == -1)
+    {
+        start = (errno == ENXIO) ? limit : offset;
+    }
+    if (start > limit) start = limit;
+
+    // Find the end of the extent, at the next hole.
+    *end = (start < limit) ? lseek(fd, start, SEEK_HOLE) : limit;
+    if (*end == -1 || *end > limit) *end = limit;
+
+    return start;
+}
+
 /*
  * Checks if there was a file read error.
  *
@@ -15,6 +15,7 @@
 #include "data.h"
 
 #include <stdio.h>
+#include <sys/types.h>
 
 #define FILE_ERROR 0
 #define NO_ERROR 1
@@ -29,8 +30,11 @@
  * Function prototypes
  */
 FILE *get_file(char *filename, char *flag);
+char *get_output_path (char *output_dir, char *filename);
+char *get_served_path (char *root, char *filename);
 FILE *create_dir_and_file (char *output_dir, char *filename);
 int get_filesize(FILE *file);
+off_t next_data_extent (int fd, off_t offset, off_t limit, off_t *end);
 int check_fileread(FILE *file);
 void show_transfer_info(char *filename, char *filesize, char *server_name);
 
@@ -0,0 +1,40 @@
+/*
+ *  Name        : librftp.h
+ *  Author      : Edmund Luong <edmundvmluong@gmail.com>
+ *  Version     : 1.0
+ *  Copyright   : MIT 2014 © Edmund Luong
+ *  Date        : November 16, 2014
+ *  Description : Interface of the Reliable File Transfer Protocol library
+ *                (librftp.a and librftp.so), for programs that transfer
+ *                files without running the rftp and rftpd executables.
+ *
+ *  CS 3357a Assignment 2
+ */
+
+#ifndef LIBRFTP_H
+#define LIBRFTP_H
+
+/*
+ * Library limits
+ *
+ * The library is not thread-safe: all of its calls must come from one
+ * thread. The pre-shared key and the cipher of encrypted sessions belong
+ * to the process, not to a session, so only one encrypted transfer runs
+ * at a time: the blocking calls run one session after another, and
+ * rftp_serve lets other clients wait while an encrypted session is open.
+ * Non-blocking sessions do not encrypt, and are refused with
+ * EPROTONOSUPPORT once load_psk has loaded a key. Library calls never
+ * exit the program; they return their errors, which sessions keep for
+ * rftp_session_error.
+ */
+
+#include "rftp-client.h"   // Blocking transfers and fetches
+#include "rftp-server.h"   // Blocking servers
+#include "rftp-session.h"  // Non-blocking transfers, for event loops
+#include "rftp-batch.h"    // Batch uploads to many servers
+#include "rftp-stream.h"   // Multiplexed uploads of many files
+#include "rftp-protocol.h" // Retransmission limit and timers
+#include "rftp-crypto.h"   // Pre-shared keys
+#include "rftp-config.h"   // Defaults
+
+#endif /* LIBRFTP_H */
@@ -0,0 +1,344 @@
+/*
+ *  Name        : output-file.c
+ *  Author      : Edmund Luong <edmundvmluong@gmail.com>
+ *  Version     : 1.0
+ *  Copyright   : MIT 2014 © Edmund Luong
+ *  Date        : November 16, 2014
+ *  Description : Implementation of the file written to by a RFTP server,
+ *                either through stdio or through aligned direct I/O.
+ *
+ *  CS 3357a Assignment 2
+ */
+
+#define _GNU_SOURCE
+
+#include "output-file.h"
+#include "file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Opens the target file for direct I/O, and allocates its staging buffer.
+ *
+ * Returns 1 if the file was opened for direct I/O.
+ * Returns 0 if direct I/O is unavailable for the file.
+ */
+static int open_direct (output_file *out, char *path)
+{
+    // Open the file, bypassing the page cache.
+    if ((out->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT,
+                        0644)) == -1)
+    {
+        return 0;
+    }
+
+    // Allocate a staging buffer aligned for direct I/O.
+    if (posix_memalign((void**) &out->stage, DIRECT_ALIGN, DIRECT_STAGE))
+    {
+        close(out->fd);
+        out->fd = -1;
+        out->stage = NULL;
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * Writes a number of bytes from the staging buffer at the staging offset.
+ * The number of bytes must be a multiple of the direct I/O alignment.
+ *
+ * Returns 1 if the bytes were written.
+ * Returns 0 if there was a write error.
+ */
+static int flush_stage (output_file *out, size_t length)
+{
+    size_t written = 0; // Number of bytes written so far
+    ssize_t result = 0; // Result of the write operation
+
+    // Write the aligned block, resuming after any short writes.
+    while (written < length)
+    {
+        result = pwrite(out->fd, out->stage + written, length - written,
+                        out->offset + written);
+        if (result == -1 && errno == EINTR) continue;
+        if (result <= 0)
+        {
+            perror("File write error");
+            return 0;
+        }
+        written += result;
+    }
+
+    return 1;
+}
+
+/*
+ * Creates the output directory, and opens a file in that directory
+ * with the specified I/O mode. If the filesystem does not support
+ * direct I/O, the file falls back to buffered I/O.
+ *
+ * Returns an output file, if successful.
+ * Returns NULL if the file could not be created.
+ */
+output_file *open_output_file (char *output_dir, char *filename, int mode)
+{
+    output_file *out = NULL; // The output file
+
+    // Allocate an empty output file.
+    if (!(out = (output_file*) calloc(1, sizeof(output_file)))) return NULL;
+    out->fd = -1;
+    if (!(out->path = get_output_path(output_dir, filename)))
+    {
+        free(out);
+        return NULL;
+    }
+
+    // Open the file for direct I/O, if requested.
+    if (mode == DIRECT_IO)
+    {
+        mkdir(output_dir, 0700);
+        if (open_direct(out, out->path)) return out;
+        printf("Direct I/O is not available for %s, "
+               "using buffered writes.\n", filename);
+    }
+
+    // Otherwise, open the file through stdio.
+    if ((out->stream = create_dir_and_file(output_dir, filename)))
+    {
+        return out;
+    }
+
+    free(out->path);
+    free(out);
+    return NULL;
+}
+
+/*
+ * Checks that a file could be opened for writing in the output directory,
+ * without creating or truncating it: an existing file must be writable,
+ * and a new one must have a writable directory, unless that directory is
+ * the output directory, which is created along with the file.
+ *
+ * Returns 1 if the file could be opened.
+ * Returns 0 if the file could not be opened, with errno set.
+ */
+int check_output_file (char *output_dir, char *filename)
+{
+    char *path = NULL; // Full pathname of the file
+    int status = 0;    // Whether the file could be opened
+    int error = 0;     // Cause of a failure
+
+    if (!(path = get_output_path(output_dir, filename))) return 0;
+    if (access(path, W_OK) == 0)
+    {
+        status = 1;
+    }
+    else if (errno == ENOENT)
+    {
+        *strrchr(path, '/') = '\0';
+        status = access(path, W_OK | X_OK) == 0
+                 || (errno == ENOENT && !strcmp(path, output_dir));
+    }
+    error = errno;
+    free(path);
+    errno = error;
+    return status;
+}
+
+/*
+ * Preallocates the full size of the output file, so that its extents are
+ * reserved contiguously before any data is written. Filesystems that do
+ * not support preallocation are written to as usual.
+ *
+ * Returns 1 if the space was reserved, or preallocation is unsupported.
+ * Returns 0 if the space could not be reserved, with errno set.
+ */
+int preallocate_output_file (output_file *out, off_t size)
+{
+    int fd = (out->stream) ? fileno(out->stream) : out->fd;
+
+    // Nothing to reserve for an empty file.
+    if (size <= 0) return 1;
+
+    // Reserve the extents, and extend the file to its full size.
+    if (fallocate(fd, 0, 0, size) == -1)
+    {
+        return (errno == EOPNOTSUPP || errno == ENOSYS);
+    }
+
+    return 1;
+}
+
+/*
+ * Writes a number of bytes to the output file. In direct mode, the bytes
+ * are staged and written out whenever the staging buffer fills up.
+ *
+ * Returns 1 if the bytes were written or staged.
+ * Returns 0 if there was a write error.
+ */
+int write_output_file (output_file *out, uint8_t *data, size_t length)
+{
+    size_t copied = 0; // Number of bytes copied into the staging buffer
+
+    // Buffered mode writes through stdio.
+    if (out->stream)
+    {
+        fwrite(data, sizeof(uint8_t), length, out->stream);
+        if (ferror(out->stream))
+        {
+            perror("File write error");
+            return 0;
+        }
+        return 1;
+    }
+
+    // Direct mode copies the bytes into the staging buffer.
+    while (length > 0)
+    {
+        copied = DIRECT_STAGE - out->staged;
+        if (copied > length) copied = length;
+        memcpy(out->stage + out->staged, data, copied);
+        out->staged += copied;
+        data += copied;
+        length -= copied;
+
+        // Write out the staging buffer once it is full.
+        if (out->staged == DIRECT_STAGE)
+        {
+            if (!flush_stage(out, DIRECT_STAGE)) return 0;
+            out->offset += DIRECT_STAGE;
+            out->staged = 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Skips over a number of bytes of zeros in the output file. A hole has
+ * any space preallocated for it punched out, so that a sparse file is
+ * received sparse; otherwise the preallocated space, which reads as
+ * zeros, is kept. In direct mode, a range that does not start and end
+ * on the direct I/O alignment is written out as zeros instead.
+ *
+ * Returns 1 if the hole was left.
+ * Returns 0 if there was a write error.
+ */
+int skip_output_file (output_file *out, off_t length, int hole)
+{
+    uint8_t zeros[DIRECT_ALIGN]; // Zeros of an unaligned hole
+    off_t start = 0;             // File offset of the hole
+    size_t size = 0;             // Size of the zeros written at once
+    int fd = -1;                 // File descriptor of the file
+
+    if (length <= 0) return 1;
+
+    // Write out the bytes before the hole.
+    if (out->stream)
+    {
+        if (fflush(out->stream) || (start = ftello(out->stream)) == -1)
+        {
+            perror("File write error");
+            return 0;
+        }
+        fd = fileno(out->stream);
+    }
+    else
+    {
+        start = out->offset + out->staged;
+        if ((start | length) & (DIRECT_ALIGN - 1))
+        {
+            memset(zeros, 0, sizeof(zeros));
+            for (; length > 0; length -= size)
+            {
+                size = (length < DIRECT_ALIGN) ? length : DIRECT_ALIGN;
+                if (!write_output_file(out, zeros, size)) return 0;
+            }
+            return 1;
+        }
+        if (out->staged > 0 && !flush_stage(out, out->staged)) return 0;
+        fd = out->fd;
+    }
+
+    // Free any space preallocated for a hole, and skip over the range.
+    if (hole && fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                          start, length) == -1
+            && errno != EOPNOTSUPP && errno != ENOSYS)
+    {
+        perror("File write error");
+        return 0;
+    }
+    if (out->stream) return fseeko(out->stream, length, SEEK_CUR) == 0;
+    out->offset = start + length;
+    out->staged = 0;
+    return 1;
+}
+
+/*
+ * Closes the output file, and frees its memory. The file is truncated to
+ * the number of bytes written, trimming any unused preallocated space.
+ * In direct mode, the unaligned tail is padded out to a full block,
+ * written, and the padding is then truncated off the end of the file.
+ *
+ * Returns 1 if the file was completely written and closed.
+ * Returns 0 if there was an error writing the file.
+ */
+int close_output_file (output_file *out)
+{
+    int status = 1;    // Status of the close operation
+    size_t padded = 0; // Size of the tail, rounded up to the alignment
+
+    if (!out) return 0;
+
+    // Close a buffered file.
+    if (out->stream)
+    {
+        if (fflush(out->stream)
+                || ftruncate(fileno(out->stream), ftello(out->stream)) == -1)
+        {
+            status = 0;
+        }
+        if (fclose(out->stream)) status = 0;
+    }
+    // Write out the tail of a direct file, and trim the padding.
+    else
+    {
+        if (out->staged > 0)
+        {
+            padded = (out->staged + DIRECT_ALIGN - 1)
+                     & ~((size_t) DIRECT_ALIGN - 1);
+            memset(out->stage + out->staged, 0, padded - out->staged);
+            if (!flush_stage(out, padded)) status = 0;
+        }
+        if (ftruncate(out->fd, out->offset + out->staged) == -1) status = 0;
+        if (close(out->fd) == -1) status = 0;
+        free(out->stage);
+    }
+
+    free(out->path);
+    free(out);
+    return status;
+}
+
+/*
+ * Closes the output file, and removes it from the output directory.
+ */
+void discard_output_file (output_file *out)
+{
+    char *path = NULL; // Full pathname of the file
+
+    if (!out) return;
+
+    // Keep the pathname until the file has been closed.
+    path = out->path;
+    out->path = NULL;
+    close_output_file(out);
+    unlink(path);
+    free(path);
+}
@@ -0,0 +1,56 @@
+/*
+ *  Name        : output-file.h
+ *  Author      : Edmund Luong <edmundvmluong@gmail.com>
+ *  Version     : 1.0
+ *  Copyright   : MIT 2014 © Edmund Luong
+ *  Date        : November 16, 2014
+ *  Description : Implementation of the file written to by a RFTP server,
+ *                either through stdio or through aligned direct I/O.
+ *
+ *  CS 3357a Assignment 2
+ */
+
+#ifndef OUTPUT_FILE_H
+#define OUTPUT_FILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Output-oriented macros
+ */
+#define BUFFERED_IO 0           // Write through stdio and the page cache
+#define DIRECT_IO 1             // Write with O_DIRECT, bypassing the page cache
+#define DIRECT_ALIGN 4096       // Direct I/O buffer, offset and size alignment
+#define DIRECT_STAGE 1048576    // Direct I/O staging buffer size, in bytes
+
+/*
+ * Output file
+ *
+ * A file being received by the server. In direct mode, payloads are
+ * accumulated in an aligned staging buffer and written in large aligned
+ * blocks; the unaligned tail is padded and trimmed when the file is closed.
+ */
+typedef struct output_file
+{
+    FILE *stream;     // Buffered stdio stream, in buffered mode
+    int fd;           // File descriptor opened with O_DIRECT, in direct mode
+    uint8_t *stage;   // Aligned staging buffer, in direct mode
+    size_t staged;    // Number of bytes held in the staging buffer
+    off_t offset;     // File offset of the start of the staging buffer
+    char *path;       // Full pathname of the file
+} output_file;
+
+/*
+ * Function prototypes
+ */
+output_file *open_output_file (char *output_dir, char *filename, int mode);
+int check_output_file (char *output_dir, char *filename);
+int preallocate_output_file (output_file *out, off_t size);
+int write_output_file (output_file *out, uint8_t *data, size_t length);
+int skip_output_file (output_file *out, off_t length, int hole);
+int close_output_file (output_file *out);
+void discard_output_file (output_file *out);
+
+#endif /* OUTPUT_FILE_H */
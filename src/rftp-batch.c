@@ -0,0 +1,267 @@
+/*
+ *  Name        : rftp-batch.c
+ *  Author      : Edmund Luong <edmundvmluong@gmail.com>
+ *  Version     : 1.0
+ *  Copyright   : MIT 2014 © Edmund Luong
+ *  Date        : November 16, 2014
+ *  Description : Implementation of batch uploads of the Reliable File
+ *                Transfer Protocol, which send a batch of files to many
+ *                RFTP servers at once, from a bounded pool of concurrent
+ *                non-blocking sessions.
+ *
+ *  CS 3357a Assignment 2
+ */
+
+#include "rftp-batch.h"
+#include "rftp-protocol.h"
+#include "rftp-config.h"
+#include "rftp-stats.h"
+#include "udp-client.h"
+#include "data.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#define BATCH_EVENTS 64 // Socket events handled per wait
+
+static void start_file (batch_destination *dest);
+static void finish_destination (batch_destination *dest);
+
+/*
+ * Returns a rate of bytes over microseconds, in megabits per second.
+ */
+static double megabits (int64_t bytes, uint64_t usec)
+{
+    return usec ? (double) bytes * 8 / usec : 0;
+}
+
+/*
+ * Discards any messages left on the socket of a server by an earlier
+ * session, such as duplicate acknowledgments, so that they are not taken
+ * for acknowledgments of the next session.
+ */
+static void drain_socket (batch_destination *dest)
+{
+    rftp_message *msg = NULL; // Stale RFTP message
+    host_t source;            // Source of the stale message
+
+    if (dest->sockfd == -1) return;
+    while ((msg = receive_rftp_message(dest->sockfd, &source, SILENT)))
+    {
+        free(msg);
+    }
+}
+
+/*
+ * Starts sending the files of the batch to the next waiting server, with
+ * a socket of its own. A server that cannot be reached, such as one whose
+ * name cannot be resolved, fails every file, and is finished at once.
+ */
+static void start_destination (upload_batch *batch)
+{
+    batch_destination *dest = &batch->dests[batch->next_dest++]; // Server
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = dest };
+
+    dest->started_at = stats_now();
+    batch->active++;
+    if ((dest->sockfd = open_client_socket(dest->name, dest->port,
+                                           &dest->server)) == -1)
+    {
+        printf("ERROR: Unable to reach %s:%s (%s).\n", dest->name,
+               dest->port, strerror(errno));
+        dest->files_failed = batch->file_count;
+        finish_destination(dest);
+        return;
+    }
+    fcntl(dest->sockfd, F_SETFL, fcntl(dest->sockfd, F_GETFL) | O_NONBLOCK);
+    epoll_ctl(batch->epfd, EPOLL_CTL_ADD, dest->sockfd, &event);
+    start_file(dest);
+}
+
+/*
+ * Reports the files sent to a server once it was sent the whole batch,
+ * closes its socket, and starts the next waiting server in its place.
+ */
+static void finish_destination (batch_destination *dest)
+{
+    upload_batch *batch = dest->batch;              // Batch of the server
+    uint64_t elapsed = stats_now() - dest->started_at; // Time of the server
+
+    printf("%s:%s: %d of %d files sent (%.2f MB in %.2f s, %.2f Mbps)\n",
+           dest->name, dest->port, dest->files_sent, batch->file_count,
+           (double) dest->bytes / MB, (double) elapsed / 1000000,
+           megabits(dest->bytes, elapsed));
+
+    if (dest->sockfd != -1)
+    {
+        epoll_ctl(batch->epfd, EPOLL_CTL_DEL, dest->sockfd, NULL);
+        close(dest->sockfd);
+        dest->sockfd = -1;
+    }
+    batch->active--;
+    if (batch->next_dest < batch->dest_count) start_destination(batch);
+}
+
+/*
+ * Counts a file as sent or failed once its session ends, and starts the
+ * next file of the batch on the same socket.
+ */
+static void end_file (rftp_session *session, int status, void *arg)
+{
+    batch_destination *dest = (batch_destination*) arg; // Server
+
+    if (status)
+    {
+        dest->files_sent++;
+        dest->bytes += session->filesize;
+    }
+    else
+    {
+        dest->files_failed++;
+        printf("ERROR: %s could not be sent to %s:%s (%s).\n",
+               session->filename, dest->name, dest->port,
+               strerror(rftp_session_error(session)));
+    }
+    rftp_session_free(session);
+    dest->session = NULL;
+    start_file(dest);
+}
+
+/*
+ * Starts a session for the next file of the batch that can be opened,
+ * on the socket of a server. Once every file was started, the server
+ * is finished.
+ */
+static void start_file (batch_destination *dest)
+{
+    upload_batch *batch = dest->batch; // Batch of the server
+    char *filename = NULL;             // Next file of the batch
+
+    while (dest->next_file < batch->file_count)
+    {
+        filename = batch->files[dest->next_file++];
+        drain_socket(dest);
+        if ((dest->session = rftp_session_upload_socket(dest->sockfd,
+                                                        &dest->server,
+                                                        filename,
+                                                        batch->timeout,
+                                                        batch->window,
+                                                        end_file, dest,
+                                                        batch->verbose)))
+        {
+            return;
+        }
+        dest->files_failed++;
+        printf("ERROR: %s could not be sent to %s:%s (%s).\n", filename,
+               dest->name, dest->port, strerror(errno));
+    }
+    finish_destination(dest);
+}
+
+/*
+ * Sends every file of a batch to every server of a list, using the
+ * Reliable File Transfer Protocol (RFTP). Up to a number of jobs, servers
+ * are sent the files at once, each through its own socket; each server
+ * is sent the files one after another, reusing its socket. A server may
+ * be given as SERVER:PORT, or else the port number is used. The files
+ * sent to each server are reported as it finishes, and the aggregate
+ * throughput of the batch at the end.
+ *
+ * Return a successful status code if every file was sent to every server.
+ * Return a failure status code if any transfer failed.
+ */
+int rftp_upload_batch (char **servers, int server_count, char *port_number,
+        char **files, int file_count, int jobs, int timeout, int window,
+        int verbose)
+{
+    upload_batch batch;                      // Batch of the upload
+    struct epoll_event events[BATCH_EVENTS]; // Readable sockets
+    batch_destination *dest = NULL;          // Server of the batch
+    uint64_t started_at = stats_now();       // Time the batch was started
+    uint64_t elapsed = 0;                    // Time the batch took
+    int64_t bytes = 0;                       // Bytes sent to every server
+    int sent = 0, failed = 0;                // Files sent and failed
+    char *colon = NULL;                      // Port separator of a server
+    int count = 0;                           // Readable sockets
+    int i;
+
+    memset(&batch, 0, sizeof(batch));
+    batch.files = files;
+    batch.file_count = file_count;
+    batch.dest_count = server_count;
+    batch.jobs = (jobs > 0) ? jobs : 1;
+    batch.timeout = timeout;
+    batch.window = window;
+    batch.verbose = verbose;
+    if ((batch.epfd = epoll_create1(0)) == -1
+            || !(batch.dests = (batch_destination*) calloc(server_count,
+                                                  sizeof(batch_destination))))
+    {
+        perror("Unable to start the batch");
+        if (batch.epfd != -1) close(batch.epfd);
+        return FAILURE;
+    }
+
+    // Split the port number off each server.
+    for (i = 0; i < server_count; i++)
+    {
+        dest = &batch.dests[i];
+        dest->batch = &batch;
+        dest->sockfd = -1;
+        dest->name = strdup(servers[i]);
+        dest->port = port_number;
+        if (dest->name && (colon = strrchr(dest->name, ':')))
+        {
+            *colon = '\0';
+            dest->port = colon + 1;
+        }
+    }
+
+    // A server that stops responding is given up on, so that the rest
+    // of the batch can go on.
+    set_retransmit_limit(BATCH_RETRANSMITS);
+    printf("Sending %d files to %d servers, %d at a time ...\n", file_count,
+           server_count, batch.jobs);
+
+    // Start the first jobs, and run the sessions until every server is
+    // finished.
+    while (batch.active < batch.jobs && batch.next_dest < batch.dest_count)
+    {
+        start_destination(&batch);
+    }
+    while (batch.active > 0)
+    {
+        count = epoll_wait(batch.epfd, events, BATCH_EVENTS,
+                           rftp_next_timeout());
+        for (i = 0; i < count; i++)
+        {
+            dest = (batch_destination*) events[i].data.ptr;
+            if (dest->session) rftp_session_readable(dest->session);
+            else drain_socket(dest);
+        }
+        rftp_expire_timers();
+    }
+
+    // Report the aggregate throughput of the batch.
+    elapsed = stats_now() - started_at;
+    for (i = 0; i < server_count; i++)
+    {
+        sent += batch.dests[i].files_sent;
+        failed += batch.dests[i].files_failed;
+        bytes += batch.dests[i].bytes;
+        free(batch.dests[i].name);
+    }
+    printf("\nSent %d of %d files to %d servers: %.2f MB in %.2f s "
+           "(%.2f Mbps aggregate).\n", sent, sent + failed, server_count,
+           (double) bytes / MB, (double) elapsed / 1000000,
+           megabits(bytes, elapsed));
+
+    close(batch.epfd);
+    free(batch.dests);
+    return (failed == 0) ? SUCCESS : FAILURE;
+}
@@ -0,0 +1,80 @@
+/*
+ *  Name        : rftp-batch.h
+ *  Author      : Edmund Luong <edmundvmluong@gmail.com>
+ *  Version     : 1.0
+ *  Copyright   : MIT 2014 © Edmund Luong
+ *  Date        : November 16, 2014
+ *  Description : Implementation of batch uploads of the Reliable File
+ *                Transfer Protocol, which send a batch of files to many
+ *                RFTP servers at once, from a bounded pool of concurrent
+ *                non-blocking sessions.
+ *
+ *  CS 3357a Assignment 2
+ */
+
+#ifndef RFTP_BATCH_H
+#define RFTP_BATCH_H
+
+#include "rftp-session.h"
+#include "udp-sockets.h"
+
+#include <stdint.h>
+
+/*
+ * Batch-oriented macros
+ */
+#define DEFAULT_JOBS 8          // Default servers uploaded to at once
+#define BATCH_RETRANSMITS 200   // Resends before a server is given up on
+
+struct upload_batch;
+
+/*
+ * Batch destination
+ *
+ * A server of the batch, which is sent every file of the batch in turn
+ * through one socket, since a RFTP server receives one file at a time.
+ */
+typedef struct batch_destination
+{
+    struct upload_batch *batch; // Batch of the destination
+    char *name;                 // Server name
+    char *port;                 // Server port number
+    int sockfd;                 // Socket reused for every file, or -1
+    host_t server;              // Server host
+    rftp_session *session;      // Session of the file being sent
+    int next_file;              // Index of the next file to send
+    int files_sent;             // Files sent to the server
+    int files_failed;           // Files that could not be sent
+    int64_t bytes;              // Bytes of the files sent
+    uint64_t started_at;        // Time the first file was started, in usec
+} batch_destination;
+
+/*
+ * Upload batch
+ *
+ * The files of a batch and the servers they are sent to. Up to a number
+ * of jobs, servers are sent the files at once; the others wait in order.
+ */
+typedef struct upload_batch
+{
+    batch_destination *dests;   // Servers of the batch
+    int dest_count;             // Number of servers
+    int next_dest;              // Index of the next server to start
+    int active;                 // Servers being sent files
+    char **files;               // Files of the batch
+    int file_count;             // Number of files
+    int jobs;                   // Most servers sent files at once
+    int epfd;                   // Sockets of the active servers (epoll)
+    int timeout;                // Retransmission timeout, in milliseconds
+    int window;                 // Data packets kept in flight per session
+    int verbose;                // Verbose output
+} upload_batch;
+
+/*
+ * Function prototypes
+ */
+int rftp_upload_batch (char **servers, int server_count, char *port_number,
+        char **files, int file_count, int jobs, int timeout, int window,
+        int verbose);
+
+#endif /* RFTP_BATCH_H */
@@ -0,0 +1,155 @@
+/*
+ *  Name        : rftp-busypoll.c
+ *  Author      : Edmund Luong <edmundvmluong@gmail.com>
+ *  Version     : 1.0
+ *  Copyright   : MIT 2014 © Edmund Luong
+ *  Date        : November 16, 2014
+ *  Description : Implementation of the low-latency receive mode of the
+ *                Reliable File Transfer Protocol, which busy-polls sockets
+ *                instead of sleeping until a message arrives.
+ *
+ *  CS 3357a Assignment 2
+ */
+
+#define _GNU_SOURCE
+
+#include "rftp-busypoll.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+
+static int max_spin = 0;   // Longest spin before blocking, in usec
+static int spin = 0;       // Current adaptive spin, in usec
+
+/*
+ * Returns the time on the monotonic clock, in microseconds.
+ */
+static uint64_t busy_poll_now ()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * Enables the low-latency receive mode, spinning up to the given number
+ * of microseconds for a message before blocking, and pins the process
+ * to a CPU unless it is NO_CPU.
+ *
+ * Return 1 if the mode was configured.
+ * Return 0 if the process could not be pinned to the CPU.
+ */
+int busy_poll_configure (int usec, int cpu)
+{
+    cpu_set_t set; // CPUs the process may run on
+
+    max_spin = spin = (usec > 0) ? usec : 0;
+    if (cpu == NO_CPU) return 1;
+
+    // Pin the process to the CPU, keeping its caches warm.
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) == -1)
+    {
+        perror("Unable to pin to CPU");
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Returns whether the low-latency receive mode is enabled.
+ */
+int busy_poll_enabled ()
+{
+    return max_spin > 0;
+}
+
+/*
+ * Asks the kernel to busy-poll the device queue of a socket when it is
+ * read (SO_BUSY_POLL), for as long as the userspace spin. Raising the
+ * busy-poll time above net.core.busy_read needs CAP_NET_ADMIN, so a
+ * failure only leaves the userspace spin in place.
+ */
+void busy_poll_socket (int sockfd)
+{
+    if (max_spin <= 0) return;
+
+    if (setsockopt(sockfd, SOL_SOCKET, SO_BUSY_POLL, &max_spin,
+                   sizeof(max_spin)) == -1)
+    {
+        fprintf(stderr, "Kernel busy polling is unavailable (%s); "
+                "spinning in userspace only.\n", strerror(errno));
+    }
+}
+
+/*
+ * Waits up to a timeout in milliseconds (or forever, if negative) until a
+ * message can be read from a socket, as a drop-in for poll() on a single
+ * socket. The socket is first polled in a spin, and only then with a
+ * blocking poll(). The spin adapts to how long
+ * messages take to arrive: it grows to twice any wait that was shorter
+ * than the longest spin, and halves after a longer wait, so that idle
+ * periods give the CPU back sooner.
+ *
+ * Return 1 if a message can be read.
+ * Return 0 if no message arrived before the timeout.
+ * Return -1 if the socket could not be polled.
+ */
+int busy_poll_wait (struct pollfd *fd, int timeout)
+{
+    uint64_t start = busy_poll_now(); // Start of the wait
+    uint64_t waited = 0;              // Length of the wait, in usec
+    int remaining = timeout;          // Time left to block, in msec
+    int retval = 0;                   // Result of the wait
+    char byte;                        // Peeked byte of a message
+
+    // Spin until a message arrives or the spin runs out.
+    do
+    {
+        if (recv(fd->fd, &byte, sizeof(byte), MSG_PEEK | MSG_DONTWAIT) >= 0)
+        {
+            fd->revents = POLLIN;
+            retval = 1;
+            break;
+        }
+
+        // Let a peer sharing the CPU run, so the spin does not delay it.
+        sched_yield();
+    }
+    while ((waited = busy_poll_now() - start) < (uint64_t) spin);
+
+    // Otherwise, block for the rest of the timeout.
+    if (!retval)
+    {
+        if (timeout >= 0)
+        {
+            remaining = timeout - (int) (waited / 1000);
+            if (remaining < 0) remaining = 0;
+        }
+        retval = poll(fd, 1, remaining);
+        waited = busy_poll_now() - start;
+    }
+
+    // Adapt the spin to the wait.
+    if (retval == 1 && waited < (uint64_t) max_spin)
+    {
+        spin = (waited * 2 > (uint64_t) max_spin) ? max_spin
+               : (waited * 2 > (uint64_t) spin) ? (int) waited * 2 : spin;
+    }
+    else
+    {
+        spin = (spin / 2 < SPIN_MIN) ? SPIN_MIN : spin / 2;
+    }
+    return retval;
+}
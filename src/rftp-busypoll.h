@@ -0,0 +1,33 @@
+/*
+ *  Name        : rftp-busypoll.h
+ *  Author      : Edmund Luong <edmundvmluong@gmail.com>
+ *  Version     : 1.0
+ *  Copyright   : MIT 2014 © Edmund Luong
+ *  Date        : November 16, 2014
+ *  Description : Implementation of the low-latency receive mode of the
+ *                Reliable File Transfer Protocol, which busy-polls sockets
+ *                instead of sleeping until a message arrives.
+ *
+ *  CS 3357a Assignment 2
+ */
+
+#ifndef RFTP_BUSYPOLL_H
+#define RFTP_BUSYPOLL_H
+
+#include <poll.h>
+
+/*
+ * Busy-poll-oriented macros
+ */
+#define NO_CPU -1           // No CPU to pin the process to
+#define SPIN_MIN 2          // Smallest adaptive spin, in usec
+
+/*
+ * Function prototypes
+ */
+int busy_poll_configure (int usec, int cpu);
+void busy_poll_socket (int sockfd);
+int busy_poll_enabled ();
+int busy_poll_wait (struct pollfd *fd, int timeout);
+
+#endif /* RFTP_BUSYPOLL_H */
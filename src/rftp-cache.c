@@ -0,0 +1,344 @@
+/*
+ *  Name        : rftp-cache.c
+ *  Author      : Edmund Luong <edmundvmluong@gmail.com>
+ *  Version     : 1.0
+ *  Copyright   : MIT 2014 © Edmund Luong
+ *  Date        : November 16, 2014
+ *  Description : Implementation of the hot-file cache of the Reliable File
+ *                Transfer Protocol server, which keeps the most recently
+ *                served files copied (and locked) in memory, so that serving
+ *                a file to many clients does not read it from disk each time.
+ *
+ *  CS 3357a Assignment 2
+ */
+
+#define _GNU_SOURCE
+
+#include "rftp-cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * Creates an empty file cache holding up to a number of bytes.
+ *
+ * Return a file cache.
+ * Return NULL if the file cache could not be allocated.
+ */
+file_cache *create_file_cache (size_t capacity)
+{
+    file_cache *cache = NULL; // File cache
+
+    if ((cache = (file_cache*) calloc(1, sizeof(file_cache))))
+    {
+        cache->capacity = capacity;
+    }
+    return cache;
+}
+
+/*
+ * Returns the hash bucket of a pathname (FNV-1a).
+ */
+static unsigned int hash_path (char *path)
+{
+    uint32_t hash = 2166136261u; // Hash of the pathname
+
+    for (; *path; path++)
+    {
+        hash = (hash ^ (uint8_t) *path) * 16777619u;
+    }
+    return hash % CACHE_BUCKETS;
+}
+
+/*
+ * Unmaps the copy or closes the file of an entry, and frees it.
+ */
+static void free_entry (cache_entry *entry)
+{
+    if (entry->data) munmap(entry->data, entry->size);
+    if (entry->fd != -1) close(entry->fd);
+    free(entry->path);
+    free(entry);
+}
+
+/*
+ * Links an entry at the head of the most recently used list.
+ */
+static void link_entry (file_cache *cache, cache_entry *entry)
+{
+    entry->prev = NULL;
+    entry->next = cache->head;
+    if (cache->head) cache->head->prev = entry;
+    else cache->tail = entry;
+    cache->head = entry;
+}
+
+/*
+ * Unlinks an entry from the most recently used list.
+ */
+static void unlink_entry (file_cache *cache, cache_entry *entry)
+{
+    if (entry->prev) entry->prev->next = entry->next;
+    else cache->head = entry->next;
+    if (entry->next) entry->next->prev = entry->prev;
+    else cache->tail = entry->prev;
+    entry->prev = entry->next = NULL;
+}
+
+/*
+ * Removes an entry from the cache. The entry is freed now if it is not
+ * referenced, or else once its last reference is released.
+ */
+static void remove_entry (file_cache *cache, cache_entry *entry)
+{
+    cache_entry **link = &cache->buckets[hash_path(entry->path)];
+
+    // Unlink the entry from its bucket and from the list.
+    while (*link != entry) link = &(*link)->chain;
+    *link = entry->chain;
+    entry->chain = NULL;
+    unlink_entry(cache, entry);
+
+    cache->used -= entry->size;
+    entry->cached = 0;
+    if (entry->refs == 0) free_entry(entry);
+}
+
+/*
+ * Evicts the least recently used entries that are not referenced, until
+ * a number of bytes fits in the cache.
+ *
+ * Return 1 if the bytes fit in the cache.
+ * Return 0 if the referenced entries leave too little room.
+ */
+static int make_room (file_cache *cache, size_t size)
+{
+    cache_entry *entry = cache->tail; // Candidate for eviction
+    cache_entry *prev = NULL;         // More recently used entry
+
+    while (cache->used + size > cache->capacity && entry)
+    {
+        prev = entry->prev;
+        if (entry->refs == 0)
+        {
+            remove_entry(cache, entry);
+            cache->evictions++;
+        }
+        entry = prev;
+    }
+    return cache->used + size <= cache->capacity;
+}
+
+/*
+ * Opens a file into a new entry, described by the status of the opened
+ * file, so that a file replaced after it was looked up is still read
+ * consistently.
+ *
+ * Return the entry, with no references.
+ * Return NULL if the file could not be opened, with errno set.
+ */
+static cache_entry *open_entry (char *path)
+{
+    cache_entry *entry = NULL; // New entry
+    struct stat st;            // Status of the file
+    int fd = -1;               // File descriptor of the file
+    int error = 0;             // Cause of a failure
+
+    if ((fd = open(path, O_RDONLY)) == -1) return NULL;
+    if (fstat(fd, &st) == -1)
+    {
+        error = errno;
+    }
+    else if (!S_ISREG(st.st_mode))
+    {
+        error = S_ISDIR(st.st_mode) ? EISDIR : EINVAL;
+    }
+    else if (!(entry = (cache_entry*) calloc(1, sizeof(cache_entry)))
+             || !(entry->path = strdup(path)))
+    {
+        free(entry);
+        entry = NULL;
+        error = ENOMEM;
+    }
+
+    if (error)
+    {
+        close(fd);
+        errno = error;
+        return NULL;
+    }
+
+    entry->fd = fd;
+    entry->size = st.st_size;
+    entry->dev = st.st_dev;
+    entry->ino = st.st_ino;
+    entry->mtime = st.st_mtim;
+    return entry;
+}
+
+/*
+ * Copies the whole file of an entry into anonymous memory, and closes the
+ * file. The cached contents are pinned this way: truncating or rewriting
+ * the file on disk cannot change them, or fault a session serving them.
+ * An empty file has nothing to copy.
+ *
+ * Return 1 if the file was copied.
+ * Return 0 if the file could not be copied, leaving it open.
+ */
+static int load_entry (cache_entry *entry)
+{
+    uint8_t *data = NULL; // Copied contents of the file
+    size_t done = 0;      // Number of bytes copied so far
+    ssize_t result = 0;   // Result of the read operation
+
+    if (entry->size > 0)
+    {
+        if ((data = mmap(NULL, entry->size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+        {
+            return 0;
+        }
+
+        // Copy the file, resuming after any short reads; a file that
+        // shrank meanwhile is left to be read from disk.
+        while (done < entry->size)
+        {
+            result = pread(entry->fd, data + done, entry->size - done, done);
+            if (result == -1 && errno == EINTR) continue;
+            if (result <= 0)
+            {
+                munmap(data, entry->size);
+                return 0;
+            }
+            done += result;
+        }
+        mprotect(data, entry->size, PROT_READ);
+    }
+
+    entry->data = data;
+    close(entry->fd);
+    entry->fd = -1;
+    return 1;
+}
+
+/*
+ * Looks up a file in the cache by its real pathname, copying it on a miss.
+ * A cached entry is only used while the file's device, inode, size and
+ * modification time are unchanged; otherwise the file is copied again.
+ * Cached files are locked in memory when the memory lock limit allows it.
+ * A file that cannot be cached is only opened. Each acquired entry must
+ * be released with cache_release.
+ *
+ * Return the entry of the file.
+ * Return NULL if the file could not be opened, with errno set.
+ */
+cache_entry *cache_acquire (file_cache *cache, char *path)
+{
+    unsigned int bucket = hash_path(path); // Hash bucket of the file
+    cache_entry *entry = NULL;             // Entry of the file
+    struct stat st;                        // Status of the file
+
+    if (stat(path, &st) == -1) return NULL;
+
+    // Look for the file in the cache.
+    for (entry = cache->buckets[bucket]; entry; entry = entry->chain)
+    {
+        if (!strcmp(entry->path, path)) break;
+    }
+    if (entry)
+    {
+        if (entry->dev == st.st_dev && entry->ino == st.st_ino
+                && entry->size == (size_t) st.st_size
+                && entry->mtime.tv_sec == st.st_mtim.tv_sec
+                && entry->mtime.tv_nsec == st.st_mtim.tv_nsec)
+        {
+            // Hit: the entry becomes the most recently used.
+            unlink_entry(cache, entry);
+            link_entry(cache, entry);
+            cache->hits++;
+            entry->refs++;
+            return entry;
+        }
+
+        // The file changed since it was cached.
+        remove_entry(cache, entry);
+    }
+
+    // Miss: open the file, and copy it into the cache if it fits.
+    cache->misses++;
+    if (!(entry = open_entry(path))) return NULL;
+    if (entry->size <= cache->capacity && make_room(cache, entry->size)
+            && load_entry(entry))
+    {
+        if (entry->data) mlock(entry->data, entry->size);
+        entry->chain = cache->buckets[bucket];
+        cache->buckets[bucket] = entry;
+        link_entry(cache, entry);
+        cache->used += entry->size;
+        entry->cached = 1;
+    }
+    entry->refs++;
+    return entry;
+}
+
+/*
+ * Releases an acquired entry. An entry that is no longer cached is freed
+ * once its last reference is released.
+ */
+void cache_release (file_cache *cache, cache_entry *entry)
+{
+    if (!entry) return;
+
+    entry->refs--;
+    if (!entry->cached && entry->refs == 0) free_entry(entry);
+}
+
+/*
+ * Reads a number of bytes of an entry's file at an offset, from its
+ * cached copy or else with a positional read into the buffer.
+ *
+ * Return the bytes that were read.
+ * Return NULL if the bytes could not be read.
+ */
+uint8_t *cache_read (cache_entry *entry, uint8_t *buffer, size_t length,
+        off_t offset)
+{
+    size_t done = 0;    // Number of bytes read so far
+    ssize_t result = 0; // Result of the read operation
+
+    if (offset < 0 || (size_t) offset + length > entry->size) return NULL;
+    if (entry->fd == -1) return entry->data + offset;
+
+    // Read the bytes, resuming after any short reads.
+    while (done < length)
+    {
+        result = pread(entry->fd, buffer + done, length - done,
+                       offset + done);
+        if (result == -1 && errno == EINTR) continue;
+        if (result <= 0)
+        {
+            perror("File read error");
+            return NULL;
+        }
+        done += result;
+    }
+
+    return buffer;
+}
+
+/*
+ * Frees a file cache and unmaps its entries.
+ */
+void free_file_cache (file_cache *cache)
+{
+    if (!cache) return;
+
+    while (cache->head) remove_entry(cache, cache->head);
+    free(cache);
+}
@@ -0,0 +1,83 @@
+/*
+ *  Name        : rftp-cache.h
+ *  Author      : Edmund Luong <edmundvmluong@gmail.com>
+ *  Version     : 1.0
+ *  Copyright   : MIT 2014 © Edmund Luong
+ *  Date        : November 16, 2014
+ *  Description : Implementation of the hot-file cache of the Reliable File
+ *                Transfer Protocol server, which keeps the most recently
+ *                served files copied (and locked) in memory, so that serving
+ *                a file to many clients does not read it from disk each time.
+ *
+ *  CS 3357a Assignment 2
+ */
+
+#ifndef RFTP_CACHE_H
+#define RFTP_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <sys/types.h>
+
+/*
+ * Cache-oriented macros
+ */
+#define DEFAULT_CACHE_MB 256    // Default capacity of the cache, in MB
+#define CACHE_BUCKETS 1024      // Buckets of the cache's hash table
+
+/*
+ * Cache entry
+ *
+ * A file copied into memory. Entries are looked up by pathname, and kept
+ * on a list from the most to the least recently used. An entry is only
+ * freed once it is no longer referenced, so a file being served stays in
+ * memory even if it is evicted, or truncated or rewritten on disk
+ * meanwhile. A file that is not cached is kept open instead, and read with
+ * positional reads.
+ */
+typedef struct cache_entry
+{
+    char *path;                 // Real pathname of the file
+    uint8_t *data;              // Copied contents of the file
+    int fd;                     // Open file, when it is not copied
+    size_t size;                // Size of the file, in bytes
+    dev_t dev;                  // Device of the file
+    ino_t ino;                  // Inode of the file
+    struct timespec mtime;      // Modification time of the file
+    int refs;                   // Number of sessions serving the entry
+    int cached;                 // Whether the entry is held by the cache
+    struct cache_entry *chain;  // Next entry in the hash bucket
+    struct cache_entry *prev;   // More recently used entry
+    struct cache_entry *next;   // Less recently used entry
+} cache_entry;
+
+/*
+ * File cache
+ *
+ * Files larger than the capacity of the cache are opened for the session
+ * that serves them only, and never cached.
+ */
+typedef struct file_cache
+{
+    cache_entry *buckets[CACHE_BUCKETS]; // Hash table of the entries
+    cache_entry *head;                   // Most recently used entry
+    cache_entry *tail;                   // Least recently used entry
+    size_t capacity;                     // Capacity of the cache, in bytes
+    size_t used;                         // Bytes held by the cache
+    uint64_t hits;                       // Lookups served from the cache
+    uint64_t misses;                     // Lookups that copied the file
+    uint64_t evictions;                  // Entries evicted from the cache
+} file_cache;
+
+/*
+ * Function prototypes
+ */
+file_cache *create_file_cache (size_t capacity);
+cache_entry *cache_acquire (file_cache *cache, char *path);
+void cache_release (file_cache *cache, cache_entry *entry);
+uint8_t *cache_read (cache_entry *entry, uint8_t *buffer, size_t length,
+        off_t offset);
+void free_file_cache (file_cache *cache);
+
+#endif /* RFTP_CACHE_H */
@@ -0,0 +1,95 @@
+/*
+ *  Name        : rftp-chunk.c
+ *  Author      : Edmund Luong <edmundvmluong@gmail.com>
+ *  Version     : 1.0
+ *  Copyright   : MIT 2014 © Edmund Luong
+ *  Date        : November 16, 2014
+ *  Description : Implementation of content-defined chunking (FastCDC) for
+ *                deduplicated transfers of the Reliable File Transfer
+ *                Protocol, which splits files into chunks at boundaries
+ *                chosen by their content, and hashes the chunks.
+ *
+ *  CS 3357a Assignment 2
+ */
+
+#include "rftp-chunk.h"
+
+#include <openssl/evp.h>
+
+static uint64_t gear[256];    // Gear hash value of each byte
+static uint64_t gear_ls[256]; // Gear hash values, shifted left once
+static int gear_ready = 0;    // Whether the gear tables are filled
+
+/*
+ * Fills the gear tables from a fixed seed (splitmix64), so that every
+ * sender chunks the same content at the same boundaries.
+ */
+static void fill_gear_tables ()
+{
+    uint64_t state = 0x5246545043444321ULL; // Seed of the tables
+    uint64_t z;
+    int i;
+
+    for (i = 0; i < 256; i++)
+    {
+        z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        gear[i] = z ^ (z >> 31);
+        gear_ls[i] = gear[i] << 1;
+    }
+    gear_ready = 1;
+}
+
+/*
+ * Finds the end of the chunk at the start of the data (FastCDC). A gear
+ * hash is rolled over the data past the smallest chunk size, and the
+ * chunk ends where the hash has all the bits of a mask clear. A stricter
+ * mask is used before the normal chunk size and a looser one after it,
+ * which keeps chunk sizes close to the normal size. The hash is rolled
+ * two bytes per iteration, with a second table of pre-shifted values,
+ * which halves the shifts and loop overhead per byte.
+ *
+ * Return the length of the chunk, between CHUNK_MIN and CHUNK_MAX bytes
+ * (or the length of the data, if shorter).
+ */
+size_t find_chunk_boundary (const uint8_t *data, size_t length)
+{
+    uint64_t hash = 0;    // Rolling gear hash
+    size_t normal = 0;    // End of the stricter mask
+    size_t i = 0;         // Position in the data
+
+    if (!gear_ready) fill_gear_tables();
+    if (length <= CHUNK_MIN) return length;
+    if (length > CHUNK_MAX) length = CHUNK_MAX;
+    normal = (length < CHUNK_AVG) ? length : CHUNK_AVG;
+
+    // Both halves of each iteration test the mask at the same alignment:
+    // the first against the mask shifted left once.
+    for (i = CHUNK_MIN / 2; i < normal / 2; i++)
+    {
+        hash = (hash << 2) + gear_ls[data[2 * i]];
+        if (!(hash & (CHUNK_MASK_S << 1))) return 2 * i;
+        hash += gear[data[2 * i + 1]];
+        if (!(hash & CHUNK_MASK_S)) return 2 * i + 1;
+    }
+    for (; i < length / 2; i++)
+    {
+        hash = (hash << 2) + gear_ls[data[2 * i]];
+        if (!(hash & (CHUNK_MASK_L << 1))) return 2 * i;
+        hash += gear[data[2 * i + 1]];
+        if (!(hash & CHUNK_MASK_L)) return 2 * i + 1;
+    }
+
+    return length;
+}
+
+/*
+ * Hashes a chunk with SHA-256, which names the chunk in offers and in
+ * the receiver's chunk store.
+ */
+void hash_chunk (const uint8_t *data, size_t length,
+        uint8_t hash[CHUNK_HASH])
+{
+    EVP_Digest(data, length, hash, NULL, EVP_sha256(), NULL);
+}
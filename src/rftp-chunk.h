@@ -0,0 +1,39 @@
+/*
+ *  Name        : rftp-chunk.h
+ *  Author      : Edmund Luong <edmundvmluong@gmail.com>
+ *  Version     : 1.0
+ *  Copyright   : MIT 2014 © Edmund Luong
+ *  Date        : November 16, 2014
+ *  Description : Implementation of content-defined chunking (FastCDC) for
+ *                deduplicated transfers of the Reliable File Transfer
+ *                Protocol, which splits files into chunks at boundaries
+ *                chosen by their content, and hashes the chunks.
+ *
+ *  CS 3357a Assignment 2
+ */
+
+#ifndef RFTP_CHUNK_H
+#define RFTP_CHUNK_H
+
+#include "rftp-messages.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Chunk-oriented macros
+ */
+#define CHUNK_MIN 2048          // Smallest chunk, in bytes
+#define CHUNK_AVG 8192          // Normal chunk, in bytes
+#define CHUNK_MAX 65536         // Largest chunk, in bytes
+#define CHUNK_MASK_S 0x0000d9f003530000ULL // 15-bit mask, before CHUNK_AVG
+#define CHUNK_MASK_L 0x0000d90003530000ULL // 11-bit mask, after CHUNK_AVG
+
+/*
+ * Function prototypes
+ */
+size_t find_chunk_boundary (const uint8_t *data, size_t length);
+void hash_chunk (const uint8_t *data, size_t length,
+        uint8_t hash[CHUNK_HASH]);
+
+#endif /* RFTP_CHUNK_H */
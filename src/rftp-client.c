@@ -5,47 +5,111 @@
  *  Copyright   : MIT 2014 © Edmund Luong
  *  Date        : November 11, 2014
  *  Description : Implementation of a Reliable File Transfer Protocol client,
- *                used to transfer a file to a RFTP server.
+ *                used to transfer a file to a RFTP server, or to fetch a
+ *                file from one.
  *
  *  CS 3357a Assignment 2
  */
 
 #include "rftp-protocol.h"
 #include "rftp-client.h"
+#include "rftp-server.h"
 #include "rftp-config.h"
 #include "udp-sockets.h"
 #include "udp-client.h"
 #include "file.h"
+#include "rftp-busypoll.h"
+#include "rftp-chunk.h"
+#include "rftp-zero.h"
+#include "rftp-window.h"
+#include "rftp-crypto.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
 
 /*
- * Attempts to initialize a file transfer session with a RFTP server using
- * the Stop-and-Wait protocol.
+ * Begins sealing the messages of a session, once the server answers the
+ * key exchange with its hello at an index of a handshake message. Without
+ * a pre-shared key, the session is not sealed.
+ *
+ * Return a successful status if the session is sealed, or needs no sealing.
+ * Return a failure status if the server does not encrypt transfers, or
+ * holds a different key.
+ */
+static int seal_session (crypto_hello *hello, rftp_message *msg, int index)
+{
+    crypto_hello reply; // Server's half of the key exchange
+
+    if (!crypto_configured()) return SUCCESS;
+    if (!find_hello(msg, index, &reply))
+    {
+        printf("\nERROR: The server does not encrypt transfers.\n");
+        return FAILURE;
+    }
+    return begin_cipher(hello, &reply, CLIENT_ROLE);
+}
+
+/*
+ * Reports the cause a session with a server failed with, as the protocol
+ * kept it: ETIMEDOUT if the server stopped responding, or else the cause
+ * the server rejected a request with. Messages that could not be sent
+ * fail with EIO, and are not reported.
+ */
+void report_peer_error (int error)
+{
+    if (error == ETIMEDOUT)
+    {
+        printf("\nERROR: The peer stopped responding.\n");
+    }
+    else if (error && error != EIO)
+    {
+        printf("\nERROR: The server rejected the request (%s).\n",
+               strerror(error));
+    }
+}
+
+/*
+ * Attempts to initialize a transfer session with a RFTP server using the
+ * Stop-and-Wait protocol, with an initialization message, which is freed
+ * if the session could not be initialized.
  * When the server does not acknowledge an initialization request,
  * another request will be sent when it times out.
+ * With a pre-shared key, the initialization message carries the client's
+ * half of the key exchange, and its acknowledgment the server's half.
  *
- * Return an initiation message for file transfer information
- * if file is valid and a file transfer session has been initiated.
- *
- * Return NULL if there was an error with the file
- * or an error initiating a session with a server.
+ * Return the acknowledged initialization message, if a transfer session
+ * has been initiated.
+ * Return NULL if there was an error initiating a session with a server.
  */
-control_message *request_transfer_session (int sockfd, host_t *dest,
-        char *filename, int timeout, int verbose)
+control_message *initiate_session (int sockfd, host_t *dest,
+        rftp_message *init, int timeout, session_stats *stats, int verbose)
 {
-    rftp_message *init; // A initialization message
+    crypto_hello hello; // Client's half of the key exchange
 
-    // Construct an initialization message.
-    if ((init = create_init_message(filename)))
+    if (init)
     {
+        if (crypto_configured())
+        {
+            create_hello(&hello);
+            add_hello(init, &hello);
+        }
+
         // Send initialization message to server via Stop-and-Wait protocol.
-        if (stop_and_wait_send(sockfd, dest, init, INIT_MSG, timeout,
-                               verbose))
+        if (stop_and_wait_send(sockfd, dest, init, INIT_MSG, timeout, 0,
+                               NULL, stats, verbose))
         {
-            return (control_message*) init;
+            // Seal the session, once the server answers the key exchange.
+            if (seal_session(&hello, init, 1))
+            {
+                return (control_message*) init;
+            }
         }
+        else report_peer_error(errno);
     }
 
     // Transfer failed to initialize.
@@ -54,85 +118,272 @@ control_message *request_transfer_session (int sockfd, host_t *dest,
 }
 
 /*
- * Transfers a file to a RFTP server.
+ * Attempts to initialize a file transfer session with a RFTP server using
+ * the Stop-and-Wait protocol (see initiate_session).
+ *
+ * Return an initiation message for file transfer information
+ * if file is valid and a file transfer session has been initiated.
+ *
+ * Return NULL if there was an error with the file
+ * or an error initiating a session with a server.
+ */
+control_message *request_transfer_session (int sockfd, host_t *dest,
+        char *filename, int timeout, session_stats *stats, int verbose)
+{
+    return initiate_session(sockfd, dest, create_init_message(filename),
+                            timeout, stats, verbose);
+}
+
+/*
+ * Transfers a file to a RFTP server, pacing the data packets when
+ * a pacer is given. Only the data extents of a sparse file are sent;
+ * each hole between them is sent as a hole packet holding its length.
+ * Runs of data packets holding only zeros are sent as zero range packets.
+ * The packets are sent through the send window of the session, which
+ * keeps up to as many in flight as the server advertises it can hold,
+ * striped across the paths of the window.
  *
  * Return a successful status if the file transfer was successful.
  * Return a failure status if the file transfer failed.
  */
-int transfer_file (int sockfd, host_t *dest, char *filename, int filesize,
-        int timeout, int verbose)
+int transfer_file (send_window *flight, char *filename, int filesize)
 {
     FILE *file = NULL;         // The file to be sent
     uint8_t buffer[DATA_MSS];  // Buffer to hold data
-    int next_seq = 1;          // The next sequence number
     int bytes_read = 0;        // Number of bytes read from file
     int bytes_sent = 0;        // Total number of bytes successfully sent
     int curr_mult = 0;         // The current percent multiple being returned
     int last_mult = OUTPUTTED; // The last displayed percentage multiple
+    off_t start = 0;           // Start of the next data extent
+    off_t end = 0;             // End of the next data extent
+    int64_t zeros = 0;         // Length of the run of zeros not yet sent
+    int capacity = data_capacity(); // Data bytes per packet
 
     // Open the file to be transferred.
-    if ((file = get_file(filename, "rb")))
+    if (!(file = get_file(filename, "rb"))) return FAILURE;
+
+    // While the end of the file has not been reached.
+    while (bytes_sent < filesize)
     {
-        // While the end of the file has not been reached.
-        while (!feof(file))
+        // Send the hole before the next data extent, if any.
+        start = next_data_extent(fileno(file), bytes_sent, filesize, &end);
+        if (start > bytes_sent)
+        {
+            if (!send_zero_run(flight, &zeros)
+                    || !send_hole_packet(flight, start - bytes_sent))
+            {
+                break;
+            }
+            bytes_sent = start;
+            curr_mult = output_progress(SEND, bytes_sent, filesize,
+                                        last_mult);
+            if (curr_mult != OUTPUTTED) last_mult = curr_mult;
+        }
+        if (fseeko(file, start, SEEK_SET)) break;
+
+        // Send the data extent, one data packet at a time.
+        while (bytes_sent < end)
         {
             // Read data from the file.
-            bytes_read = fread(buffer, sizeof(uint8_t), sizeof(buffer), file);
-            if (!check_fileread(file)) break;
+            bytes_read = fread(buffer, sizeof(uint8_t),
+                               (end - bytes_sent < capacity)
+                               ? end - bytes_sent : capacity, file);
+            if (!check_fileread(file) || bytes_read == 0) break;
 
-            // Create a data packet and send it to the server.
-            // Continue when data packet was successfully acknowledged.
-            if ((send_data_packet(sockfd, dest, next_seq, bytes_read, buffer,
-                                  timeout, verbose)))
+            // Add a packet of zeros to the run of zeros. Otherwise, send
+            // the run so far, then create a data packet and send it to
+            // the server.
+            if (is_zero_block(buffer, bytes_read))
             {
-                // Output the progress of the file transfer.
-                bytes_sent += bytes_read;
-                curr_mult = output_progress(SEND, bytes_sent, filesize,
-                                            last_mult);
-                if (curr_mult != OUTPUTTED) last_mult = curr_mult;
-
-                // Update the sequence number.
-                next_seq = (next_seq == 1) ? 0 : 1;
+                zeros += bytes_read;
             }
-            // If there was an error sending any data packets.
-            else
+            else if (!send_zero_run(flight, &zeros)
+                     || !send_data_packet(flight, bytes_read, buffer))
             {
-                fclose(file);
-                return FAILURE;
+                // If there was an error sending any data packets.
+                break;
             }
+
+            // Output the progress of the file transfer.
+            bytes_sent += bytes_read;
+            curr_mult = output_progress(SEND, bytes_sent, filesize,
+                                        last_mult);
+            if (curr_mult != OUTPUTTED) last_mult = curr_mult;
         }
+        if (bytes_sent < end) break;
     }
 
-    // Terminate the file transfer session and return the status code.
+    // Wait for the packets in flight, then terminate the file transfer
+    // session and return the status code.
     fclose(file);
-    return end_transfer_session(sockfd, dest, filename, filesize, next_seq,
-                                timeout, verbose);
+    if (bytes_sent < filesize || !send_zero_run(flight, &zeros)
+            || !window_drain(flight))
+    {
+        return FAILURE;
+    }
+    return end_transfer_session(flight, filename, filesize);
+}
+
+/*
+ * Sends a batch of chunks to a RFTP server: offers their hashes first,
+ * then sends the bytes of the chunks the server does not hold, packed
+ * into data packets. The offer is only sent once the packets in flight
+ * are acknowledged, since its acknowledgment decides what follows.
+ *
+ * Return a successful status if the chunks were sent.
+ * Return a failure status if the chunks could not be sent.
+ */
+static int send_chunks (send_window *flight, uint8_t *data, size_t *starts,
+        chunk_offer *offers, int count)
+{
+    rftp_message *offer = NULL; // Offer of the chunks
+    chunk_offer *marks = NULL;  // Offers marked by the server
+    uint8_t buffer[DATA_MSS];   // Buffer to pack chunk bytes into
+    int filled = 0;             // Bytes packed into the buffer
+    int length = 0;             // Length of a chunk
+    int take = 0;               // Bytes of a chunk packed at once
+    int done = 0;               // Bytes of a chunk packed so far
+    int capacity = data_capacity(); // Data bytes per packet
+    int i;
+
+    // Offer the chunks, and learn which ones the server holds.
+    if (!(offer = create_offer_message(window_seq(flight), offers, count))
+            || !window_exchange(flight, offer, OFFER_MSG))
+    {
+        free(offer);
+        return FAILURE;
+    }
+    marks = (chunk_offer*) ((data_message*) offer)->data;
+
+    // Send the bytes of the other chunks, packing them into full packets.
+    for (i = 0; i < count; i++)
+    {
+        if (marks[i].present) continue;
+
+        length = ntohl(offers[i].length);
+        for (done = 0; done < length; done += take)
+        {
+            take = length - done;
+            if (take > capacity - filled) take = capacity - filled;
+            memcpy(buffer + filled, data + starts[i] + done, take);
+            filled += take;
+
+            // Send the buffer once it is full, or holds the last bytes.
+            if (filled == capacity)
+            {
+                if (!send_data_packet(flight, filled, buffer))
+                {
+                    free(offer);
+                    return FAILURE;
+                }
+                filled = 0;
+            }
+        }
+    }
+    if (filled > 0 && !send_data_packet(flight, filled, buffer))
+    {
+        free(offer);
+        return FAILURE;
+    }
+
+    free(offer);
+    return SUCCESS;
+}
+
+/*
+ * Transfers a file to a RFTP server, deduplicated against the chunks the
+ * server already holds. The file is split into content-defined chunks,
+ * so data shifted by an insertion still splits into the same chunks.
+ *
+ * Return a successful status if the file transfer was successful.
+ * Return a failure status if the file transfer failed.
+ */
+int transfer_chunked_file (send_window *flight, char *filename,
+        int filesize)
+{
+    chunk_offer offers[OFFER_CHUNKS]; // Offers of a batch of chunks
+    size_t starts[OFFER_CHUNKS];      // Offsets of the chunks of a batch
+    uint8_t *data = NULL;        // Mapped contents of the file
+    size_t length = 0;           // Length of a chunk
+    size_t pos = 0;              // Offset of the next chunk
+    int count = 0;               // Number of chunks in the batch
+    int curr_mult = 0;           // The current percent multiple being returned
+    int last_mult = OUTPUTTED;   // The last displayed percentage multiple
+    int fd = -1;                 // File descriptor of the file
+    int status = SUCCESS;        // Status of the file transfer
+
+    // Map the file to be transferred.
+    if ((fd = open(filename, O_RDONLY)) == -1)
+    {
+        perror("Unable to open file");
+        return FAILURE;
+    }
+    if (filesize > 0 && (data = mmap(NULL, filesize, PROT_READ, MAP_PRIVATE,
+                                     fd, 0)) == MAP_FAILED)
+    {
+        perror("Unable to map file");
+        close(fd);
+        return FAILURE;
+    }
+    close(fd);
+
+    // Offer and send the chunks of the file, a batch at a time.
+    memset(offers, 0, sizeof(offers));
+    while (status && pos < (size_t) filesize)
+    {
+        for (count = 0; count < OFFER_CHUNKS && pos < (size_t) filesize;
+                count++)
+        {
+            length = find_chunk_boundary(data + pos, filesize - pos);
+            hash_chunk(data + pos, length, offers[count].hash);
+            offers[count].length = htonl((uint32_t) length);
+            starts[count] = pos;
+            pos += length;
+        }
+        status = send_chunks(flight, data, starts, offers, count);
+
+        // Output the progress of the file transfer.
+        curr_mult = output_progress(SEND, pos, filesize, last_mult);
+        if (curr_mult != OUTPUTTED) last_mult = curr_mult;
+    }
+    if (data) munmap(data, filesize);
+
+    // Wait for the packets in flight, then terminate the file transfer
+    // session and return the status code.
+    if (!status || !window_drain(flight)) return FAILURE;
+    return end_transfer_session(flight, filename, filesize);
 }
 
 /*
  * Attempts to terminate a file transfer session with a UDP server using
- * the Stop-and-Wait protocol.
+ * the Stop-and-Wait protocol, once the send window of the session is
+ * drained.
  * When the server does not acknowledge a termination request,
- * another request will be sent when it times out.
+ * another request will be sent when it times out. The first one is resent
+ * early, after the tail-loss probe timeout of the window, since a lost
+ * termination request is otherwise only recovered by a full timeout.
  *
  * Return a successful status code if the termination was acknowledged.
- * Return a failure status code if the termination could not be acknowledged.
+ * Return a failure status code if the termination could not be acknowledged,
+ * with its cause kept as the error of the window.
  */
-int end_transfer_session (int sockfd, host_t *dest, char *filename,
-        int filesize, int next_seq, int timeout, int verbose)
+int end_transfer_session (send_window *flight, char *filename,
+        int filesize)
 {
     rftp_message *term; // A termination message
 
     // Create a termination message.
-    if ((term = create_term_message(next_seq, filename, filesize)))
+    if ((term = create_term_message(window_seq(flight), filename, filesize)))
     {
         // Send termination message to server using Stop-and-Wait.
-        if (stop_and_wait_send(sockfd, dest, term, TERM_MSG, timeout,
-                               verbose))
+        if (stop_and_wait_send(flight->sockfd, flight->dest, term, TERM_MSG,
+                               flight->timeout, window_tail_timeout(flight),
+                               NULL, flight->stats, flight->verbose))
         {
             free(term);
             return SUCCESS;
         }
+        flight->error = errno;
     }
 
     // If an error occurred, return a failure status.
@@ -140,44 +391,343 @@ int end_transfer_session (int sockfd, host_t *dest, char *filename,
     return FAILURE;
 }
 
+/*
+ * Asks a RFTP server to join a path to the transfer session of a file,
+ * with the token the server gave the session, resending the request each
+ * time it times out, up to JOIN_ATTEMPTS times, so a path that cannot
+ * reach the server is given up.
+ *
+ * Return a successful status if the server accepted the path.
+ * Return a failure status if the path was rejected or could not join.
+ */
+static int join_path (int sockfd, host_t *dest, char *filename,
+        int filesize, uint64_t token, int timeout, session_stats *stats,
+        int verbose)
+{
+    rftp_message *join = NULL;     // Path join message
+    rftp_message *response = NULL; // A received RFTP message
+    host_t source;                 // Source of the received message
+    int attempt = 0;               // Number of requests sent
+    int status = FAILURE;          // Status of the join
+
+    if (!(join = create_join_message(filename, filesize, token)))
+    {
+        return FAILURE;
+    }
+
+    // Send the request until the server answers it.
+    for (attempt = 0; attempt < JOIN_ATTEMPTS && !response; attempt++)
+    {
+        if (send_rftp_message(sockfd, dest, join, JOIN_MSG, verbose)
+                == SEND_ERR)
+        {
+            break;
+        }
+        stats_record_sent(stats);
+
+        while ((response = receive_rftp_message_with_timeout(sockfd, &source,
+                                                             timeout,
+                                                             verbose)))
+        {
+            stats_record_received(stats);
+            if (same_host(&source, dest)
+                    && (check_acknowledgment(join, response, JOIN_MSG)
+                        || check_rejection(join, response, JOIN_MSG)))
+            {
+                status = check_acknowledgment(join, response, JOIN_MSG);
+                break;
+            }
+            free(response);
+        }
+    }
+
+    free(response);
+    free(join);
+    return status;
+}
+
+/*
+ * Joins a path to the transfer session for each local address after the
+ * first, whose socket is the session's own, and adds the paths that the
+ * server accepted to the send window. Paths that cannot join, and the
+ * addresses past the most paths a session has, are left out of the
+ * transfer, and reported.
+ */
+static void join_paths (send_window *flight, char **sources,
+        int source_count, char *server_name, char *port_number,
+        char *filename, int filesize, uint64_t token)
+{
+    host_t dest; // Server, as reached through the path
+    int sockfd;  // Socket of the path
+    int i;
+
+    if (source_count > 0) flight->paths[0].name = sources[0];
+    for (i = 1; i < source_count; i++)
+    {
+        if (i >= MAX_PATHS)
+        {
+            printf("Path from %s was left out of the transfer (at most %d "
+                   "paths).\n", sources[i], MAX_PATHS);
+            continue;
+        }
+        if ((sockfd = open_bound_client_socket(sources[i], server_name,
+                                               port_number, &dest)) == -1)
+        {
+            printf("Path from %s could not join the transfer (%s).\n",
+                   sources[i], strerror(errno));
+            continue;
+        }
+        busy_poll_socket(sockfd);
+        pace_socket(flight->pacer, sockfd);
+        if (join_path(sockfd, &dest, filename, filesize, token,
+                      flight->timeout, flight->stats, flight->verbose)
+                && window_add_path(flight, sockfd, &dest, sources[i]))
+        {
+            printf("Path from %s joined the transfer.\n", sources[i]);
+        }
+        else
+        {
+            printf("Path from %s could not join the transfer.\n",
+                   sources[i]);
+            close(sockfd);
+        }
+    }
+}
+
 /*
  * Transfers a file to the UDP server using
  * the Reliable File Transfer Protocol (RFTP).
+ * A positive rate, in kilobits per second, paces the data packets.
+ * A deduplicated transfer only sends the chunks the server lacks.
+ * Up to a window of packets are kept in flight; a window of 1 is the
+ * Stop-and-Wait protocol. Given local addresses, the socket of the
+ * session is bound to the first one, and the data packets are striped
+ * across paths from each of them.
  *
  * Return a successful status code if the transfer was successful
  * Return a failure status code if the transfer failed.
  */
 int rftp_transfer_file (char *server_name, char *port_number, char *filename,
-        int timeout, int verbose)
+        int timeout, long rate, int window, int dedup, char **sources,
+        int source_count, int verbose)
 {
     host_t server;                // Server host
+    send_window *flight = NULL;   // Packets in flight
     control_message *init = NULL; // Initialization message
+    session_stats *stats = NULL;  // Statistics of the transfer session
+    pacer *pacer = NULL;          // Pacer of the data packets
     int filesize = NO_FSIZE;      // The size of the file being transferred
     int status = FAILURE;         // Status of the file transfer
+    int i;
 
     // Create a socket and listen on port number.
-    int sockfd = create_client_socket(server_name, port_number, &server);
+    int sockfd = (source_count > 0)
+                 ? open_bound_client_socket(sources[0], server_name,
+                                            port_number, &server)
+                 : open_client_socket(server_name, port_number, &server);
+    if (sockfd == -1)
+    {
+        printf("ERROR: Unable to reach %s:%s (%s).\n", server_name,
+               port_number, strerror(errno));
+        return FAILURE;
+    }
+    busy_poll_socket(sockfd);
     printf("Trying to initiate a file transfer with %s:%s ...\n", server_name,
            port_number);
+    stats = stats_open_session(SEND, filename, NO_FSIZE);
+    pacer = create_pacer(sockfd, rate, verbose);
 
     // If the transfer was initialized, begin transferring the file.
     if ((init = request_transfer_session(sockfd, &server, filename, timeout,
-                                         verbose)))
+                                         stats, verbose)))
     {
         // Get the filesize of the file transfer.
         printf("File transfer initialized.\n\n");
         filesize = ntohl(init->fsize);
+        stats_set_peer(stats, &server);
+        if (stats) stats->filesize = filesize;
 
         // Display file transfer information.
         output_transfer_info(SEND, filename, filesize);
 
-        // Transfer the file to the server.
-        status = transfer_file(sockfd, &server, filename, filesize, timeout,
-                               verbose);
+        // Join the other paths, and transfer the file to the server.
+        if ((flight = create_send_window(sockfd, &server, 1, window, timeout,
+                                         pacer, stats, verbose)))
+        {
+            join_paths(flight, sources, source_count, server_name,
+                       port_number, filename, filesize,
+                       find_session_token((rftp_message*) init));
+            status = dedup ? transfer_chunked_file(flight, filename, filesize)
+                           : transfer_file(flight, filename, filesize);
+            if (!status) report_peer_error(flight->error);
+            report_window_paths(flight);
+        }
+    }
+    stats_close_session(stats, status);
+    end_cipher();
+    for (i = 1; flight && i < flight->path_count; i++)
+    {
+        close(flight->paths[i].sockfd);
+    }
+    free_send_window(flight);
+
+    // Return the status of the file transfer.
+    close(sockfd);
+    free(pacer);
+    free(init);
+    return status;
+}
+
+/*
+ * Requests a file, or a byte range of it, from a RFTP server, resending
+ * the request each time it times out. The server answers the request by
+ * initializing a transfer session of the file to the client, or rejects it.
+ *
+ * Return the initialization message of the server, if the request was answered.
+ * Return NULL if the request was rejected or could not be sent.
+ */
+control_message *request_file (int sockfd, host_t *dest, rftp_message *get,
+        int msg_type, int timeout, session_stats *stats, int verbose)
+{
+    timer_wheel *wheel = protocol_timers(); // Timers of the protocol
+    timer retransmit;                 // Retransmission timer of the request
+    control_message *response = NULL; // A received RFTP message
+    host_t source;                    // Source of the received message
+
+    // Send the request until the server answers it.
+    timer_init(&retransmit, NULL, NULL);
+    while (send_rftp_message(sockfd, dest, get, msg_type, verbose) != SEND_ERR)
+    {
+        timer_schedule_after(wheel, &retransmit, (uint64_t) timeout * 1000);
+        stats_record_sent(stats);
+
+        while ((response = (control_message*) receive_rftp_message_before(
+                sockfd, &source, wheel, &retransmit, verbose)))
+        {
+            stats_record_received(stats);
+            if (same_host(&source, dest))
+            {
+                // The server initializes the transfer of the file.
+                if (response->type == INIT_MSG && response->ack == NAK
+                        && ntohs(response->seq_num) == 0)
+                {
+                    timer_cancel(wheel, &retransmit);
+                    return response;
+                }
+
+                // The server rejected the request, or holds another key
+                // than the client (see open_received_message).
+                if (check_rejection(get, (rftp_message*) response, msg_type)
+                        || (response->type == INIT_MSG
+                            && response->ack == REJ))
+                {
+                    printf("\nERROR: The server rejected the request (%s).\n",
+                           strerror(ntohl(response->fsize)));
+                    timer_cancel(wheel, &retransmit);
+                    free(response);
+                    return NULL;
+                }
+            }
+            free(response);
+        }
+
+        // The request timed out.
+        stats_record_timeout(stats);
+        stats_record_retransmit(stats);
+    }
+
+    // The request could not be sent.
+    return NULL;
+}
+
+/*
+ * Fetches a file from a RFTP server into an output directory, using
+ * the Reliable File Transfer Protocol (RFTP). Once the server answers
+ * the request, the client receives the file just as a server would.
+ * Unless the length is NO_RANGE, only the byte range of the file from
+ * the offset is fetched (see range_message). With a pre-shared key, the
+ * request carries the client's half of the key exchange, and the
+ * initialization message of the server its half.
+ *
+ * Return a successful status code if the fetch was successful.
+ * Return a failure status code if the fetch failed.
+ */
+int rftp_fetch_file (char *server_name, char *port_number, char *filename,
+        char *output_dir, int64_t offset, int64_t length, int timeout,
+        int verbose)
+{
+    host_t server;                // Server host
+    rftp_message *request = NULL; // File or range request message
+    int msg_type = GET_MSG;       // Type of the request message
+    control_message *init = NULL; // Initialization message of the server
+    output_file *target = NULL;   // Target file
+    session_stats *stats = NULL;  // Statistics of the transfer session
+    char *name = NULL;            // Name of the file in the output directory
+    int filesize = NO_FSIZE;      // The size of the file being transferred
+    int status = FAILURE;         // Status of the file transfer
+    crypto_hello hello;           // Client's half of the key exchange
+
+    // The file is saved under its own name, without the served directories.
+    name = strrchr(filename, '/') ? strrchr(filename, '/') + 1 : filename;
+
+    // Create a socket and request the file from the server.
+    int sockfd = open_client_socket(server_name, port_number, &server);
+    if (sockfd == -1)
+    {
+        printf("ERROR: Unable to reach %s:%s (%s).\n", server_name,
+               port_number, strerror(errno));
+        return FAILURE;
+    }
+    busy_poll_socket(sockfd);
+    printf("Requesting %s from %s:%s ...\n", filename, server_name,
+           port_number);
+    stats = stats_open_session(RECV, name, NO_FSIZE);
+
+    // If the server answered, accept the transfer and receive the file.
+    if (length == NO_RANGE) request = create_get_message(filename);
+    else
+    {
+        request = create_range_message(filename, offset, (uint32_t) length);
+        msg_type = RANGE_MSG;
+    }
+    if (request && crypto_configured())
+    {
+        create_hello(&hello);
+        add_hello(request, &hello);
+    }
+    if (request && (init = request_file(sockfd, &server, request, msg_type,
+                                        timeout, stats, verbose)))
+    {
+        filesize = ntohl(init->fsize);
+        stats_set_peer(stats, &server);
+        if (stats) stats->filesize = filesize;
+
+        // Seal the session, once the server answers the key exchange,
+        // or else turn the server away.
+        if (!seal_session(&hello, (rftp_message*) init, 0))
+        {
+            reject_message(sockfd, &server, (rftp_message*) init, INIT_MSG,
+                           EACCES, verbose);
+        }
+        else if ((target = accept_transfer_session(sockfd, &server, init,
+                                                   name, output_dir,
+                                                   BUFFERED_IO, verbose)))
+        {
+            printf("File transfer initialized.\n\n");
+            stats_record_sent(stats);
+            output_transfer_info(RECV, name, filesize);
+
+            status = receive_file(sockfd, &server, target, name, filesize,
+                                  0, NULL, BUFFERED_IO, DEFAULT_FETCH_WAIT,
+                                  stats, verbose);
+        }
     }
+    stats_close_session(stats, status);
+    end_cipher();
 
     // Return the status of the file transfer.
     close(sockfd);
+    free(request);
     free(init);
     return status;
 }
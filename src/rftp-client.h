@@ -5,7 +5,8 @@
  *  Copyright   : MIT 2014 © Edmund Luong
  *  Date        : November 11, 2014
  *  Description : Implementation of a Reliable File Transfer Protocol client,
- *                used to transfer a file to a RFTP server.
+ *                used to transfer a file to a RFTP server, or to fetch a
+ *                file from one.
  *
  *  CS 3357a Assignment 2
  */
@@ -15,17 +16,37 @@
 
 #include "rftp-messages.h"
 #include "udp-sockets.h"
+#include "rftp-stats.h"
+#include "rftp-pacer.h"
+#include "rftp-window.h"
+
+#include <stdint.h>
+
+/*
+ * Client-oriented macros
+ */
+#define NO_RANGE -1 // Fetches the whole file, rather than a byte range
 
 /*
  * Function prototypes
  */
+void report_peer_error (int error);
+control_message *initiate_session (int sockfd, host_t *dest,
+        rftp_message *init, int timeout, session_stats *stats, int verbose);
 control_message *request_transfer_session (int sockfd, host_t *dest,
-        char *filename, int timeout, int verbose);
-int transfer_file (int sockfd, host_t *dest, char *filename, int filesize,
-        int timeout, int verbose);
-int end_transfer_session (int sockfd, host_t *dest, char *filename,
-        int filesize, int next_seq, int timeout, int verbose);
+        char *filename, int timeout, session_stats *stats, int verbose);
+int transfer_file (send_window *flight, char *filename, int filesize);
+int transfer_chunked_file (send_window *flight, char *filename,
+        int filesize);
+int end_transfer_session (send_window *flight, char *filename,
+        int filesize);
 int rftp_transfer_file (char *server_name, char *port_number, char *filename,
-        int timeout, int verbose);
+        int timeout, long rate, int window, int dedup, char **sources,
+        int source_count, int verbose);
+control_message *request_file (int sockfd, host_t *dest, rftp_message *get,
+        int msg_type, int timeout, session_stats *stats, int verbose);
+int rftp_fetch_file (char *server_name, char *port_number, char *filename,
+        char *output_dir, int64_t offset, int64_t length, int timeout,
+        int verbose);
 
 #endif /* RFTP_CLIENT_H */
@@ -21,6 +21,11 @@
 #define DEFAULT_TIMEOUT 50      // Default transmission timeout, in milliseconds
 #define DEFAULT_TIME_WAIT 30    // Default server wait state duration, in milliseconds
 #define DEFAULT_PORT "5000"     // Default port number
+#define DEFAULT_PROXY_PORT "5001"  // Default impairment proxy port number
+#define DEFAULT_FETCH_WAIT 200  // Default client wait state duration after a fetch, in milliseconds
+#define SERVE_RETRANSMITS 40    // Resends before the server gives up on a client
+#define IDLE_TIMEOUT 10000      // Silence before the server gives up on a session, in milliseconds
+#define JOIN_ATTEMPTS 10        // Join requests sent before a path is given up
 #define OUTPUT_INTVAL 1         // Output interval, in percentage
 
 #endif /* RFTP_CONFIG_H */
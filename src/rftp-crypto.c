@@ -0,0 +1,516 @@
+/*
+ *  Name        : rftp-crypto.c
+ *  Author      : Edmund Luong <edmundvmluong@gmail.com>
+ *  Version     : 1.0
+ *  Copyright   : MIT 2014 © Edmund Luong
+ *  Date        : November 16, 2014
+ *  Description : Implementation of authenticated encryption for the Reliable
+ *                File Transfer Protocol, which seals the messages of a
+ *                transfer session with keys derived from a pre-shared key
+ *                and the nonces exchanged in its handshake.
+ *
+ *  CS 3357a Assignment 2
+ */
+
+#include "rftp-crypto.h"
+#include "rftp-config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <endian.h>
+#include <arpa/inet.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/kdf.h>
+#include <openssl/rand.h>
+
+static uint8_t psk[PSK_MAX];              // Pre-shared key
+static size_t psk_len = 0;                // Length of the pre-shared key
+static EVP_CIPHER_CTX *seal_ctx = NULL;   // Cipher of sealed messages
+static EVP_CIPHER_CTX *open_ctx = NULL;   // Cipher of opened messages
+static uint64_t seal_count = 0;           // Messages sealed in the session
+static uint64_t open_count = 0;           // Highest counter opened
+static uint64_t replay_bits[REPLAY_WINDOW / 64]; // Counters opened lately
+static crypto_hello session_hello;        // Own hello of the session
+
+/*
+ * Loads the pre-shared key of the process from a key file, whose whole
+ * contents (at least PSK_MIN bytes) are the key.
+ *
+ * Return a successful status if the key was loaded.
+ * Return a failure status if the key file could not be read, or is too short.
+ */
+int load_psk (char *path)
+{
+    FILE *file = NULL; // Key file
+
+    if (!(file = fopen(path, "rb")))
+    {
+        perror("Unable to open key file");
+        return FAILURE;
+    }
+    psk_len = fread(psk, sizeof(uint8_t), sizeof(psk), file);
+    fclose(file);
+
+    if (psk_len < PSK_MIN)
+    {
+        printf("ERROR: The key file must hold at least %d bytes.\n", PSK_MIN);
+        OPENSSL_cleanse(psk, sizeof(psk));
+        psk_len = 0;
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/*
+ * Returns whether the process has a pre-shared key, and so encrypts its
+ * transfer sessions.
+ */
+int crypto_configured ()
+{
+    return psk_len > 0;
+}
+
+/*
+ * Returns whether the current transfer session seals its messages.
+ */
+int crypto_active ()
+{
+    return seal_ctx != NULL;
+}
+
+/*
+ * Returns the cipher of a cipher suite, or NULL for an unknown suite.
+ */
+static const EVP_CIPHER *suite_cipher (int suite)
+{
+    if (suite == SUITE_AES_GCM) return EVP_aes_256_gcm();
+    if (suite == SUITE_CHACHA20) return EVP_chacha20_poly1305();
+    return NULL;
+}
+
+/*
+ * Creates this side's half of the key exchange, with a random nonce.
+ * AES-256-GCM is proposed on CPUs with AES and carry-less multiply
+ * instructions, where OpenSSL runs it in hardware, and ChaCha20-Poly1305,
+ * which is faster in software, everywhere else.
+ */
+void create_hello (crypto_hello *hello)
+{
+    memset(hello, 0, sizeof(crypto_hello));
+    RAND_bytes(hello->nonce, NONCE_LEN);
+    hello->suite = SUITE_CHACHA20;
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("aes") && __builtin_cpu_supports("pclmul"))
+    {
+        hello->suite = SUITE_AES_GCM;
+    }
+#endif
+}
+
+/*
+ * Creates the random token of a transfer session, which the paths that
+ * join it must carry (see add_session_token).
+ *
+ * Return a nonzero token.
+ * Return 0 if no random bytes are available, so no path can join.
+ */
+uint64_t create_session_token ()
+{
+    uint64_t token = 0; // Session token
+
+    while (!token)
+    {
+        if (RAND_bytes((uint8_t*) &token, sizeof(token)) != 1) return 0;
+    }
+    return token;
+}
+
+/*
+ * Returns the offset of the first crypto hello of a handshake message,
+ * right after its filename.
+ */
+static int hello_offset (rftp_message *msg)
+{
+    if (((control_message*) msg)->type == RANGE_MSG)
+    {
+        return RANGE_HEADER + ntohl(((range_message*) msg)->fname_len);
+    }
+    return CTRL_HEADER + ntohl(((control_message*) msg)->fname_len);
+}
+
+/*
+ * Appends a crypto hello to a handshake message.
+ *
+ * Return a successful status if the hello was appended.
+ * Return a failure status if the message has no room for it.
+ */
+int add_hello (rftp_message *msg, crypto_hello *hello)
+{
+    if (msg->length + HELLO_LEN > RFTP_MSS) return FAILURE;
+
+    memcpy(msg->buffer + msg->length, hello, HELLO_LEN);
+    msg->length += HELLO_LEN;
+    return SUCCESS;
+}
+
+/*
+ * Finds a crypto hello of a handshake message: the client's at index 0,
+ * and, in an acknowledged initialization message, the server's at index 1.
+ *
+ * Return a successful status if the message holds the hello.
+ * Return a failure status otherwise.
+ */
+int find_hello (rftp_message *msg, int index, crypto_hello *hello)
+{
+    int offset = hello_offset(msg) + index * HELLO_LEN; // Offset of the hello
+
+    if (offset < 0 || offset + (int) HELLO_LEN > msg->length) return FAILURE;
+
+    memcpy(hello, msg->buffer + offset, HELLO_LEN);
+    return SUCCESS;
+}
+
+/*
+ * Derives key material of a session from the pre-shared key and the
+ * nonces of both sides (HKDF-SHA256), for a purpose given by a label.
+ *
+ * Return a successful status if the key material was derived.
+ * Return a failure status otherwise.
+ */
+static int derive_key (crypto_hello *client, crypto_hello *server,
+        const char *label, uint8_t *key, size_t length)
+{
+    EVP_PKEY_CTX *ctx = NULL;        // Key derivation
+    uint8_t salt[2 * NONCE_LEN];     // Nonces of the session
+    uint8_t info[32];                // Purpose and suite of the key
+    size_t info_len = strlen(label); // Length of the purpose
+    int status = FAILURE;            // Status of the derivation
+
+    memcpy(salt, client->nonce, NONCE_LEN);
+    memcpy(salt + NONCE_LEN, server->nonce, NONCE_LEN);
+    memcpy(info, label, info_len);
+    info[info_len++] = client->suite;
+
+    if ((ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL))
+            && EVP_PKEY_derive_init(ctx) > 0
+            && EVP_PKEY_CTX_set_hkdf_md(ctx, EVP_sha256()) > 0
+            && EVP_PKEY_CTX_set1_hkdf_salt(ctx, salt, sizeof(salt)) > 0
+            && EVP_PKEY_CTX_set1_hkdf_key(ctx, psk, psk_len) > 0
+            && EVP_PKEY_CTX_add1_hkdf_info(ctx, info, info_len) > 0
+            && EVP_PKEY_derive(ctx, key, &length) > 0)
+    {
+        status = SUCCESS;
+    }
+
+    EVP_PKEY_CTX_free(ctx);
+    return status;
+}
+
+/*
+ * Begins sealing the messages of a transfer session, once both halves of
+ * its key exchange are known. Each direction has its own key. The server
+ * fills in the proof of its hello; the client checks it, so a server with
+ * another key is found out during the handshake, rather than by the
+ * messages it cannot open.
+ *
+ * Return a successful status if the session seals its messages.
+ * Return a failure status if the suite is unknown, or the keys differ.
+ */
+int begin_cipher (crypto_hello *client, crypto_hello *server, int role)
+{
+    const EVP_CIPHER *cipher = suite_cipher(client->suite); // Cipher
+    uint8_t client_key[KEY_LEN];   // Key of the client's messages
+    uint8_t server_key[KEY_LEN];   // Key of the server's messages
+    uint8_t proof[PROOF_LEN];      // Proof of the pre-shared key
+    int status = FAILURE;          // Status of the cipher
+
+    end_cipher();
+    if (!cipher)
+    {
+        printf("ERROR: Unknown cipher suite %d.\n", client->suite);
+        return FAILURE;
+    }
+
+    // Derive the keys of the session, and prove or check the key.
+    if (derive_key(client, server, "rftp client", client_key, KEY_LEN)
+            && derive_key(client, server, "rftp server", server_key, KEY_LEN)
+            && derive_key(client, server, "rftp proof", proof, PROOF_LEN))
+    {
+        if (role == SERVER_ROLE)
+        {
+            memcpy(server->proof, proof, PROOF_LEN);
+            status = SUCCESS;
+        }
+        else if (CRYPTO_memcmp(server->proof, proof, PROOF_LEN) == 0)
+        {
+            status = SUCCESS;
+        }
+        else
+        {
+            printf("\nERROR: The peer holds a different key.\n");
+        }
+    }
+
+    // Key the ciphers of both directions.
+    if (status && (!(seal_ctx = EVP_CIPHER_CTX_new())
+                   || !(open_ctx = EVP_CIPHER_CTX_new())
+                   || !EVP_EncryptInit_ex(seal_ctx, cipher, NULL,
+                                          (role == CLIENT_ROLE) ? client_key
+                                                                : server_key,
+                                          NULL)
+                   || !EVP_DecryptInit_ex(open_ctx, cipher, NULL,
+                                          (role == CLIENT_ROLE) ? server_key
+                                                                : client_key,
+                                          NULL)))
+    {
+        end_cipher();
+        status = FAILURE;
+    }
+    session_hello = (role == CLIENT_ROLE) ? *client : *server;
+
+    OPENSSL_cleanse(client_key, KEY_LEN);
+    OPENSSL_cleanse(server_key, KEY_LEN);
+    return status;
+}
+
+/*
+ * Appends this side's hello of the current session to a handshake message,
+ * such as the acknowledgment of a retransmitted initialization message.
+ *
+ * Return a successful status if the hello was appended, or is not needed.
+ * Return a failure status if the message has no room for it.
+ */
+int add_session_hello (rftp_message *msg)
+{
+    return crypto_active() ? add_hello(msg, &session_hello) : SUCCESS;
+}
+
+/*
+ * Ends the sealing of the messages of the current session.
+ */
+void end_cipher ()
+{
+    EVP_CIPHER_CTX_free(seal_ctx);
+    EVP_CIPHER_CTX_free(open_ctx);
+    seal_ctx = open_ctx = NULL;
+    seal_count = open_count = 0;
+    memset(replay_bits, 0, sizeof(replay_bits));
+}
+
+/*
+ * Returns the most data bytes a data message of the current session can
+ * carry, leaving room for the authentication tag when it is sealed.
+ */
+int data_capacity ()
+{
+    return crypto_active() ? DATA_MSS - SEAL_OVERHEAD : DATA_MSS;
+}
+
+/*
+ * Returns whether a message type is a handshake message, which is not
+ * sealed: the session keys are not known until its handshake is done.
+ * A join message is sealed, since a path only joins a session whose
+ * keys are known.
+ */
+static int is_handshake (int msg_type)
+{
+    return msg_type == INIT_MSG || msg_type == GET_MSG
+           || msg_type == RANGE_MSG
+           || (msg_type == JOIN_MSG && !crypto_active());
+}
+
+/*
+ * Returns whether a message is a handshake message, which is tagged
+ * rather than sealed (see seal_message).
+ */
+int is_handshake_message (rftp_message *msg)
+{
+    return is_handshake(msg->buffer[0]);
+}
+
+/*
+ * Computes the tag of a handshake message: an HMAC-SHA256 of the message
+ * under the pre-shared key, cut to TAG_LEN bytes.
+ *
+ * Return a successful status if the tag was computed.
+ * Return a failure status otherwise.
+ */
+static int handshake_tag (uint8_t *buffer, int length, uint8_t tag[TAG_LEN])
+{
+    static const char label[] = "rftp handshake"; // Purpose of the tag
+    uint8_t input[sizeof(label) + RFTP_MSS];       // Purpose and message
+    uint8_t mac[EVP_MAX_MD_SIZE];                  // HMAC of the message
+    unsigned int mac_len = 0;                      // Length of the HMAC
+
+    memcpy(input, label, sizeof(label));
+    memcpy(input + sizeof(label), buffer, length);
+    if (!HMAC(EVP_sha256(), psk, psk_len, input, sizeof(label) + length,
+              mac, &mac_len))
+    {
+        return FAILURE;
+    }
+    memcpy(tag, mac, TAG_LEN);
+    return SUCCESS;
+}
+
+/*
+ * Checks the counter of a sealed message against the counters opened
+ * lately, which are kept as a bitmap of the last REPLAY_WINDOW counters,
+ * one 64-bit word at a time: a counter already opened, or too far behind
+ * the highest one to tell, is a replay.
+ *
+ * Return a successful status if the counter is new.
+ * Return a failure status if the message is replayed.
+ */
+static int check_replay (uint64_t counter)
+{
+    if (counter == 0) return FAILURE;
+    if (counter > open_count) return SUCCESS;
+    if (open_count - counter >= REPLAY_WINDOW - 64) return FAILURE;
+    return !(replay_bits[(counter / 64) % (REPLAY_WINDOW / 64)]
+             & ((uint64_t) 1 << (counter % 64)));
+}
+
+/*
+ * Records the counter of an opened message, sliding the counters opened
+ * lately forward past it.
+ */
+static void record_counter (uint64_t counter)
+{
+    uint64_t word = 0; // Word of the counters being cleared
+
+    if (counter > open_count)
+    {
+        // Clear the words of the counters skipped over.
+        for (word = open_count / 64 + 1;
+                word <= counter / 64 && word <= open_count / 64
+                                                  + REPLAY_WINDOW / 64;
+                word++)
+        {
+            replay_bits[word % (REPLAY_WINDOW / 64)] = 0;
+        }
+        open_count = counter;
+    }
+    replay_bits[(counter / 64) % (REPLAY_WINDOW / 64)]
+        |= (uint64_t) 1 << (counter % 64);
+}
+
+/*
+ * Seals a copy of a message of the current session: everything after its
+ * header (type, acknowledgment, sequence number and data length, which
+ * stay in the clear to route the message) is encrypted, and the header
+ * is authenticated along with it. The authentication tag, and the counter
+ * that makes up the nonce, are appended to the copy. The message itself
+ * stays in the clear, so a retransmission is sealed afresh. With a
+ * pre-shared key, a handshake message is not encrypted, but the copy is
+ * tagged with an HMAC under the key, so only a peer holding the key can
+ * start or answer a session. A rejection is left untagged, so that a
+ * peer holding another key can read it.
+ *
+ * Return the sealed copy, or the message itself if it needs no sealing.
+ * Return NULL if the message has no room to be sealed.
+ */
+rftp_message *seal_message (rftp_message *msg, rftp_message *sealed)
+{
+    uint8_t iv[12] = { 0 }; // Nonce of the message
+    uint8_t scratch[16];    // Output of the final step
+    uint64_t counter = 0;   // Counter of the message
+    int length = 0;         // Bytes output by a step
+
+    if (!crypto_configured()) return msg;
+    if (is_handshake(msg->buffer[0]) && msg->buffer[1] == REJ) return msg;
+    if (is_handshake(msg->buffer[0]))
+    {
+        if (msg->length + TAG_LEN > RFTP_MSS
+                || !handshake_tag(msg->buffer, msg->length,
+                                  sealed->buffer + msg->length))
+        {
+            return NULL;
+        }
+        memcpy(sealed->buffer, msg->buffer, msg->length);
+        sealed->length = msg->length + TAG_LEN;
+        return sealed;
+    }
+    if (!crypto_active()) return msg;
+    if (msg->length < SEAL_AAD || msg->length + SEAL_OVERHEAD > RFTP_MSS)
+    {
+        return NULL;
+    }
+
+    counter = htobe64(++seal_count);
+    memcpy(iv + 4, &counter, sizeof(counter));
+    memcpy(sealed->buffer, msg->buffer, SEAL_AAD);
+    if (!EVP_EncryptInit_ex(seal_ctx, NULL, NULL, NULL, iv)
+            || !EVP_EncryptUpdate(seal_ctx, NULL, &length, msg->buffer,
+                                  SEAL_AAD)
+            || !EVP_EncryptUpdate(seal_ctx, sealed->buffer + SEAL_AAD,
+                                  &length, msg->buffer + SEAL_AAD,
+                                  msg->length - SEAL_AAD)
+            || !EVP_EncryptFinal_ex(seal_ctx, scratch, &length)
+            || !EVP_CIPHER_CTX_ctrl(seal_ctx, EVP_CTRL_AEAD_GET_TAG, TAG_LEN,
+                                    sealed->buffer + msg->length))
+    {
+        return NULL;
+    }
+    memcpy(sealed->buffer + msg->length + TAG_LEN, &counter, sizeof(counter));
+    sealed->length = msg->length + SEAL_OVERHEAD;
+    return sealed;
+}
+
+/*
+ * Opens a received message of the current session in place, checking its
+ * authentication tag, and that its counter was not opened before, so a
+ * recorded message cannot be replayed into the session. With a
+ * pre-shared key, a handshake message is only checked against its HMAC,
+ * and a rejection is not checked at all.
+ *
+ * Return a successful status if the message was opened, or is not sealed.
+ * Return a failure status if the message is forged, corrupted or replayed.
+ */
+int open_message (rftp_message *msg)
+{
+    uint8_t iv[12] = { 0 }; // Nonce of the message
+    uint8_t scratch[16];    // Output of the final step
+    uint8_t tag[TAG_LEN];   // Tag of a handshake message
+    uint64_t counter = 0;   // Counter of the message
+    int length = 0;         // Length of the opened message
+    int out = 0;            // Bytes output by a step
+
+    if (!crypto_configured()) return SUCCESS;
+    if (msg->length < SEAL_AAD) return FAILURE;
+    if (is_handshake(msg->buffer[0]) && msg->buffer[1] == REJ) return SUCCESS;
+    if (is_handshake(msg->buffer[0]))
+    {
+        length = msg->length - TAG_LEN;
+        if (length < SEAL_AAD || !handshake_tag(msg->buffer, length, tag)
+                || CRYPTO_memcmp(tag, msg->buffer + length, TAG_LEN))
+        {
+            return FAILURE;
+        }
+        msg->length = length;
+        return SUCCESS;
+    }
+    if (!crypto_active()) return SUCCESS;
+    if (msg->length < SEAL_AAD + SEAL_OVERHEAD) return FAILURE;
+
+    length = msg->length - SEAL_OVERHEAD;
+    memcpy(&counter, msg->buffer + length + TAG_LEN, sizeof(counter));
+    if (!check_replay(be64toh(counter))) return FAILURE;
+    memcpy(iv + 4, &counter, sizeof(counter));
+    if (!EVP_DecryptInit_ex(open_ctx, NULL, NULL, NULL, iv)
+            || !EVP_DecryptUpdate(open_ctx, NULL, &out, msg->buffer,
+                                  SEAL_AAD)
+            || !EVP_DecryptUpdate(open_ctx, msg->buffer + SEAL_AAD, &out,
+                                  msg->buffer + SEAL_AAD, length - SEAL_AAD)
+            || !EVP_CIPHER_CTX_ctrl(open_ctx, EVP_CTRL_AEAD_SET_TAG, TAG_LEN,
+                                    msg->buffer + length)
+            || EVP_DecryptFinal_ex(open_ctx, scratch, &out) <= 0)
+    {
+        return FAILURE;
+    }
+    record_counter(be64toh(counter));
+    msg->length = length;
+    return SUCCESS;
+}
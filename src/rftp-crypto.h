@@ -0,0 +1,77 @@
+/*
+ *  Name        : rftp-crypto.h
+ *  Author      : Edmund Luong <edmundvmluong@gmail.com>
+ *  Version     : 1.0
+ *  Copyright   : MIT 2014 © Edmund Luong
+ *  Date        : November 16, 2014
+ *  Description : Implementation of authenticated encryption for the Reliable
+ *                File Transfer Protocol, which seals the messages of a
+ *                transfer session with keys derived from a pre-shared key
+ *                and the nonces exchanged in its handshake.
+ *
+ *  CS 3357a Assignment 2
+ */
+
+#ifndef RFTP_CRYPTO_H
+#define RFTP_CRYPTO_H
+
+#include "rftp-messages.h"
+
+#include <stdint.h>
+
+/*
+ * Crypto-oriented macros
+ */
+#define PSK_MIN 16              // Shortest pre-shared key, in bytes
+#define PSK_MAX 1024            // Longest pre-shared key, in bytes
+#define KEY_LEN 32              // Length of a session key, in bytes
+#define NONCE_LEN 16            // Length of a handshake nonce, in bytes
+#define PROOF_LEN 16            // Length of a key proof, in bytes
+#define TAG_LEN 16              // Length of an authentication tag, in bytes
+#define SEAL_AAD 8              // Message header bytes left in the clear
+#define SEAL_OVERHEAD 24        // Bytes a sealed message grows by
+#define REPLAY_WINDOW 32768     // Counters checked for replays, in messages
+#define SUITE_AES_GCM 1         // AES-256-GCM
+#define SUITE_CHACHA20 2        // ChaCha20-Poly1305
+#define CLIENT_ROLE 0           // Seals as the client of a session
+#define SERVER_ROLE 1           // Seals as the server of a session
+
+/*
+ * Crypto hello
+ *
+ * One side's half of the key exchange of a transfer session, appended
+ * after the filename of a handshake message (an initialization, file
+ * request or range request message). The client proposes a cipher suite
+ * and a nonce; the server answers with its own nonce, and a proof that
+ * it holds the same pre-shared key. The session keys are derived from
+ * the pre-shared key and both nonces, so a recorded session cannot be
+ * replayed into a new one.
+ */
+typedef struct crypto_hello
+{
+    uint8_t suite;             // Cipher suite of the session
+    uint8_t nonce[NONCE_LEN];  // Random nonce of the sender
+    uint8_t proof[PROOF_LEN];  // Proof of the pre-shared key (server only)
+} crypto_hello;
+
+#define HELLO_LEN sizeof(crypto_hello) // Length of a crypto hello, in bytes
+
+/*
+ * Function prototypes
+ */
+int load_psk (char *path);
+int crypto_configured ();
+int crypto_active ();
+void create_hello (crypto_hello *hello);
+uint64_t create_session_token ();
+int add_hello (rftp_message *msg, crypto_hello *hello);
+int find_hello (rftp_message *msg, int index, crypto_hello *hello);
+int begin_cipher (crypto_hello *client, crypto_hello *server, int role);
+int add_session_hello (rftp_message *msg);
+void end_cipher ();
+int data_capacity ();
+int is_handshake_message (rftp_message *msg);
+rftp_message *seal_message (rftp_message *msg, rftp_message *sealed);
+int open_message (rftp_message *msg);
+
+#endif /* RFTP_CRYPTO_H */
@@ -0,0 +1,502 @@
+/*
+ *  Name        : rftp-fair.c
+ *  Author      : Edmund Luong <edmundvmluong@gmail.com>
+ *  Version     : 1.0
+ *  Copyright   : MIT 2014 © Edmund Luong
+ *  Date        : November 16, 2014
+ *  Description : Implementation of fair scheduling for the Reliable File
+ *                Transfer Protocol server, which shares its service among
+ *                the transfer sessions of many clients at once, by weight,
+ *                within the rate limits of each session and client.
+ *
+ *  CS 3357a Assignment 2
+ */
+
+#include "rftp-fair.h"
+#include "rftp-config.h"
+#include "rftp-timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+static long session_limit = 0;            // Rate limit of a session, in kbps
+static long client_limit = 0;             // Rate limit of a client, in kbps
+static fair_weight weights[MAX_WEIGHTS];  // Weights given to clients
+static int weight_count = 0;              // Number of weights given
+
+/*
+ * Sets the rate limits of every transfer session, and of all the sessions
+ * of each client together, in kilobits per second (0 = unlimited).
+ */
+void set_fair_limits (long session_rate, long client_rate)
+{
+    session_limit = (session_rate > 0) ? session_rate : 0;
+    client_limit = (client_rate > 0) ? client_rate : 0;
+}
+
+/*
+ * Gives the client of an address a weight, from a specification of the
+ * form ADDRESS=WEIGHT. Clients that are not given one have a weight of 1.
+ *
+ * Return a successful status if the weight was given.
+ * Return a failure status if the specification is invalid, or too many
+ * weights were given.
+ */
+int add_fair_weight (char *spec)
+{
+    char address[INET_ADDRSTRLEN]; // Address of the specification
+    char *equals = strchr(spec, '='); // Separator of the weight
+    struct in_addr addr;           // Parsed address
+    char *end = NULL;              // End of the parsed weight
+    long weight = 0;               // Parsed weight
+
+    if (weight_count == MAX_WEIGHTS)
+    {
+        printf("ERROR: At most %d clients may be given a weight.\n",
+               MAX_WEIGHTS);
+        return FAILURE;
+    }
+    if (equals && equals - spec < INET_ADDRSTRLEN)
+    {
+        memcpy(address, spec, equals - spec);
+        address[equals - spec] = '\0';
+        weight = strtol(equals + 1, &end, 10);
+    }
+    if (!equals || equals - spec >= INET_ADDRSTRLEN || *end
+            || inet_pton(AF_INET, address, &addr) != 1
+            || weight < 1 || weight > MAX_WEIGHT)
+    {
+        printf("ERROR: Invalid weight %s (ADDRESS=1..%d).\n", spec,
+               MAX_WEIGHT);
+        return FAILURE;
+    }
+
+    weights[weight_count].address = addr.s_addr;
+    weights[weight_count++].weight = (int) weight;
+    return SUCCESS;
+}
+
+/*
+ * Initializes a token bucket at a rate in kilobits per second, holding
+ * a full burst. A rate of 0 leaves the bucket unlimited.
+ */
+void bucket_init (token_bucket *bucket, long rate)
+{
+    bucket->rate = (rate > 0) ? (uint64_t) rate * 1000 / 8 : 0;
+    bucket->burst = (int64_t) bucket->rate * FAIR_BURST / 1000;
+    if (bucket->burst < RFTP_MSS) bucket->burst = RFTP_MSS;
+    bucket->tokens = bucket->burst;
+    bucket->filled_at = timer_now();
+}
+
+/*
+ * Adds the tokens that accrued since the bucket was last filled, and
+ * returns whether a message may be served now.
+ */
+int bucket_ready (token_bucket *bucket, uint64_t now)
+{
+    uint64_t added = 0; // Tokens accrued since the bucket was filled
+
+    if (!bucket->rate) return 1;
+
+    // Only whole tokens are added, so that the fraction of a token
+    // accrued so far is not lost.
+    if (now > bucket->filled_at
+            && (added = (now - bucket->filled_at) * bucket->rate / 1000000))
+    {
+        bucket->tokens += (int64_t) added;
+        bucket->filled_at += added * 1000000 / bucket->rate;
+        if (bucket->tokens >= bucket->burst)
+        {
+            bucket->tokens = bucket->burst;
+            bucket->filled_at = now;
+        }
+    }
+    return bucket->tokens > 0;
+}
+
+/*
+ * Takes the tokens of a served message from a bucket.
+ */
+void bucket_take (token_bucket *bucket, int length)
+{
+    if (bucket->rate) bucket->tokens -= length;
+}
+
+/*
+ * Returns the time at which a bucket will hold tokens again, in usec.
+ */
+uint64_t bucket_ready_at (token_bucket *bucket)
+{
+    if (!bucket->rate || bucket->tokens > 0) return bucket->filled_at;
+    return bucket->filled_at
+           + (uint64_t) (1 - bucket->tokens) * 1000000 / bucket->rate + 1;
+}
+
+/*
+ * Appends a session to the tail of a list.
+ */
+static void list_append (fair_flow **head, fair_flow **tail, fair_flow *flow)
+{
+    flow->next = NULL;
+    if (*tail) (*tail)->next = flow;
+    else *head = flow;
+    *tail = flow;
+}
+
+/*
+ * Removes a session from a list, if it is on it. The tail of the list,
+ * if it keeps one, is updated.
+ */
+static void list_remove (fair_flow **head, fair_flow **tail, fair_flow *flow)
+{
+    fair_flow *prev = NULL; // Session before the removed one
+
+    for (; *head && *head != flow; head = &(*head)->next) prev = *head;
+    if (!*head) return;
+
+    *head = flow->next;
+    if (tail && *tail == flow) *tail = prev;
+    flow->next = NULL;
+}
+
+/*
+ * Returns the bytes a session may be served per round: its client's
+ * weight, split among the client's sessions.
+ */
+static int64_t flow_quantum (fair_flow *flow)
+{
+    int64_t quantum = (int64_t) FAIR_QUANTUM * flow->tenant->weight
+                      / flow->tenant->flows; // Share of the session
+
+    return (quantum < FAIR_MIN_QUANTUM) ? FAIR_MIN_QUANTUM : quantum;
+}
+
+/*
+ * Creates an empty fair scheduler.
+ *
+ * Return the scheduler.
+ * Return NULL if the scheduler could not be allocated.
+ */
+fair_scheduler *create_fair_scheduler ()
+{
+    return (fair_scheduler*) calloc(1, sizeof(fair_scheduler));
+}
+
+/*
+ * Opens a flow for the transfer session of a client, sharing the weight
+ * and rate limit of the client with its other sessions.
+ *
+ * Return the flow of the session.
+ * Return NULL if the flow could not be allocated.
+ */
+fair_flow *fair_open_flow (fair_scheduler *scheduler, host_t *client,
+        void *owner)
+{
+    uint32_t address = client->addr.sin_addr.s_addr; // Address of the client
+    fair_tenant *tenant = NULL; // Client of the session
+    fair_flow *flow = NULL;     // Flow of the session
+    int i;
+
+    if (!(flow = (fair_flow*) calloc(1, sizeof(fair_flow))))
+    {
+        perror("Unable to create flow");
+        return NULL;
+    }
+
+    // Find the client, or add it with its weight.
+    for (tenant = scheduler->tenants; tenant && tenant->address != address;
+         tenant = tenant->next);
+    if (!tenant)
+    {
+        if (!(tenant = (fair_tenant*) calloc(1, sizeof(fair_tenant))))
+        {
+            perror("Unable to create flow");
+            free(flow);
+            return NULL;
+        }
+        tenant->address = address;
+        tenant->weight = DEFAULT_WEIGHT;
+        for (i = 0; i < weight_count; i++)
+        {
+            if (weights[i].address == address)
+            {
+                tenant->weight = weights[i].weight;
+            }
+        }
+        bucket_init(&tenant->bucket, client_limit);
+        tenant->next = scheduler->tenants;
+        scheduler->tenants = tenant;
+    }
+    tenant->flows++;
+
+    flow->tenant = tenant;
+    flow->owner = owner;
+    flow->list = FAIR_IDLE;
+    bucket_init(&flow->bucket, session_limit);
+    return flow;
+}
+
+/*
+ * Queues a message for a session. A session that had no messages queued
+ * joins the list of new sessions, with a fresh quantum.
+ *
+ * Return a successful status if the message was queued.
+ * Return a failure status if the queue of the session is full, in which
+ * case the message is left to the caller.
+ */
+int fair_enqueue (fair_scheduler *scheduler, fair_flow *flow,
+        rftp_message *msg, host_t *from)
+{
+    fair_packet *packet = NULL; // Queued message
+
+    if (flow->queued >= FAIR_QUEUE
+            || !(packet = (fair_packet*) malloc(sizeof(fair_packet))))
+    {
+        return FAILURE;
+    }
+    packet->msg = msg;
+    packet->from = *from;
+    packet->next = NULL;
+    if (flow->tail) flow->tail->next = packet;
+    else flow->head = packet;
+    flow->tail = packet;
+    flow->queued++;
+
+    if (flow->list == FAIR_IDLE)
+    {
+        flow->deficit = flow_quantum(flow);
+        flow->list = FAIR_NEW;
+        list_append(&scheduler->new_head, &scheduler->new_tail, flow);
+    }
+    return SUCCESS;
+}
+
+/*
+ * Moves the throttled sessions whose rate limits allow them again to the
+ * list of old sessions.
+ */
+static void wake_flows (fair_scheduler *scheduler, uint64_t now)
+{
+    fair_flow **link = &scheduler->throttled; // Link to the next session
+    fair_flow *flow = NULL;                   // Throttled session
+
+    while ((flow = *link))
+    {
+        if (flow->ready_at > now)
+        {
+            link = &flow->next;
+            continue;
+        }
+        *link = flow->next;
+        flow->list = FAIR_OLD;
+        list_append(&scheduler->old_head, &scheduler->old_tail, flow);
+    }
+}
+
+/*
+ * Takes the next message to serve, by deficit round robin over the new
+ * sessions, and then the old ones. A session whose queue runs dry leaves
+ * the lists, a new one only once it has gone around the old ones, so a
+ * session cannot stay new by sending sparsely. A session over its rate
+ * limit, or its client's, is throttled until the limit allows it.
+ *
+ * Return the flow of the message, storing the message and its source.
+ * Return NULL if no session may be served now.
+ */
+fair_flow *fair_next (fair_scheduler *scheduler, rftp_message **msg,
+        host_t *from)
+{
+    uint64_t now = timer_now(); // Current time
+    fair_flow *flow = NULL;     // Session being served
+    fair_packet *packet = NULL; // Message being served
+    int is_new = 0;             // Whether the session is a new one
+    uint64_t ready_at = 0;      // Time a rate limit allows the session
+
+    wake_flows(scheduler, now);
+    while ((flow = scheduler->new_head ? scheduler->new_head
+                                       : scheduler->old_head))
+    {
+        is_new = (flow == scheduler->new_head);
+        if (!flow->queued)
+        {
+            list_remove(is_new ? &scheduler->new_head : &scheduler->old_head,
+                        is_new ? &scheduler->new_tail : &scheduler->old_tail,
+                        flow);
+            flow->list = is_new ? FAIR_OLD : FAIR_IDLE;
+            if (is_new)
+            {
+                list_append(&scheduler->old_head, &scheduler->old_tail, flow);
+            }
+            continue;
+        }
+        if (flow->deficit <= 0)
+        {
+            list_remove(is_new ? &scheduler->new_head : &scheduler->old_head,
+                        is_new ? &scheduler->new_tail : &scheduler->old_tail,
+                        flow);
+            flow->deficit += flow_quantum(flow);
+            flow->list = FAIR_OLD;
+            list_append(&scheduler->old_head, &scheduler->old_tail, flow);
+            continue;
+        }
+        if (!bucket_ready(&flow->bucket, now)
+                || !bucket_ready(&flow->tenant->bucket, now))
+        {
+            list_remove(is_new ? &scheduler->new_head : &scheduler->old_head,
+                        is_new ? &scheduler->new_tail : &scheduler->old_tail,
+                        flow);
+            flow->ready_at = bucket_ready_at(&flow->bucket);
+            ready_at = bucket_ready_at(&flow->tenant->bucket);
+            if (ready_at > flow->ready_at) flow->ready_at = ready_at;
+            flow->list = FAIR_THROTTLED;
+            flow->next = scheduler->throttled;
+            scheduler->throttled = flow;
+            continue;
+        }
+
+        // Serve the oldest message of the session, which keeps its place.
+        packet = flow->head;
+        flow->head = packet->next;
+        if (!flow->head) flow->tail = NULL;
+        flow->queued--;
+        flow->deficit -= packet->msg->length;
+        bucket_take(&flow->bucket, packet->msg->length);
+        bucket_take(&flow->tenant->bucket, packet->msg->length);
+        *msg = packet->msg;
+        *from = packet->from;
+        free(packet);
+        return flow;
+    }
+
+    return NULL;
+}
+
+/*
+ * Returns whether any session may have a message to serve now.
+ */
+int fair_pending (fair_scheduler *scheduler)
+{
+    return scheduler->new_head || scheduler->old_head;
+}
+
+/*
+ * Returns the milliseconds until the scheduler next has a message to
+ * serve, as a timeout for poll().
+ *
+ * Return the timeout, in milliseconds.
+ * Return -1 if no session is waiting for its rate limit.
+ */
+int fair_next_timeout (fair_scheduler *scheduler)
+{
+    uint64_t now = timer_now(); // Current time
+    uint64_t soonest = 0;       // Time the first session is ready
+    fair_flow *flow = NULL;     // Throttled session
+
+    if (fair_pending(scheduler)) return 0;
+    if (!scheduler->throttled) return -1;
+
+    soonest = scheduler->throttled->ready_at;
+    for (flow = scheduler->throttled; flow; flow = flow->next)
+    {
+        if (flow->ready_at < soonest) soonest = flow->ready_at;
+    }
+    return (soonest > now) ? (int) ((soonest - now + 999) / 1000) : 0;
+}
+
+/*
+ * Charges a session for a message it sent, such as a data packet of a
+ * file it serves, against its share of the rounds and the rate limits of
+ * the session and its client, as if the message had been served to it.
+ * The acknowledgments of a session that sends are then served no faster
+ * than its limits allow, and so are the messages they let it send.
+ */
+void fair_charge (fair_flow *flow, int length)
+{
+    if (!flow) return;
+
+    flow->deficit -= length;
+    bucket_take(&flow->bucket, length);
+    bucket_take(&flow->tenant->bucket, length);
+}
+
+/*
+ * Returns the receive window to advertise to a session: no more messages
+ * than its rate limit, or its share of its client's, serves in half a
+ * retransmission timeout, so that the messages it is held back on are
+ * not resent meanwhile. Without a rate limit, the window is unchanged.
+ */
+int fair_window (fair_flow *flow, int slots)
+{
+    uint64_t rate = flow->bucket.rate;  // Rate limit of the session
+    uint64_t share = 0;                 // Share of the client's limit
+    int window = 0;                     // Advertised window
+
+    if (flow->tenant->bucket.rate)
+    {
+        share = flow->tenant->bucket.rate / flow->tenant->flows;
+        if (!rate || share < rate) rate = share;
+    }
+    if (!rate) return slots;
+
+    window = (int) (rate * DEFAULT_TIMEOUT / 2000 / RFTP_MSS);
+    return (window < slots) ? window : slots;
+}
+
+/*
+ * Closes the flow of a session, discarding its queued messages. A client
+ * is forgotten once its last session is closed.
+ */
+void fair_close_flow (fair_scheduler *scheduler, fair_flow *flow)
+{
+    fair_tenant **link = &scheduler->tenants; // Link to the client
+    fair_packet *packet = NULL;               // Discarded message
+
+    if (!flow) return;
+
+    if (flow->list == FAIR_NEW)
+    {
+        list_remove(&scheduler->new_head, &scheduler->new_tail, flow);
+    }
+    else if (flow->list == FAIR_OLD)
+    {
+        list_remove(&scheduler->old_head, &scheduler->old_tail, flow);
+    }
+    else if (flow->list == FAIR_THROTTLED)
+    {
+        list_remove(&scheduler->throttled, NULL, flow);
+    }
+    while ((packet = flow->head))
+    {
+        flow->head = packet->next;
+        free(packet->msg);
+        free(packet);
+    }
+
+    if (--flow->tenant->flows == 0)
+    {
+        for (; *link != flow->tenant; link = &(*link)->next);
+        *link = flow->tenant->next;
+        free(flow->tenant);
+    }
+    free(flow);
+}
+
+/*
+ * Frees a fair scheduler, once the flows of its sessions are closed.
+ */
+void free_fair_scheduler (fair_scheduler *scheduler)
+{
+    fair_tenant *tenant = NULL; // Client of the scheduler
+
+    if (!scheduler) return;
+
+    while ((tenant = scheduler->tenants))
+    {
+        scheduler->tenants = tenant->next;
+        free(tenant);
+    }
+    free(scheduler);
+}
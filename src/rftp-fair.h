@@ -0,0 +1,159 @@
+/*
+ *  Name        : rftp-fair.h
+ *  Author      : Edmund Luong <edmundvmluong@gmail.com>
+ *  Version     : 1.0
+ *  Copyright   : MIT 2014 © Edmund Luong
+ *  Date        : November 16, 2014
+ *  Description : Implementation of fair scheduling for the Reliable File
+ *                Transfer Protocol server, which shares its service among
+ *                the transfer sessions of many clients at once, by weight,
+ *                within the rate limits of each session and client.
+ *
+ *  CS 3357a Assignment 2
+ */
+
+#ifndef RFTP_FAIR_H
+#define RFTP_FAIR_H
+
+#include "rftp-messages.h"
+#include "udp-sockets.h"
+
+#include <stdint.h>
+
+/*
+ * Fairness-oriented macros
+ */
+#define FAIR_QUANTUM 8192       // Bytes served per round, per unit of weight
+#define FAIR_MIN_QUANTUM 512    // Fewest bytes a session is served per round
+#define FAIR_QUEUE 512          // Most messages queued per session
+#define FAIR_BATCH 64           // Most messages read or handled per turn
+#define FAIR_BURST 20           // Burst of a rate limit, in milliseconds
+#define DEFAULT_WEIGHT 1        // Default weight of a client
+#define MAX_WEIGHT 1000         // Largest weight of a client
+#define MAX_WEIGHTS 64          // Most clients given a weight
+#define FAIR_IDLE 0             // Session has no messages queued
+#define FAIR_NEW 1              // Session is on the list of new sessions
+#define FAIR_OLD 2              // Session is on the list of old sessions
+#define FAIR_THROTTLED 3        // Session waits for its rate limit
+
+/*
+ * Token bucket
+ *
+ * Limits a rate of bytes: tokens accrue at the rate, up to a burst, and
+ * each message served takes its length in tokens. A message may be
+ * served whenever the bucket holds tokens, even if it takes more than
+ * are left; the debt is paid back before the next one.
+ */
+typedef struct token_bucket
+{
+    uint64_t rate;              // Rate, in bytes per second (0 = unlimited)
+    int64_t burst;              // Most tokens held, in bytes
+    int64_t tokens;             // Tokens held, in bytes (negative = debt)
+    uint64_t filled_at;         // Time the tokens were last added, in usec
+} token_bucket;
+
+/*
+ * Fair weight
+ *
+ * The weight given to the client of an address.
+ */
+typedef struct fair_weight
+{
+    uint32_t address;           // Address of the client (network order)
+    int weight;                 // Share of the client, relative to others
+} fair_weight;
+
+/*
+ * Fair tenant
+ *
+ * A client of the server, by address: the sessions of a client share its
+ * weight and its rate limit, however many of them it opens.
+ */
+typedef struct fair_tenant
+{
+    uint32_t address;           // Address of the client (network order)
+    int weight;                 // Share of the client, relative to others
+    token_bucket bucket;        // Rate limit of the client
+    int flows;                  // Sessions of the client
+    struct fair_tenant *next;   // Next client of the scheduler
+} fair_tenant;
+
+/*
+ * Fair packet
+ *
+ * A message queued for a session, until the session is served.
+ */
+typedef struct fair_packet
+{
+    rftp_message *msg;          // Queued message
+    host_t from;                // Source of the message
+    struct fair_packet *next;   // Next message of the session
+} fair_packet;
+
+/*
+ * Fair flow
+ *
+ * The messages of one transfer session waiting to be served, and its
+ * share of the rounds of the scheduler (deficit round robin).
+ */
+typedef struct fair_flow
+{
+    fair_tenant *tenant;        // Client of the session
+    token_bucket bucket;        // Rate limit of the session
+    void *owner;                // Session the messages are handed to
+    fair_packet *head;          // Oldest queued message
+    fair_packet *tail;          // Newest queued message
+    int queued;                 // Number of queued messages
+    int64_t deficit;            // Bytes the session may still be served
+    int list;                   // List the session is on
+    uint64_t ready_at;          // Time a throttled session may be served
+    struct fair_flow *next;     // Next session on its list
+} fair_flow;
+
+/*
+ * Fair scheduler
+ *
+ * Serves the queued messages of the sessions by deficit round robin: each
+ * round, a session may be served a quantum of bytes, its client's weight
+ * split among the client's sessions, so that clients share the server by
+ * weight however many sessions each opens. Sessions that have just
+ * become active are served from a list of new sessions ahead of the
+ * others, for their first quantum, so that small transfers are not held
+ * up behind bulk ones. A session over its own rate limit, or its
+ * client's, waits on the list of throttled sessions until the limit
+ * allows it, and is not acknowledged meanwhile.
+ */
+typedef struct fair_scheduler
+{
+    fair_tenant *tenants;       // Clients with sessions
+    fair_flow *new_head;        // Sessions served ahead of the others
+    fair_flow *new_tail;        // Last of the new sessions
+    fair_flow *old_head;        // Sessions served in turn
+    fair_flow *old_tail;        // Last of the old sessions
+    fair_flow *throttled;       // Sessions waiting for their rate limits
+} fair_scheduler;
+
+/*
+ * Function prototypes
+ */
+void set_fair_limits (long session_rate, long client_rate);
+int add_fair_weight (char *spec);
+void bucket_init (token_bucket *bucket, long rate);
+int bucket_ready (token_bucket *bucket, uint64_t now);
+void bucket_take (token_bucket *bucket, int length);
+uint64_t bucket_ready_at (token_bucket *bucket);
+fair_scheduler *create_fair_scheduler ();
+fair_flow *fair_open_flow (fair_scheduler *scheduler, host_t *client,
+        void *owner);
+int fair_enqueue (fair_scheduler *scheduler, fair_flow *flow,
+        rftp_message *msg, host_t *from);
+fair_flow *fair_next (fair_scheduler *scheduler, rftp_message **msg,
+        host_t *from);
+int fair_pending (fair_scheduler *scheduler);
+int fair_next_timeout (fair_scheduler *scheduler);
+void fair_charge (fair_flow *flow, int length);
+int fair_window (fair_flow *flow, int slots);
+void fair_close_flow (fair_scheduler *scheduler, fair_flow *flow);
+void free_fair_scheduler (fair_scheduler *scheduler);
+
+#endif /* RFTP_FAIR_H */
@@ -17,6 +17,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <endian.h>
 #include <arpa/inet.h>
 
 /*
@@ -70,12 +71,13 @@ rftp_message *create_init_message (char *filename)
 }
 
 /*
- * Creates a termination control message to signal the end of a file transfer session.
+ * Creates a control message of any type for a file of a given size.
  *
- * Returns a file transfer termination message, if successful.
- * Returns NULL if an error occurred while creating the termination message.
+ * Returns a control message, if successful.
+ * Returns NULL if an error occurred while creating the control message.
  */
-rftp_message *create_term_message (int seq_num, char *filename, int filesize)
+rftp_message *create_control_message (int msg_type, int seq_num,
+        char *filename, int filesize)
 {
     int fname_len = 0; // The length of the filename
 
@@ -85,11 +87,12 @@ rftp_message *create_term_message (int seq_num, char *filename, int filesize)
     {
         // Get the length of the filename.
         fname_len = strlen(filename);
+        if (fname_len > FNAME_MSS) fname_len = FNAME_MSS;
 
-        // Construct the termination message and convert
+        // Construct the control message and convert
         // contents into network order, if necessary.
         msg->length = CTRL_HEADER + fname_len;        // RFTP message length
-        msg->type = (uint8_t) TERM_MSG;               // Termination message
+        msg->type = (uint8_t) msg_type;               // Control message type
         msg->ack = (uint8_t) NAK;                     // Unacknowledged message
         msg->seq_num = htons((uint16_t) seq_num);     // Sequence number
         msg->fsize = htonl((uint32_t) filesize);      // Size of the file
@@ -97,10 +100,137 @@ rftp_message *create_term_message (int seq_num, char *filename, int filesize)
         memcpy(msg->fname, filename, fname_len);      // Filename
     }
 
-    // Return termination message.
+    // Return control message.
+    return (rftp_message*) msg;
+}
+
+/*
+ * Creates a termination control message to signal the end of a file transfer session.
+ *
+ * Returns a file transfer termination message, if successful.
+ * Returns NULL if an error occurred while creating the termination message.
+ */
+rftp_message *create_term_message (int seq_num, char *filename, int filesize)
+{
+    return create_control_message(TERM_MSG, seq_num, filename, filesize);
+}
+
+/*
+ * Creates a request control message, asking a server to send a file.
+ *
+ * Returns a file request message, if successful.
+ * Returns NULL if an error occurred while creating the request message.
+ */
+rftp_message *create_get_message (char *filename)
+{
+    return create_control_message(GET_MSG, 0, filename, NO_FSIZE);
+}
+
+/*
+ * Creates a join control message, asking a server to accept another path
+ * into the transfer session of a file, which is named as in the
+ * initialization message of the session, and carries the token the
+ * server gave the session.
+ *
+ * Returns a path join message, if successful.
+ * Returns NULL if an error occurred while creating the join message.
+ */
+rftp_message *create_join_message (char *filename, int filesize,
+        uint64_t token)
+{
+    rftp_message *msg = NULL; // Path join message
+
+    if ((msg = create_control_message(JOIN_MSG, 0, filename, filesize))
+            && !add_session_token(msg, token))
+    {
+        free(msg);
+        msg = NULL;
+    }
+    return msg;
+}
+
+/*
+ * Returns the offset of a range request message, from its two halves.
+ */
+int64_t range_offset (range_message *msg)
+{
+    return (int64_t) (((uint64_t) ntohl(msg->offset_hi) << 32)
+                      | ntohl(msg->offset_lo));
+}
+
+/*
+ * Creates a range request message, asking a server to send a byte range
+ * of a file.
+ *
+ * Returns a range request message, if successful.
+ * Returns NULL if an error occurred while creating the request message.
+ */
+rftp_message *create_range_message (char *filename, int64_t offset,
+        uint32_t length)
+{
+    int fname_len = 0; // The length of the filename
+
+    // Create a new RFTP range message.
+    range_message *msg = (range_message*) create_message();
+    if (msg)
+    {
+        // Get the length of the filename.
+        fname_len = strlen(filename);
+        if (fname_len > RANGE_FNAME_MSS) fname_len = RANGE_FNAME_MSS;
+
+        // Construct the range message and convert
+        // contents into network order.
+        msg->length = RANGE_HEADER + fname_len;         // RFTP message length
+        msg->type = (uint8_t) RANGE_MSG;                // Range message type
+        msg->ack = (uint8_t) NAK;                       // Unacknowledged message
+        msg->seq_num = htons(0);                        // Sequence number
+        msg->offset_hi = htonl((uint32_t) ((uint64_t) offset >> 32));
+        msg->offset_lo = htonl((uint32_t) offset);      // Offset of the range
+        msg->range_len = htonl(length);                 // Length of the range
+        msg->fname_len = htonl((uint32_t) fname_len);   // Length of the filename
+        memcpy(msg->fname, filename, fname_len);        // Filename
+    }
+
+    // Return range message.
     return (rftp_message*) msg;
 }
 
+/*
+ * Appends a session token to a control message. A server gives each
+ * transfer session a random token, last in the acknowledgment of its
+ * initialization message, and only lets a path join the session with a
+ * join message that carries the token last.
+ *
+ * Returns 1 if the token was appended.
+ * Returns 0 if the message has no room for it.
+ */
+int add_session_token (rftp_message *msg, uint64_t token)
+{
+    if (msg->length + TOKEN_LEN > RFTP_MSS) return 0;
+
+    memcpy(msg->buffer + msg->length, &token, TOKEN_LEN);
+    msg->length += TOKEN_LEN;
+    return 1;
+}
+
+/*
+ * Returns the session token a control message carries last, after its
+ * filename, or 0 if it carries none.
+ */
+uint64_t find_session_token (rftp_message *msg)
+{
+    control_message *ctrl = (control_message*) msg; // Control message
+    uint64_t token = 0;                             // Session token
+
+    if (msg->length >= CTRL_HEADER + TOKEN_LEN
+            && ntohl(ctrl->fname_len) <= (uint32_t) (msg->length - CTRL_HEADER
+                                                     - TOKEN_LEN))
+    {
+        memcpy(&token, msg->buffer + msg->length - TOKEN_LEN, TOKEN_LEN);
+    }
+    return token;
+}
+
 /*
  * Creates a data message to store and transmit data between hosts.
  *
@@ -128,6 +258,200 @@ rftp_message *create_data_message (int seq_num, int bytes_read,
     return (rftp_message*) msg;
 }
 
+/*
+ * Creates a hole message, which tells a receiver that the next bytes of
+ * a sparse file are a hole. A hole message is laid out as a data message
+ * whose data holds the length of the hole, so that it is sent and
+ * acknowledged in sequence with the data messages around it.
+ *
+ * Returns a hole message holding the length of the hole, if successful.
+ * Returns NULL if an error occurred while creating the hole message.
+ */
+rftp_message *create_hole_message (int seq_num, int64_t hole_len)
+{
+    uint64_t length = htobe64((uint64_t) hole_len); // Length of the hole
+
+    // Create a new RFTP hole message.
+    data_message *msg = (data_message*) create_message();
+    if (msg)
+    {
+        // Construct the hole message and convert
+        // contents into network order.
+        msg->length = DATA_HEADER + sizeof(length);   // RFTP message length
+        msg->type = (uint8_t) HOLE_MSG;               // Hole message type
+        msg->ack = (uint8_t) NAK;                     // Unacknowledged message
+        msg->seq_num = htons((uint16_t) seq_num);     // Sequence number
+        msg->data_len = htonl(sizeof(length));        // Number of data bytes
+        memcpy(msg->data, &length, sizeof(length));   // Length of the hole
+    }
+
+    // Return hole message.
+    return (rftp_message*) msg;
+}
+
+/*
+ * Creates a zero range message, which tells a receiver that the next
+ * bytes of a file are all zeros. It is laid out as a hole message, but
+ * the receiver keeps the range allocated, as it was in the sent file.
+ *
+ * Returns a zero range message holding the length of the range, if successful.
+ * Returns NULL if an error occurred while creating the zero range message.
+ */
+rftp_message *create_zero_message (int seq_num, int64_t zero_len)
+{
+    // Create a hole message, and mark it as a zero range.
+    data_message *msg = (data_message*) create_hole_message(seq_num,
+                                                            zero_len);
+    if (msg) msg->type = (uint8_t) ZERO_MSG;
+
+    // Return zero range message.
+    return (rftp_message*) msg;
+}
+
+/*
+ * Creates a cumulative acknowledgment of the sequenced messages received
+ * in order up to a sequence number. Its data holds the window of the
+ * receiver: how many messages past that one it can hold.
+ *
+ * Returns a window acknowledgment, if successful.
+ * Returns NULL if an error occurred while creating the acknowledgment.
+ */
+rftp_message *create_window_ack (int msg_type, int seq_num, int window)
+{
+    uint32_t advertised = htonl((uint32_t) window); // Window of the receiver
+
+    // Create a new RFTP data message.
+    data_message *msg = (data_message*) create_message();
+    if (msg)
+    {
+        // Construct the acknowledgment and convert
+        // contents into network order.
+        msg->length = DATA_HEADER + sizeof(advertised); // RFTP message length
+        msg->type = (uint8_t) msg_type;                 // Acknowledged type
+        msg->ack = (uint8_t) ACK;                       // Acknowledgment
+        msg->seq_num = htons((uint16_t) seq_num);       // Last in-order message
+        msg->data_len = htonl(sizeof(advertised));      // Number of data bytes
+        memcpy(msg->data, &advertised, sizeof(advertised)); // Receive window
+    }
+
+    // Return window acknowledgment.
+    return (rftp_message*) msg;
+}
+
+/*
+ * Creates an offer message, offering a number of chunks to a receiver.
+ *
+ * Returns an offer message holding the chunk offers, if successful.
+ * Returns NULL if an error occurred while creating the offer message.
+ */
+rftp_message *create_offer_message (int seq_num, chunk_offer *offers,
+        int count)
+{
+    int bytes = count * sizeof(chunk_offer); // Size of the chunk offers
+
+    // Create a data message holding the offers, and mark it as an offer.
+    data_message *msg = (data_message*) create_data_message(seq_num, bytes,
+                                                            (uint8_t*) offers);
+    if (msg) msg->type = (uint8_t) OFFER_MSG;
+
+    // Return offer message.
+    return (rftp_message*) msg;
+}
+
+/*
+ * Creates a stream data message, holding data of one stream of a
+ * multiplexed transfer session.
+ *
+ * Returns a stream data message storing binary data bytes, if successful.
+ * Returns NULL if an error occurred while creating the stream data message.
+ */
+rftp_message *create_stream_message (int seq_num, int stream_id,
+        int bytes_read, uint8_t buffer[DATA_MSS])
+{
+    // Create a new RFTP stream data message.
+    stream_message *msg = (stream_message*) create_message();
+    if (msg)
+    {
+        // Construct the stream data message and convert
+        // contents into network order.
+        msg->length = STREAM_HEADER + bytes_read;       // RFTP message length
+        msg->type = (uint8_t) STREAM_MSG;               // Stream data type
+        msg->ack = (uint8_t) NAK;                       // Unacknowledged message
+        msg->seq_num = htons((uint16_t) seq_num);       // Sequence number
+        msg->stream_id = htons((uint16_t) stream_id);   // Stream of the data
+        msg->data_len = htons((uint16_t) bytes_read);   // Number of data bytes
+        memcpy(msg->data, buffer, bytes_read);          // Binary data bytes
+    }
+
+    // Return stream data message.
+    return (rftp_message*) msg;
+}
+
+/*
+ * Creates a stream open message, opening a stream of a multiplexed
+ * transfer session for a file of a given size.
+ *
+ * Returns a stream open message, if successful.
+ * Returns NULL if an error occurred while creating the stream open message.
+ */
+rftp_message *create_open_message (int seq_num, int stream_id,
+        char *filename, int filesize)
+{
+    int fname_len = 0; // The length of the filename
+
+    // Create a new RFTP stream open message.
+    stream_open_message *msg = (stream_open_message*) create_message();
+    if (msg)
+    {
+        // Get the length of the filename.
+        fname_len = strlen(filename);
+        if (fname_len > FNAME_MSS) fname_len = FNAME_MSS;
+
+        // Construct the stream open message and convert
+        // contents into network order.
+        msg->length = CTRL_HEADER + fname_len;        // RFTP message length
+        msg->type = (uint8_t) OPEN_MSG;               // Stream open type
+        msg->ack = (uint8_t) NAK;                     // Unacknowledged message
+        msg->seq_num = htons((uint16_t) seq_num);     // Sequence number
+        msg->fsize = htonl((uint32_t) filesize);      // Size of the file
+        msg->stream_id = htons((uint16_t) stream_id); // Stream being opened
+        msg->fname_len = htons((uint16_t) fname_len); // Length of the filename
+        memcpy(msg->fname, filename, fname_len);      // Filename
+    }
+
+    // Return stream open message.
+    return (rftp_message*) msg;
+}
+
+/*
+ * Creates a gap report, which acknowledges the sequenced messages received
+ * in order up to a sequence number, as a window acknowledgment does, and
+ * lists the ranges of messages missing past it (see gap_range).
+ *
+ * Returns a gap report, if successful.
+ * Returns NULL if an error occurred while creating the gap report.
+ */
+rftp_message *create_gap_message (int seq_num, int window,
+        gap_range *ranges, int count)
+{
+    int bytes = count * sizeof(gap_range); // Size of the ranges
+
+    // Create a window acknowledgment, append the ranges, and mark it as a
+    // negative acknowledgment of the missing messages.
+    data_message *msg = (data_message*) create_window_ack(GAP_MSG, seq_num,
+                                                          window);
+    if (msg)
+    {
+        memcpy(msg->data + sizeof(uint32_t), ranges, bytes);
+        msg->length += bytes;
+        msg->ack = (uint8_t) NAK;
+        msg->data_len = htonl(sizeof(uint32_t) + bytes);
+    }
+
+    // Return gap report.
+    return (rftp_message*) msg;
+}
+
 /*
  * Outputs verbose details about a given RFTP message.
  */
@@ -139,29 +463,102 @@ void verbose_msg_output (int trans_type, int msg_type, rftp_message* msg)
     char *ack = NULL;             // Acknowledgment of message
     control_message *ctrl = NULL; // Control message
     data_message *data = NULL;    // Data message
+    range_message *range = NULL;  // Range message
+    stream_message *stream = NULL; // Stream data message
+    stream_open_message *open = NULL; // Stream open message
+    uint64_t hole_len = 0;        // Length of a hole or zero range
+    uint32_t window = 0;          // Window of a window acknowledgment
 
     // Determine the transmission type.
     char *trans_t = (trans_type == SEND) ? "Sent" : "Received";
 
     // Control messages.
-    if (msg_type == INIT_MSG || msg_type == TERM_MSG)
+    if (msg_type == INIT_MSG || msg_type == TERM_MSG || msg_type == GET_MSG
+            || msg_type == JOIN_MSG)
     {
         // Construct strings and display verbose output.
-        msg_t = (msg_type == INIT_MSG) ? "INIT MSG" : "TERM MSG";
+        msg_t = (msg_type == INIT_MSG) ? "INIT MSG"
+                : (msg_type == TERM_MSG) ? "TERM MSG"
+                : (msg_type == GET_MSG) ? "GET MSG" : "JOIN MSG";
         ctrl = (control_message*) msg;
-        ack = (ctrl->ack == NAK) ? "NAK" : "ACK";
+        ack = (ctrl->ack == NAK) ? "NAK" : (ctrl->ack == ACK) ? "ACK" : "REJ";
         printf("%s %s[%d] ..... %s\n", trans_t, msg_t, ntohs(ctrl->seq_num),
                ack);
     }
-    // Data messages.
-    if (msg_type == DATA_MSG)
+    // Range messages.
+    if (msg_type == RANGE_MSG)
+    {
+        // Construct strings and display verbose output.
+        range = (range_message*) msg;
+        ack = (range->ack == NAK) ? "NAK" : (range->ack == ACK) ? "ACK" : "REJ";
+        printf("%s RANGE MSG[%d] (%lld+%u B) ..... %s\n", trans_t,
+               ntohs(range->seq_num), (long long) range_offset(range),
+               ntohl(range->range_len), ack);
+    }
+    // Window acknowledgments of data, hole, zero range and stream messages.
+    data = (data_message*) msg;
+    if ((msg_type == DATA_MSG || msg_type == HOLE_MSG || msg_type == ZERO_MSG
+         || msg_type == STREAM_MSG || msg_type == OPEN_MSG)
+            && data->ack == ACK)
     {
         // Construct strings and display verbose output.
-        msg_t = "DATA_MSG";
+        msg_t = (msg_type == DATA_MSG) ? "DATA_MSG"
+                : (msg_type == HOLE_MSG) ? "HOLE MSG"
+                : (msg_type == ZERO_MSG) ? "ZERO MSG"
+                : (msg_type == STREAM_MSG) ? "STREAM MSG" : "OPEN MSG";
+        memcpy(&window, data->data, sizeof(window));
+        printf("%s %s[%d] (window %u) ..... ACK\n", trans_t, msg_t,
+               ntohs(data->seq_num), ntohl(window));
+        return;
+    }
+    // Hole and zero range messages.
+    if (msg_type == HOLE_MSG || msg_type == ZERO_MSG)
+    {
+        // Construct strings and display verbose output.
+        msg_t = (msg_type == HOLE_MSG) ? "HOLE MSG" : "ZERO MSG";
+        data = (data_message*) msg;
+        ack = (data->ack == NAK) ? "NAK" : "ACK";
+        memcpy(&hole_len, data->data, sizeof(hole_len));
+        printf("%s %s[%d] (%lld B) ..... %s\n", trans_t, msg_t,
+               ntohs(data->seq_num), (long long) be64toh(hole_len), ack);
+    }
+    // Data and offer messages.
+    if (msg_type == DATA_MSG || msg_type == OFFER_MSG)
+    {
+        // Construct strings and display verbose output.
+        msg_t = (msg_type == DATA_MSG) ? "DATA_MSG" : "OFFER_MSG";
         data = (data_message*) msg;
         ack = (data->ack == NAK) ? "NAK" : "ACK";
         data_size = ntohl(data->data_len);
         printf("%s %s[%d] (%d B) ..... %s\n", trans_t, msg_t,
                ntohs(data->seq_num), data_size, ack);
     }
+    // Gap reports.
+    if (msg_type == GAP_MSG)
+    {
+        // Construct strings and display verbose output.
+        memcpy(&window, data->data, sizeof(window));
+        printf("%s GAP MSG[%d] (window %u, %d ranges) ..... NAK\n", trans_t,
+               ntohs(data->seq_num), ntohl(window),
+               (int) ((ntohl(data->data_len) - sizeof(window))
+                      / sizeof(gap_range)));
+    }
+    // Stream data messages.
+    if (msg_type == STREAM_MSG)
+    {
+        // Construct strings and display verbose output.
+        stream = (stream_message*) msg;
+        printf("%s STREAM MSG[%d] (stream %d, %d B) ..... NAK\n", trans_t,
+               ntohs(stream->seq_num), ntohs(stream->stream_id),
+               ntohs(stream->data_len));
+    }
+    // Stream open messages.
+    if (msg_type == OPEN_MSG)
+    {
+        // Construct strings and display verbose output.
+        open = (stream_open_message*) msg;
+        printf("%s OPEN MSG[%d] (stream %d, %u B) ..... NAK\n", trans_t,
+               ntohs(open->seq_num), ntohs(open->stream_id),
+               ntohl(open->fsize));
+    }
 }
@@ -28,12 +28,31 @@
 #define INIT_MSG 1      // File transfer initiation message
 #define TERM_MSG 2      // File transfer termination message
 #define DATA_MSG 3      // File transfer data message
+#define GET_MSG 4       // File request message
+#define RANGE_MSG 5     // File byte-range request message
+#define OFFER_MSG 6     // Chunk offer message, for deduplicated transfers
+#define HOLE_MSG 7      // File hole message, for sparse files
+#define ZERO_MSG 8      // Zero range message, for runs of zeros in files
+#define JOIN_MSG 9      // Path join message, for multipath transfers
+#define STREAM_MSG 10   // Stream data message, for multiplexed transfers
+#define OPEN_MSG 11     // Stream open message, for multiplexed transfers
+#define GAP_MSG 12      // Gap report message, for fast retransmissions
 #define NAK 0           // Unacknowledged message
 #define ACK 1           // Acknowledged message
+#define REJ 2           // Rejected message
 #define SEND 0          // Sent message
 #define RECV 1          // Received message
 #define DATA_HEADER 8   // Data message header size
 #define CTRL_HEADER 12  // Control message header size
+#define RANGE_HEADER 20 // Range message header size
+#define STREAM_HEADER 8 // Stream data message header size
+#define RANGE_FNAME_MSS 1452 // Range message filename maximum segment size
+#define SEQ_SPACE 65536 // Number of distinct sequence numbers
+#define CHUNK_HASH 32   // Size of a chunk hash (SHA-256), in bytes
+#define OFFER_CHUNKS 36 // Chunks offered per offer message
+#define MAX_STREAMS 1024 // Most files multiplexed in one session
+#define GAP_RANGES 16   // Missing ranges listed per gap report
+#define TOKEN_LEN 8     // Size of a session token, in bytes
 
 /*
  * RFTP Message
@@ -57,6 +76,8 @@ typedef struct rftp_control_message
     int length;               // RFTP message length
     uint8_t type;             // Type 1 RFTP message is for initialization
                               // Type 2 RFTP message is for termination
+                              // Type 4 RFTP message is for file requests
+                              // Type 9 RFTP message is for path joins
     uint8_t ack;              // Acknowledgment status
     uint16_t seq_num;         // Sequence number of the message
     uint32_t fsize;           // Size of the file, in bytes
@@ -73,20 +94,137 @@ typedef struct rftp_data_message
 {
     int length;             // RFTP message length
     uint8_t type;           // Type 3 RFTP message is for data packets
+                            // Type 6 RFTP message is for chunk offers
+                            // Type 7 RFTP message is for file holes
+                            // Type 8 RFTP message is for zero ranges
     uint8_t ack;            // Acknowledgment status
     uint16_t seq_num;       // Sequence number of the message
     uint32_t data_len;      // Number of data bytes in the message
     uint8_t data[DATA_MSS]; // Buffer of binary data bytes, 1464 bytes maximum
 } data_message;
 
+/*
+ * RFTP Range message
+ *
+ * Used to request a byte range of a file. A negative offset counts back
+ * from the end of the file, and a length of 0 extends to the end of it.
+ * The offset is sent as two 32-bit halves, upper half first, so that the
+ * message is aligned like the others and no larger than a RFTP message.
+ * A rejection carries its cause in place of the upper half of the offset,
+ * where a control message carries it in its filesize.
+ */
+typedef struct rftp_range_message
+{
+    int length;                     // RFTP message length
+    uint8_t type;                   // Type 5 RFTP message is for range requests
+    uint8_t ack;                    // Acknowledgment status
+    uint16_t seq_num;               // Sequence number of the message
+    uint32_t offset_hi;             // Upper half of the offset, in bytes
+    uint32_t offset_lo;             // Lower half of the offset
+    uint32_t range_len;             // Length of the range, in bytes
+    uint32_t fname_len;             // Length of the filename
+    uint8_t fname[RANGE_FNAME_MSS]; // Filename, maximum of 1452 characters
+} range_message;
+
+/*
+ * RFTP Stream data message
+ *
+ * Used to transmit the data of one file of a multiplexed transfer session,
+ * whose files are sent at once, each as a stream of its own. Its sequence
+ * number orders it among the messages of every stream of the session.
+ */
+typedef struct rftp_stream_message
+{
+    int length;             // RFTP message length
+    uint8_t type;           // Type 10 RFTP message is for stream data
+    uint8_t ack;            // Acknowledgment status
+    uint16_t seq_num;       // Sequence number of the message
+    uint16_t stream_id;     // Stream the data belongs to
+    uint16_t data_len;      // Number of data bytes in the message
+    uint8_t data[DATA_MSS]; // Buffer of binary data bytes, 1464 bytes maximum
+} stream_message;
+
+/*
+ * RFTP Stream open message
+ *
+ * Used to open a stream of a multiplexed transfer session, naming its file,
+ * before any of its data is sent. It is sequenced along with the data
+ * messages, so a receiver always opens a stream before its data arrives.
+ * Streams are numbered from 0, in the order they are opened.
+ */
+typedef struct rftp_stream_open_message
+{
+    int length;               // RFTP message length
+    uint8_t type;             // Type 11 RFTP message is for stream opens
+    uint8_t ack;              // Acknowledgment status
+    uint16_t seq_num;         // Sequence number of the message
+    uint32_t fsize;           // Size of the file, in bytes
+    uint16_t stream_id;       // Stream being opened
+    uint16_t fname_len;       // Length of the filename
+    uint8_t fname[FNAME_MSS]; // Filename, maximum of 1460 characters
+} stream_open_message;
+
+/*
+ * Chunk offer
+ *
+ * An entry of an offer message, which is a data message whose data holds
+ * up to 36 chunk offers. The receiver acknowledges the offer message with
+ * the chunks it already holds marked as present; the sender then sends
+ * only the other chunks, in order, as data messages.
+ */
+typedef struct chunk_offer
+{
+    uint8_t hash[CHUNK_HASH]; // SHA-256 hash of the chunk
+    uint32_t length;          // Length of the chunk, in bytes
+    uint8_t present;          // Whether the receiver holds the chunk
+    uint8_t reserved[3];      // Reserved, zero
+} chunk_offer;
+
+/*
+ * Gap range
+ *
+ * An entry of a gap report, which is a negative acknowledgment (NAK) laid
+ * out as a window acknowledgment: its sequence number is the last message
+ * received in order, and its data holds the window of the receiver,
+ * followed by up to 16 ranges of messages missing before the ones it
+ * holds. The sender resends the missing messages at once, rather than
+ * waiting for them to time out.
+ */
+typedef struct gap_range
+{
+    uint16_t start;           // First missing sequence number
+    uint16_t count;           // Number of missing messages
+} gap_range;
+
 /*
  * Function prototypes
  */
 rftp_message *create_message ();
 rftp_message *create_init_message (char *filename);
+rftp_message *create_control_message (int msg_type, int seq_num,
+        char *filename, int filesize);
 rftp_message *create_term_message (int seq_num, char *fname, int fsize);
+rftp_message *create_get_message (char *filename);
+rftp_message *create_join_message (char *filename, int filesize,
+        uint64_t token);
+int64_t range_offset (range_message *msg);
+rftp_message *create_range_message (char *filename, int64_t offset,
+        uint32_t length);
+int add_session_token (rftp_message *msg, uint64_t token);
+uint64_t find_session_token (rftp_message *msg);
 rftp_message *create_data_message (int seq_num, int bytes_read,
         uint8_t buffer[DATA_MSS]);
+rftp_message *create_hole_message (int seq_num, int64_t hole_len);
+rftp_message *create_zero_message (int seq_num, int64_t zero_len);
+rftp_message *create_window_ack (int msg_type, int seq_num, int window);
+rftp_message *create_offer_message (int seq_num, chunk_offer *offers,
+        int count);
+rftp_message *create_stream_message (int seq_num, int stream_id,
+        int bytes_read, uint8_t buffer[DATA_MSS]);
+rftp_message *create_open_message (int seq_num, int stream_id,
+        char *filename, int filesize);
+rftp_message *create_gap_message (int seq_num, int window,
+        gap_range *ranges, int count);
 void verbose_msg_output (int trans_type, int msg_type, rftp_message* msg);
 
 #endif /* RFTP_MESSAGES_H */
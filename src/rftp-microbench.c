@@ -0,0 +1,632 @@
+/*
+ *  Name        : rftp-microbench.c
+ *  Author      : Edmund Luong <edmundvmluong@gmail.com>
+ *  Version     : 1.0
+ *  Copyright   : MIT 2014 © Edmund Luong
+ *  Date        : November 16, 2014
+ *  Description : Microbenchmarks for the per-packet hot path of the
+ *                Reliable File Transfer Protocol. Each benchmark prints
+ *                one JSON object with the nanoseconds, heap allocations
+ *                and CPU cycles spent per operation, and cycles per byte.
+ *
+ *  Linked with -Wl,--wrap=malloc so that allocations can be counted.
+ *
+ *  CS 3357a Assignment 2
+ */
+
+#include "rftp-protocol.h"
+#include "rftp-messages.h"
+#include "rftp-config.h"
+#include "rftp-trace.h"
+#include "rftp-timer.h"
+#include "rftp-chunk.h"
+#include "rftp-zero.h"
+#include "rftp-crypto.h"
+#include "udp-server.h"
+#include "udp-client.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define DEFAULT_ITERATIONS 1000000 // Default iterations of a benchmark
+#define SOCKET_BATCH 64            // Datagrams queued per receive batch
+#define BENCH_PORT "5700"          // Port for the loopback benchmarks
+#define BENCH_TIMERS 100000        // Outstanding timers in the wheel
+#define BENCH_CHUNK_MB 8           // Size of the chunked buffer, in MB
+
+/*
+ * Benchmark result
+ */
+typedef struct bench_result
+{
+    long iterations;   // Number of operations measured
+    uint64_t nsec;     // Elapsed time, in nanoseconds
+    uint64_t cycles;   // Elapsed CPU cycles (0 if unavailable)
+    uint64_t allocs;   // Heap allocations made
+    int bytes;         // Bytes processed per operation
+} bench_result;
+
+/*
+ * Benchmark clock, holding the measurements at the start of a run.
+ */
+typedef struct bench_clock
+{
+    uint64_t nsec;     // Start time, in nanoseconds
+    uint64_t cycles;   // Start CPU cycles
+    uint64_t allocs;   // Heap allocations made before the run
+} bench_clock;
+
+void *__real_malloc (size_t size);
+
+static uint64_t allocations = 0; // Heap allocations made so far
+static volatile int sink = 0;    // Keeps results from being optimized away
+
+/*
+ * Counts every heap allocation, then allocates as usual.
+ */
+void *__wrap_malloc (size_t size)
+{
+    allocations++;
+    return __real_malloc(size);
+}
+
+/*
+ * Returns the time on the monotonic clock, in nanoseconds.
+ */
+static uint64_t now_nsec ()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Returns the CPU timestamp counter, or 0 where there is none.
+ */
+static uint64_t now_cycles ()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/*
+ * Starts measuring a run of a benchmark.
+ */
+static void start_bench (bench_clock *clock)
+{
+    clock->allocs = allocations;
+    clock->cycles = now_cycles();
+    clock->nsec = now_nsec();
+}
+
+/*
+ * Adds the measurements of a run of a benchmark to its result.
+ */
+static void stop_bench (bench_clock *clock, bench_result *result)
+{
+    result->nsec += now_nsec() - clock->nsec;
+    result->cycles += now_cycles() - clock->cycles;
+    result->allocs += allocations - clock->allocs;
+}
+
+/*
+ * Outputs a benchmark result as a JSON object.
+ */
+static void output_result (char *name, bench_result *result)
+{
+    double ops = (double) result->iterations;
+
+    printf("{\"bench\": \"%s\", \"iterations\": %ld, \"ns_per_op\": %.2f, "
+           "\"allocs_per_op\": %.2f, \"cycles_per_op\": %.1f, "
+           "\"cycles_per_byte\": %.3f}\n", name, result->iterations,
+           result->nsec / ops, result->allocs / ops, result->cycles / ops,
+           (result->bytes > 0) ? result->cycles / ops / result->bytes : 0);
+    fflush(stdout);
+}
+
+/*
+ * Measures the construction of full data messages.
+ */
+static void bench_create_data_message (long iterations)
+{
+    bench_result result = { .iterations = iterations, .bytes = DATA_MSS };
+    uint8_t buffer[DATA_MSS];
+    rftp_message *msg = NULL;
+    bench_clock timer;
+    long i;
+
+    memset(buffer, 0xA5, sizeof(buffer));
+    start_bench(&timer);
+    for (i = 0; i < iterations; i++)
+    {
+        msg = create_data_message(i, DATA_MSS, buffer);
+        sink += msg->length;
+        free(msg);
+    }
+    stop_bench(&timer, &result);
+
+    output_result("create_data_message", &result);
+}
+
+/*
+ * Measures the encoding of termination control messages.
+ */
+static void bench_encode_control_message (long iterations)
+{
+    bench_result result = { .iterations = iterations };
+    char *filename = "benchmarks/archive.zip";
+    rftp_message *msg = NULL;
+    bench_clock timer;
+    long i;
+
+    result.bytes = CTRL_HEADER + strlen(filename);
+    start_bench(&timer);
+    for (i = 0; i < iterations; i++)
+    {
+        msg = create_term_message(i, filename, 123456789);
+        sink += msg->length;
+        free(msg);
+    }
+    stop_bench(&timer, &result);
+
+    output_result("encode_control_message", &result);
+}
+
+/*
+ * Measures the decoding of a control message into its file information,
+ * as the server does on receiving an initialization message.
+ */
+static void bench_decode_control_message (long iterations)
+{
+    bench_result result = { .iterations = iterations };
+    control_message *ctrl = NULL;
+    char *filename = NULL;
+    bench_clock timer;
+    uint32_t fname_len = 0;
+    long i;
+
+    ctrl = (control_message*) create_term_message(1, "benchmarks/archive.zip",
+                                                  123456789);
+    result.bytes = ctrl->length;
+    start_bench(&timer);
+    for (i = 0; i < iterations; i++)
+    {
+        fname_len = ntohl(ctrl->fname_len);
+        filename = malloc(fname_len + 1);
+        memcpy(filename, ctrl->fname, fname_len);
+        filename[fname_len] = '\0';
+        sink += ctrl->type + ntohs(ctrl->seq_num) + ntohl(ctrl->fsize)
+                + filename[0];
+        free(filename);
+    }
+    stop_bench(&timer, &result);
+    free(ctrl);
+
+    output_result("decode_control_message", &result);
+}
+
+/*
+ * Measures the decoding of a data message, as the server does before
+ * writing its data to file.
+ */
+static void bench_decode_data_message (long iterations)
+{
+    bench_result result = { .iterations = iterations, .bytes = DATA_MSS };
+    uint8_t buffer[DATA_MSS];
+    uint8_t target[DATA_MSS];
+    data_message *data = NULL;
+    bench_clock timer;
+    long i;
+
+    memset(buffer, 0x5A, sizeof(buffer));
+    data = (data_message*) create_data_message(1, DATA_MSS, buffer);
+    start_bench(&timer);
+    for (i = 0; i < iterations; i++)
+    {
+        if (data->type == DATA_MSG && ntohs(data->seq_num) == 1)
+        {
+            memcpy(target, data->data, ntohl(data->data_len));
+        }
+        sink += target[i % DATA_MSS];
+    }
+    stop_bench(&timer, &result);
+    free(data);
+
+    output_result("decode_data_message", &result);
+}
+
+/*
+ * Measures the comparison of a data message with its acknowledgment.
+ */
+static void bench_check_acknowledgment (long iterations)
+{
+    bench_result result = { .iterations = iterations, .bytes = DATA_HEADER };
+    uint8_t buffer[DATA_MSS];
+    rftp_message *orig = NULL, *response = NULL;
+    bench_clock timer;
+    long i;
+
+    memset(buffer, 0, sizeof(buffer));
+    orig = create_data_message(7, DATA_MSS, buffer);
+    response = create_data_message(7, DATA_MSS, buffer);
+    ((data_message*) response)->ack = ACK;
+    start_bench(&timer);
+    for (i = 0; i < iterations; i++)
+    {
+        sink += check_acknowledgment(orig, response, DATA_MSG);
+    }
+    stop_bench(&timer, &result);
+    free(orig);
+    free(response);
+
+    output_result("check_acknowledgment", &result);
+}
+
+/*
+ * Measures the verbose output of a data message, written to /dev/null.
+ */
+static void bench_verbose_msg_output (long iterations)
+{
+    bench_result result = { .iterations = iterations, .bytes = DATA_MSS };
+    uint8_t buffer[DATA_MSS];
+    rftp_message *msg = NULL;
+    bench_clock timer;
+    int saved_stdout = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    long i;
+
+    // Send standard output to /dev/null while measuring.
+    memset(buffer, 0, sizeof(buffer));
+    msg = create_data_message(7, DATA_MSS, buffer);
+    fflush(stdout);
+    dup2(null_fd, STDOUT_FILENO);
+    start_bench(&timer);
+    for (i = 0; i < iterations; i++)
+    {
+        verbose_msg_output(SEND, DATA_MSG, msg);
+    }
+    fflush(stdout);
+    stop_bench(&timer, &result);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    close(null_fd);
+    free(msg);
+
+    output_result("verbose_msg_output", &result);
+}
+
+/*
+ * Measures the tracing of a data message into the trace ring, the
+ * low-overhead alternative to its verbose output.
+ */
+static void bench_trace_record (long iterations)
+{
+    bench_result result = { .iterations = iterations, .bytes = DATA_MSS };
+    uint8_t buffer[DATA_MSS];
+    rftp_message *msg = NULL;
+    bench_clock timer;
+    long i;
+
+    memset(buffer, 0, sizeof(buffer));
+    msg = create_data_message(7, DATA_MSS, buffer);
+    trace_enable("/dev/null");
+    start_bench(&timer);
+    for (i = 0; i < iterations; i++)
+    {
+        trace_record(TRACE_SEND, DATA_MSG, msg);
+    }
+    stop_bench(&timer, &result);
+    trace_shutdown();
+    free(msg);
+
+    output_result("trace_record", &result);
+}
+
+/*
+ * Measures the timer wheel with 100k outstanding deadlines, spread over
+ * the next ten seconds: rescheduling a timer (as each acknowledgment
+ * does), and advancing the wheel through every deadline in batches.
+ */
+static void bench_timer_wheel (long iterations)
+{
+    bench_result sched_result = { .iterations = iterations };
+    bench_result expire_result = { .iterations = BENCH_TIMERS };
+    timer_wheel *wheel = create_timer_wheel(TIMER_TICK);
+    timer *timers = calloc(BENCH_TIMERS, sizeof(timer));
+    uint64_t now = wheel->start;
+    uint64_t seed = 88172645463325252ULL;
+    bench_clock timer;
+    long i;
+
+    // Fill the wheel with deadlines.
+    for (i = 0; i < BENCH_TIMERS; i++)
+    {
+        seed ^= seed << 13, seed ^= seed >> 7, seed ^= seed << 17;
+        timer_init(&timers[i], NULL, NULL);
+        timer_schedule(wheel, &timers[i], now + seed % 10000000);
+    }
+
+    // Reschedule random timers to new deadlines.
+    start_bench(&timer);
+    for (i = 0; i < iterations; i++)
+    {
+        seed ^= seed << 13, seed ^= seed >> 7, seed ^= seed << 17;
+        timer_schedule(wheel, &timers[seed % BENCH_TIMERS],
+                       now + (seed >> 20) % 10000000);
+    }
+    stop_bench(&timer, &sched_result);
+
+    // Expire every timer, a millisecond at a time.
+    start_bench(&timer);
+    while (wheel->count > 0)
+    {
+        now += 1000;
+        sink += timer_advance(wheel, now);
+    }
+    stop_bench(&timer, &expire_result);
+    free(timers);
+    free(wheel);
+
+    output_result("timer_schedule", &sched_result);
+    output_result("timer_expire", &expire_result);
+}
+
+/*
+ * Measures content-defined chunking of a buffer of random bytes: finding
+ * the chunk boundaries, and hashing the chunks.
+ */
+static void bench_chunking (long iterations)
+{
+    size_t size = (size_t) BENCH_CHUNK_MB << 20;
+    bench_result cut_result = { .iterations = iterations, .bytes = size };
+    bench_result hash_result = { .iterations = iterations, .bytes = size };
+    uint8_t *data = malloc(size);
+    uint8_t hash[CHUNK_HASH];
+    uint64_t seed = 88172645463325252ULL;
+    size_t pos, length;
+    bench_clock timer;
+    long i;
+
+    for (pos = 0; pos < size; pos++)
+    {
+        seed ^= seed << 13, seed ^= seed >> 7, seed ^= seed << 17;
+        data[pos] = (uint8_t) seed;
+    }
+
+    // Find the chunk boundaries of the buffer.
+    start_bench(&timer);
+    for (i = 0; i < iterations; i++)
+    {
+        for (pos = 0; pos < size; pos += length)
+        {
+            length = find_chunk_boundary(data + pos, size - pos);
+            sink += length;
+        }
+    }
+    stop_bench(&timer, &cut_result);
+
+    // Hash the buffer in chunks of the normal size.
+    start_bench(&timer);
+    for (i = 0; i < iterations; i++)
+    {
+        for (pos = 0; pos < size; pos += CHUNK_AVG)
+        {
+            hash_chunk(data + pos, CHUNK_AVG, hash);
+            sink += hash[0];
+        }
+    }
+    stop_bench(&timer, &hash_result);
+    free(data);
+
+    output_result("find_chunk_boundary", &cut_result);
+    output_result("hash_chunk", &hash_result);
+}
+
+/*
+ * Measures checking full data packets for zeros: a packet of zeros, which
+ * is checked to its end, and a packet of data, which is rejected early.
+ */
+static void bench_is_zero_block (long iterations)
+{
+    bench_result zero_result = { .iterations = iterations, .bytes = DATA_MSS };
+    bench_result data_result = { .iterations = iterations, .bytes = DATA_MSS };
+    uint8_t zeros[DATA_MSS];
+    uint8_t data[DATA_MSS];
+    bench_clock timer;
+    long i;
+
+    memset(zeros, 0, sizeof(zeros));
+    memset(data, 0xA5, sizeof(data));
+
+    start_bench(&timer);
+    for (i = 0; i < iterations; i++)
+    {
+        sink += is_zero_block(zeros, DATA_MSS);
+    }
+    stop_bench(&timer, &zero_result);
+
+    start_bench(&timer);
+    for (i = 0; i < iterations; i++)
+    {
+        sink += is_zero_block(data, DATA_MSS);
+    }
+    stop_bench(&timer, &data_result);
+
+    output_result("is_zero_block_zeros", &zero_result);
+    output_result("is_zero_block_data", &data_result);
+}
+
+/*
+ * Measures sealing and opening full data messages of an encrypted session,
+ * in the cipher suite the CPU would propose. Each opened message is first
+ * copied from the sealed one, since messages are opened in place.
+ */
+static void bench_seal_message (long iterations)
+{
+    bench_result seal_result = { .iterations = iterations,
+                                 .bytes = DATA_MSS - SEAL_OVERHEAD };
+    bench_result open_result = { .iterations = iterations,
+                                 .bytes = DATA_MSS - SEAL_OVERHEAD };
+    char path[] = "/tmp/rftp-bench-keyXXXXXX";
+    uint8_t key[PSK_MIN];
+    uint8_t buffer[DATA_MSS];
+    crypto_hello client, server;
+    rftp_message *msg = NULL, sealed, opened;
+    bench_clock timer;
+    int fd;
+    long i;
+
+    // Key an encrypted session, from a key file of fixed bytes.
+    memset(key, 0x5A, sizeof(key));
+    if ((fd = mkstemp(path)) == -1) return;
+    if (write(fd, key, sizeof(key)) != sizeof(key) || !load_psk(path))
+    {
+        close(fd);
+        unlink(path);
+        return;
+    }
+    close(fd);
+    unlink(path);
+    create_hello(&client);
+    create_hello(&server);
+    memset(buffer, 0xC3, sizeof(buffer));
+    msg = create_data_message(1, DATA_MSS - SEAL_OVERHEAD, buffer);
+
+    // Seal messages as the server.
+    begin_cipher(&client, &server, SERVER_ROLE);
+    start_bench(&timer);
+    for (i = 0; i < iterations; i++)
+    {
+        sink += seal_message(msg, &sealed)->length;
+    }
+    stop_bench(&timer, &seal_result);
+
+    // Open a message of the client as the server.
+    begin_cipher(&client, &server, CLIENT_ROLE);
+    seal_message(msg, &sealed);
+    begin_cipher(&client, &server, SERVER_ROLE);
+    start_bench(&timer);
+    for (i = 0; i < iterations; i++)
+    {
+        memcpy(&opened, &sealed, sizeof(sealed));
+        sink += open_message(&opened);
+    }
+    stop_bench(&timer, &open_result);
+    end_cipher();
+    free(msg);
+
+    output_result("seal_message", &seal_result);
+    output_result("open_message", &open_result);
+}
+
+/*
+ * Measures sending and receiving full data messages over loopback.
+ * Datagrams are sent and received in batches, so that each side
+ * is measured separately without overflowing the socket buffer.
+ */
+static void bench_loopback (long iterations)
+{
+    bench_result send_result = { .iterations = 0, .bytes = RFTP_MSS };
+    bench_result recv_result = { .iterations = 0, .bytes = RFTP_MSS };
+    uint8_t buffer[DATA_MSS];
+    rftp_message *msg = NULL, *received = NULL;
+    host_t server, source;
+    bench_clock timer;
+    int server_fd, client_fd;
+    long i, j;
+
+    // Open a connected pair of loopback sockets.
+    server_fd = create_server_socket(BENCH_PORT);
+    client_fd = create_client_socket("127.0.0.1", BENCH_PORT, &server);
+    memset(buffer, 0xC3, sizeof(buffer));
+    msg = create_data_message(1, DATA_MSS, buffer);
+
+    for (i = 0; i < iterations; i += SOCKET_BATCH)
+    {
+        // Send a batch of datagrams.
+        start_bench(&timer);
+        for (j = 0; j < SOCKET_BATCH; j++)
+        {
+            send_rftp_message(client_fd, &server, msg, DATA_MSG, SILENT);
+        }
+        stop_bench(&timer, &send_result);
+        send_result.iterations += SOCKET_BATCH;
+
+        // Receive the batch of datagrams.
+        start_bench(&timer);
+        for (j = 0; j < SOCKET_BATCH; j++)
+        {
+            if ((received = receive_rftp_message(server_fd, &source, SILENT)))
+            {
+                sink += received->length;
+                free(received);
+                recv_result.iterations++;
+            }
+        }
+        stop_bench(&timer, &recv_result);
+    }
+
+    close(client_fd);
+    close(server_fd);
+    free(msg);
+
+    output_result("send_rftp_message", &send_result);
+    output_result("receive_rftp_message", &recv_result);
+}
+
+// Main program.
+int main (int argc, char **argv)
+{
+    long iterations = DEFAULT_ITERATIONS; // Iterations of each benchmark
+
+    // Handle command line options.
+    int arg, option_index = 0;
+    static struct option long_options[] =
+    {
+            {"iterations", required_argument, 0, 'n'},
+            {0, 0, 0, 0}
+    };
+    while ((arg = getopt_long(argc, argv, "n:", long_options,
+                              &option_index)) != EOF)
+    {
+        switch (arg)
+        {
+            case 'n':   // Sets the number of iterations of each benchmark
+                iterations = atol(optarg);
+                break;
+            case '?':   // Failure
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (iterations < SOCKET_BATCH) iterations = SOCKET_BATCH;
+
+    // Run the benchmarks.
+    bench_create_data_message(iterations);
+    bench_encode_control_message(iterations);
+    bench_decode_control_message(iterations);
+    bench_decode_data_message(iterations);
+    bench_check_acknowledgment(iterations);
+    bench_verbose_msg_output(iterations);
+    bench_trace_record(iterations);
+    bench_timer_wheel(iterations);
+    bench_chunking(iterations / 100000 + 1);
+    bench_is_zero_block(iterations);
+    bench_seal_message(iterations / 10);
+    bench_loopback(iterations / 10);
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,127 @@
+/*
+ *  Name        : rftp-pacer.c
+ *  Author      : Edmund Luong <edmundvmluong@gmail.com>
+ *  Version     : 1.0
+ *  Copyright   : MIT 2014 © Edmund Luong
+ *  Date        : November 16, 2014
+ *  Description : Implementation of transmit pacing for the Reliable File
+ *                Transfer Protocol, which spreads sent messages evenly at a
+ *                target rate instead of sending them in bursts.
+ *
+ *  CS 3357a Assignment 2
+ */
+
+#include "rftp-pacer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <linux/net_tstamp.h>
+
+#ifndef SO_TXTIME
+#define SO_TXTIME 61
+#endif
+
+/*
+ * Returns the time on the monotonic clock, in nanoseconds.
+ */
+static uint64_t pacer_now ()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Sleeps until a time on the monotonic clock, in nanoseconds.
+ */
+static void sleep_until (uint64_t time)
+{
+    struct timespec ts = {
+        .tv_sec = time / 1000000000,
+        .tv_nsec = time % 1000000000
+    };
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL));
+}
+
+/*
+ * Creates a pacer for a socket, at a target rate in kilobits per second.
+ * SO_TXTIME is enabled on the socket when the kernel supports it, so that
+ * an fq qdisc can release each message at its scheduled time.
+ *
+ * Return a pacer for the socket.
+ * Return NULL if the rate does not call for pacing, or on failure.
+ */
+pacer *create_pacer (int sockfd, long rate, int verbose)
+{
+    struct sock_txtime txtime = { .clockid = CLOCK_MONOTONIC, .flags = 0 };
+    pacer *pacer = NULL; // Pacer for the socket
+
+    if (rate <= 0 || !(pacer = (struct pacer*) calloc(1, sizeof(*pacer))))
+    {
+        return NULL;
+    }
+    pacer->rate = (uint64_t) rate * 1000 / 8;
+    pacer->txtime = (setsockopt(sockfd, SOL_SOCKET, SO_TXTIME, &txtime,
+                                sizeof(txtime)) == 0);
+
+    if (verbose)
+    {
+        printf("Pacing sent messages at %ld kbps (%s).\n", rate,
+               pacer->txtime ? "SO_TXTIME" : "userspace timer");
+    }
+    return pacer;
+}
+
+/*
+ * Paces another socket with a pacer, such as another path of the same
+ * session, so that the messages of all its sockets share its rate.
+ * Should the socket not support SO_TXTIME, the pacer falls back to its
+ * userspace timer for every socket.
+ */
+void pace_socket (pacer *pacer, int sockfd)
+{
+    struct sock_txtime txtime = { .clockid = CLOCK_MONOTONIC, .flags = 0 };
+
+    if (pacer && pacer->txtime && setsockopt(sockfd, SOL_SOCKET, SO_TXTIME,
+                                             &txtime, sizeof(txtime)) != 0)
+    {
+        pacer->txtime = 0;
+    }
+}
+
+/*
+ * Waits until a message of the given length may be sent, and schedules
+ * the next message one transmission time later. A pacer that fell behind
+ * does not build up credit, so it never sends a burst to catch up.
+ *
+ * Return the time at which the socket should send the message (SO_TXTIME).
+ * Return 0 if the message should be sent now.
+ */
+uint64_t pace_message (pacer *pacer, int length)
+{
+    uint64_t now = pacer_now(); // Current time
+    uint64_t send_at = 0;       // Scheduled time of the message
+
+    if (!pacer) return 0;
+
+    // Schedule the message.
+    if (pacer->next < now) pacer->next = now;
+    send_at = pacer->next;
+    pacer->next += (uint64_t) length * 1000000000 / pacer->rate;
+
+    // Let the qdisc release the message, staying within its horizon.
+    if (pacer->txtime)
+    {
+        if (send_at > now + PACE_HORIZON) sleep_until(send_at - PACE_HORIZON);
+        return send_at;
+    }
+
+    // Otherwise, sleep until shortly before the message is due, then spin.
+    if (send_at > now + PACE_SPIN) sleep_until(send_at - PACE_SPIN);
+    while (pacer_now() < send_at);
+    return 0;
+}
@@ -0,0 +1,48 @@
+/*
+ *  Name        : rftp-pacer.h
+ *  Author      : Edmund Luong <edmundvmluong@gmail.com>
+ *  Version     : 1.0
+ *  Copyright   : MIT 2014 © Edmund Luong
+ *  Date        : November 16, 2014
+ *  Description : Implementation of transmit pacing for the Reliable File
+ *                Transfer Protocol, which spreads sent messages evenly at a
+ *                target rate instead of sending them in bursts.
+ *
+ *  CS 3357a Assignment 2
+ */
+
+#ifndef RFTP_PACER_H
+#define RFTP_PACER_H
+
+#include <stdint.h>
+
+/*
+ * Pacing-oriented macros
+ */
+#define PACE_SPIN 50000        // Busy-wait the last 50 usec before a send
+#define PACE_HORIZON 2000000   // Hand messages to the qdisc up to 2 msec early
+
+/*
+ * Pacer
+ *
+ * Schedules each message one transmission time after the previous one.
+ * With SO_TXTIME, the kernel's fq qdisc releases each message at its
+ * scheduled time, and the sender only sleeps to stay within the horizon.
+ * Otherwise, the sender sleeps until the scheduled time itself, spinning
+ * for the last few microseconds to make up for timer slack.
+ */
+typedef struct pacer
+{
+    uint64_t rate;     // Target rate, in bytes per second
+    uint64_t next;     // Earliest time of the next message, in nsec
+    int txtime;        // Whether the socket schedules sends (SO_TXTIME)
+} pacer;
+
+/*
+ * Function prototypes
+ */
+pacer *create_pacer (int sockfd, long rate, int verbose);
+void pace_socket (pacer *pacer, int sockfd);
+uint64_t pace_message (pacer *pacer, int length);
+
+#endif /* RFTP_PACER_H */
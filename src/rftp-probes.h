@@ -0,0 +1,49 @@
+/*
+ *  Name        : rftp-probes.h
+ *  Author      : Edmund Luong <edmundvmluong@gmail.com>
+ *  Version     : 1.0
+ *  Copyright   : MIT 2014 © Edmund Luong
+ *  Date        : November 16, 2014
+ *  Description : Static tracepoints (USDT) on the hot paths of the Reliable
+ *                File Transfer Protocol, for tracing with bpftrace, perf or
+ *                SystemTap without rebuilding. See probes/ for examples.
+ *
+ *  Each probe compiles to a single nop when no tracer is attached. Where
+ *  <sys/sdt.h> is not available (or with -DRFTP_NO_PROBES), the probes
+ *  compile to nothing at all.
+ *
+ *  Probes of the rftp provider:
+ *
+ *    send_message (type, seq_num, length)       A message was sent
+ *    receive_message (type, seq_num, length)    A message was received
+ *    receive_timeout (timeout)                  No message within timeout
+ *    retransmit (type, seq_num)                 A message is sent again
+ *    write_start (length)                       File write begins
+ *    write_done (length, status)                File write ends
+ *    session_start (filename, filesize, peer)   rftpd accepted a transfer
+ *    session_end (filename, status, bytes)      rftpd finished a transfer
+ *
+ *  CS 3357a Assignment 2
+ */
+
+#ifndef RFTP_PROBES_H
+#define RFTP_PROBES_H
+
+#if !defined(RFTP_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define RFTP_HAVE_PROBES 1
+#endif
+#endif
+
+#ifdef RFTP_HAVE_PROBES
+#define RFTP_PROBE1(name, a) DTRACE_PROBE1(rftp, name, a)
+#define RFTP_PROBE2(name, a, b) DTRACE_PROBE2(rftp, name, a, b)
+#define RFTP_PROBE3(name, a, b, c) DTRACE_PROBE3(rftp, name, a, b, c)
+#else
+#define RFTP_PROBE1(name, a) do { } while (0)
+#define RFTP_PROBE2(name, a, b) do { } while (0)
+#define RFTP_PROBE3(name, a, b, c) do { } while (0)
+#endif
+
+#endif /* RFTP_PROBES_H */
@@ -14,11 +14,98 @@
 #include "rftp-protocol.h"
 #include "rftp-messages.h"
 #include "rftp-config.h"
+#include "rftp-trace.h"
+#include "rftp-probes.h"
+#include "rftp-busypoll.h"
+#include "rftp-timer.h"
+#include "rftp-crypto.h"
 #include "data.h"
 
+#include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include <poll.h>
 #include <arpa/inet.h>
+#include <sys/socket.h>
+
+#ifndef SCM_TXTIME
+#define SCM_TXTIME 61
+#endif
+
+static timer_wheel *protocol_wheel = NULL; // Timers of the protocol
+static int retransmit_limit = 0;           // Resends before giving up
+
+/*
+ * Returns the timer wheel that holds the deadlines of the protocol,
+ * creating it on first use.
+ */
+timer_wheel *protocol_timers ()
+{
+    if (!protocol_wheel) protocol_wheel = create_timer_wheel(TIMER_TICK);
+    return protocol_wheel;
+}
+
+/*
+ * Limits the number of times a message is resent before its peer is
+ * considered gone, so a server does not wait forever on a client that
+ * stopped responding. A limit of 0 resends forever.
+ */
+void set_retransmit_limit (int limit)
+{
+    retransmit_limit = (limit > 0) ? limit : 0;
+}
+
+/*
+ * Returns whether a message resent a number of times has reached the
+ * retransmission limit, and its peer is considered gone.
+ */
+int retransmit_limit_reached (int resent)
+{
+    return retransmit_limit && resent >= retransmit_limit;
+}
+
+/*
+ * Returns whether two hosts have the same address and port.
+ */
+int same_host (host_t *a, host_t *b)
+{
+    return a->addr.sin_addr.s_addr == b->addr.sin_addr.s_addr
+           && a->addr.sin_port == b->addr.sin_port;
+}
+
+/*
+ * Opens a received RFTP message (see open_message). With a pre-shared
+ * key, a handshake message whose tag does not check out comes from a
+ * peer holding another key, or none: it is taken as a rejection, and a
+ * request to start or join a session is also rejected to the peer as not
+ * permitted, rather than left for it to resend.
+ *
+ * Return a successful status if the message opened, or was taken as a
+ * rejection.
+ * Return a failure status if the message is to be discarded.
+ */
+static int open_received_message (int sockfd, host_t *source,
+        rftp_message *msg, int verbose)
+{
+    control_message *ctrl = (control_message*) msg; // Handshake message
+
+    if (open_message(msg)) return SUCCESS;
+    if (!is_handshake_message(msg) || msg->length < CTRL_HEADER
+            || msg->length > RFTP_MSS)
+    {
+        return FAILURE;
+    }
+
+    if (ctrl->ack == NAK)
+    {
+        inet_ntop(source->addr.sin_family, &source->addr.sin_addr,
+                  source->friendly_ip, sizeof(source->friendly_ip));
+        reject_message(sockfd, source, msg, ctrl->type, EACCES, verbose);
+    }
+    ctrl->ack = REJ;
+    ctrl->fsize = htonl(EACCES);
+    return SUCCESS;
+}
 
 /*
  * Receives a RFTP message from the socket file descriptor.
@@ -38,10 +125,22 @@ rftp_message *receive_rftp_message (int sockfd, host_t *source, int verbose)
     source->addr_len = sizeof(source->addr);
 
     // Read the message, storing its contents in the message
-    // and save the source address.
-    msg->length = recvfrom(sockfd, msg->buffer, sizeof(msg->buffer), 0,
-                           (struct sockaddr*) &source->addr,
-                           &source->addr_len);
+    // and save the source address. Sealed messages that do not open
+    // are discarded.
+    do
+    {
+        // In the low-latency mode, spin until the message arrives.
+        if (busy_poll_enabled())
+        {
+            struct pollfd fd = { .fd = sockfd, .events = POLLIN };
+            busy_poll_wait(&fd, -1);
+        }
+
+        msg->length = recvfrom(sockfd, msg->buffer, sizeof(msg->buffer), 0,
+                               (struct sockaddr*) &source->addr,
+                               &source->addr_len);
+    } while (msg->length > 0
+             && !open_received_message(sockfd, source, msg, verbose));
 
     // If a message was successfully received.
     if (msg->length > 0)
@@ -55,7 +154,10 @@ rftp_message *receive_rftp_message (int sockfd, host_t *source, int verbose)
         // and determine what type of RFTP message was received.
         ctrl = (control_message*) msg;
 
-        // Display verbose message output.
+        // Trace the message, and display verbose message output.
+        trace_record(TRACE_RECV, ctrl->type, msg);
+        RFTP_PROBE3(receive_message, ctrl->type, ntohs(ctrl->seq_num),
+                    msg->length);
         if (verbose) verbose_msg_output(RECV, ctrl->type, msg);
         ctrl = NULL;
 
@@ -70,15 +172,87 @@ rftp_message *receive_rftp_message (int sockfd, host_t *source, int verbose)
     }
 }
 
+/*
+ * Receives a RFTP message from a peer, discarding any messages that
+ * other hosts send meanwhile.
+ *
+ * Return a RFTP message if a message was successfully received from the peer.
+ * Return NULL if a message was not received.
+ */
+rftp_message *receive_rftp_message_from (int sockfd, host_t *peer,
+        int verbose)
+{
+    rftp_message *msg = NULL; // RFTP message
+    host_t source;            // Source of the message
+
+    while ((msg = receive_rftp_message(sockfd, &source, verbose))
+            && !same_host(&source, peer))
+    {
+        free(msg);
+    }
+
+    return msg;
+}
+
+/*
+ * Receives a RFTP message already waiting on the socket file descriptor,
+ * without waiting for one. Sealed messages that do not open are discarded.
+ *
+ * Return a RFTP message if a message was waiting.
+ * Return NULL if no message was waiting.
+ */
+rftp_message *receive_waiting_rftp_message (int sockfd, host_t *source,
+        int verbose)
+{
+    rftp_message *msg;     // RFTP message
+    control_message *ctrl; // RFTP control message
+
+    msg = create_message();
+    source->addr_len = sizeof(source->addr);
+    do
+    {
+        msg->length = recvfrom(sockfd, msg->buffer, sizeof(msg->buffer),
+                               MSG_DONTWAIT, (struct sockaddr*) &source->addr,
+                               &source->addr_len);
+    } while (msg->length > 0
+             && !open_received_message(sockfd, source, msg, verbose));
+
+    // If a message was waiting, trace it, and display verbose output.
+    if (msg->length > 0)
+    {
+        inet_ntop(source->addr.sin_family, &source->addr.sin_addr,
+                  source->friendly_ip, sizeof(source->friendly_ip));
+        ctrl = (control_message*) msg;
+        trace_record(TRACE_RECV, ctrl->type, msg);
+        RFTP_PROBE3(receive_message, ctrl->type, ntohs(ctrl->seq_num),
+                    msg->length);
+        if (verbose) verbose_msg_output(RECV, ctrl->type, msg);
+        return msg;
+    }
+
+    free(msg);
+    return NULL;
+}
+
+/*
+ * Traces a timeout of a wait for a RFTP message.
+ */
+static void report_timeout (int timeout)
+{
+    trace_record(TRACE_TIMEOUT, 0, NULL);
+    RFTP_PROBE1(receive_timeout, timeout);
+}
+
 /*
  * Receives a RFTP message from the specified socket file descriptor,
- * with a specified timeout duration.
+ * with a specified timeout duration, storing whether the wait timed out
+ * without reporting it.
  *
  * Return a RFTP message if a message was successfully received from sender.
  * Return NULL if a message was not received before request times out.
  */
-rftp_message *receive_rftp_message_with_timeout (int sockfd, host_t *source,
-        int timeout, int verbose)
+static rftp_message *poll_rftp_message (int sockfd, host_t *source,
+        int timeout, int *timed_out, int verbose)
 {
     rftp_message *msg;     // RFTP message
     control_message *ctrl; // RFTP control message
@@ -87,8 +261,10 @@ rftp_message *receive_rftp_message_with_timeout (int sockfd, host_t *source,
     msg = create_message();
     struct pollfd fd = { .fd = sockfd, .events = POLLIN };
 
-    // Poll the socket for specified time.
-    int retval = poll(&fd, 1, timeout);
+    // Poll the socket for specified time, spinning first in the
+    // low-latency mode.
+    int retval = busy_poll_enabled() ? busy_poll_wait(&fd, timeout)
+                                     : poll(&fd, 1, timeout);
 
     // If socket receives data to read.
     if (retval == 1 && fd.revents == POLLIN)
@@ -102,8 +278,9 @@ rftp_message *receive_rftp_message_with_timeout (int sockfd, host_t *source,
                                (struct sockaddr*) &source->addr,
                                &source->addr_len);
 
-        // If the message was successfully received.
-        if (msg->length > 0)
+        // If the message was successfully received, and opens.
+        if (msg->length > 0
+                && open_received_message(sockfd, source, msg, verbose))
         {
             // Convert the source address to a human-readable IP address
             // and store it.
@@ -114,7 +291,10 @@ rftp_message *receive_rftp_message_with_timeout (int sockfd, host_t *source,
             // and determine what type of RFTP message was received.
             ctrl = (control_message*) msg;
 
-            // Display verbose message output.
+            // Trace the message, and display verbose message output.
+            trace_record(TRACE_RECV, ctrl->type, msg);
+            RFTP_PROBE3(receive_message, ctrl->type, ntohs(ctrl->seq_num),
+                        msg->length);
             if (verbose) verbose_msg_output(RECV, ctrl->type, msg);
             ctrl = NULL;
 
@@ -123,11 +303,73 @@ rftp_message *receive_rftp_message_with_timeout (int sockfd, host_t *source,
         }
     }
 
-    // Free any allocated memory in case a message was not received.
+    // Note a timeout, and free any allocated memory in case a message
+    // was not received.
+    *timed_out = (retval == 0);
     if (msg) free(msg);
     return NULL;
 }
 
+/*
+ * Receives a RFTP message from the specified socket file descriptor,
+ * with a specified timeout duration.
+ *
+ * Return a RFTP message if a message was successfully received from sender.
+ * Return NULL if a message was not received before request times out.
+ */
+rftp_message *receive_rftp_message_with_timeout (int sockfd, host_t *source,
+        int timeout, int verbose)
+{
+    rftp_message *msg = NULL; // RFTP message
+    int timed_out = 0;        // Whether the wait timed out
+
+    msg = poll_rftp_message(sockfd, source, timeout, &timed_out, verbose);
+    if (timed_out) report_timeout(timeout);
+    return msg;
+}
+
+/*
+ * Receives a RFTP message from the specified socket file descriptor,
+ * until a deadline timer on the wheel expires. Any other timers of the
+ * wheel that expire while waiting are expired along the way; only the
+ * expiry of the deadline is traced as a timeout.
+ *
+ * Return a RFTP message if a message was successfully received from sender.
+ * Return NULL if a message was not received before the deadline expired.
+ */
+rftp_message *receive_rftp_message_before (int sockfd, host_t *source,
+        timer_wheel *wheel, timer *deadline, int verbose)
+{
+    rftp_message *msg = NULL; // RFTP message
+    int timeout = 0;          // Time until the next timer, in msec
+    int timed_out = 0;        // Whether the wait timed out
+
+    while (timer_pending(deadline))
+    {
+        // Wait for a message until the next timer is due,
+        // then expire the timers that are due.
+        timeout = timer_next_timeout(wheel, timer_now());
+        msg = poll_rftp_message(sockfd, source, timeout, &timed_out,
+                                verbose);
+        timer_advance(wheel, timer_now());
+        if (msg) return msg;
+        if (!timer_pending(deadline)) report_timeout(timeout);
+    }
+
+    return NULL;
+}
+
+/*
+ * Traces a sent message, and displays its verbose message output.
+ */
+static void report_sent_message (int msg_type, rftp_message *msg, int verbose)
+{
+    trace_record(TRACE_SEND, msg_type, msg);
+    RFTP_PROBE3(send_message, msg_type,
+                ntohs(((control_message*) msg)->seq_num), msg->length);
+    if (verbose) verbose_msg_output(SEND, msg_type, msg);
+}
+
 /*
  * Sends a RFTP message to a host.
  *
@@ -137,14 +379,71 @@ rftp_message *receive_rftp_message_with_timeout (int sockfd, host_t *source,
 int send_rftp_message (int sockfd, host_t *dest, rftp_message *msg,
         int msg_type, int verbose)
 {
-    int result; // The result of the send operation.
+    int result;           // The result of the send operation.
+    rftp_message sealed;  // Sealed copy of the message
+    rftp_message *wire;   // Message as sent
+
+    // Seal the message, if the session is encrypted.
+    if (!(wire = seal_message(msg, &sealed))) return SEND_ERR;
 
     // Send the message to the specified socket.
-    if ((result = sendto(sockfd, msg->buffer, msg->length, 0,
+    if ((result = sendto(sockfd, wire->buffer, wire->length, 0,
                          (struct sockaddr*) &dest->addr, dest->addr_len)))
     {
-        // Display verbose message output.
-        if (verbose) verbose_msg_output(SEND, msg_type, msg);
+        report_sent_message(msg_type, msg, verbose);
+    }
+
+    // Return the result.
+    return result;
+}
+
+/*
+ * Sends a RFTP message to a host once the pacer allows it. When the
+ * socket schedules its sends (SO_TXTIME), the message carries its
+ * transmit time to the qdisc. Without a pacer, the message is sent now.
+ *
+ * Return 1 if the message was sent successfully.
+ * Return 0 if the message could not be sent.
+ */
+int send_paced_rftp_message (int sockfd, host_t *dest, rftp_message *msg,
+        int msg_type, pacer *pacer, int verbose)
+{
+    uint64_t txtime = pace_message(pacer, msg->length); // Transmit time
+    char control[CMSG_SPACE(sizeof(txtime))];           // Control message
+    struct iovec iov;                                   // Message as sent
+    struct msghdr hdr;                                  // Message header
+    struct cmsghdr *cmsg = NULL;                        // Transmit time
+    rftp_message sealed;                                // Sealed copy
+    rftp_message *wire;                                 // Message as sent
+    int result;                                         // Result of the send
+
+    // Without a transmit time, send the message as usual.
+    if (!txtime) return send_rftp_message(sockfd, dest, msg, msg_type, verbose);
+
+    // Seal the message, if the session is encrypted.
+    if (!(wire = seal_message(msg, &sealed))) return SEND_ERR;
+    iov.iov_base = wire->buffer;
+    iov.iov_len = wire->length;
+
+    // Attach the transmit time to the message.
+    memset(&hdr, 0, sizeof(hdr));
+    memset(control, 0, sizeof(control));
+    hdr.msg_name = &dest->addr;
+    hdr.msg_namelen = dest->addr_len;
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control;
+    hdr.msg_controllen = sizeof(control);
+    cmsg = CMSG_FIRSTHDR(&hdr);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_TXTIME;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(txtime));
+    memcpy(CMSG_DATA(cmsg), &txtime, sizeof(txtime));
+
+    // Send the message to the specified socket.
+    if ((result = sendmsg(sockfd, &hdr, 0)))
+    {
+        report_sent_message(msg_type, msg, verbose);
     }
 
     // Return the result.
@@ -165,7 +464,8 @@ int acknowledge_message (int sockfd, host_t *dest, rftp_message *msg,
     int retval = SEND_ERR;        // The status of the send operation
 
     // Acknowledge a control message.
-    if (msg_type == INIT_MSG || msg_type == TERM_MSG)
+    if (msg_type == INIT_MSG || msg_type == TERM_MSG
+            || msg_type == GET_MSG || msg_type == JOIN_MSG)
     {
         ctrl = (control_message*) msg;
         ctrl->ack = ACK;
@@ -187,6 +487,73 @@ int acknowledge_message (int sockfd, host_t *dest, rftp_message *msg,
     return (retval != SEND_ERR);
 }
 
+/*
+ * Acknowledges the sequenced messages received in order up to a sequence
+ * number, advertising how many messages past it the receiver can hold.
+ *
+ * Return a successful status if the acknowledgment was successfully sent.
+ * Return a failure status if the acknowledgment could not be sent.
+ */
+int acknowledge_sequence (int sockfd, host_t *dest, int msg_type,
+        int seq_num, int window, int verbose)
+{
+    rftp_message *ack = NULL; // Cumulative acknowledgment
+    int retval = SEND_ERR;    // The status of the send operation
+
+    if ((ack = create_window_ack(msg_type, seq_num, window)))
+    {
+        retval = send_rftp_message(sockfd, dest, ack, msg_type, verbose);
+        free(ack);
+    }
+
+    return (retval != SEND_ERR);
+}
+
+/*
+ * Reports the gaps in the sequenced messages received: acknowledges the
+ * ones received in order up to a sequence number, as acknowledge_sequence
+ * does, and lists the ranges of messages missing past it, for the sender
+ * to resend at once.
+ *
+ * Return a successful status if the gap report was successfully sent.
+ * Return a failure status if the gap report could not be sent.
+ */
+int report_gaps (int sockfd, host_t *dest, int seq_num, int window,
+        gap_range *ranges, int count, int verbose)
+{
+    rftp_message *report = NULL; // Gap report
+    int retval = SEND_ERR;       // The status of the send operation
+
+    if ((report = create_gap_message(seq_num, window, ranges, count)))
+    {
+        retval = send_rftp_message(sockfd, dest, report, GAP_MSG, verbose);
+        free(report);
+    }
+
+    return (retval != SEND_ERR);
+}
+
+/*
+ * Rejects a control message and sends it back to a host, carrying the
+ * cause of the rejection in place of the filesize.
+ *
+ * Return a successful status if the rejection was successfully sent.
+ * Return a failure status if the rejection could not be sent.
+ */
+int reject_message (int sockfd, host_t *dest, rftp_message *msg,
+        int msg_type, int error, int verbose)
+{
+    control_message *ctrl = (control_message*) msg; // RFTP control message
+
+    // Mark the message as rejected, with the cause of the rejection.
+    ctrl->ack = REJ;
+    ctrl->fsize = htonl((uint32_t) error);
+
+    // Return the status of the rejection operation.
+    return (send_rftp_message(sockfd, dest, msg, msg_type, verbose)
+            != SEND_ERR);
+}
+
 /*
  * Checks the acknowledgment a received RFTP message.
  *
@@ -200,7 +567,8 @@ int check_acknowledgment (rftp_message *orig, rftp_message *response,
     data_message *data = NULL;       // A RFTP data message
 
     // Handle control message acknowledgments.
-    if (msg_type == INIT_MSG || msg_type == TERM_MSG)
+    if (msg_type == INIT_MSG || msg_type == TERM_MSG
+            || msg_type == GET_MSG || msg_type == JOIN_MSG)
     {
         control_message *tmp;
 
@@ -236,6 +604,35 @@ int check_acknowledgment (rftp_message *orig, rftp_message *response,
     return FAILURE;
 }
 
+/*
+ * Checks whether a received RFTP message rejects a sent control message.
+ *
+ * Return a successful status if the control message was rejected.
+ * Return a failure status otherwise.
+ */
+int check_rejection (rftp_message *orig, rftp_message *response,
+        int msg_type)
+{
+    control_message *control = (control_message*) response; // Response
+    control_message *tmp = (control_message*) orig;         // Original
+
+    // Only control messages can be rejected.
+    if (msg_type != INIT_MSG && msg_type != TERM_MSG && msg_type != GET_MSG
+            && msg_type != RANGE_MSG && msg_type != JOIN_MSG)
+    {
+        return FAILURE;
+    }
+
+    // Compare original message with response.
+    if ((control->type == tmp->type) && (control->ack == REJ)
+            && (ntohs(control->seq_num) == ntohs(tmp->seq_num)))
+    {
+        return SUCCESS;
+    }
+
+    return FAILURE;
+}
+
 /*
  * Outputs the percentage progress of the file transfer.
  *
@@ -294,94 +691,241 @@ int output_progress (int trans_type, int bytes_sent, int total_bytes,
 }
 
 /*
- * Creates a data packet and sends it to the UDP server using
- * the Stop-and-Wait protocol.
- * When the server does not acknowledge a data packet,
- * the packet will be resent when it times out.
+ * Creates a data packet and sends it to the UDP server through the send
+ * window of the session. When the server does not acknowledge the packet,
+ * the window resends it when it times out.
  *
- * Return a successful status if the packet was acknowledged.
- * Return a failure status if the packet could not be sent and acknowledged.
+ * Return a successful status if the packet was sent.
+ * Return a failure status if the packet could not be sent.
  */
-int send_data_packet (int sockfd, host_t *dest, int seq_num, int data_size,
-        uint8_t data[DATA_MSS], int timeout, int verbose)
+int send_data_packet (send_window *window, int data_size,
+        uint8_t data[DATA_MSS])
 {
-    rftp_message *packet = NULL; // Packet of file data to be sent
-    int status = FAILURE;        // Status of the packet transfer
-
-    // Create a data packet and send it to the server using the
-    // Stop-and-Wait protocol.
-    if ((packet = create_data_message(seq_num, data_size, data)))
+    // Create a data packet and hand it to the send window.
+    if (!window_send(window, create_data_message(window_seq(window),
+                                                 data_size, data),
+                     DATA_MSG))
     {
-        // If the packet is acknowledged,
-        if (stop_and_wait_send(sockfd, dest, packet, DATA_MSG, timeout,
-                               verbose))
-        {
-            status = SUCCESS;
-        }
+        return FAILURE;
+    }
+
+    stats_record_bytes(window->stats, data_size);
+    return SUCCESS;
+}
+
+/*
+ * Creates a hole packet, for a hole of a sparse file, and sends it to the
+ * UDP server through the send window of the session.
+ *
+ * Return a successful status if the packet was sent.
+ * Return a failure status if the packet could not be sent.
+ */
+int send_hole_packet (send_window *window, int64_t hole_len)
+{
+    return window_send(window, create_hole_message(window_seq(window),
+                                                   hole_len),
+                       HOLE_MSG);
+}
 
-        // Free the allocated memory for the data message.
-        free(packet);
+/*
+ * Sends the run of zeros read from a file so far, if any, as a zero range
+ * packet through the send window of the session. Data packets that hold
+ * only zeros are added to the run rather than sent, so a long run of
+ * zeros crosses the wire as a single packet. The run is cleared once it
+ * is sent.
+ *
+ * Return a successful status if the run was sent, or empty.
+ * Return a failure status if the packet could not be sent.
+ */
+int send_zero_run (send_window *window, int64_t *zero_len)
+{
+    if (*zero_len == 0) return SUCCESS;
+    if (!window_send(window, create_zero_message(window_seq(window),
+                                                 *zero_len),
+                     ZERO_MSG))
+    {
+        return FAILURE;
     }
 
-    // Return the status of the packet transfer.
-    return status;
+    *zero_len = 0;
+    return SUCCESS;
 }
 
 /*
  * Sends a RFTP message, and waits for an acknowledgment from the server.
+ * The message is resent each time its retransmission timer expires.
+ * Given a tail-loss probe timeout, in microseconds, the timer first
+ * expires after it instead, since nothing sent after the message would
+ * reveal its loss; 0 waits for the full timeout. Like the tail-loss probe
+ * of a window, the early resend is not counted as a retransmission.
+ * Responses from any host other than the destination are ignored.
+ * The round-trip time is only sampled for messages acknowledged without
+ * being resent, since the acknowledgment of a resent message is ambiguous.
+ * An acknowledged offer is replaced by its acknowledgment, which marks
+ * the offered chunks that the receiver already holds, and so is an
+ * initialization message whose acknowledgment carries the server's half
+ * of the key exchange.
  *
  * Returns a successful status if message was sent and acknowledged.
- * Returns a failure status if an error occurred while sending the message.
+ * Returns a failure status if an error occurred while sending the message,
+ * with errno set to the cause the peer rejected it with, or to ETIMEDOUT
+ * if the peer stopped responding.
  */
 int stop_and_wait_send (int sockfd, host_t* dest, rftp_message *msg,
-        int msg_type, int timeout, int verbose)
+        int msg_type, int timeout, uint64_t probe, pacer *pacer,
+        session_stats *stats, int verbose)
 {
+    timer_wheel *wheel = protocol_timers(); // Timers of the protocol
+    timer retransmit;              // Retransmission timer of the message
     rftp_message *response = NULL; // A received RFTP message
+    host_t source;                 // Source of the received message
     int status = FAILURE;          // The result of the operation
     int retval = SEND_ERR;         // Return value from send operation.
-
-    // Send the message to the server.
-    retval = send_rftp_message(sockfd, dest, msg, msg_type, verbose);
+    int resent = 0;                // Number of times the message was resent
+    int probing = 0;               // Whether the timer expires to probe
+    int probed = 0;                // Whether the message was resent as a probe
+    int error = EIO;               // Cause of a failure (errno value)
+    uint64_t sent_at = 0;          // Time the message was first sent
+
+    // Send the message to the server, and start its retransmission timer,
+    // or its tail-loss probe timer if it expires sooner.
+    timer_init(&retransmit, NULL, NULL);
+    retval = send_paced_rftp_message(sockfd, dest, msg, msg_type, pacer,
+                                     verbose);
+    sent_at = stats_now();
+    if (!probe || probe > (uint64_t) timeout * 1000)
+    {
+        probe = (uint64_t) timeout * 1000;
+    }
+    probing = (probe < (uint64_t) timeout * 1000);
+    timer_schedule_after(wheel, &retransmit, probe);
+    stats_record_sent(stats);
 
     // While the message was successfully sent.
     while (retval != SEND_ERR)
     {
         // Listen for an acknowledgment of the sent packet.
-        response = receive_rftp_message_with_timeout(sockfd, dest, timeout,
-                                                     verbose);
+        response = receive_rftp_message_before(sockfd, &source, wheel,
+                                               &retransmit, verbose);
+        if (response && !same_host(&source, dest))
+        {
+            free(response);
+            response = NULL;
+            continue;
+        }
+        if (response) stats_record_received(stats);
+        else if (!probing) stats_record_timeout(stats);
+        stats_poll();
 
         // If the message was acknowledged, return a successful status code.
         if (response && check_acknowledgment(msg, response, msg_type))
         {
+            if (!resent && !probed)
+            {
+                stats_record_rtt(stats, stats_now() - sent_at);
+            }
+            if ((msg_type == OFFER_MSG && response->length == msg->length)
+                    || (msg_type == INIT_MSG
+                        && response->length > msg->length))
+            {
+                memcpy(msg->buffer, response->buffer, response->length);
+                msg->length = response->length;
+            }
             status = SUCCESS;
             break;
         }
 
-        // If the message timed out, send the message again.
-        retval = send_rftp_message(sockfd, dest, msg, msg_type, verbose);
+        // If the message was rejected, stop and report the cause.
+        if (response && check_rejection(msg, response, msg_type))
+        {
+            error = ntohl(((control_message*) response)->fsize);
+            break;
+        }
+
+        // A stale acknowledgment of an earlier message is ignored, since
+        // resending on it would duplicate every message that follows.
+        // The retransmission timer keeps running meanwhile.
+        if (response)
+        {
+            free(response);
+            response = NULL;
+            continue;
+        }
+
+        // If the message was probed, send it again, like a tail-loss
+        // probe of a window, which is not counted as a retransmission.
+        if (probing)
+        {
+            trace_record(TRACE_RETRANSMIT, msg_type, msg);
+            retval = send_paced_rftp_message(sockfd, dest, msg, msg_type,
+                                             pacer, verbose);
+            timer_schedule_after(wheel, &retransmit,
+                                 (uint64_t) timeout * 1000);
+            stats_record_sent(stats);
+            probing = 0;
+            probed = 1;
+            continue;
+        }
+
+        // If the message timed out, send the message again, unless the
+        // peer is considered gone.
+        if (retransmit_limit_reached(resent))
+        {
+            error = ETIMEDOUT;
+            break;
+        }
+        trace_record(TRACE_RETRANSMIT, msg_type, msg);
+        RFTP_PROBE2(retransmit, msg_type,
+                    ntohs(((control_message*) msg)->seq_num));
+        retval = send_paced_rftp_message(sockfd, dest, msg, msg_type, pacer,
+                                         verbose);
+        timer_schedule_after(wheel, &retransmit, (uint64_t) timeout * 1000);
+        stats_record_sent(stats);
+        stats_record_retransmit(stats);
+        resent++;
     }
 
-    // Free allocated memory and return the result of the operation.
+    // Stop the timer, free allocated memory and return the result.
+    timer_cancel(wheel, &retransmit);
     free(response);
+    if (!status) errno = error;
     return status;
 }
 
 /*
  * Writes data from a data packet to the target file.
  */
-int write_data_to_file (data_message *packet, FILE *target)
+int write_data_to_file (data_message *packet, output_file *target)
 {
+    int status = SUCCESS; // Status of the write
+
     // Write the data from the data packet to file.
-    fwrite(packet->data, sizeof(uint8_t), ntohl(packet->data_len), target);
+    RFTP_PROBE1(write_start, ntohl(packet->data_len));
+    if (!write_output_file(target, packet->data, ntohl(packet->data_len)))
+    {
+        status = FAILURE;
+    }
+    RFTP_PROBE2(write_done, ntohl(packet->data_len), status);
+
+    return status;
+}
 
-    // If file error occurred.
-    if (ferror(target))
+/*
+ * Writes data from a stream data packet to the target file of its stream.
+ */
+int write_stream_to_file (stream_message *packet, output_file *target)
+{
+    int status = SUCCESS; // Status of the write
+
+    // Write the data from the stream data packet to file.
+    RFTP_PROBE1(write_start, ntohs(packet->data_len));
+    if (!write_output_file(target, packet->data, ntohs(packet->data_len)))
     {
-        perror("File write error: ");
-        return FAILURE;
+        status = FAILURE;
     }
+    RFTP_PROBE2(write_done, ntohs(packet->data_len), status);
 
-    return SUCCESS;
+    return status;
 }
 
 /*
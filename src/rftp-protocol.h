@@ -15,26 +15,55 @@
 #define RFTP_PROTOCOL_H
 
 #include "rftp-messages.h"
+#include "output-file.h"
+#include "rftp-stats.h"
+#include "rftp-pacer.h"
+#include "rftp-timer.h"
+#include "rftp-window.h"
 
 #define SEND_ERR -1 // RFTP send error code
 
 /*
  * Function prototypes
  */
+timer_wheel *protocol_timers ();
+void set_retransmit_limit (int limit);
+int retransmit_limit_reached (int resent);
+int same_host (host_t *a, host_t *b);
 rftp_message *receive_rftp_message (int sockfd, host_t *source, int verbose);
+rftp_message *receive_rftp_message_from (int sockfd, host_t *peer,
+        int verbose);
+rftp_message *receive_waiting_rftp_message (int sockfd, host_t *source,
+        int verbose);
 rftp_message *receive_rftp_message_with_timeout (int sockfd, host_t *source,
         int timeout, int verbose);
+rftp_message *receive_rftp_message_before (int sockfd, host_t *source,
+        timer_wheel *wheel, timer *deadline, int verbose);
 int send_rftp_message (int sockfd, host_t *dest, rftp_message *msg,
         int msg_type, int verbose);
-int send_data_packet (int sockfd, host_t *dest, int seq_num, int data_size,
-        uint8_t data[DATA_MSS], int timeout, int verbose);
+int send_paced_rftp_message (int sockfd, host_t *dest, rftp_message *msg,
+        int msg_type, pacer *pacer, int verbose);
+int send_data_packet (send_window *window, int data_size,
+        uint8_t data[DATA_MSS]);
+int send_hole_packet (send_window *window, int64_t hole_len);
+int send_zero_run (send_window *window, int64_t *zero_len);
 int acknowledge_message (int sockfd, host_t *dest, rftp_message *msg,
         int msg_type, int verbose);
+int acknowledge_sequence (int sockfd, host_t *dest, int msg_type,
+        int seq_num, int window, int verbose);
+int report_gaps (int sockfd, host_t *dest, int seq_num, int window,
+        gap_range *ranges, int count, int verbose);
+int reject_message (int sockfd, host_t *dest, rftp_message *msg,
+        int msg_type, int error, int verbose);
 int check_acknowledgment (rftp_message *orig, rftp_message *response,
         int msg_type);
+int check_rejection (rftp_message *orig, rftp_message *response,
+        int msg_type);
 int stop_and_wait_send (int sockfd, host_t* dest, rftp_message *msg,
-        int msg_type, int timeout, int verbose);
-int write_data_to_file (data_message *packet, FILE *target);
+        int msg_type, int timeout, uint64_t probe, pacer *pacer,
+        session_stats *stats, int verbose);
+int write_data_to_file (data_message *packet, output_file *target);
+int write_stream_to_file (stream_message *packet, output_file *target);
 int output_progress (int trans_type, int bytes_sent, int total_bytes,
         int last_mult);
 void output_transfer_info (int trans_type, char *filename, int filesize);
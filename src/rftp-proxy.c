@@ -0,0 +1,128 @@
+/*
+ *  Name        : rftp-proxy.c
+ *  Author      : Edmund Luong <edmundvmluong@gmail.com>
+ *  Version     : 1.0
+ *  Copyright   : MIT 2014 © Edmund Luong
+ *  Date        : November 16, 2014
+ *  Description : Executable network impairment proxy, used to place a
+ *                lossy, delayed or rate-limited link between a RFTP
+ *                client and a RFTP server.
+ *
+ *  CS 3357a Assignment 2
+ */
+
+#include "udp-proxy.h"
+#include "rftp-config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+// Main program.
+int main (int argc, char **argv)
+{
+    static int verbose = SILENT;            // Toggles verbose output
+    char *listen_port = DEFAULT_PROXY_PORT; // Port to accept datagrams on
+    char *server = NULL;                    // RFTP server name (IP address)
+    char *server_port = DEFAULT_PORT;       // RFTP server port number
+    uint64_t seed = 1;                      // Random number generator seed
+    impairment imp =                        // Link impairment
+    {
+        .burst_len = DEFAULT_BURST_LEN,
+        .queue_limit = DEFAULT_QUEUE
+    };
+
+    // Handle command line options.
+    int arg, option_index = 0;
+    static struct option long_options[] =
+    {
+            {"verbose", no_argument, &verbose, 1},
+            {"port", required_argument, 0, 'p'},
+            {"delay", required_argument, 0, 'd'},
+            {"jitter", required_argument, 0, 'j'},
+            {"loss", required_argument, 0, 'l'},
+            {"burst-loss", required_argument, 0, 'b'},
+            {"burst-len", required_argument, 0, 'n'},
+            {"duplicate", required_argument, 0, 'u'},
+            {"reorder", required_argument, 0, 'o'},
+            {"rate", required_argument, 0, 'r'},
+            {"queue", required_argument, 0, 'q'},
+            {"seed", required_argument, 0, 's'},
+            {0, 0, 0, 0}
+    };
+    while ((arg = getopt_long(argc, argv, "vp:d:j:l:b:n:u:o:r:q:s:",
+                              long_options, &option_index)) != EOF)
+    {
+        switch (arg)
+        {
+            case 'v':   // Enables verbose output
+                verbose = VERBOSE;
+                break;
+            case 'p':   // Sets the port to accept client datagrams on
+                listen_port = optarg;
+                break;
+            case 'd':   // Sets the one-way delay, in milliseconds
+                imp.delay = atof(optarg);
+                break;
+            case 'j':   // Sets the delay jitter, in milliseconds
+                imp.jitter = atof(optarg);
+                break;
+            case 'l':   // Sets the random loss, in percent
+                imp.loss = atof(optarg);
+                break;
+            case 'b':   // Sets the bursty loss, in percent
+                imp.burst_loss = atof(optarg);
+                break;
+            case 'n':   // Sets the mean loss burst length, in datagrams
+                imp.burst_len = atof(optarg);
+                break;
+            case 'u':   // Sets the duplication, in percent
+                imp.duplicate = atof(optarg);
+                break;
+            case 'o':   // Sets the reordering, in percent
+                imp.reorder = atof(optarg);
+                break;
+            case 'r':   // Sets the bandwidth cap, in kilobits per second
+                imp.rate = atol(optarg);
+                break;
+            case 'q':   // Sets the link queue limit, in datagrams
+                imp.queue_limit = atoi(optarg);
+                break;
+            case 's':   // Sets the random number generator seed
+                seed = strtoull(optarg, NULL, 10);
+                break;
+            case '?':   // Failure
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    // Handle non-option arguments.
+    for (; optind < argc; ++optind)
+    {
+        // Get the server name from arguments.
+        if (!server) server = argv[optind];
+        // Get the server port from arguments.
+        else server_port = argv[optind];
+    }
+
+    // If the server was not supplied, exit the program.
+    if (!server)
+    {
+        printf("ERROR:\n");
+        printf("- A server name must be supplied.\n");
+        printf("Sample usage: %s [OPTIONS...] [SERVER] [SERVER PORT]\n",
+               argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (imp.burst_len < 1) imp.burst_len = 1;
+
+    // Relay datagrams until the proxy is stopped.
+    if (run_udp_proxy(listen_port, server, server_port, &imp, seed, verbose))
+    {
+        exit(EXIT_SUCCESS);
+    }
+    else
+    {
+        exit(EXIT_FAILURE);
+    }
+}
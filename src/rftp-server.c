@@ -5,7 +5,8 @@
  *  Copyright   : MIT 2014 © Edmund Luong
  *  Date        : November 11, 2014
  *  Description : Implementation of a Reliable File Transfer Protocol server,
- *                used to receive a file transfer from a RFTP client.
+ *                used to receive a file transfer from a RFTP client, or to
+ *                serve files to RFTP clients that request them.
  *
  *  CS 3357a Assignment 2
  */
@@ -16,7 +17,18 @@
 #include "udp-sockets.h"
 #include "udp-server.h"
 #include "file.h"
+#include "rftp-probes.h"
+#include "rftp-busypoll.h"
+#include "rftp-cache.h"
+#include "rftp-store.h"
+#include "rftp-zero.h"
+#include "rftp-window.h"
+#include "rftp-crypto.h"
+#include "rftp-trace.h"
 
+#include <endian.h>
+#include <errno.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -27,11 +39,11 @@
  * Initializes the server to begin receiving a file from a RFTP client
  * when a file transfer initialization message is received.
  *
- * The server acknowledges the initialization message and
- * begins receiving a file.
+ * The initialization message is not acknowledged until the output file
+ * has been created, see accept_transfer_session.
  *
  * Return an init message with file transfer information, if successful.
- * Return NULL if there was an error with acknowledging the message.
+ * Return NULL if the message was not an initialization message.
  */
 control_message *initialize_receive (int sockfd, host_t *source, int verbose)
 {
@@ -41,182 +53,2076 @@ control_message *initialize_receive (int sockfd, host_t *source, int verbose)
     if ((msg = (control_message*) receive_rftp_message(sockfd, source,
                                                        verbose)))
     {
-        // If the message is an initialization message.
-        if (msg->type == INIT_MSG && ntohs(msg->seq_num) == 0)
+        // If the message is an initialization message, return it.
+        if (msg->type == INIT_MSG && msg->ack == NAK
+                && ntohs(msg->seq_num) == 0)
         {
-            // Acknowledge the message and return the initialization message.
-            if (acknowledge_message(sockfd, source, (rftp_message*) msg,
+            return msg;
+        }
+    }
+
+    // If the message was not an initialization message.
+    free(msg);
+    return NULL;
+}
+
+/*
+ * Creates the output file for a file transfer session, and preallocates
+ * the full size of the file before acknowledging the initialization
+ * message. If the file cannot be created or the space is not available,
+ * the initialization message is rejected with the cause of the error.
+ *
+ * Return the output file, if the transfer session was accepted.
+ * Return NULL if the transfer session was rejected.
+ */
+output_file *accept_transfer_session (int sockfd, host_t *source,
+        control_message *init, char *filename, char *output_dir, int io_mode,
+        int verbose)
+{
+    output_file *target = NULL; // Target file
+    int error = 0;              // Cause of the rejection
+
+    // Create the output file and reserve its extents up front.
+    if ((target = open_output_file(output_dir, filename, io_mode)))
+    {
+        if (preallocate_output_file(target, ntohl(init->fsize)))
+        {
+            // Accept the transfer session.
+            if (acknowledge_message(sockfd, source, (rftp_message*) init,
                                     INIT_MSG, verbose))
             {
-                return msg;
+                return target;
             }
+            discard_output_file(target);
+            return NULL;
         }
+        error = errno;
+        discard_output_file(target);
+    }
+    else
+    {
+        error = errno;
     }
 
-    // If there was an error with acknowledging the message.
-    free(msg);
+    // Reject the transfer session.
+    printf("ERROR: %s could not be received (%s).\n", filename,
+           strerror(error));
+    reject_message(sockfd, source, (rftp_message*) init, INIT_MSG, error,
+                   verbose);
     return NULL;
 }
 
 /*
- * Accepts data packets from a RFTP client, and writes them to a file.
+ * Accepts a transfer session with a pre-shared key, without creating its
+ * output file yet. The initialization message is only authenticated by
+ * its HMAC, which a recorded copy replayed later still passes, so the
+ * file is only created once a sealed message of the client opens (see
+ * create_deferred_file), and a replay cannot truncate it. The file is
+ * checked to be writable, to reject the session with the cause at once.
  *
- * Return a successful status if the file was successfully received.
- * Return a failure status if the file failed to transfer.
+ * Return a successful status if the transfer session was accepted.
+ * Return a failure status if the transfer session was rejected.
  */
-int receive_file (int sockfd, host_t *source, char *filename, int filesize,
-        char *output_dir, int time_wait, int verbose)
-{
-    control_message *term = NULL; // RFTP termination message
-    data_message *data = NULL;    // RFTP data message
-    FILE *target = NULL;          // Target file
-    int status = FAILURE;         // Status of the file transfer
-    int next_seq = 1;             // Next expected sequence number
-    int bytes_recv = 0;           // Total number of bytes received
-    int curr_mult = 0;            // The current percent multiple being returned
-    int last_mult = OUTPUTTED;    // Last outputted progress multiple
-    int retval = 0;               // The status of the send operations
+static int defer_transfer_session (int sockfd, host_t *source,
+        control_message *init, char *filename, char *output_dir, int verbose)
+{
+    int error = 0; // Cause of the rejection
 
-    // Create the output directory and output file.
-    target = create_dir_and_file(output_dir, filename);
+    if (check_output_file(output_dir, filename))
+    {
+        return acknowledge_message(sockfd, source, (rftp_message*) init,
+                                   INIT_MSG, verbose) != SEND_ERR;
+    }
+    error = errno;
+    printf("ERROR: %s could not be received (%s).\n", filename,
+           strerror(error));
+    reject_message(sockfd, source, (rftp_message*) init, INIT_MSG, error,
+                   verbose);
+    return FAILURE;
+}
 
-    // Receive data from the client until a termination message is sent.
-    rftp_message *msg = receive_rftp_message(sockfd, source, verbose);
-    while (((term = (control_message*) msg)->type != TERM_MSG)
-            && (retval != SEND_ERR))
+/*
+ * Creates the output file of a transfer session whose creation was
+ * deferred (see defer_transfer_session), in its store directory, and
+ * reserves its size.
+ *
+ * Return a successful status if the file was created.
+ * Return a failure status if the file could not be created.
+ */
+static int create_deferred_file (transfer_session *session)
+{
+    session->deferred = 0;
+    if ((session->target = open_output_file(session->store_dir,
+                                            session->filename,
+                                            session->io_mode))
+            && preallocate_output_file(session->target, session->filesize))
+    {
+        return SUCCESS;
+    }
+    printf("ERROR: %s could not be received (%s).\n", session->filename,
+           strerror(errno));
+    if (session->target) discard_output_file(session->target);
+    session->target = NULL;
+    return FAILURE;
+}
+
+/*
+ * Delivers a data, hole or zero range packet received in order: writes
+ * its data to the file, or to the chunk store in a deduplicated transfer,
+ * or skips over the hole or run of zeros it holds rather than writing
+ * zeros, adding the bytes to the count of bytes received.
+ *
+ * Return a successful status if the packet was delivered.
+ * Return a failure status if the packet could not be delivered.
+ */
+static int deliver_packet (data_message *data, output_file *target,
+        dedup_session *dedup, int filesize, int *bytes_recv,
+        session_stats *stats)
+{
+    uint64_t hole_len = 0; // Length of a hole or run of zeros
+    uint32_t data_len = ntohl(data->data_len); // Number of data bytes
+
+    // The packet must hold the data it claims.
+    if (data_len > DATA_MSS || data->length < DATA_HEADER
+            || data_len > (uint32_t) (data->length - DATA_HEADER))
+    {
+        printf("ERROR: The client sent a malformed data packet.\n");
+        return FAILURE;
+    }
+
+    // Write data to file, or to the chunk store.
+    if (data->type == DATA_MSG)
+    {
+        if (data_len > (uint32_t) (filesize - *bytes_recv))
+        {
+            printf("ERROR: The client sent data past the end of the "
+                   "file.\n");
+            return FAILURE;
+        }
+        if (dedup ? !receive_chunk_data(dedup, data->data,
+                                        ntohl(data->data_len))
+                  : !write_data_to_file(data, target))
+        {
+            return FAILURE;
+        }
+        *bytes_recv += ntohl(data->data_len);
+        stats_record_bytes(stats, ntohl(data->data_len));
+        return SUCCESS;
+    }
+
+    // Skip over a hole or a run of zeros.
+    memcpy(&hole_len, data->data, sizeof(hole_len));
+    hole_len = be64toh(hole_len);
+    if (data_len != sizeof(hole_len)
+            || hole_len > (uint64_t) (filesize - *bytes_recv)
+            || !skip_output_file(target, hole_len, data->type == HOLE_MSG))
+    {
+        printf("ERROR: Could not skip the zeros of the file.\n");
+        return FAILURE;
+    }
+    *bytes_recv += hole_len;
+    return SUCCESS;
+}
+
+/*
+ * Returns the name a stream's file is received under: its filename
+ * without any directories.
+ */
+static char *stream_name (char *filename)
+{
+    return strrchr(filename, '/') ? strrchr(filename, '/') + 1 : filename;
+}
+
+/*
+ * Returns whether a file is being received by an active transfer session,
+ * as its file or the file of one of its streams, so that two sessions
+ * never write the same file at once.
+ */
+static int receiving_file (transfer_session *sessions, char *fname,
+        size_t fname_len)
+{
+    transfer_session *session = NULL; // Scheduled session
+    char *name = NULL;                // Name of a file being received
+    int i;
+
+    for (session = sessions; session; session = session->next)
     {
-        // If the received data packet is not a duplicate, write the data to file.
-        data = (data_message*) msg;
-        if (data->type == DATA_MSG && ntohs(data->seq_num) == next_seq)
+        if (session->state != TRANSFER_ACTIVE || session->fetch) continue;
+        if (!session->multiplexed && strlen(session->filename) == fname_len
+                && !memcmp(session->filename, fname, fname_len))
+        {
+            return 1;
+        }
+        for (i = 0; i < session->stream_count; i++)
         {
-            // Write data to file, if there was an error, close the file
-            // and stop receiving data.
-            if (!write_data_to_file(data, target))
+            if (!session->streams[i].target) continue;
+            name = stream_name(session->streams[i].filename);
+            if (strlen(name) == fname_len && !memcmp(name, fname, fname_len))
             {
-                fclose(target);
-                break;
+                return 1;
             }
+        }
+    }
+    return 0;
+}
 
-            // Acknowledge the data packet and send back to client.
-            retval = acknowledge_message(sockfd, source, (rftp_message*) data,
-            DATA_MSG,
-                                         verbose);
+/*
+ * Opens a stream of a multiplexed transfer session, once its open message
+ * is received in order: creates the file it names in the store directory
+ * of the session, under its name without any directories, and reserves
+ * its size. The streams must be opened in order, their files must add up
+ * to no more than the size of the session, and no two of them may be
+ * received under the same name. A scheduled session may not open a file
+ * another session is receiving. An open message for a file that cannot
+ * be created is rejected with the cause.
+ *
+ * Return a successful status if the stream was opened.
+ * Return a failure status if the stream or its file could not be opened.
+ */
+static int open_stream (transfer_session *session,
+        stream_open_message *open)
+{
+    transfer_stream *streams = NULL; // Grown streams of the session
+    transfer_stream *stream = NULL;  // Opened stream
+    char *name = NULL;               // Name of the file without directories
+    int fname_len = ntohs(open->fname_len); // Length of the filename
+    int filesize = ntohl(open->fsize);      // Size of the file
+    int opened = 0;                  // Bytes of the streams opened so far
+    int error = 0;                   // Cause of a file not created
+    int i;
 
-            // Give an output of received data.
-            bytes_recv += ntohl(data->data_len);
-            curr_mult = output_progress(RECV, bytes_recv, filesize,
-                                        last_mult);
-            if (curr_mult != OUTPUTTED) last_mult = curr_mult;
+    for (i = 0; i < session->stream_count; i++)
+    {
+        opened += session->streams[i].filesize;
+    }
+    if (!session->multiplexed || session->stream_count == MAX_STREAMS
+            || ntohs(open->stream_id) != session->stream_count
+            || fname_len == 0 || fname_len > FNAME_MSS || filesize < 0
+            || filesize > session->filesize - opened)
+    {
+        printf("ERROR: The client opened an invalid stream.\n");
+        return FAILURE;
+    }
+    if (!(streams = (transfer_stream*) realloc(session->streams,
+                                               (session->stream_count + 1)
+                                               * sizeof(transfer_stream))))
+    {
+        perror("Unable to open stream");
+        return FAILURE;
+    }
+    session->streams = streams;
 
-            // Update the next expected sequence number.
-            next_seq = (next_seq == 1) ? 0 : 1;
-        }
+    // Get the file's information from the open message.
+    stream = &streams[session->stream_count];
+    memset(stream, 0, sizeof(transfer_stream));
+    if (!(stream->filename = malloc(fname_len + 1)))
+    {
+        perror("Unable to open stream");
+        return FAILURE;
+    }
+    memcpy(stream->filename, open->fname, fname_len);
+    stream->filename[fname_len] = '\0';
+    stream->filesize = filesize;
+    session->stream_count++;
+    name = stream_name(stream->filename);
+    for (i = 0; i < session->stream_count - 1; i++)
+    {
+        if (!strcmp(stream_name(streams[i].filename), name)) break;
+    }
 
-        // Receive another message from the client.
-        free(msg);
-        msg = receive_rftp_message(sockfd, source, verbose);
+    // Create the file and reserve its extents up front.
+    if (i < session->stream_count - 1) error = EEXIST;
+    else if (session->scheduled
+             && receiving_file(*session->scheduled, name, strlen(name)))
+    {
+        error = EBUSY;
     }
-    // If a termination message was given, end the file transfer.
-    if (term->type == TERM_MSG)
+    errno = error ? error : EINVAL;
+    if (!*name || error
+            || !(stream->target = open_output_file(session->store_dir, name,
+                                                   session->io_mode))
+            || !preallocate_output_file(stream->target, filesize))
     {
-        fclose(target);
-        status = end_receive_session(sockfd, source, term, target, time_wait,
-                                     verbose);
-        term = NULL;
+        error = errno;
+        printf("ERROR: %s could not be received (%s).\n", stream->filename,
+               strerror(error));
+        if (stream->target) discard_output_file(stream->target);
+        stream->target = NULL;
+        reject_message(session->sockfd, &session->client,
+                       (rftp_message*) open, OPEN_MSG, error,
+                       session->verbose);
+        return FAILURE;
     }
 
-    // Free allocated memory and return the status of the file transfer.
-    free(msg);
-    return status;
+    // An empty file is already complete.
+    if (filesize == 0)
+    {
+        if (!close_output_file(stream->target)) return FAILURE;
+        stream->target = NULL;
+        printf("Received %s (0 bytes) from %s.\n", stream->filename,
+               session->client.friendly_ip);
+    }
+    return SUCCESS;
 }
 
 /*
- * Terminates the file transfer session.
+ * Delivers a stream data packet of a multiplexed transfer session,
+ * received in order: writes its data to the file of its stream. The
+ * packet must hold exactly the data it claims. Once the file is complete,
+ * it is closed.
  *
- * Return a successful status if the file transfer session was terminated.
- * Return a failure status if there was an error sending an acknowledgment.
+ * Return a successful status if the packet was delivered.
+ * Return a failure status if the packet could not be delivered.
  */
-int end_receive_session (int sockfd, host_t *source, control_message *term,
-        FILE *target, int time_wait, int verbose)
+static int deliver_stream_packet (transfer_session *session,
+        stream_message *packet)
 {
-    control_message *dupe; // Duplicate RFTP termination message
-    int retval = 0;        // The result of the send operation
+    transfer_stream *stream = NULL;           // Stream of the packet
+    output_file *target = NULL;               // File of a completed stream
+    int data_len = ntohs(packet->data_len);   // Number of data bytes
+    int id = ntohs(packet->stream_id);        // Stream of the packet
 
-    // Acknowledge the termination message and send it back to client.
-    retval = acknowledge_message(sockfd, source, (rftp_message*) term,
-                                 TERM_MSG, verbose);
+    if (STREAM_HEADER + data_len != packet->length || data_len > DATA_MSS)
+    {
+        printf("ERROR: The client sent a malformed stream packet.\n");
+        return FAILURE;
+    }
+    if (id >= session->stream_count || !session->streams[id].target
+            || data_len > session->streams[id].filesize
+                          - session->streams[id].bytes_recv)
+    {
+        printf("ERROR: The client sent data past the end of a stream.\n");
+        return FAILURE;
+    }
+    stream = &session->streams[id];
 
-    // Go into a waiting state for any duplicate termination requests.
-    while ((dupe = (control_message*) receive_rftp_message_with_timeout(
-            sockfd, source, time_wait, verbose)) && (retval != SEND_ERR))
+    // Write data to the file of the stream.
+    if (!write_stream_to_file(packet, stream->target)) return FAILURE;
+    stream->bytes_recv += data_len;
+    session->bytes_recv += data_len;
+    stats_record_bytes(session->stats, data_len);
+
+    // Close the file once it is complete.
+    if (stream->bytes_recv == stream->filesize)
     {
-        // Resend termination acknowledgment.
-        retval = acknowledge_message(sockfd, source, (rftp_message*) dupe,
-                                     TERM_MSG, verbose);
-        free(dupe);
+        target = stream->target;
+        stream->target = NULL;
+        if (!close_output_file(target)) return FAILURE;
+        printf("Received %s (%d bytes) from %s.\n", stream->filename,
+               stream->filesize, session->client.friendly_ip);
     }
+    return SUCCESS;
+}
 
-    // Return the status of the termination.
-    if (retval == SEND_ERR) return FAILURE;
-    else return SUCCESS;
+/*
+ * Returns whether a message type is sequenced: sent through the send
+ * window of the client, and delivered in order.
+ */
+static int sequenced_message (int msg_type)
+{
+    return msg_type == DATA_MSG || msg_type == HOLE_MSG
+           || msg_type == ZERO_MSG || msg_type == STREAM_MSG
+           || msg_type == OPEN_MSG;
 }
 
 /*
- * Receives a file from a RFTP client, via the Reliable File Transfer Protocol (RFTP).
+ * Delivers a sequenced message of a transfer session, received in order:
+ * a stream message of a multiplexed session, or a data, hole or zero
+ * range packet of the file of any other session.
  *
- * Return a successful status if the file was successfully transferred.
- * Return a failure status if the file could not be transferred.
+ * Return a successful status if the message was delivered.
+ * Return a failure status if the message could not be delivered.
  */
-int rftp_receive_file (char *port_number, char *output_dir, int time_wait,
-        int verbose)
+static int deliver_message (transfer_session *session, rftp_message *msg)
 {
-    host_t client;           // Client host
-    char *filename = NULL;   // Name of the file being transferred
-    int filesize = NO_FSIZE; // Size of the file being transferred
-    int status = 0;          // Status of the file transfer
+    data_message *data = (data_message*) msg; // Data message
 
-    // Create a socket and listen on port number.
-    int sockfd = create_server_socket(port_number);
-    printf("Listening on port %s for a file transfer request ...\n",
-           port_number);
+    if (data->type == OPEN_MSG)
+    {
+        return open_stream(session, (stream_open_message*) msg);
+    }
+    if (data->type == STREAM_MSG && session->multiplexed)
+    {
+        return deliver_stream_packet(session, (stream_message*) msg);
+    }
+    if (data->type == STREAM_MSG || session->multiplexed)
+    {
+        printf("ERROR: The client mixed streams into a single file.\n");
+        return FAILURE;
+    }
+    return deliver_packet(data, session->target, session->dedup,
+                          session->filesize, &session->bytes_recv,
+                          session->stats);
+}
 
-    // If a file transfer was initialized.
-    control_message *init = initialize_receive(sockfd, &client, verbose);
-    if (init)
+/*
+ * Returns whether a message belongs to a transfer session: it comes from
+ * the client, or from one of the other paths it joined to the session.
+ * A request to join another path may come from any host.
+ */
+static int session_message (transfer_session *session, rftp_message *msg,
+        host_t *from)
+{
+    int i;
+
+    if (same_host(from, &session->client)
+            || ((control_message*) msg)->type == JOIN_MSG)
     {
-        // Get the file's information from the init message.
-        printf("File transfer initialized.\n");
-        printf("File will be received in the %s directory.\n\n", output_dir);
-        filesize = ntohl(init->fsize);
-        filename = malloc(ntohl(init->fname_len) + 1);
-        memcpy(filename, init->fname, ntohl(init->fname_len));
-        filename[ntohl(init->fname_len)] = '\0';
+        return 1;
+    }
+    for (i = 0; i < session->path_count; i++)
+    {
+        if (same_host(from, &session->paths[i])) return 1;
+    }
+    return 0;
+}
 
-        // Display the file transfer information.
-        output_transfer_info(RECV, filename, filesize);
+/*
+ * Receives a message of a transfer session: a message from the client,
+ * from one of the other paths it joined to the session, or a request to
+ * join another path. Messages from any other host are ignored.
+ *
+ * Return the received message, storing where it came from.
+ */
+static rftp_message *receive_session_message (transfer_session *session,
+        host_t *from)
+{
+    rftp_message *msg = NULL; // RFTP message
 
-        // Receive the file from the client.
-        status = receive_file(sockfd, &client, filename, filesize, output_dir,
-                              time_wait, verbose);
+    while ((msg = receive_rftp_message(session->sockfd, from,
+                                       session->verbose)))
+    {
+        if (session_message(session, msg, from)) return msg;
+        free(msg);
+    }
 
-        // Report the status of the file transfer.
-        if (status)
+    return NULL;
+}
+
+/*
+ * Checks a request to join another path to a transfer session. The
+ * request must come from a new host, name the file as the client did,
+ * and carry the token of the session, which only the client was given;
+ * a session without a token takes no paths. The session must also have
+ * room for another path.
+ *
+ * Return 0 if the path may join the session.
+ * Return the cause of the rejection otherwise.
+ */
+static int check_join (transfer_session *session, control_message *join,
+        host_t *from)
+{
+    size_t fname_len = strlen(session->filename); // Length of the filename
+
+    if (!session->token
+            || find_session_token((rftp_message*) join) != session->token)
+    {
+        return EACCES;
+    }
+    if (session->path_count == MAX_PATHS - 1) return EBUSY;
+    if (same_host(from, &session->client)
+            || ntohl(join->fsize) != (uint32_t) session->filesize
+            || ntohl(join->fname_len) != fname_len
+            || memcmp(join->fname, session->filename, fname_len))
+    {
+        return EINVAL;
+    }
+    return 0;
+}
+
+/*
+ * Opens the receiving end of a transfer session, once its output file is
+ * created, reserving its receive window. The session does not own the
+ * filename, the store directory or the statistics.
+ *
+ * Return the session.
+ * Return NULL if the session could not be opened, closing the output file.
+ */
+static transfer_session *open_transfer_session (int sockfd, host_t *source,
+        output_file *target, char *filename, int filesize, char *store_dir,
+        session_stats *stats, int verbose)
+{
+    transfer_session *session = NULL; // Session of the transfer
+
+    if (!(session = (transfer_session*) calloc(1, sizeof(transfer_session)))
+            || !(session->window = open_receive_window()))
+    {
+        free(session);
+        close_output_file(target);
+        return NULL;
+    }
+    session->sockfd = sockfd;
+    session->client = *source;
+    session->target = target;
+    session->filename = filename;
+    session->filesize = filesize;
+    session->store_dir = store_dir;
+    session->stats = stats;
+    session->verbose = verbose;
+    session->next_seq = 1;
+    session->last_mult = OUTPUTTED;
+    session->state = TRANSFER_ACTIVE;
+    timer_init(&session->expiry, NULL, NULL);
+    return session;
+}
+
+/*
+ * Outputs the progress of a transfer session, if it is shown.
+ */
+static void report_progress (transfer_session *session)
+{
+    int curr_mult = 0; // The current percent multiple being returned
+
+    if (!session->progress) return;
+    curr_mult = output_progress(RECV, session->bytes_recv, session->filesize,
+                                session->last_mult);
+    if (curr_mult != OUTPUTTED) session->last_mult = curr_mult;
+}
+
+/*
+ * Returns the receive window advertised to the client of a session: the
+ * slots of its window, narrowed to the rate limits of a scheduled session.
+ */
+static int advertised_window (transfer_session *session)
+{
+    if (!session->flow) return session->window->slots;
+    return fair_window(session->flow, session->window->slots);
+}
+
+/*
+ * Handles a message of a transfer session, taking ownership of it.
+ *
+ * If the next expected packet is received, it is delivered, and then the
+ * packets held after it. Packets received ahead of the next expected one
+ * are held in the receive window, up to as many as its slots. Every packet
+ * is answered with a cumulative acknowledgment of the packets received in
+ * order, which advertises the slots of the window, so the client never
+ * sends more than it can hold. While packets are held, a packet received
+ * out of order is answered with a gap report instead, which also lists
+ * the packets missing before the held ones, so the client resends them
+ * without waiting for a timeout.
+ *
+ * The client may offer the chunks of the file first, to deduplicate the
+ * transfer, and may join other paths to the session. In a multiplexed
+ * session, the packets are stream messages instead, which open the files
+ * of the streams and carry their data. A termination message is kept in
+ * the session, for the caller to end the transfer.
+ *
+ * Return a successful status if the message was handled.
+ * Return a failure status if the file could not be written, or an
+ * acknowledgment could not be sent.
+ */
+static int receive_transfer_message (transfer_session *session,
+        rftp_message *msg, host_t *from)
+{
+    control_message *ctrl = (control_message*) msg; // Control message
+    data_message *data = (data_message*) msg;       // Data message
+    int delivered = SUCCESS;      // Status of the delivered packets
+    int retval = 0;               // The status of the send operations
+    int bytes_present = 0;        // Bytes of the offered chunks held
+    int error = 0;                // Cause of a rejected path
+    gap_range ranges[GAP_RANGES]; // Ranges of packets missing
+    int gaps = 0;                 // Number of missing ranges
+    int i;
+
+    // A deferred file is created once a sealed message of the client
+    // opens, which proves the client holds the key.
+    if (session->deferred && !is_handshake_message(msg)
+            && !create_deferred_file(session))
+    {
+        free(msg);
+        return FAILURE;
+    }
+
+    // Keep a termination message for the caller.
+    if (ctrl->type == TERM_MSG)
+    {
+        session->term = ctrl;
+        return SUCCESS;
+    }
+    stats_record_received(session->stats);
+
+    // If the next expected packet is received, deliver it, and then
+    // the packets held after it.
+    if (sequenced_message(data->type)
+            && ntohs(data->seq_num) == session->next_seq)
+    {
+        while (data && (delivered = deliver_message(session,
+                                                    (rftp_message*) data)))
         {
-            // Success.
-            printf("\n%s was successfully received from %s into %s.\n",
-                   filename, client.friendly_ip, output_dir);
+            report_progress(session);
+
+            // Update the next expected sequence number.
+            session->next_seq = (session->next_seq + 1) % SEQ_SPACE;
+            if (data != (data_message*) msg) free(data);
+            data = (data_message*) window_take(session->window,
+                                               session->next_seq);
+        }
+        if (data != (data_message*) msg) free(data);
+        if (!delivered)
+        {
+            free(msg);
+            return FAILURE;
+        }
+
+        // Acknowledge the packets received in order.
+        retval = acknowledge_sequence(session->sockfd, &session->client,
+                                      ctrl->type, (session->next_seq
+                                                   + SEQ_SPACE - 1)
+                                                  % SEQ_SPACE,
+                                      advertised_window(session),
+                                      session->verbose);
+        stats_record_sent(session->stats);
+    }
+    // If a packet is received ahead of the next expected one, hold it.
+    // Otherwise, it is a duplicate whose acknowledgment was lost, or a
+    // tail-loss probe. Either way, report the gaps before the held packets
+    // for the client to resend them at once, or if there are none,
+    // acknowledge the packets received in order again.
+    else if (sequenced_message(data->type))
+    {
+        if (window_hold(session->window, session->next_seq, msg)) msg = NULL;
+        else stats_record_duplicate(session->stats);
+        gaps = window_gaps(session->window, session->next_seq, ranges,
+                           GAP_RANGES);
+        if (gaps > 0)
+        {
+            retval = report_gaps(session->sockfd, &session->client,
+                                 (session->next_seq + SEQ_SPACE - 1)
+                                 % SEQ_SPACE, advertised_window(session),
+                                 ranges, gaps, session->verbose);
         }
         else
         {
-            // Failure.
-            printf("\nCould not successfully receive %s from %s.\n", filename,
-                   client.friendly_ip);
+            retval = acknowledge_sequence(session->sockfd, &session->client,
+                                          data->type, (session->next_seq
+                                                       + SEQ_SPACE - 1)
+                                                      % SEQ_SPACE,
+                                          advertised_window(session),
+                                          session->verbose);
         }
+        stats_record_sent(session->stats);
     }
+    // If the client offers chunks, mark those already held, and
+    // acknowledge the offer with the marks.
+    else if (data->type == OFFER_MSG && session->store_dir
+             && ntohs(data->seq_num) == session->next_seq)
+    {
+        if ((!session->dedup && !(session->dedup = create_dedup_session(
+                                                       session->store_dir)))
+                || !receive_offer(session->dedup, data, &bytes_present))
+        {
+            free(msg);
+            return FAILURE;
+        }
+        retval = acknowledge_message(session->sockfd, &session->client, msg,
+                                     OFFER_MSG, session->verbose);
+        stats_record_sent(session->stats);
 
-    // Return status of the file transfer.
-    close(sockfd);
-    free(filename);
-    free(init);
-    return status;
+        // Give an output of the file bytes already held.
+        session->bytes_recv += bytes_present;
+        report_progress(session);
+        session->next_seq = (session->next_seq + 1) % SEQ_SPACE;
+    }
+    // If the acknowledgment of an offer was lost, acknowledge the
+    // retransmitted duplicate again, with the same marks.
+    else if (data->type == OFFER_MSG && session->dedup)
+    {
+        repeat_offer(session->dedup, data);
+        retval = acknowledge_message(session->sockfd, &session->client, msg,
+                                     OFFER_MSG, session->verbose);
+        stats_record_sent(session->stats);
+        stats_record_duplicate(session->stats);
+    }
+    // If the client joins another path to the session, accept it,
+    // or reject it with the cause. A path whose acknowledgment was
+    // lost is accepted again.
+    else if (ctrl->type == JOIN_MSG && ctrl->ack == NAK)
+    {
+        for (i = 0; i < session->path_count
+                    && !same_host(from, &session->paths[i]); i++);
+        if (i == session->path_count
+                && (error = check_join(session, ctrl, from)))
+        {
+            retval = reject_message(session->sockfd, from, msg, JOIN_MSG,
+                                    error, session->verbose);
+        }
+        else
+        {
+            if (i == session->path_count)
+            {
+                session->paths[session->path_count++] = *from;
+            }
+            else stats_record_duplicate(session->stats);
+            retval = acknowledge_message(session->sockfd, from, msg, JOIN_MSG,
+                                         session->verbose);
+        }
+        stats_record_sent(session->stats);
+    }
+    // If the acknowledgment of the initialization was lost,
+    // acknowledge the retransmitted initialization again.
+    else if (ctrl->type == INIT_MSG && ctrl->ack == NAK
+             && ntohs(ctrl->seq_num) == 0)
+    {
+        add_session_hello(msg);
+        add_session_token(msg, session->token);
+        retval = acknowledge_message(session->sockfd, &session->client, msg,
+                                     INIT_MSG, session->verbose);
+        stats_record_sent(session->stats);
+        stats_record_duplicate(session->stats);
+    }
+
+    free(msg);
+    return retval != SEND_ERR;
+}
+
+/*
+ * Writes out the file of a transfer session once its termination message
+ * is received: a deduplicated file is assembled from the chunk store, and
+ * the file is closed, so the termination is only acknowledged once the
+ * file is fully written. A multiplexed session must have written the
+ * files of all of its streams.
+ *
+ * Return a successful status if the file was fully written.
+ * Return a failure status otherwise.
+ */
+static int complete_transfer (transfer_session *session)
+{
+    output_file *target = session->target; // Target file
+    int i;
+
+    // The files of a multiplexed session are closed as they complete.
+    if (session->multiplexed)
+    {
+        for (i = 0; i < session->stream_count
+                    && !session->streams[i].target; i++);
+        if (i < session->stream_count
+                || session->bytes_recv != session->filesize)
+        {
+            printf("ERROR: Not every file of the session was received.\n");
+            return FAILURE;
+        }
+        stats_record_received(session->stats);
+        return SUCCESS;
+    }
+
+    session->target = NULL;
+    if (session->dedup && !assemble_file(session->dedup, target,
+                                         session->filesize))
+    {
+        close_output_file(target);
+        return FAILURE;
+    }
+    if (!close_output_file(target)) return FAILURE;
+
+    stats_record_received(session->stats);
+    return SUCCESS;
+}
+
+/*
+ * Stops the timers of a fetch session, releases its file, and frees it.
+ */
+static void free_fetch_session (fetch_session *fetch)
+{
+    if (!fetch) return;
+
+    timer_cancel(protocol_timers(), &fetch->retransmit);
+    if (fetch->flight)
+    {
+        timer_cancel(protocol_timers(), &fetch->flight->retransmit);
+    }
+    free_send_window(fetch->flight);
+    free(fetch->control);
+    cache_release(fetch->cache, fetch->entry);
+    free(fetch->path);
+    free(fetch);
+}
+
+/*
+ * Closes a transfer session, closing any partially received files, or
+ * releasing the file it served, and frees it.
+ */
+static void close_transfer_session (transfer_session *session)
+{
+    int i;
+
+    if (!session) return;
+
+    if (session->target) close_output_file(session->target);
+    for (i = 0; i < session->stream_count; i++)
+    {
+        if (session->streams[i].target)
+        {
+            close_output_file(session->streams[i].target);
+        }
+        free(session->streams[i].filename);
+    }
+    free(session->streams);
+    free_fetch_session(session->fetch);
+    close_receive_window(session->window);
+    free_dedup_session(session->dedup);
+    free(session->term);
+    free(session->request);
+    free(session);
+}
+
+/*
+ * Accepts data packets from a RFTP client, and writes them to a file.
+ * Messages from any other host are ignored. The holes of a sparse file
+ * are left as holes in the written file.
+ *
+ * The client may join other paths to the session, each from another
+ * local address, and stripe the data packets across them, with the token
+ * the session was given (or none, for a token of 0). The packets of every
+ * path are acknowledged to the client itself.
+ *
+ * Packets received ahead of the next expected one are held in a receive
+ * window, up to as many as its slots, and delivered once the packets
+ * before them arrive. Every packet is answered with a cumulative
+ * acknowledgment of the packets received in order, which advertises the
+ * slots of the window, so the client never sends more than it can hold.
+ *
+ * If the client offers the chunks of the file first, and a store directory
+ * is given, the transfer is deduplicated: the offered chunks the store
+ * already holds are marked as present, the data packets carry only the
+ * other chunks, and the file is assembled from the store once the
+ * termination message is received.
+ *
+ * Without a target file, the file is created in the store directory, with
+ * the I/O mode, once a sealed message of the client opens (see
+ * defer_transfer_session).
+ *
+ * Return a successful status if the file was successfully received.
+ * Return a failure status if the file failed to transfer.
+ */
+int receive_file (int sockfd, host_t *source, output_file *target,
+        char *filename, int filesize, uint64_t token, char *store_dir,
+        int io_mode, int time_wait, session_stats *stats, int verbose)
+{
+    transfer_session *session = NULL; // Session of the transfer
+    rftp_message *msg = NULL;         // A received RFTP message
+    host_t from;                      // Source of the received message
+    int status = FAILURE;             // Status of the file transfer
+
+    // Reserve the receive window of the session.
+    if (!(session = open_transfer_session(sockfd, source, target, filename,
+                                          filesize, store_dir, stats,
+                                          verbose)))
+    {
+        return FAILURE;
+    }
+    session->token = token;
+    session->io_mode = io_mode;
+    session->deferred = !target;
+    session->progress = 1;
+
+    // Receive data from the client until a termination message is sent.
+    while (!session->term && (msg = receive_session_message(session, &from))
+           && receive_transfer_message(session, msg, &from))
+    {
+        stats_poll();
+    }
+
+    // If a termination message was given, end the file transfer.
+    if (session->term && complete_transfer(session))
+    {
+        status = end_receive_session(sockfd, source, session->term, time_wait,
+                                     stats, verbose);
+    }
+
+    // Close a partially received file, and return the status of the
+    // file transfer.
+    close_transfer_session(session);
+    return status;
+}
+
+/*
+ * Terminates the file transfer session.
+ *
+ * Return a successful status if the file transfer session was terminated.
+ * Return a failure status if there was an error sending an acknowledgment.
+ */
+int end_receive_session (int sockfd, host_t *source, control_message *term,
+        int time_wait, session_stats *stats, int verbose)
+{
+    timer_wheel *wheel = protocol_timers(); // Timers of the protocol
+    timer wait;            // Time-wait timer
+    control_message *dupe; // Duplicate RFTP termination message
+    host_t from;           // Source of the duplicate
+    int retval = 0;        // The result of the send operation
+
+    // Acknowledge the termination message and send it back to client.
+    retval = acknowledge_message(sockfd, source, (rftp_message*) term,
+                                 TERM_MSG, verbose);
+    stats_record_sent(stats);
+
+    // Go into a waiting state for any duplicate termination requests,
+    // which restart the wait. Any other messages are ignored.
+    timer_init(&wait, NULL, NULL);
+    timer_schedule_after(wheel, &wait, (uint64_t) time_wait * 1000);
+    while ((dupe = (control_message*) receive_rftp_message_before(
+            sockfd, &from, wheel, &wait, verbose)) && (retval != SEND_ERR))
+    {
+        // Resend termination acknowledgment.
+        if (same_host(&from, source) && dupe->type == TERM_MSG)
+        {
+            retval = acknowledge_message(sockfd, source, (rftp_message*) dupe,
+                                         TERM_MSG, verbose);
+            timer_schedule_after(wheel, &wait, (uint64_t) time_wait * 1000);
+            stats_record_received(stats);
+            stats_record_sent(stats);
+            stats_record_duplicate(stats);
+        }
+        free(dupe);
+    }
+    timer_cancel(wheel, &wait);
+
+    // Return the status of the termination.
+    if (retval == SEND_ERR) return FAILURE;
+    else return SUCCESS;
+}
+
+/*
+ * Answers the client's half of the key exchange in a handshake message,
+ * and begins sealing the messages of the session. Without a pre-shared
+ * key, the session is not sealed. With one, a request that does not
+ * carry the client's half is rejected, so no file is ever transferred
+ * in the clear.
+ *
+ * Return a successful status if the session is sealed, or needs no sealing.
+ * Return a failure status if the handshake message was rejected.
+ */
+static int answer_key_exchange (int sockfd, host_t *client,
+        rftp_message *request, int verbose)
+{
+    crypto_hello hello; // Client's half of the key exchange
+    crypto_hello reply; // Server's half of the key exchange
+
+    if (!crypto_configured()) return SUCCESS;
+
+    create_hello(&reply);
+    if (!find_hello(request, 0, &hello))
+    {
+        printf("ERROR: The request of %s is not encrypted.\n",
+               client->friendly_ip);
+    }
+    else if (begin_cipher(&hello, &reply, SERVER_ROLE))
+    {
+        return SUCCESS;
+    }
+    reject_message(sockfd, client, request, request->buffer[0], EACCES,
+                   verbose);
+    return FAILURE;
+}
+
+/*
+ * Returns the length of the filename of an initialization message, no
+ * longer than FNAME_MSS or the bytes the message holds, whatever length
+ * it claims.
+ */
+static uint32_t init_fname_len (control_message *init)
+{
+    uint32_t fname_len = ntohl(init->fname_len); // Length of the filename
+
+    if (fname_len > FNAME_MSS) fname_len = FNAME_MSS;
+    if (init->length < CTRL_HEADER) return 0;
+    if (fname_len > (uint32_t) (init->length - CTRL_HEADER))
+    {
+        fname_len = init->length - CTRL_HEADER;
+    }
+    return fname_len;
+}
+
+/*
+ * Copies the filename of an initialization message (see init_fname_len).
+ *
+ * Return the allocated filename.
+ * Return NULL if the filename could not be allocated.
+ */
+static char *copy_init_filename (control_message *init)
+{
+    uint32_t fname_len = init_fname_len(init); // Length of the filename
+    char *filename = NULL;                     // Copied filename
+
+    if ((filename = malloc(fname_len + 1)))
+    {
+        memcpy(filename, init->fname, fname_len);
+        filename[fname_len] = '\0';
+    }
+    return filename;
+}
+
+/*
+ * Receives a file from a RFTP client once its initialization message
+ * has been received, and reports the result of the transfer session.
+ * The acknowledgment of the initialization message carries the server's
+ * half of the key exchange.
+ *
+ * Return a successful status if the file was successfully transferred.
+ * Return a failure status if the file could not be transferred.
+ */
+static int receive_session (int sockfd, host_t *client, control_message *init,
+        char *output_dir, int time_wait, int io_mode, int verbose)
+{
+    output_file *target = NULL;  // Target file
+    session_stats *stats = NULL; // Statistics of the transfer session
+    char *filename = NULL;       // Name of the file being transferred
+    int filesize = NO_FSIZE;     // Size of the file being transferred
+    uint64_t token = create_session_token(); // Token of joining paths
+    int status = FAILURE;        // Status of the file transfer
+
+    // Multiplexed sessions are only received while serving (see rftp_serve).
+    if (ntohl(init->fname_len) == 0)
+    {
+        printf("ERROR: Multiplexed transfers are only received while "
+               "serving.\n");
+        reject_message(sockfd, client, (rftp_message*) init, INIT_MSG,
+                       EPROTONOSUPPORT, verbose);
+        return FAILURE;
+    }
+
+    // Get the file's information from the init message.
+    filesize = ntohl(init->fsize);
+    if (!(filename = copy_init_filename(init)))
+    {
+        perror("Unable to receive file");
+        return FAILURE;
+    }
+
+    // Start the statistics of the transfer session.
+    stats = stats_open_session(RECV, filename, filesize);
+    stats_set_peer(stats, client);
+    stats_record_received(stats);
+
+    // If the key exchange was answered and the output file was created,
+    // or is deferred until the client proves its key, accept the file
+    // transfer, giving the client the session's token.
+    if (answer_key_exchange(sockfd, client, (rftp_message*) init, verbose)
+            && add_session_hello((rftp_message*) init)
+            && add_session_token((rftp_message*) init, token)
+            && (crypto_configured()
+                ? defer_transfer_session(sockfd, client, init, filename,
+                                         output_dir, verbose)
+                : !!(target = accept_transfer_session(sockfd, client, init,
+                                                      filename, output_dir,
+                                                      io_mode, verbose))))
+    {
+        printf("File transfer initialized.\n");
+        printf("File will be received in the %s directory.\n\n", output_dir);
+        stats_record_sent(stats);
+        RFTP_PROBE3(session_start, filename, filesize, client->friendly_ip);
+
+        // Display the file transfer information.
+        output_transfer_info(RECV, filename, filesize);
+
+        // Receive the file from the client.
+        status = receive_file(sockfd, client, target, filename, filesize,
+                              token, output_dir, io_mode, time_wait, stats,
+                              verbose);
+
+        // Report the status of the file transfer.
+        if (status)
+        {
+            // Success.
+            printf("\n%s was successfully received from %s into %s.\n",
+                   filename, client->friendly_ip, output_dir);
+        }
+        else
+        {
+            // Failure.
+            printf("\nCould not successfully receive %s from %s.\n", filename,
+                   client->friendly_ip);
+        }
+        RFTP_PROBE3(session_end, filename, status, stats ? stats->bytes : 0);
+    }
+
+    // Return status of the file transfer.
+    stats_close_session(stats, status);
+    end_cipher();
+    free(filename);
+    return status;
+}
+
+/*
+ * Receives a file from a RFTP client, via the Reliable File Transfer Protocol (RFTP).
+ *
+ * Return a successful status if the file was successfully transferred.
+ * Return a failure status if the file could not be transferred, or the
+ * port could not be bound.
+ */
+int rftp_receive_file (char *port_number, char *output_dir, int time_wait,
+        int io_mode, int verbose)
+{
+    host_t client;  // Client host
+    int status = 0; // Status of the file transfer
+
+    // Create a socket and listen on port number.
+    int sockfd = open_server_socket(port_number);
+    if (sockfd == -1)
+    {
+        perror("Unable to bind");
+        return FAILURE;
+    }
+    busy_poll_socket(sockfd);
+    printf("Listening on port %s for a file transfer request ...\n",
+           port_number);
+
+    // If a file transfer was initialized, receive the file.
+    control_message *init = initialize_receive(sockfd, &client, verbose);
+    if (init)
+    {
+        status = receive_session(sockfd, &client, init, output_dir, time_wait,
+                                 io_mode, verbose);
+    }
+
+    // Return status of the file transfer.
+    close(sockfd);
+    free(init);
+    return status;
+}
+
+/*
+ * Gives up on a scheduled transfer session whose client fell silent, or
+ * ends one whose time-wait is over, once its timer expires. The session
+ * is freed by the server loop.
+ */
+static void expire_transfer (timer *expiry, void *arg)
+{
+    transfer_session *session = (transfer_session*) arg; // Session
+
+    if (session->state == TRANSFER_TIME_WAIT)
+    {
+        session->state = TRANSFER_DONE;
+    }
+    else
+    {
+        printf("ERROR: The client %s stopped responding.\n",
+               session->client.friendly_ip);
+        session->state = TRANSFER_FAILED;
+    }
+}
+
+/*
+ * Sends the control message of a fetch session (its initialization or
+ * termination message), and starts its retransmission timer. The timer
+ * of a termination message first expires after the tail-loss probe
+ * timeout of the window, if that is sooner.
+ *
+ * Return a successful status if the message was sent.
+ * Return a failure status if the message could not be sent.
+ */
+static int send_fetch_control (transfer_session *session)
+{
+    fetch_session *fetch = session->fetch; // Served file
+    control_message *ctrl = (control_message*) fetch->control; // Message
+    uint64_t delay = (uint64_t) DEFAULT_TIMEOUT * 1000; // Time until resent
+    uint64_t probe = 0; // Tail-loss probe timeout of the window
+
+    if (send_rftp_message(session->sockfd, &session->client, fetch->control,
+                          ctrl->type, session->verbose) == SEND_ERR)
+    {
+        return FAILURE;
+    }
+    stats_record_sent(session->stats);
+
+    // Resend a termination message early, as a tail-loss probe.
+    fetch->tail_probing = fetch->state == FETCH_TERM && !fetch->resent
+                          && !fetch->tail_probed
+                          && (probe = window_tail_timeout(fetch->flight))
+                          && probe < delay;
+    if (fetch->tail_probing) delay = probe;
+    timer_schedule_after(protocol_timers(), &fetch->retransmit, delay);
+    return SUCCESS;
+}
+
+/*
+ * Resends the control message of a fetch session once its retransmission
+ * timer expires, unless the client is considered gone. A session that
+ * fails is freed by the server loop.
+ */
+static void expire_fetch_control (timer *retransmit, void *arg)
+{
+    transfer_session *session = (transfer_session*) arg; // Session
+    fetch_session *fetch = session->fetch;               // Served file
+    control_message *ctrl = (control_message*) fetch->control; // Message
+
+    // A tail-loss probe is not counted as a timeout or a retransmission.
+    if (fetch->tail_probing)
+    {
+        trace_record(TRACE_RETRANSMIT, ctrl->type, fetch->control);
+        fetch->tail_probed = 1;
+        if (!send_fetch_control(session)) session->state = TRANSFER_FAILED;
+        return;
+    }
+    stats_record_timeout(session->stats);
+    if (retransmit_limit_reached(fetch->resent))
+    {
+        printf("ERROR: The client %s stopped responding.\n",
+               session->client.friendly_ip);
+        session->state = TRANSFER_FAILED;
+        return;
+    }
+    trace_record(TRACE_RETRANSMIT, ctrl->type, fetch->control);
+    RFTP_PROBE2(retransmit, ctrl->type, ntohs(ctrl->seq_num));
+    stats_record_retransmit(session->stats);
+    fetch->resent++;
+    if (!send_fetch_control(session)) session->state = TRANSFER_FAILED;
+}
+
+/*
+ * Resends the oldest data packet in flight of a fetch session once the
+ * retransmission timer of its window expires.
+ */
+static void expire_fetch_window (timer *retransmit, void *arg)
+{
+    transfer_session *session = (transfer_session*) arg; // Session
+
+    if (!window_expire(session->fetch->flight))
+    {
+        if (session->fetch->flight->error == ETIMEDOUT)
+        {
+            printf("ERROR: The client %s stopped responding.\n",
+                   session->client.friendly_ip);
+        }
+        session->state = TRANSFER_FAILED;
+    }
+}
+
+/*
+ * Sends as many packets of the served range as the window of a fetch
+ * session has room for, one message at a time. The bytes come from the
+ * file's cached copy, or else from positional reads of the file, skipping
+ * over its holes, which are sent as hole packets. Runs of zeros are sent
+ * as zero range packets. The data sent is charged to the flow of the
+ * session, so its rate limits hold. Once the whole range is sent and
+ * acknowledged, the termination message is sent.
+ *
+ * Return a successful status if the packets were sent.
+ * Return a failure status if the file could not be read or sent.
+ */
+static int fill_fetch_window (transfer_session *session)
+{
+    fetch_session *fetch = session->fetch; // Served file
+    send_window *flight = fetch->flight;   // Packets in flight
+    uint8_t buffer[DATA_MSS];              // Buffer for positional reads
+    uint8_t *data = NULL;                  // Data of the next data packet
+    off_t position = 0;                    // Offset of the next byte to send
+    off_t start = 0;                       // Start of the next data extent
+    int data_size = 0;                     // Size of the next data packet
+    int capacity = data_capacity();        // Data bytes per packet
+
+    while (fetch->bytes_sent < fetch->length && window_has_room(flight))
+    {
+        // Once the current data extent is sent, find the next one. A hole
+        // is sent after the run of zeros before it.
+        position = fetch->offset + fetch->bytes_sent;
+        if (position >= fetch->extent_end)
+        {
+            start = position;
+            fetch->extent_end = fetch->offset + fetch->length;
+            if (fetch->entry->fd != -1)
+            {
+                start = next_data_extent(fetch->entry->fd, start,
+                                         fetch->extent_end,
+                                         &fetch->extent_end);
+            }
+            if (start > position && fetch->zeros)
+            {
+                if (!send_zero_run(flight, &fetch->zeros)) return FAILURE;
+                fetch->extent_end = position;
+                continue;
+            }
+            if (start > position)
+            {
+                if (!send_hole_packet(flight, start - position))
+                {
+                    return FAILURE;
+                }
+                fetch->bytes_sent = start - fetch->offset;
+                continue;
+            }
+        }
+
+        data_size = (fetch->extent_end - position < capacity)
+                    ? fetch->extent_end - position : capacity;
+        if (!(data = cache_read(fetch->entry, buffer, data_size, position)))
+        {
+            return FAILURE;
+        }
+
+        // Add a packet of zeros to the run of zeros, or else send the run
+        // so far, and the data packet once the window has room for it.
+        if (is_zero_block(data, data_size))
+        {
+            fetch->zeros += data_size;
+        }
+        else if (fetch->zeros)
+        {
+            if (!send_zero_run(flight, &fetch->zeros)) return FAILURE;
+            continue;
+        }
+        else if (!send_data_packet(flight, data_size, data))
+        {
+            return FAILURE;
+        }
+        else
+        {
+            fair_charge(session->flow, data_size);
+        }
+        fetch->bytes_sent += data_size;
+    }
+
+    // Send the last run of zeros, and end the session once every packet
+    // is acknowledged.
+    if (fetch->bytes_sent < fetch->length) return SUCCESS;
+    if (fetch->zeros)
+    {
+        if (!window_has_room(flight)) return SUCCESS;
+        if (!send_zero_run(flight, &fetch->zeros)) return FAILURE;
+    }
+    if (flight->base < flight->next) return SUCCESS;
+
+    free(fetch->control);
+    fetch->control = create_term_message(window_seq(flight),
+                                         session->filename, fetch->length);
+    fetch->resent = 0;
+    fetch->state = FETCH_TERM;
+    return fetch->control && send_fetch_control(session);
+}
+
+/*
+ * Handles a scheduled message of a fetch session, in the state the fetch
+ * is in: the client accepts or rejects the file, acknowledges its data
+ * packets, and then ends the session, which then waits out its time-wait.
+ * Any other message, such as a duplicate of the request, is ignored.
+ *
+ * Return a successful status if the message was handled.
+ * Return a failure status if the client rejected the file, or the data
+ * packets could not be sent.
+ */
+static int serve_fetch_message (transfer_session *session, rftp_message *msg)
+{
+    fetch_session *fetch = session->fetch;          // Served file
+    control_message *ctrl = (control_message*) msg; // Received message
+    int window = 0;                                 // Packets in flight
+
+    switch (fetch->state)
+    {
+        case FETCH_INIT: // The client accepts or rejects the file
+            stats_record_received(session->stats);
+            if (check_rejection(fetch->control, msg, INIT_MSG))
+            {
+                printf("ERROR: %s rejected %s (%s).\n",
+                       session->client.friendly_ip, session->filename,
+                       strerror(ntohl(ctrl->fsize)));
+                return FAILURE;
+            }
+            if (!check_acknowledgment(fetch->control, msg, INIT_MSG))
+            {
+                return SUCCESS;
+            }
+            timer_cancel(protocol_timers(), &fetch->retransmit);
+
+            // Keep no more packets in flight than the rate limits of the
+            // session, or its share of its client's, serve in time.
+            window = fair_window(session->flow, DEFAULT_WINDOW);
+            if (!(fetch->flight = create_send_window(session->sockfd,
+                                                     &session->client, 1,
+                                                     (window > 0) ? window : 1,
+                                                     DEFAULT_TIMEOUT, NULL,
+                                                     session->stats,
+                                                     session->verbose)))
+            {
+                return FAILURE;
+            }
+            timer_init(&fetch->flight->retransmit, expire_fetch_window,
+                       session);
+            fetch->state = FETCH_DATA;
+            return fill_fetch_window(session);
+        case FETCH_DATA: // The client acknowledges data packets
+            if (!window_receive(fetch->flight, msg)) return FAILURE;
+            return fill_fetch_window(session);
+        case FETCH_TERM: // The client ends the session
+            stats_record_received(session->stats);
+            if (check_acknowledgment(fetch->control, msg, TERM_MSG))
+            {
+                timer_cancel(protocol_timers(), &fetch->retransmit);
+                session->state = TRANSFER_TIME_WAIT;
+            }
+            return SUCCESS;
+    }
+    return SUCCESS;
+}
+
+/*
+ * Admits a request for a file, or a byte range of it, under the root
+ * directory, as a scheduled fetch session: the key exchange is answered,
+ * the file is opened through the file cache, and the initialization
+ * message of the transfer is sent to the client. The file is then sent
+ * as the client acknowledges it, while the server goes on with other
+ * clients. A request for a file or range that cannot be served is
+ * rejected with the cause of the error.
+ *
+ * Return the session, if the file is being served.
+ * Return NULL if the request was rejected.
+ */
+static transfer_session *admit_fetch_session (int sockfd, host_t *client,
+        rftp_message *request, char *root, file_cache *cache,
+        fair_scheduler *scheduler, int verbose)
+{
+    control_message *get = (control_message*) request; // File request
+    range_message *range = (range_message*) request;   // Range request
+    transfer_session *session = NULL; // Session of the transfer
+    fetch_session *fetch = NULL; // Served file
+    cache_entry *entry = NULL;   // Cache entry of the file
+    char *filename = NULL;       // Name of the requested file
+    char *path = NULL;           // Real pathname of the requested file
+    uint8_t *fname = NULL;       // Filename in the request
+    uint32_t fname_len = 0;      // Length of the filename in the request
+    int64_t offset = 0;          // Offset of the requested range
+    int64_t length = 0;          // Length of the requested range
+    uint64_t hits = cache->hits; // Cache hits before the request
+    int error = 0;               // Cause of the rejection
+
+    // Get the requested filename and range from the request message.
+    if (get->type == RANGE_MSG)
+    {
+        fname = range->fname;
+        fname_len = ntohl(range->fname_len);
+        offset = range_offset(range);
+        length = ntohl(range->range_len);
+        if (fname_len > RANGE_FNAME_MSS) fname_len = RANGE_FNAME_MSS;
+    }
+    else
+    {
+        fname = get->fname;
+        fname_len = ntohl(get->fname_len);
+        if (fname_len > FNAME_MSS) fname_len = FNAME_MSS;
+    }
+    if (!(filename = malloc(fname_len + 1))) return NULL;
+    memcpy(filename, fname, fname_len);
+    filename[fname_len] = '\0';
+
+    // Answer the key exchange of the client, before looking for the file.
+    if (!answer_key_exchange(sockfd, client, request, verbose))
+    {
+        free(filename);
+        return NULL;
+    }
+
+    // Find the file under the root, and open it through the cache.
+    if (!(path = get_served_path(root, filename))
+            || !(entry = cache_acquire(cache, path)))
+    {
+        error = errno;
+    }
+    else
+    {
+        // Resolve the range against the size of the file. A negative
+        // offset counts back from the end, and a length of 0 (or one
+        // past the end) extends to the end. The offset is compared before
+        // it is negated, since the most negative offset has no negation.
+        if (offset < 0) offset = (offset < -(int64_t) entry->size)
+                                 ? 0 : (int64_t) entry->size + offset;
+        if (offset > (int64_t) entry->size) error = ERANGE;
+        else if (length == 0 || length > (int64_t) entry->size - offset)
+        {
+            length = (int64_t) entry->size - offset;
+        }
+        if (!error && length > MAX_FSIZE) error = EFBIG;
+    }
+    if (!error && (!(session = (transfer_session*)
+                              calloc(1, sizeof(transfer_session)))
+                   || !(fetch = (fetch_session*)
+                                calloc(1, sizeof(fetch_session)))
+                   || !(session->request = (rftp_message*)
+                                           malloc(sizeof(rftp_message)))))
+    {
+        if (session) free(session->request);
+        free(fetch);
+        error = ENOMEM;
+    }
+
+    // Reject the request.
+    if (error)
+    {
+        printf("ERROR: %s could not be served to %s (%s).\n", filename,
+               client->friendly_ip, strerror(error));
+        reject_message(sockfd, client, request, get->type, error, verbose);
+        end_cipher();
+        cache_release(cache, entry);
+        free(session);
+        free(path);
+        free(filename);
+        return NULL;
+    }
+
+    // Open the session, which owns the filename and the file.
+    session->sockfd = sockfd;
+    session->client = *client;
+    session->filename = filename;
+    session->filesize = (int) length;
+    session->verbose = verbose;
+    session->state = TRANSFER_ACTIVE;
+    session->fetch = fetch;
+    fetch->cache = cache;
+    fetch->entry = entry;
+    fetch->path = path;
+    memcpy(session->request, request, sizeof(rftp_message));
+    fetch->offset = offset;
+    fetch->length = (int) length;
+    fetch->extent_end = offset;
+    fetch->state = FETCH_INIT;
+    timer_init(&fetch->retransmit, expire_fetch_control, session);
+    timer_init(&session->expiry, expire_transfer, session);
+    session->stats = stats_open_session(SEND, filename, (int) length);
+    stats_set_peer(session->stats, client);
+    stats_record_received(session->stats);
+
+    // Initialize the transfer session with the client, answering its
+    // key exchange, and schedule its acknowledgments.
+    if (!(session->flow = fair_open_flow(scheduler, client, session))
+            || !(fetch->control = create_control_message(INIT_MSG, 0,
+                                                         filename,
+                                                         (int) length))
+            || !add_session_hello(fetch->control)
+            || !send_fetch_control(session))
+    {
+        printf("ERROR: %s could not be served to %s.\n", filename,
+               client->friendly_ip);
+        fair_close_flow(scheduler, session->flow);
+        stats_close_session(session->stats, FAILURE);
+        end_cipher();
+        free(filename);
+        close_transfer_session(session);
+        return NULL;
+    }
+
+    if (length == (int64_t) entry->size)
+    {
+        printf("Serving %s (%d bytes) to %s (cache %s) ...\n", filename,
+               (int) length, client->friendly_ip,
+               (cache->hits > hits) ? "hit" : "miss");
+    }
+    else
+    {
+        printf("Serving bytes %lld-%lld of %s to %s (cache %s) ...\n",
+               (long long) offset, (long long) (offset + length),
+               filename, client->friendly_ip,
+               (cache->hits > hits) ? "hit" : "miss");
+    }
+    RFTP_PROBE3(session_start, filename, (int) length, client->friendly_ip);
+    timer_schedule_after(protocol_timers(), &session->expiry,
+                         (uint64_t) IDLE_TIMEOUT * 1000);
+    return session;
+}
+
+/*
+ * Admits the transfer session of a client to the scheduler, once its
+ * initialization message is received: the key exchange is answered, and
+ * the output file is created, before the initialization is acknowledged.
+ * With a pre-shared key, the file is only created once the client proves
+ * its key (see defer_transfer_session).
+ * An initialization message without a filename starts a multiplexed
+ * session, whose files are created as their streams are opened, within
+ * the size it gives. The session owns its filename and statistics.
+ *
+ * Return the session, if the transfer was accepted.
+ * Return NULL if the transfer was rejected.
+ */
+static transfer_session *admit_transfer_session (int sockfd, host_t *client,
+        control_message *init, char *output_dir, fair_scheduler *scheduler,
+        int io_mode, int verbose)
+{
+    transfer_session *session = NULL; // Session of the transfer
+    output_file *target = NULL;       // Target file
+    session_stats *stats = NULL;      // Statistics of the transfer session
+    rftp_message *request = NULL;     // Initialization message, as sent
+    char *filename = NULL;            // Name of the file being transferred
+    int filesize = ntohl(init->fsize); // Size of the file being transferred
+    int multiplexed = (ntohl(init->fname_len) == 0); // Files of streams
+    uint64_t token = create_session_token(); // Token of joining paths
+
+    // Keep the initialization message as the client sent it, before it is
+    // answered in place, to know its duplicates.
+    if ((request = (rftp_message*) malloc(sizeof(rftp_message))))
+    {
+        memcpy(request, init, sizeof(rftp_message));
+    }
+
+    // Get the file's information from the init message.
+    if (!(filename = copy_init_filename(init)))
+    {
+        perror("Unable to receive file");
+        free(request);
+        return NULL;
+    }
+
+    // Start the statistics of the transfer session.
+    stats = stats_open_session(RECV, filename, filesize);
+    stats_set_peer(stats, client);
+    stats_record_received(stats);
+
+    // If the key exchange was answered and the output file was created,
+    // or is deferred until the client proves its key, accept the file
+    // transfer, giving the client the session's token, and schedule its
+    // messages.
+    if (request
+            && answer_key_exchange(sockfd, client, (rftp_message*) init,
+                                   verbose)
+            && add_session_hello((rftp_message*) init)
+            && add_session_token((rftp_message*) init, token)
+            && (multiplexed
+                ? acknowledge_message(sockfd, client, (rftp_message*) init,
+                                      INIT_MSG, verbose) != SEND_ERR
+                : crypto_configured()
+                ? defer_transfer_session(sockfd, client, init, filename,
+                                         output_dir, verbose)
+                : !!(target = accept_transfer_session(sockfd, client, init,
+                                                      filename, output_dir,
+                                                      io_mode, verbose))))
+    {
+        stats_record_sent(stats);
+        if ((session = open_transfer_session(sockfd, client, target, filename,
+                                             filesize, output_dir, stats,
+                                             verbose))
+                && (session->flow = fair_open_flow(scheduler, client,
+                                                   session)))
+        {
+            session->token = token;
+            session->request = request;
+            session->io_mode = io_mode;
+            session->multiplexed = multiplexed;
+            session->deferred = !multiplexed && !target;
+            if (multiplexed)
+            {
+                printf("Receiving multiplexed files (%d bytes) from %s ...\n",
+                       filesize, client->friendly_ip);
+            }
+            else
+            {
+                printf("Receiving %s (%d bytes) from %s ...\n", filename,
+                       filesize, client->friendly_ip);
+            }
+            RFTP_PROBE3(session_start, filename, filesize,
+                        client->friendly_ip);
+            timer_init(&session->expiry, expire_transfer, session);
+            timer_schedule_after(protocol_timers(), &session->expiry,
+                                 (uint64_t) IDLE_TIMEOUT * 1000);
+            return session;
+        }
+        close_transfer_session(session);
+    }
+
+    stats_close_session(stats, FAILURE);
+    end_cipher();
+    free(request);
+    free(filename);
+    return NULL;
+}
+
+/*
+ * Finds the scheduled transfer session a message belongs to: the session
+ * of its client, or of the path it comes from. A request to join another
+ * path from a new host belongs to the session whose token it carries.
+ *
+ * Return the session of the message.
+ * Return NULL if the message belongs to no session.
+ */
+static transfer_session *find_transfer_session (transfer_session *sessions,
+        rftp_message *msg, host_t *from)
+{
+    control_message *join = (control_message*) msg; // Join request
+    transfer_session *session = NULL;               // Scheduled session
+    uint64_t token = 0;                             // Token of the request
+    int i;
+
+    for (session = sessions; session; session = session->next)
+    {
+        if (same_host(from, &session->client)) return session;
+        for (i = 0; i < session->path_count; i++)
+        {
+            if (same_host(from, &session->paths[i])) return session;
+        }
+    }
+    if (join->type != JOIN_MSG || !(token = find_session_token(msg)))
+    {
+        return NULL;
+    }
+
+    for (session = sessions; session; session = session->next)
+    {
+        if (session->state == TRANSFER_ACTIVE && session->token == token)
+        {
+            return session;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Handles a scheduled message of a transfer session, once the scheduler
+ * serves it. Once the termination message is received and the file is
+ * fully written, the termination is acknowledged, and the session waits
+ * out its time-wait for duplicates of it.
+ */
+static void serve_transfer_message (fair_scheduler *scheduler,
+        transfer_session *session, rftp_message *msg, host_t *from,
+        int time_wait)
+{
+    if (session->state != TRANSFER_ACTIVE)
+    {
+        free(msg);
+        return;
+    }
+    if (session->fetch)
+    {
+        if (!serve_fetch_message(session, msg))
+        {
+            session->state = TRANSFER_FAILED;
+        }
+        free(msg);
+
+        // Once the client ends the session, stop scheduling it, and wait
+        // out any duplicates of its request.
+        if (session->state == TRANSFER_TIME_WAIT)
+        {
+            fair_close_flow(scheduler, session->flow);
+            session->flow = NULL;
+            timer_schedule_after(protocol_timers(), &session->expiry,
+                                 (uint64_t) time_wait * 1000);
+        }
+        return;
+    }
+    if (!receive_transfer_message(session, msg, from))
+    {
+        session->state = TRANSFER_FAILED;
+        return;
+    }
+    if (!session->term) return;
+
+    // End the file transfer, and stop scheduling the session.
+    if (!complete_transfer(session)
+            || acknowledge_message(session->sockfd, &session->client,
+                                   (rftp_message*) session->term, TERM_MSG,
+                                   session->verbose) == SEND_ERR)
+    {
+        session->state = TRANSFER_FAILED;
+        return;
+    }
+    stats_record_sent(session->stats);
+    fair_close_flow(scheduler, session->flow);
+    session->flow = NULL;
+    session->state = TRANSFER_TIME_WAIT;
+    timer_schedule_after(protocol_timers(), &session->expiry,
+                         (uint64_t) time_wait * 1000);
+}
+
+/*
+ * Returns whether a message opens a session: an initialization message,
+ * or a request for a file or a range of one.
+ */
+static int opening_message (control_message *msg)
+{
+    return msg->ack == NAK && ((msg->type == INIT_MSG
+                                && ntohs(msg->seq_num) == 0)
+                               || msg->type == GET_MSG
+                               || msg->type == RANGE_MSG);
+}
+
+/*
+ * Returns whether a message from the client of a session in its time-wait
+ * opens its next session, rather than being a duplicate of the message
+ * that opened this one, which a late or resent copy would be.
+ */
+static int new_session_message (transfer_session *session, rftp_message *msg)
+{
+    if (!opening_message((control_message*) msg)) return 0;
+    return msg->length != session->request->length
+           || memcmp(msg->buffer, session->request->buffer, msg->length);
+}
+
+/*
+ * Handles a message of a transfer session in its time-wait: a duplicate
+ * termination message of an upload is acknowledged again, and restarts
+ * the wait. A duplicate of the message that opened the session is not
+ * admitted again, so a finished file is neither received nor served
+ * twice. Any other message is ignored.
+ */
+static void wait_transfer_message (transfer_session *session,
+        rftp_message *msg, host_t *from, int time_wait)
+{
+    if (opening_message((control_message*) msg))
+    {
+        stats_record_received(session->stats);
+        stats_record_duplicate(session->stats);
+    }
+    else if (!session->fetch && same_host(from, &session->client)
+            && ((control_message*) msg)->type == TERM_MSG)
+    {
+        acknowledge_message(session->sockfd, &session->client, msg, TERM_MSG,
+                            session->verbose);
+        timer_schedule_after(protocol_timers(), &session->expiry,
+                             (uint64_t) time_wait * 1000);
+        stats_record_received(session->stats);
+        stats_record_sent(session->stats);
+        stats_record_duplicate(session->stats);
+    }
+    free(msg);
+}
+
+/*
+ * Reports and frees the scheduled transfer sessions that ended.
+ */
+static void reap_transfer_sessions (transfer_session **sessions,
+        fair_scheduler *scheduler)
+{
+    transfer_session *session = NULL; // Scheduled session
+    int status = FAILURE;             // Status of the file transfer
+
+    while ((session = *sessions))
+    {
+        if (session->state < TRANSFER_DONE)
+        {
+            sessions = &session->next;
+            continue;
+        }
+        *sessions = session->next;
+
+        // Report the status of the file transfer.
+        status = (session->state == TRANSFER_DONE);
+        if (status && session->fetch)
+        {
+            printf("%s was successfully sent to %s.\n", session->filename,
+                   session->client.friendly_ip);
+        }
+        else if (session->fetch)
+        {
+            printf("Could not successfully send %s to %s.\n",
+                   session->filename, session->client.friendly_ip);
+        }
+        else if (status && session->multiplexed)
+        {
+            printf("%d files were successfully received from %s into %s.\n",
+                   session->stream_count, session->client.friendly_ip,
+                   session->store_dir);
+        }
+        else if (status)
+        {
+            printf("%s was successfully received from %s into %s.\n",
+                   session->filename, session->client.friendly_ip,
+                   session->store_dir);
+        }
+        else if (session->multiplexed)
+        {
+            printf("Could not successfully receive the multiplexed files "
+                   "from %s.\n", session->client.friendly_ip);
+        }
+        else
+        {
+            printf("Could not successfully receive %s from %s.\n",
+                   session->filename, session->client.friendly_ip);
+        }
+        RFTP_PROBE3(session_end, session->filename, status,
+                    session->stats ? session->stats->bytes : 0);
+
+        // Free the session.
+        timer_cancel(protocol_timers(), &session->expiry);
+        fair_close_flow(scheduler, session->flow);
+        stats_close_session(session->stats, status);
+        end_cipher();
+        free(session->filename);
+        close_transfer_session(session);
+    }
+}
+
+/*
+ * Serves the files under a root directory to RFTP clients that request
+ * them, until the process is stopped. Served files are kept in a cache of
+ * the given size, in bytes. When an output directory is given, files that
+ * clients transfer to the server are received into it as well; otherwise,
+ * transfers are rejected.
+ *
+ * Transfers are received and files served concurrently: the messages of
+ * each session are queued, and served by a fair scheduler, which shares
+ * the server among clients by weight, within the rate limits of each
+ * session and client (see rftp-fair.h), so one client's bulk transfer
+ * cannot hold up the others. A file being received by one session is
+ * not accepted from another until it is complete. With a pre-shared key,
+ * the cipher of the process belongs to one session at a time, so other
+ * clients are not answered until it ends.
+ *
+ * Return a failure status if the server could not be started.
+ */
+int rftp_serve (char *port_number, char *root, char *output_dir,
+        size_t cache_size, int time_wait, int io_mode, int verbose)
+{
+    file_cache *cache = NULL;           // Cache of the served files
+    fair_scheduler *scheduler = NULL;   // Scheduler of the transfer sessions
+    transfer_session *sessions = NULL;  // Transfer sessions being received
+    transfer_session *session = NULL;   // Session of a received message
+    fair_flow *flow = NULL;             // Flow of a scheduled message
+    control_message *msg = NULL;        // Received RFTP control message
+    rftp_message *served = NULL;        // Message served by the scheduler
+    host_t client;                      // Client host
+    int wait = 0;                       // Time to wait for messages, in msec
+    int timeout = 0;                    // Time until the next timer, in msec
+    int count = 0;                      // Messages read or served in a turn
+
+    if (!(cache = create_file_cache(cache_size)))
+    {
+        perror("Unable to create file cache");
+        return FAILURE;
+    }
+    if (!(scheduler = create_fair_scheduler()))
+    {
+        perror("Unable to create scheduler");
+        free_file_cache(cache);
+        return FAILURE;
+    }
+
+    // Create a socket and listen on port number. A client that stops
+    // responding is given up on, so that other clients can be served.
+    int sockfd = open_server_socket(port_number);
+    struct pollfd fd = { .fd = sockfd, .events = POLLIN };
+    if (sockfd == -1)
+    {
+        perror("Unable to bind");
+        free_fair_scheduler(scheduler);
+        free_file_cache(cache);
+        return FAILURE;
+    }
+    busy_poll_socket(sockfd);
+    set_retransmit_limit(SERVE_RETRANSMITS);
+    printf("Serving %s on port %s ...\n", root, port_number);
+
+    while (1)
+    {
+        // Wait for messages until the next timer is due, a throttled
+        // session may be served again, or the statistics are reported.
+        wait = fair_next_timeout(scheduler);
+        timeout = timer_next_timeout(protocol_timers(), timer_now());
+        if (wait == -1 || (timeout != -1 && timeout < wait)) wait = timeout;
+        timeout = stats_next_timeout();
+        if (wait == -1 || (timeout != -1 && timeout < wait)) wait = timeout;
+        if (busy_poll_enabled()) busy_poll_wait(&fd, wait);
+        else poll(&fd, 1, wait);
+
+        // Read the waiting messages, queueing those of transfer sessions.
+        for (count = 0; count < FAIR_BATCH
+                        && (msg = (control_message*)
+                            receive_waiting_rftp_message(sockfd, &client,
+                                                         verbose)); count++)
+        {
+            session = find_transfer_session(sessions, (rftp_message*) msg,
+                                            &client);
+
+            // A new initialization message or request from a client in
+            // its time-wait starts its next session; a duplicate of the
+            // one that opened the session is left to the wait.
+            if (session && session->state == TRANSFER_TIME_WAIT
+                    && new_session_message(session, (rftp_message*) msg))
+            {
+                session->state = TRANSFER_DONE;
+                reap_transfer_sessions(&sessions, scheduler);
+                session = NULL;
+            }
+            if (session && session->state == TRANSFER_ACTIVE)
+            {
+                timer_schedule_after(protocol_timers(), &session->expiry,
+                                     (uint64_t) IDLE_TIMEOUT * 1000);
+                if (!fair_enqueue(scheduler, session->flow,
+                                  (rftp_message*) msg, &client))
+                {
+                    free(msg);
+                }
+                continue;
+            }
+            if (session && session->state == TRANSFER_TIME_WAIT)
+            {
+                wait_transfer_message(session, (rftp_message*) msg, &client,
+                                      time_wait);
+                continue;
+            }
+
+            // With a pre-shared key, other clients wait for the session.
+            if (session || (crypto_configured() && sessions))
+            {
+                free(msg);
+                continue;
+            }
+
+            // Serve a requested file, or a range of it.
+            if ((msg->type == GET_MSG || msg->type == RANGE_MSG)
+                    && msg->ack == NAK)
+            {
+                if ((session = admit_fetch_session(sockfd, &client,
+                                                   (rftp_message*) msg, root,
+                                                   cache, scheduler,
+                                                   verbose)))
+                {
+                    session->next = sessions;
+                    sessions = session;
+                }
+            }
+            // Receive a transferred file, if transfers are accepted.
+            else if (msg->type == INIT_MSG && msg->ack == NAK
+                     && ntohs(msg->seq_num) == 0)
+            {
+                if (!output_dir)
+                {
+                    reject_message(sockfd, &client, (rftp_message*) msg,
+                                   INIT_MSG, EACCES, verbose);
+                }
+                else if (msg->fname_len
+                         && receiving_file(sessions, (char*) msg->fname,
+                                           init_fname_len(msg)))
+                {
+                    printf("ERROR: %.*s is already being received.\n",
+                           (int) init_fname_len(msg), (char*) msg->fname);
+                    reject_message(sockfd, &client, (rftp_message*) msg,
+                                   INIT_MSG, EBUSY, verbose);
+                }
+                else if ((session = admit_transfer_session(sockfd, &client,
+                                                           msg, output_dir,
+                                                           scheduler, io_mode,
+                                                           verbose)))
+                {
+                    session->scheduled = &sessions;
+                    session->next = sessions;
+                    sessions = session;
+                }
+            }
+            // A path cannot join a session without its token.
+            else if (msg->type == JOIN_MSG && msg->ack == NAK)
+            {
+                reject_message(sockfd, &client, (rftp_message*) msg,
+                               JOIN_MSG, EACCES, verbose);
+            }
+
+            // Any other message is left over from an earlier session.
+            free(msg);
+        }
+
+        // Handle the queued messages of the transfer sessions, in the
+        // order the scheduler serves them.
+        for (count = 0; count < FAIR_BATCH
+                        && (flow = fair_next(scheduler, &served, &client));
+             count++)
+        {
+            serve_transfer_message(scheduler,
+                                   (transfer_session*) flow->owner, served,
+                                   &client, time_wait);
+        }
+
+        // Expire the timers of the sessions, and free those that ended.
+        timer_advance(protocol_timers(), timer_now());
+        reap_transfer_sessions(&sessions, scheduler);
+        stats_poll();
+    }
+
+    close(sockfd);
+    free_fair_scheduler(scheduler);
+    free_file_cache(cache);
+    return FAILURE;
 }
@@ -5,7 +5,8 @@
  *  Copyright   : MIT 2014 © Edmund Luong
  *  Date        : November 11, 2014
  *  Description : Implementation of a Reliable File Transfer Protocol server,
- *                used to receive a file transfer from a RFTP client.
+ *                used to receive a file transfer from a RFTP client, or to
+ *                serve files to RFTP clients that request them.
  *
  *  CS 3357a Assignment 2
  */
@@ -15,17 +16,129 @@
 
 #include "rftp-messages.h"
 #include "udp-sockets.h"
+#include "output-file.h"
+#include "rftp-stats.h"
+#include "rftp-cache.h"
+#include "rftp-store.h"
+#include "rftp-window.h"
+#include "rftp-timer.h"
+#include "rftp-fair.h"
+
+#include <stddef.h>
+
+/*
+ * Transfer-oriented macros
+ */
+#define TRANSFER_ACTIVE 0    // Receiving the file
+#define TRANSFER_TIME_WAIT 1 // Waiting for duplicate termination messages
+#define TRANSFER_DONE 2      // The file was received
+#define TRANSFER_FAILED 3    // The file could not be received
+#define FETCH_INIT 0         // Waiting for the client to accept the file
+#define FETCH_DATA 1         // Sending the data packets of the file
+#define FETCH_TERM 2         // Waiting for the client to end the session
+
+/*
+ * Transfer stream
+ *
+ * A file received within a multiplexed transfer session, whose packets
+ * arrive interleaved with those of the other files of the session.
+ */
+typedef struct transfer_stream
+{
+    output_file *target;         // Target file, until it is fully written
+    char *filename;              // Name of the file being received
+    int filesize;                // Size of the file being received
+    int bytes_recv;              // Number of bytes of the file received
+} transfer_stream;
+
+/*
+ * Fetch session
+ *
+ * The sending end of a transfer session that serves a requested file, or
+ * a byte range of it, to the client that requested it. Its data packets
+ * are sent as its window has room, and its messages resent by its timers,
+ * so the server goes on with other clients while it is served.
+ */
+typedef struct fetch_session
+{
+    file_cache *cache;           // Cache the served file is released to
+    cache_entry *entry;          // Cache entry of the served file
+    char *path;                  // Real pathname of the served file
+    off_t offset;                // Offset of the served range
+    int length;                  // Length of the served range
+    int bytes_sent;              // Bytes of the range sent so far
+    off_t extent_end;            // End of the current data extent
+    int64_t zeros;               // Length of the run of zeros not yet sent
+    int state;                   // State of the fetch
+    rftp_message *control;       // Initialization or termination message
+    timer retransmit;            // Retransmission timer of the control message
+    int resent;                  // Times the control message was resent
+    int tail_probing;            // Whether the timer expires to probe the tail
+    int tail_probed;             // Whether the tail was probed
+    send_window *flight;         // Data packets in flight
+} fetch_session;
+
+/*
+ * Transfer session
+ *
+ * The receiving end of a transfer session, from the acceptance of its
+ * initialization message to its termination message. Each message of the
+ * client is handled in turn, whether the server reads it from a socket of
+ * its own, or schedules it among the messages of other sessions. A
+ * multiplexed session receives many files at once, one per stream, into
+ * the store directory. A scheduled session may instead serve a file the
+ * client fetches, whose acknowledgments are scheduled the same way.
+ */
+typedef struct transfer_session
+{
+    int sockfd;                  // Socket of the session
+    host_t client;               // Client of the session
+    host_t paths[MAX_PATHS - 1]; // Other paths joined to the session
+    int path_count;              // Number of paths joined to the session
+    uint64_t token;              // Token of the paths joining the session
+    output_file *target;         // Target file
+    char *filename;              // Name of the file being received
+    int filesize;                // Size of the file being received
+    char *store_dir;             // Directory of the chunk store
+    int io_mode;                 // I/O mode of the files of streams
+    int deferred;                // Creates the file once the key is proven
+    int multiplexed;             // Receives files of streams, not one file
+    transfer_stream *streams;    // Files of a multiplexed session
+    int stream_count;            // Number of streams opened
+    dedup_session *dedup;        // Deduplication of the transfer
+    receive_window *window;      // Packets received out of order
+    int next_seq;                // Next expected sequence number
+    int bytes_recv;              // Total number of bytes received
+    int progress;                // Outputs the progress of the transfer
+    int last_mult;               // Last outputted progress multiple
+    control_message *term;       // Termination message, once received
+    rftp_message *request;       // Message that opened the session, as sent
+    session_stats *stats;        // Statistics of the session
+    int verbose;                 // Verbose output
+    int state;                   // State of a scheduled session
+    fair_flow *flow;             // Queued messages of a scheduled session
+    fetch_session *fetch;        // File served to the client, if fetched
+    timer expiry;                // Idle or time-wait timer of the session
+    struct transfer_session *next; // Next scheduled session
+    struct transfer_session **scheduled; // Scheduled sessions, if scheduled
+} transfer_session;
 
 /*
  * Function prototypes.
  */
-control_message *accept_transfer_session (int sockfd, host_t *source,
+control_message *initialize_receive (int sockfd, host_t *source, int verbose);
+output_file *accept_transfer_session (int sockfd, host_t *source,
+        control_message *init, char *filename, char *output_dir, int io_mode,
         int verbose);
-int receive_file (int sockfd, host_t *source, char *filename, int filesize,
-        char *output_dir, int time_wait, int verbose);
+int receive_file (int sockfd, host_t *source, output_file *target,
+        char *filename, int filesize, uint64_t token, char *store_dir,
+        int io_mode, int time_wait, session_stats *stats, int verbose);
 int end_receive_session (int sockfd, host_t *source, control_message *term,
-        FILE *target, int time_wait, int verbose);
-int rftp_receive_file (char *port_number, char *output_dir, int time_wait,
+        int time_wait, session_stats *stats,
         int verbose);
+int rftp_receive_file (char *port_number, char *output_dir, int time_wait,
+        int io_mode, int verbose);
+int rftp_serve (char *port_number, char *root, char *output_dir,
+        size_t cache_size, int time_wait, int io_mode, int verbose);
 
 #endif /* RFTP_SERVER_H */
@@ -0,0 +1,447 @@
+/*
+ *  Name        : rftp-session.c
+ *  Author      : Edmund Luong <edmundvmluong@gmail.com>
+ *  Version     : 1.0
+ *  Copyright   : MIT 2014 © Edmund Luong
+ *  Date        : November 16, 2014
+ *  Description : Implementation of non-blocking transfer sessions of the
+ *                Reliable File Transfer Protocol, which are driven by the
+ *                event loop of the program that embeds them, rather than
+ *                blocking it until the transfer ends.
+ *
+ *  CS 3357a Assignment 2
+ */
+
+#include "rftp-session.h"
+#include "rftp-protocol.h"
+#include "rftp-config.h"
+#include "rftp-crypto.h"
+#include "rftp-trace.h"
+#include "rftp-probes.h"
+#include "udp-client.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+/*
+ * Ends a session with a state, stopping its timers, and calls its
+ * callback last, since the callback may free the session.
+ */
+static void finish_session (rftp_session *session, int state)
+{
+    timer_cancel(protocol_timers(), &session->retransmit);
+    if (session->flight)
+    {
+        timer_cancel(protocol_timers(), &session->flight->retransmit);
+    }
+    session->state = state;
+    stats_close_session(session->stats, state == SESSION_DONE);
+    session->stats = NULL;
+    if (session->done)
+    {
+        session->done(session, state == SESSION_DONE, session->arg);
+    }
+}
+
+/*
+ * Ends a session as failed, keeping the first cause of its failure.
+ */
+static void fail_session (rftp_session *session, int error)
+{
+    if (!session->error) session->error = error;
+    finish_session(session, SESSION_FAILED);
+}
+
+/*
+ * Sends the control message of a session (its initialization or
+ * termination message), and starts its retransmission timer. The timer
+ * of a termination message first expires after the tail-loss probe
+ * timeout of the window, if that is sooner.
+ *
+ * Return a successful status if the message was sent.
+ * Return a failure status if the message could not be sent.
+ */
+static int send_control (rftp_session *session)
+{
+    control_message *ctrl = (control_message*) session->control; // Message
+    uint64_t delay = 0;   // Time until the message is resent
+    uint64_t probe = 0;   // Tail-loss probe timeout of the window
+
+    if (send_rftp_message(session->sockfd, &session->server, session->control,
+                          ctrl->type, session->verbose) == SEND_ERR)
+    {
+        return FAILURE;
+    }
+    stats_record_sent(session->stats);
+
+    // Resend a termination message early, as a tail-loss probe.
+    delay = (uint64_t) session->timeout * 1000;
+    session->tail_probing = session->state == SESSION_TERM
+                            && !session->resent && !session->tail_probed
+                            && (probe = window_tail_timeout(session->flight))
+                            && probe < delay;
+    if (session->tail_probing) delay = probe;
+    timer_schedule_after(protocol_timers(), &session->retransmit, delay);
+    return SUCCESS;
+}
+
+/*
+ * Resends the control message of a session once its retransmission
+ * timer expires, unless the server is considered gone.
+ */
+static void expire_control (timer *retransmit, void *arg)
+{
+    rftp_session *session = (rftp_session*) arg; // Session of the message
+    control_message *ctrl = (control_message*) session->control; // Message
+
+    // A tail-loss probe is not counted as a timeout or a retransmission.
+    if (session->tail_probing)
+    {
+        trace_record(TRACE_RETRANSMIT, ctrl->type, session->control);
+        session->tail_probed = 1;
+        if (!send_control(session)) fail_session(session, EIO);
+        return;
+    }
+    stats_record_timeout(session->stats);
+    if (retransmit_limit_reached(session->resent))
+    {
+        fail_session(session, ETIMEDOUT);
+        return;
+    }
+    trace_record(TRACE_RETRANSMIT, ctrl->type, session->control);
+    RFTP_PROBE2(retransmit, ctrl->type, ntohs(ctrl->seq_num));
+    stats_record_retransmit(session->stats);
+    session->resent++;
+    if (!send_control(session)) fail_session(session, EIO);
+}
+
+/*
+ * Resends the oldest data packet in flight once the retransmission timer
+ * of the window expires.
+ */
+static void expire_window (timer *retransmit, void *arg)
+{
+    rftp_session *session = (rftp_session*) arg; // Session of the window
+
+    if (!window_expire(session->flight))
+    {
+        fail_session(session, session->flight->error
+                              ? session->flight->error : EIO);
+    }
+}
+
+/*
+ * Sends as many data packets of the file as the window has room for.
+ * Once the whole file is sent and acknowledged, the termination message
+ * is sent.
+ *
+ * Return a successful status if the packets were sent.
+ * Return a failure status if the file could not be read or sent.
+ */
+static int fill_window (rftp_session *session)
+{
+    uint8_t buffer[DATA_MSS];       // Buffer to hold data
+    int capacity = data_capacity(); // Data bytes per packet
+    int size = 0;                   // Size of the next data packet
+
+    while (session->bytes_sent < session->filesize
+           && window_has_room(session->flight))
+    {
+        size = session->filesize - session->bytes_sent;
+        if (size > capacity) size = capacity;
+        if (pread(session->fd, buffer, size, session->bytes_sent) != size
+                || !send_data_packet(session->flight, size, buffer))
+        {
+            return FAILURE;
+        }
+        session->bytes_sent += size;
+    }
+
+    // End the session once every data packet is acknowledged.
+    if (session->bytes_sent == session->filesize
+            && session->flight->base == session->flight->next)
+    {
+        free(session->control);
+        session->control = create_term_message(window_seq(session->flight),
+                                               session->filename,
+                                               session->filesize);
+        session->resent = 0;
+        session->state = SESSION_TERM;
+        return session->control && send_control(session);
+    }
+    return SUCCESS;
+}
+
+/*
+ * Handles a message the server sent to a session, in the state the
+ * session is in.
+ *
+ * Return a successful status if the message was handled.
+ * Return a failure status if the server rejected the session, or the
+ * data packets could not be sent.
+ */
+static int handle_message (rftp_session *session, rftp_message *msg)
+{
+    control_message *ctrl = (control_message*) msg; // Received message
+
+    switch (session->state)
+    {
+        case SESSION_INIT: // The server accepts or rejects the session
+            stats_record_received(session->stats);
+            if (check_rejection(session->control, msg, INIT_MSG))
+            {
+                session->error = ntohl(ctrl->fsize);
+                return FAILURE;
+            }
+            if (!check_acknowledgment(session->control, msg, INIT_MSG))
+            {
+                return SUCCESS;
+            }
+            timer_cancel(protocol_timers(), &session->retransmit);
+            if (!(session->flight = create_send_window(session->sockfd,
+                                                       &session->server, 1,
+                                                       session->window,
+                                                       session->timeout, NULL,
+                                                       session->stats,
+                                                       session->verbose)))
+            {
+                return FAILURE;
+            }
+            timer_init(&session->flight->retransmit, expire_window, session);
+            session->state = SESSION_DATA;
+            return fill_window(session);
+        case SESSION_DATA: // The server acknowledges data packets
+            if (!window_receive(session->flight, msg)) return FAILURE;
+            return fill_window(session);
+        case SESSION_TERM: // The server ends the session
+            stats_record_received(session->stats);
+            if (check_acknowledgment(session->control, msg, TERM_MSG))
+            {
+                timer_cancel(protocol_timers(), &session->retransmit);
+                session->state = SESSION_DONE;
+            }
+            return SUCCESS;
+    }
+    return SUCCESS;
+}
+
+/*
+ * Starts a non-blocking transfer of a file to a RFTP server, through a
+ * socket that the program keeps: the socket is made non-blocking, and
+ * the initialization message is sent. Up to a window of data packets are
+ * kept in flight once the server accepts the session. The transfer then
+ * progresses as the program calls rftp_session_readable and
+ * rftp_expire_timers, and the callback, if any, is called once it ends.
+ * Once a session ends, the socket may carry another session to the same
+ * server. Files are sent whole; holes, runs of zeros, deduplication and
+ * encryption are left to rftp_transfer_file, so sessions are refused
+ * once the process has loaded a pre-shared key, rather than sending the
+ * file in the clear. Errors are not printed: a session that fails keeps
+ * their cause for rftp_session_error.
+ *
+ * Return the session, if the transfer was started.
+ * Return NULL if the file could not be opened, or the message not sent,
+ * with errno set.
+ */
+rftp_session *rftp_session_upload_socket (int sockfd, host_t *server,
+        char *filename, int timeout, int window, session_callback done,
+        void *arg, int verbose)
+{
+    rftp_session *session = NULL; // Session of the transfer
+    int error = 0;                // Cause of a failure to start
+
+    if (crypto_configured())
+    {
+        errno = EPROTONOSUPPORT;
+        return NULL;
+    }
+    if (!(session = (rftp_session*) calloc(1, sizeof(rftp_session))))
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    session->sockfd = sockfd;
+    session->server = *server;
+    session->timeout = timeout;
+    session->window = window;
+    session->done = done;
+    session->arg = arg;
+    session->verbose = verbose;
+    session->state = SESSION_INIT;
+    timer_init(&session->retransmit, expire_control, session);
+    fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
+
+    // Open the file, and create the initialization message.
+    if ((session->fd = open(filename, O_RDONLY)) == -1)
+    {
+        error = errno;
+    }
+    else if (!(session->filename = strdup(filename))
+             || !(session->control = create_init_message(filename)))
+    {
+        error = ENOMEM;
+    }
+    else
+    {
+        // Initialize the session.
+        session->filesize = ntohl(((control_message*)
+                                   session->control)->fsize);
+        session->stats = stats_open_session(SEND, filename,
+                                            session->filesize);
+        stats_set_peer(session->stats, &session->server);
+        if (!send_control(session)) error = EIO;
+    }
+
+    if (error)
+    {
+        rftp_session_free(session);
+        errno = error;
+        return NULL;
+    }
+    return session;
+}
+
+/*
+ * Starts a non-blocking transfer of a file to a RFTP server, through a
+ * socket of its own, which is closed when the session is freed (see
+ * rftp_session_upload_socket).
+ *
+ * Return the session, if the transfer was started.
+ * Return NULL if the server could not be resolved, the file opened, or
+ * the message sent, with errno set.
+ */
+rftp_session *rftp_session_upload (char *server_name, char *port_number,
+        char *filename, int timeout, int window, session_callback done,
+        void *arg, int verbose)
+{
+    rftp_session *session = NULL; // Session of the transfer
+    host_t server;                // Server host
+    int sockfd = -1;              // Socket of the session
+    int error = 0;                // Cause of a failure to start
+
+    // Create the socket of the session.
+    if ((sockfd = open_client_socket(server_name, port_number,
+                                     &server)) == -1)
+    {
+        return NULL;
+    }
+    if (!(session = rftp_session_upload_socket(sockfd, &server, filename,
+                                               timeout, window, done, arg,
+                                               verbose)))
+    {
+        error = errno;
+        close(sockfd);
+        errno = error;
+        return NULL;
+    }
+    session->owns_socket = 1;
+    return session;
+}
+
+/*
+ * Returns the socket of a session, for the program to poll for input.
+ */
+int rftp_session_fd (rftp_session *session)
+{
+    return session->sockfd;
+}
+
+/*
+ * Returns the cause of a failed session, as an errno value: ETIMEDOUT if
+ * the server stopped responding, the error the server rejected the
+ * session with, or EIO if the file could not be read or sent.
+ *
+ * Return 0 if the session has not failed.
+ */
+int rftp_session_error (rftp_session *session)
+{
+    return session->error;
+}
+
+/*
+ * Handles every message waiting on the socket of a session, once the
+ * program finds it readable, and sends what the session has room for.
+ * Messages from any host other than the server are ignored. If the
+ * session ends, its callback is called, and may free it.
+ *
+ * Return the state of the session.
+ */
+int rftp_session_readable (rftp_session *session)
+{
+    rftp_message *msg = NULL; // A received RFTP message
+    host_t source;            // Source of the received message
+    int status = SUCCESS;     // Status of the handled messages
+
+    if (session->state >= SESSION_DONE) return session->state;
+
+    while (status && session->state < SESSION_DONE
+           && (msg = receive_rftp_message(session->sockfd, &source,
+                                          session->verbose)))
+    {
+        if (same_host(&source, &session->server))
+        {
+            status = handle_message(session, msg);
+        }
+        free(msg);
+    }
+    stats_poll();
+
+    // End the session, calling its callback last.
+    if (!status)
+    {
+        fail_session(session, EIO);
+        return SESSION_FAILED;
+    }
+    if (session->state == SESSION_DONE)
+    {
+        finish_session(session, SESSION_DONE);
+        return SESSION_DONE;
+    }
+    return session->state;
+}
+
+/*
+ * Returns the milliseconds until the timers of the sessions next need
+ * to be expired, as a timeout for poll() or epoll_wait().
+ *
+ * Return the timeout, in milliseconds.
+ * Return -1 if no timers are pending.
+ */
+int rftp_next_timeout ()
+{
+    return timer_next_timeout(protocol_timers(), timer_now());
+}
+
+/*
+ * Expires the timers of the sessions that are due, resending their
+ * messages. Sessions that end are passed to their callbacks.
+ *
+ * Return the number of timers that expired.
+ */
+int rftp_expire_timers ()
+{
+    return timer_advance(protocol_timers(), timer_now());
+}
+
+/*
+ * Frees a session, closing its file, and its socket if it owns it.
+ * A session that has not ended is abandoned.
+ */
+void rftp_session_free (rftp_session *session)
+{
+    if (!session) return;
+
+    timer_cancel(protocol_timers(), &session->retransmit);
+    stats_close_session(session->stats, FAILURE);
+    free_send_window(session->flight);
+    free(session->control);
+    free(session->filename);
+    if (session->fd != -1) close(session->fd);
+    if (session->owns_socket) close(session->sockfd);
+    free(session);
+}
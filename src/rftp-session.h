@@ -0,0 +1,95 @@
+/*
+ *  Name        : rftp-session.h
+ *  Author      : Edmund Luong <edmundvmluong@gmail.com>
+ *  Version     : 1.0
+ *  Copyright   : MIT 2014 © Edmund Luong
+ *  Date        : November 16, 2014
+ *  Description : Implementation of non-blocking transfer sessions of the
+ *                Reliable File Transfer Protocol, which are driven by the
+ *                event loop of the program that embeds them, rather than
+ *                blocking it until the transfer ends.
+ *
+ *  CS 3357a Assignment 2
+ */
+
+#ifndef RFTP_SESSION_H
+#define RFTP_SESSION_H
+
+#include "rftp-messages.h"
+#include "rftp-window.h"
+#include "rftp-stats.h"
+#include "rftp-timer.h"
+#include "udp-sockets.h"
+
+/*
+ * Session-oriented macros
+ */
+#define SESSION_INIT 0   // Waiting for the server to accept the session
+#define SESSION_DATA 1   // Sending the data packets of the file
+#define SESSION_TERM 2   // Waiting for the server to end the session
+#define SESSION_DONE 3   // The file was transferred
+#define SESSION_FAILED 4 // The file could not be transferred
+
+struct rftp_session;
+
+/*
+ * Session callback
+ *
+ * Called once a session ends, with the status of its transfer. The
+ * callback may free the session.
+ */
+typedef void (*session_callback) (struct rftp_session *session, int status,
+        void *arg);
+
+/*
+ * RFTP Session
+ *
+ * A file transfer to a RFTP server that never blocks: the session sends
+ * what it can, and returns. The program polls the socket of the session
+ * for input, and hands it to rftp_session_readable when it is readable;
+ * the retransmission timers of every session share the timer wheel of the
+ * protocol, whose next timeout the program waits for at most, and which
+ * it then expires with rftp_expire_timers.
+ */
+typedef struct rftp_session
+{
+    int sockfd;                 // Socket of the session (non-blocking)
+    int owns_socket;            // Whether the socket is closed with the session
+    host_t server;              // Server of the session
+    char *filename;             // Name of the file being sent
+    int fd;                     // File being sent
+    int filesize;               // Size of the file, in bytes
+    int bytes_sent;             // Bytes of the file sent so far
+    int state;                  // State of the session
+    int timeout;                // Retransmission timeout, in milliseconds
+    int window;                 // Data packets kept in flight
+    rftp_message *control;      // Initialization or termination message
+    timer retransmit;           // Retransmission timer of the control message
+    int resent;                 // Times the control message was resent
+    int tail_probing;           // Whether the timer expires to probe the tail
+    int tail_probed;            // Whether the tail was probed
+    send_window *flight;        // Data packets in flight
+    session_stats *stats;       // Statistics of the session
+    session_callback done;      // Called once the session ends
+    void *arg;                  // Argument of the callback
+    int error;                  // Cause of a failed session (errno value)
+    int verbose;                // Verbose output
+} rftp_session;
+
+/*
+ * Function prototypes
+ */
+rftp_session *rftp_session_upload_socket (int sockfd, host_t *server,
+        char *filename, int timeout, int window, session_callback done,
+        void *arg, int verbose);
+rftp_session *rftp_session_upload (char *server_name, char *port_number,
+        char *filename, int timeout, int window, session_callback done,
+        void *arg, int verbose);
+int rftp_session_fd (rftp_session *session);
+int rftp_session_error (rftp_session *session);
+int rftp_session_readable (rftp_session *session);
+int rftp_next_timeout ();
+int rftp_expire_timers ();
+void rftp_session_free (rftp_session *session);
+
+#endif /* RFTP_SESSION_H */
@@ -0,0 +1,432 @@
+/*
+ *  Name        : rftp-stats.c
+ *  Author      : Edmund Luong <edmundvmluong@gmail.com>
+ *  Version     : 1.0
+ *  Copyright   : MIT 2014 © Edmund Luong
+ *  Date        : November 16, 2014
+ *  Description : Implementation of per-session transfer statistics for the
+ *                Reliable File Transfer Protocol, with round-trip time
+ *                histograms and a global registry of sessions that can be
+ *                reported as JSON lines or through a local stats socket.
+ *
+ *  CS 3357a Assignment 2
+ */
+
+#include "rftp-stats.h"
+#include "rftp-messages.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static session_stats *registry[STATS_SESSIONS]; // Registered sessions
+static int next_id = 1;          // Identifier of the next session
+static int emit_interval = 0;    // JSON line interval, in msec (0 = off)
+static uint64_t last_emit = 0;   // Time of the last JSON lines, in usec
+static int stats_fd = -1;        // Listening stats socket
+static char *stats_path = NULL;  // Pathname of the stats socket
+
+/*
+ * Returns the time on the monotonic clock, in microseconds.
+ */
+uint64_t stats_now ()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * Configures how the registry is reported: as JSON lines on standard
+ * error every interval milliseconds, and through a UNIX stream socket
+ * at the given pathname, which writes out every session to each client
+ * that connects. Either report is disabled by a zero interval or a NULL
+ * pathname.
+ *
+ * Return 1 if the reports were configured.
+ * Return 0 if the stats socket could not be created.
+ */
+int stats_configure (int interval, char *socket_path)
+{
+    struct sockaddr_un addr; // Address of the stats socket
+
+    emit_interval = interval;
+    last_emit = stats_now();
+    if (!socket_path) return 1;
+
+    // Create a non-blocking stats socket at the pathname.
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+    unlink(socket_path);
+    if ((stats_fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1
+            || bind(stats_fd, (struct sockaddr*) &addr, sizeof(addr)) == -1
+            || listen(stats_fd, 16) == -1)
+    {
+        perror("Unable to create stats socket");
+        if (stats_fd != -1) close(stats_fd);
+        stats_fd = -1;
+        return 0;
+    }
+    fcntl(stats_fd, F_SETFL, O_NONBLOCK);
+    stats_path = socket_path;
+
+    // Clients that disconnect early must not stop the transfer.
+    signal(SIGPIPE, SIG_IGN);
+    return 1;
+}
+
+/*
+ * Opens the statistics of a new session, and adds it to the registry.
+ * When the registry is full, the oldest ended session is replaced.
+ *
+ * Return the statistics of the session.
+ * Return NULL if the registry is full of active sessions.
+ */
+session_stats *stats_open_session (int trans_type, char *filename,
+        int filesize)
+{
+    session_stats *stats = NULL; // Statistics of the session
+    int slot = -1;               // Registry slot of the session
+    int i;
+
+    // Find an empty slot, or the oldest ended session.
+    for (i = 0; i < STATS_SESSIONS; i++)
+    {
+        if (!registry[i])
+        {
+            slot = i;
+            break;
+        }
+        if (registry[i]->done
+                && (slot == -1 || registry[i]->id < registry[slot]->id))
+        {
+            slot = i;
+        }
+    }
+    if (slot == -1) return NULL;
+
+    // Create the statistics of the session.
+    if (!(stats = (session_stats*) calloc(1, sizeof(session_stats))))
+    {
+        return NULL;
+    }
+    stats->id = next_id++;
+    stats->trans_type = trans_type;
+    stats->filesize = (filesize > 0) ? filesize : 0;
+    stats->start = stats_now();
+    stats->rtt.min = UINT64_MAX;
+    strncpy(stats->filename, filename, STATS_FNAME - 1);
+
+    free(registry[slot]);
+    registry[slot] = stats;
+    return stats;
+}
+
+/*
+ * Ends a session, and reports its final statistics.
+ */
+void stats_close_session (session_stats *stats, int status)
+{
+    if (!stats) return;
+
+    stats->done = 1;
+    stats->status = status;
+    stats->end = stats_now();
+
+    // Report the final statistics with the periodic reports.
+    if (emit_interval > 0)
+    {
+        stats_write_json(stderr, stats);
+        fflush(stderr);
+    }
+}
+
+/*
+ * Records the address of the remote host of a session.
+ */
+void stats_set_peer (session_stats *stats, host_t *peer)
+{
+    if (stats) strncpy(stats->peer, peer->friendly_ip, INET_ADDRSTRLEN - 1);
+}
+
+/*
+ * Records a message sent to the remote host.
+ */
+void stats_record_sent (session_stats *stats)
+{
+    if (stats) stats->packets_sent++;
+}
+
+/*
+ * Records a message received from the remote host.
+ */
+void stats_record_received (session_stats *stats)
+{
+    if (stats) stats->packets_recv++;
+}
+
+/*
+ * Records a message that was sent again.
+ */
+void stats_record_retransmit (session_stats *stats)
+{
+    if (stats) stats->retransmits++;
+}
+
+/*
+ * Records a duplicate message received from the remote host.
+ */
+void stats_record_duplicate (session_stats *stats)
+{
+    if (stats) stats->duplicates++;
+}
+
+/*
+ * Records an acknowledgment that timed out.
+ */
+void stats_record_timeout (session_stats *stats)
+{
+    if (stats) stats->timeouts++;
+}
+
+/*
+ * Records file bytes delivered to the remote host.
+ */
+void stats_record_bytes (session_stats *stats, int bytes)
+{
+    if (stats) stats->bytes += bytes;
+}
+
+/*
+ * Returns the histogram bucket that holds a value.
+ */
+static int hist_bucket (uint64_t value)
+{
+    int shift = 0; // Width of the value's octave, as a power of two
+
+    if (value < HIST_SUB) return (int) value;
+    shift = 63 - __builtin_clzll(value) - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB + (int) ((value >> shift) - HIST_SUB);
+}
+
+/*
+ * Returns the value at the middle of a histogram bucket.
+ */
+static uint64_t hist_value (int bucket)
+{
+    int shift = 0; // Width of the bucket's octave, as a power of two
+
+    if (bucket < HIST_SUB) return bucket;
+    shift = bucket / HIST_SUB - 1;
+    return ((uint64_t) (HIST_SUB + bucket % HIST_SUB) << shift)
+           + (((uint64_t) 1 << shift) >> 1);
+}
+
+/*
+ * Records the round-trip time of an acknowledgment, in microseconds.
+ */
+void stats_record_rtt (session_stats *stats, uint64_t rtt)
+{
+    if (!stats) return;
+
+    stats->rtt.counts[hist_bucket(rtt)]++;
+    stats->rtt.samples++;
+    stats->rtt.sum += rtt;
+    if (rtt < stats->rtt.min) stats->rtt.min = rtt;
+    if (rtt > stats->rtt.max) stats->rtt.max = rtt;
+}
+
+/*
+ * Returns the value at a percentile of the histogram, between 0 and 100.
+ */
+uint64_t stats_percentile (rtt_histogram *hist, double percentile)
+{
+    uint64_t rank = 0;  // Rank of the sample at the percentile
+    uint64_t seen = 0;  // Samples counted so far
+    uint64_t value = 0; // Value of the bucket holding the sample
+    int i;
+
+    if (hist->samples == 0) return 0;
+
+    // Find the bucket holding the ranked sample.
+    rank = (uint64_t) (percentile / 100.0 * hist->samples + 0.5);
+    if (rank < 1) rank = 1;
+    for (i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += hist->counts[i];
+        if (seen >= rank) break;
+    }
+
+    // Keep the value within the recorded range.
+    value = hist_value(i);
+    if (value < hist->min) value = hist->min;
+    if (value > hist->max) value = hist->max;
+    return value;
+}
+
+/*
+ * Writes a string as a JSON string literal.
+ */
+static void write_json_string (FILE *out, char *str)
+{
+    fputc('"', out);
+    for (; *str; str++)
+    {
+        if (*str == '"' || *str == '\\') fprintf(out, "\\%c", *str);
+        else if ((unsigned char) *str < 0x20) fprintf(out, "\\u%04x", *str);
+        else fputc(*str, out);
+    }
+    fputc('"', out);
+}
+
+/*
+ * Writes the statistics of a session as a single JSON line.
+ */
+void stats_write_json (FILE *out, session_stats *stats)
+{
+    uint64_t now = stats_now();                            // Current time
+    uint64_t end = stats->done ? stats->end : now;         // End of session
+    double elapsed = (end - stats->start) / 1000000.0;     // Elapsed seconds
+    rtt_histogram *rtt = &stats->rtt;                      // RTT histogram
+
+    fprintf(out, "{\"ts_us\": %llu, \"session\": %d, \"role\": \"%s\", "
+            "\"state\": \"%s\", ", (unsigned long long) now, stats->id,
+            (stats->trans_type == SEND) ? "send" : "receive",
+            stats->done ? (stats->status ? "done" : "failed") : "active");
+    fprintf(out, "\"peer\": ");
+    write_json_string(out, stats->peer);
+    fprintf(out, ", \"file\": ");
+    write_json_string(out, stats->filename);
+    fprintf(out, ", \"filesize\": %llu, \"bytes\": %llu, "
+            "\"elapsed_ms\": %.3f, \"goodput_mbps\": %.3f, "
+            "\"packets_sent\": %llu, \"packets_recv\": %llu, "
+            "\"retransmits\": %llu, \"duplicates\": %llu, "
+            "\"timeouts\": %llu, ",
+            (unsigned long long) stats->filesize,
+            (unsigned long long) stats->bytes, elapsed * 1000,
+            (elapsed > 0) ? stats->bytes * 8 / elapsed / 1e6 : 0,
+            (unsigned long long) stats->packets_sent,
+            (unsigned long long) stats->packets_recv,
+            (unsigned long long) stats->retransmits,
+            (unsigned long long) stats->duplicates,
+            (unsigned long long) stats->timeouts);
+    fprintf(out, "\"rtt_us\": {\"samples\": %llu, \"min\": %llu, "
+            "\"mean\": %.1f, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, "
+            "\"max\": %llu}}\n",
+            (unsigned long long) rtt->samples,
+            (unsigned long long) (rtt->samples ? rtt->min : 0),
+            rtt->samples ? (double) rtt->sum / rtt->samples : 0,
+            (unsigned long long) stats_percentile(rtt, 50),
+            (unsigned long long) stats_percentile(rtt, 90),
+            (unsigned long long) stats_percentile(rtt, 99),
+            (unsigned long long) rtt->max);
+}
+
+/*
+ * Writes every session in the registry as JSON lines.
+ */
+static void write_registry (FILE *out, int active_only)
+{
+    int i;
+
+    for (i = 0; i < STATS_SESSIONS; i++)
+    {
+        if (registry[i] && !(active_only && registry[i]->done))
+        {
+            stats_write_json(out, registry[i]);
+        }
+    }
+    fflush(out);
+}
+
+/*
+ * Reports the registry when it is due, and serves any clients waiting
+ * on the stats socket. Called regularly from the transfer loops.
+ */
+void stats_poll ()
+{
+    FILE *client = NULL; // Stream to a stats socket client
+    int fd = -1;         // Stats socket client
+    uint64_t now = 0;    // Current time, in usec
+
+    // Report the active sessions, if the interval has passed.
+    if (emit_interval > 0)
+    {
+        now = stats_now();
+        if (now - last_emit >= (uint64_t) emit_interval * 1000)
+        {
+            write_registry(stderr, 1);
+            last_emit = now;
+        }
+    }
+
+    // Write every session out to each waiting client.
+    while (stats_fd != -1 && (fd = accept(stats_fd, NULL, NULL)) != -1)
+    {
+        if ((client = fdopen(fd, "w")))
+        {
+            write_registry(client, 0);
+            fclose(client);
+        }
+        else
+        {
+            close(fd);
+        }
+    }
+}
+
+/*
+ * Returns the milliseconds until stats_poll next has work to do, as a
+ * timeout for poll(), so that an idle loop still reports: until the next
+ * JSON lines are due, and no more than STATS_ACCEPT_POLL while clients
+ * may be waiting on the stats socket.
+ *
+ * Return the timeout, in milliseconds.
+ * Return -1 if no reports are configured.
+ */
+int stats_next_timeout ()
+{
+    uint64_t now = stats_now(); // Current time, in usec
+    uint64_t due = 0;           // Time the next JSON lines are due
+    int wait = -1;              // Time until stats_poll has work to do
+
+    if (emit_interval > 0)
+    {
+        due = last_emit + (uint64_t) emit_interval * 1000;
+        wait = (due > now) ? (int) ((due - now + 999) / 1000) : 0;
+    }
+    if (stats_fd != -1 && (wait == -1 || wait > STATS_ACCEPT_POLL))
+    {
+        wait = STATS_ACCEPT_POLL;
+    }
+    return wait;
+}
+
+/*
+ * Serves any last stats socket clients, then removes the stats socket
+ * and frees the registry.
+ */
+void stats_shutdown ()
+{
+    int i;
+
+    stats_poll();
+    if (stats_fd != -1)
+    {
+        close(stats_fd);
+        unlink(stats_path);
+        stats_fd = -1;
+    }
+    for (i = 0; i < STATS_SESSIONS; i++)
+    {
+        free(registry[i]);
+        registry[i] = NULL;
+    }
+}
@@ -0,0 +1,96 @@
+/*
+ *  Name        : rftp-stats.h
+ *  Author      : Edmund Luong <edmundvmluong@gmail.com>
+ *  Version     : 1.0
+ *  Copyright   : MIT 2014 © Edmund Luong
+ *  Date        : November 16, 2014
+ *  Description : Implementation of per-session transfer statistics for the
+ *                Reliable File Transfer Protocol, with round-trip time
+ *                histograms and a global registry of sessions that can be
+ *                reported as JSON lines or through a local stats socket.
+ *
+ *  CS 3357a Assignment 2
+ */
+
+#ifndef RFTP_STATS_H
+#define RFTP_STATS_H
+
+#include "udp-sockets.h"
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * Statistics-oriented macros
+ */
+#define STATS_SESSIONS 64     // Maximum sessions held in the registry
+#define STATS_FNAME 256       // Longest filename kept in the statistics
+#define STATS_ACCEPT_POLL 100 // Longest wait for stats socket clients, in msec
+#define HIST_SUB_BITS 4       // Log2 of the linear sub-buckets per octave
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((65 - HIST_SUB_BITS) * HIST_SUB)
+
+/*
+ * RTT histogram
+ *
+ * A log-linear (HDR-style) histogram of round-trip times, in microseconds.
+ * Each power of two is split into 16 linear buckets, so every recorded
+ * value is kept to within 1/16th of its magnitude.
+ */
+typedef struct rtt_histogram
+{
+    uint64_t counts[HIST_BUCKETS]; // Samples recorded in each bucket
+    uint64_t samples;              // Total number of samples
+    uint64_t sum;                  // Sum of all samples
+    uint64_t min;                  // Smallest sample
+    uint64_t max;                  // Largest sample
+} rtt_histogram;
+
+/*
+ * Session statistics
+ *
+ * Counters for a single file transfer session.
+ */
+typedef struct session_stats
+{
+    int id;                       // Identifier of the session
+    int trans_type;               // SEND for rftp, RECV for rftpd
+    int done;                     // Whether the session has ended
+    int status;                   // Status of the ended session
+    char peer[INET_ADDRSTRLEN];   // Address of the remote host
+    char filename[STATS_FNAME];   // Name of the file being transferred
+    uint64_t filesize;            // Size of the file being transferred
+    uint64_t start;               // Start of the session, in usec
+    uint64_t end;                 // End of the session, in usec
+    uint64_t bytes;               // File bytes delivered so far
+    uint64_t packets_sent;        // Messages sent to the remote host
+    uint64_t packets_recv;        // Messages received from the remote host
+    uint64_t retransmits;         // Messages sent more than once
+    uint64_t duplicates;          // Duplicate messages received
+    uint64_t timeouts;            // Acknowledgments that timed out
+    rtt_histogram rtt;            // Round-trip times of acknowledgments
+} session_stats;
+
+/*
+ * Function prototypes
+ */
+uint64_t stats_now ();
+int stats_configure (int interval, char *socket_path);
+session_stats *stats_open_session (int trans_type, char *filename,
+        int filesize);
+void stats_close_session (session_stats *stats, int status);
+void stats_set_peer (session_stats *stats, host_t *peer);
+void stats_record_sent (session_stats *stats);
+void stats_record_received (session_stats *stats);
+void stats_record_retransmit (session_stats *stats);
+void stats_record_duplicate (session_stats *stats);
+void stats_record_timeout (session_stats *stats);
+void stats_record_bytes (session_stats *stats, int bytes);
+void stats_record_rtt (session_stats *stats, uint64_t rtt);
+uint64_t stats_percentile (rtt_histogram *hist, double percentile);
+void stats_write_json (FILE *out, session_stats *stats);
+void stats_poll ();
+int stats_next_timeout ();
+void stats_shutdown ();
+
+#endif /* RFTP_STATS_H */
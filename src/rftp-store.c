@@ -0,0 +1,550 @@
+/*
+ *  Name        : rftp-store.c
+ *  Author      : Edmund Luong <edmundvmluong@gmail.com>
+ *  Version     : 1.0
+ *  Copyright   : MIT 2014 © Edmund Luong
+ *  Date        : November 16, 2014
+ *  Description : Implementation of the chunk store of the Reliable File
+ *                Transfer Protocol server, which keeps every chunk received
+ *                in deduplicated transfers, indexed by its hash, and
+ *                assembles received files from it.
+ *
+ *  CS 3357a Assignment 2
+ */
+
+#include "rftp-store.h"
+#include "rftp-config.h"
+#include "file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/stat.h>
+
+static chunk_store *open_store = NULL; // Chunk store of the process
+
+/*
+ * Allocates an empty chunk index with a number of slots.
+ *
+ * Return 1 if the index was allocated.
+ * Return 0 if the index could not be allocated.
+ */
+static int init_index (chunk_index *index, size_t capacity)
+{
+    index->slots = (chunk_ref*) calloc(capacity, sizeof(chunk_ref));
+    index->capacity = index->slots ? capacity : 0;
+    index->count = 0;
+    return index->slots != NULL;
+}
+
+/*
+ * Returns the slot of a hash in a chunk index: the slot holding the
+ * hash, or else the empty slot where it would be inserted.
+ */
+static chunk_ref *find_slot (chunk_index *index, uint8_t hash[CHUNK_HASH])
+{
+    uint64_t key = 0;  // Table hash of the chunk hash
+    size_t i = 0;      // Slot being probed
+
+    memcpy(&key, hash, sizeof(key));
+    for (i = key & (index->capacity - 1);
+            index->slots[i].length
+            && memcmp(index->slots[i].hash, hash, CHUNK_HASH);
+            i = (i + 1) & (index->capacity - 1));
+
+    return &index->slots[i];
+}
+
+/*
+ * Looks up a hash in a chunk index.
+ *
+ * Return the reference of the chunk, if it is in the index.
+ * Return NULL if the chunk is not in the index.
+ */
+static chunk_ref *index_lookup (chunk_index *index, uint8_t hash[CHUNK_HASH])
+{
+    chunk_ref *slot = find_slot(index, hash); // Slot of the hash
+
+    return slot->length ? slot : NULL;
+}
+
+/*
+ * Inserts a chunk reference into a chunk index, doubling the index once
+ * it is over 70% full.
+ *
+ * Return 1 if the reference was inserted.
+ * Return 0 if the index could not grow.
+ */
+static int index_insert (chunk_index *index, chunk_ref *ref)
+{
+    chunk_index grown; // Index after growing
+    size_t i;
+
+    if ((index->count + 1) * 10 > index->capacity * 7)
+    {
+        if (!init_index(&grown, index->capacity * 2)) return 0;
+        for (i = 0; i < index->capacity; i++)
+        {
+            if (index->slots[i].length)
+            {
+                *find_slot(&grown, index->slots[i].hash) = index->slots[i];
+                grown.count++;
+            }
+        }
+        free(index->slots);
+        *index = grown;
+    }
+
+    *find_slot(index, ref->hash) = *ref;
+    index->count++;
+    return 1;
+}
+
+/*
+ * Appends a chunk reference to a growable array.
+ *
+ * Return 1 if the reference was appended.
+ * Return 0 if the array could not grow.
+ */
+static int append_ref (chunk_ref **refs, size_t *len, size_t *cap,
+        chunk_ref *ref)
+{
+    chunk_ref *grown = NULL; // Array after growing
+
+    if (*len == *cap)
+    {
+        *cap = *cap ? *cap * 2 : INDEX_MIN;
+        if (!(grown = (chunk_ref*) realloc(*refs, *cap * sizeof(chunk_ref))))
+        {
+            return 0;
+        }
+        *refs = grown;
+    }
+    (*refs)[(*len)++] = *ref;
+    return 1;
+}
+
+/*
+ * Frees a chunk store, closing its files.
+ */
+static void free_store (chunk_store *store)
+{
+    close(store->pack_fd);
+    close(store->index_fd);
+    free(store->index.slots);
+    free(store->dir);
+    free(store);
+}
+
+/*
+ * Opens the chunk store in an output directory, creating it if needed,
+ * and reads its index. The store of the last directory stays open, so
+ * later sessions into the same directory share it; opening the store of
+ * another directory closes it once no session uses it. Each opened store
+ * must be closed with close_chunk_store.
+ *
+ * Return the chunk store.
+ * Return NULL if the store could not be opened.
+ */
+chunk_store *open_chunk_store (char *output_dir)
+{
+    chunk_store *store = NULL; // Chunk store
+    char *path = NULL;         // Pathname of a store file
+    chunk_ref ref;             // Record of the index file
+    struct stat st;            // Status of the pack file
+
+    if (open_store && !strcmp(open_store->dir, output_dir))
+    {
+        open_store->refs++;
+        return open_store;
+    }
+
+    // Create the output directory and the store directory.
+    mkdir(output_dir, 0700);
+    if (!(store = (chunk_store*) calloc(1, sizeof(chunk_store)))
+            || !(store->dir = strdup(output_dir))
+            || !(path = get_output_path(output_dir, STORE_DIR))
+            || (mkdir(path, 0700) == -1 && errno != EEXIST))
+    {
+        perror("Unable to create chunk store");
+        free(path);
+        if (store) free(store->dir);
+        free(store);
+        return NULL;
+    }
+    free(path);
+
+    // Open the pack and index files.
+    store->pack_fd = store->index_fd = -1;
+    if ((path = get_output_path(output_dir, STORE_DIR "/" STORE_PACK)))
+    {
+        store->pack_fd = open(path, O_RDWR | O_CREAT, 0644);
+        free(path);
+    }
+    if ((path = get_output_path(output_dir, STORE_DIR "/" STORE_INDEX)))
+    {
+        store->index_fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+        free(path);
+    }
+    if (store->pack_fd == -1 || store->index_fd == -1
+            || fstat(store->pack_fd, &st) == -1
+            || !init_index(&store->index, INDEX_MIN))
+    {
+        perror("Unable to open chunk store");
+        if (store->pack_fd != -1) close(store->pack_fd);
+        if (store->index_fd != -1) close(store->index_fd);
+        free(store->dir);
+        free(store);
+        return NULL;
+    }
+    store->pack_size = st.st_size;
+
+    // Read the index, skipping references to chunks that were never
+    // completely written.
+    while (read(store->index_fd, &ref, sizeof(ref)) == sizeof(ref))
+    {
+        if (ref.length && ref.offset + ref.length <= store->pack_size
+                && !index_lookup(&store->index, ref.hash))
+        {
+            index_insert(&store->index, &ref);
+        }
+    }
+
+    // Replace the store of another directory.
+    if (open_store && open_store->refs == 0) free_store(open_store);
+    open_store = store;
+    store->refs++;
+    return store;
+}
+
+/*
+ * Writes the stored chunks of a store through to the disk: the pack file
+ * first, then the index file, so that a synced reference never points
+ * past the synced chunks.
+ *
+ * Return 1 if the store was synced.
+ * Return 0 if there was a write error.
+ */
+int sync_chunk_store (chunk_store *store)
+{
+    if (fsync(store->pack_fd) == -1 || fsync(store->index_fd) == -1)
+    {
+        perror("Chunk store write error");
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Closes a store opened with open_chunk_store. The store of the last
+ * directory stays open for later sessions; any other store is freed once
+ * no session uses it.
+ */
+void close_chunk_store (chunk_store *store)
+{
+    if (!store) return;
+
+    store->refs--;
+    if (store != open_store && store->refs == 0) free_store(store);
+}
+
+/*
+ * Looks up a chunk in a chunk store by its hash.
+ *
+ * Return the reference of the chunk, if the store holds it.
+ * Return NULL if the store does not hold the chunk.
+ */
+chunk_ref *store_lookup (chunk_store *store, uint8_t hash[CHUNK_HASH])
+{
+    return index_lookup(&store->index, hash);
+}
+
+/*
+ * Appends a chunk to the pack file of a store, then its reference to
+ * the index file.
+ *
+ * Return 1 if the chunk was stored.
+ * Return 0 if there was a write error.
+ */
+static int store_chunk (chunk_store *store, uint8_t hash[CHUNK_HASH],
+        uint8_t *data, size_t length)
+{
+    chunk_ref ref;          // Reference of the chunk
+    size_t written = 0;     // Number of bytes written so far
+    ssize_t result = 0;     // Result of the write operation
+
+    // Write the chunk, resuming after any short writes.
+    while (written < length)
+    {
+        result = pwrite(store->pack_fd, data + written, length - written,
+                        store->pack_size + written);
+        if (result == -1 && errno == EINTR) continue;
+        if (result <= 0)
+        {
+            perror("Chunk store write error");
+            return 0;
+        }
+        written += result;
+    }
+
+    // Record the chunk in the index.
+    memset(&ref, 0, sizeof(ref));
+    memcpy(ref.hash, hash, CHUNK_HASH);
+    ref.offset = store->pack_size;
+    ref.length = length;
+    if (write(store->index_fd, &ref, sizeof(ref)) != sizeof(ref))
+    {
+        perror("Chunk store write error");
+        return 0;
+    }
+    store->pack_size += length;
+    return index_insert(&store->index, &ref);
+}
+
+/*
+ * Reads a stored chunk into a buffer of at least CHUNK_MAX bytes.
+ *
+ * Return 1 if the chunk was read.
+ * Return 0 if there was a read error.
+ */
+static int read_chunk (chunk_store *store, chunk_ref *ref, uint8_t *buffer)
+{
+    size_t done = 0;    // Number of bytes read so far
+    ssize_t result = 0; // Result of the read operation
+
+    while (done < ref->length)
+    {
+        result = pread(store->pack_fd, buffer + done, ref->length - done,
+                       ref->offset + done);
+        if (result == -1 && errno == EINTR) continue;
+        if (result <= 0)
+        {
+            perror("Chunk store read error");
+            return 0;
+        }
+        done += result;
+    }
+    return 1;
+}
+
+/*
+ * Creates the receiving side of a deduplicated transfer into an output
+ * directory, opening the directory's chunk store.
+ *
+ * Return a deduplication session.
+ * Return NULL if the session could not be created.
+ */
+dedup_session *create_dedup_session (char *output_dir)
+{
+    dedup_session *session = NULL; // Deduplication session
+    chunk_store *store = NULL;     // Chunk store of the directory
+
+    if (!(store = open_chunk_store(output_dir))) return NULL;
+    if (!(session = (dedup_session*) calloc(1, sizeof(dedup_session))))
+    {
+        perror("Unable to create deduplication session");
+        close_chunk_store(store);
+        return NULL;
+    }
+    session->store = store;
+    if (!init_index(&session->pending, INDEX_MIN)
+            || !(session->chunk = (uint8_t*) malloc(CHUNK_MAX)))
+    {
+        perror("Unable to create deduplication session");
+        free_dedup_session(session);
+        return NULL;
+    }
+    return session;
+}
+
+/*
+ * Handles an offer message: adds the offered chunks to the recipe of the
+ * file, and marks the chunks that the store holds, or that the sender
+ * will already send, as present. The sender is expected to send the
+ * other chunks next. The offer is kept, to acknowledge it again if the
+ * sender resends it.
+ *
+ * Return a successful status if the offer was handled, adding the bytes
+ * of the present chunks to the given count.
+ * Return a failure status if the offer is malformed.
+ */
+int receive_offer (dedup_session *session, data_message *offer,
+        int *bytes_present)
+{
+    chunk_offer *offers = (chunk_offer*) offer->data; // Offered chunks
+    uint32_t bytes = ntohl(offer->data_len);          // Size of the offers
+    int count = bytes / sizeof(chunk_offer);          // Number of offers
+    chunk_ref ref;                                    // Offered chunk
+    int i;
+
+    if (bytes % sizeof(chunk_offer) || count > OFFER_CHUNKS)
+    {
+        printf("ERROR: Malformed chunk offer.\n");
+        return FAILURE;
+    }
+
+    memset(&ref, 0, sizeof(ref));
+    for (i = 0; i < count; i++)
+    {
+        memcpy(ref.hash, offers[i].hash, CHUNK_HASH);
+        ref.length = ntohl(offers[i].length);
+        if (ref.length == 0 || ref.length > CHUNK_MAX)
+        {
+            printf("ERROR: Malformed chunk offer.\n");
+            return FAILURE;
+        }
+        if (!append_ref(&session->recipe, &session->recipe_len,
+                        &session->recipe_cap, &ref))
+        {
+            return FAILURE;
+        }
+
+        // Mark the chunk as present, or else expect it from the sender.
+        if (store_lookup(session->store, ref.hash)
+                || index_lookup(&session->pending, ref.hash))
+        {
+            offers[i].present = 1;
+            *bytes_present += ref.length;
+        }
+        else
+        {
+            offers[i].present = 0;
+            if (!index_insert(&session->pending, &ref)
+                    || !append_ref(&session->missing, &session->missing_len,
+                                   &session->missing_cap, &ref))
+            {
+                return FAILURE;
+            }
+        }
+    }
+
+    memcpy(&session->last_offer, offer, sizeof(data_message));
+    return SUCCESS;
+}
+
+/*
+ * Marks a resent offer the same way as when it was first received, so
+ * that acknowledging it again tells the sender the same chunks to send.
+ */
+void repeat_offer (dedup_session *session, data_message *offer)
+{
+    if (offer->seq_num == session->last_offer.seq_num
+            && offer->data_len == session->last_offer.data_len)
+    {
+        memcpy(offer->data, session->last_offer.data,
+               ntohl(offer->data_len));
+    }
+}
+
+/*
+ * Handles the data of a data message in a deduplicated transfer, which
+ * holds the next bytes of the chunks expected from the sender. Each
+ * chunk is checked against its hash once it is complete, then stored.
+ *
+ * Return a successful status if the data was handled.
+ * Return a failure status if the data does not match the expected chunks.
+ */
+int receive_chunk_data (dedup_session *session, uint8_t *data,
+        size_t length)
+{
+    uint8_t hash[CHUNK_HASH]; // Hash of a received chunk
+    chunk_ref *expected;      // Chunk being received
+    size_t take = 0;          // Bytes of the data in the chunk
+
+    while (length > 0)
+    {
+        if (session->missing_next >= session->missing_len)
+        {
+            printf("ERROR: Received more chunk data than was offered.\n");
+            return FAILURE;
+        }
+        expected = &session->missing[session->missing_next];
+
+        // Fill the chunk being received.
+        take = expected->length - session->filled;
+        if (take > length) take = length;
+        memcpy(session->chunk + session->filled, data, take);
+        session->filled += take;
+        data += take;
+        length -= take;
+
+        // Check and store the chunk once it is complete.
+        if (session->filled == expected->length)
+        {
+            hash_chunk(session->chunk, expected->length, hash);
+            if (memcmp(hash, expected->hash, CHUNK_HASH))
+            {
+                printf("ERROR: Received chunk does not match its hash.\n");
+                return FAILURE;
+            }
+            if (!store_lookup(session->store, hash)
+                    && !store_chunk(session->store, hash, session->chunk,
+                                    expected->length))
+            {
+                return FAILURE;
+            }
+            session->missing_next++;
+            session->filled = 0;
+        }
+    }
+
+    return SUCCESS;
+}
+
+/*
+ * Writes the file of a deduplicated transfer to the target file, from
+ * the chunks of its recipe in the store. The store is synced first, so
+ * the received chunks are on disk before the transfer is acknowledged.
+ *
+ * Return a successful status if the file was assembled.
+ * Return a failure status if chunks are missing or could not be copied.
+ */
+int assemble_file (dedup_session *session, output_file *target,
+        int filesize)
+{
+    chunk_ref *ref = NULL;   // Stored chunk of the recipe
+    int64_t total = 0;       // Size of the chunks of the recipe
+    size_t i;
+
+    for (i = 0; i < session->recipe_len; i++)
+    {
+        total += session->recipe[i].length;
+    }
+    if (session->missing_next < session->missing_len || total != filesize)
+    {
+        printf("ERROR: The chunks of the file were not all received.\n");
+        return FAILURE;
+    }
+    if (!sync_chunk_store(session->store)) return FAILURE;
+
+    for (i = 0; i < session->recipe_len; i++)
+    {
+        if (!(ref = store_lookup(session->store, session->recipe[i].hash))
+                || !read_chunk(session->store, ref, session->chunk)
+                || !write_output_file(target, session->chunk, ref->length))
+        {
+            return FAILURE;
+        }
+    }
+
+    return SUCCESS;
+}
+
+/*
+ * Frees a deduplication session, closing its chunk store.
+ */
+void free_dedup_session (dedup_session *session)
+{
+    if (!session) return;
+
+    close_chunk_store(session->store);
+    free(session->pending.slots);
+    free(session->recipe);
+    free(session->missing);
+    free(session->chunk);
+    free(session);
+}
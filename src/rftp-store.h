@@ -0,0 +1,120 @@
+/*
+ *  Name        : rftp-store.h
+ *  Author      : Edmund Luong <edmundvmluong@gmail.com>
+ *  Version     : 1.0
+ *  Copyright   : MIT 2014 © Edmund Luong
+ *  Date        : November 16, 2014
+ *  Description : Implementation of the chunk store of the Reliable File
+ *                Transfer Protocol server, which keeps every chunk received
+ *                in deduplicated transfers, indexed by its hash, and
+ *                assembles received files from it.
+ *
+ *  CS 3357a Assignment 2
+ */
+
+#ifndef RFTP_STORE_H
+#define RFTP_STORE_H
+
+#include "rftp-messages.h"
+#include "rftp-chunk.h"
+#include "output-file.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Store-oriented macros
+ */
+#define STORE_DIR ".rftp-chunks"  // Directory of the store, in the output directory
+#define STORE_PACK "pack"         // File holding the chunks of the store
+#define STORE_INDEX "index"       // File holding the index records of the store
+#define INDEX_MIN 1024            // Smallest capacity of a chunk index
+
+/*
+ * Chunk reference
+ *
+ * The hash, location and length of a chunk. The chunk store's index file
+ * is a sequence of these records, appended as chunks are stored.
+ */
+typedef struct chunk_ref
+{
+    uint8_t hash[CHUNK_HASH]; // SHA-256 hash of the chunk
+    uint64_t offset;          // Offset of the chunk in the pack file
+    uint32_t length;          // Length of the chunk (0 for an empty slot)
+    uint32_t reserved;        // Reserved, zero
+} chunk_ref;
+
+/*
+ * Chunk index
+ *
+ * A hash table of chunk references keyed by their hash, with open
+ * addressing. The hashes are uniform, so their first bytes serve as
+ * the table hash.
+ */
+typedef struct chunk_index
+{
+    chunk_ref *slots;         // Slots of the table
+    size_t capacity;          // Number of slots, a power of two
+    size_t count;             // Number of chunks in the table
+} chunk_index;
+
+/*
+ * Chunk store
+ *
+ * The chunks are appended to a pack file, and their references to an
+ * index file, which is read back into a chunk index when the store is
+ * opened. A reference is only appended once its chunk is written, and
+ * references past the end of the pack are ignored, so a store that was
+ * interrupted while writing stays consistent.
+ */
+typedef struct chunk_store
+{
+    char *dir;                // Directory of the store
+    int pack_fd;              // Pack file
+    int index_fd;             // Index file
+    uint64_t pack_size;       // Size of the pack file
+    chunk_index index;        // Index of the stored chunks
+    int refs;                 // Number of sessions using the store
+} chunk_store;
+
+/*
+ * Deduplication session
+ *
+ * The receiving side of a deduplicated transfer: the recipe of the file
+ * (the chunks of the file, in order), and the chunks it still expects
+ * the sender to send, in order.
+ */
+typedef struct dedup_session
+{
+    chunk_store *store;       // Store of the received chunks
+    chunk_index pending;      // Chunks expected from the sender
+    chunk_ref *recipe;        // Chunks of the file, in order
+    size_t recipe_len;        // Number of chunks in the recipe
+    size_t recipe_cap;        // Capacity of the recipe
+    chunk_ref *missing;       // Chunks expected from the sender, in order
+    size_t missing_len;       // Number of expected chunks
+    size_t missing_cap;       // Capacity of the expected chunks
+    size_t missing_next;      // Next expected chunk
+    uint8_t *chunk;           // Chunk being received
+    size_t filled;            // Bytes of the chunk received so far
+    data_message last_offer;  // Acknowledgment of the last offer
+} dedup_session;
+
+/*
+ * Function prototypes
+ */
+chunk_store *open_chunk_store (char *output_dir);
+int sync_chunk_store (chunk_store *store);
+void close_chunk_store (chunk_store *store);
+chunk_ref *store_lookup (chunk_store *store, uint8_t hash[CHUNK_HASH]);
+dedup_session *create_dedup_session (char *output_dir);
+int receive_offer (dedup_session *session, data_message *offer,
+        int *bytes_present);
+void repeat_offer (dedup_session *session, data_message *offer);
+int receive_chunk_data (dedup_session *session, uint8_t *data,
+        size_t length);
+int assemble_file (dedup_session *session, output_file *target,
+        int filesize);
+void free_dedup_session (dedup_session *session);
+
+#endif /* RFTP_STORE_H */
@@ -0,0 +1,378 @@
+/*
+ *  Name        : rftp-stream.c
+ *  Author      : Edmund Luong <edmundvmluong@gmail.com>
+ *  Version     : 1.0
+ *  Copyright   : MIT 2014 © Edmund Luong
+ *  Date        : November 16, 2014
+ *  Description : Implementation of multiplexed transfers of the Reliable
+ *                File Transfer Protocol, which send many files to a RFTP
+ *                server at once, each as a prioritized stream within one
+ *                transfer session.
+ *
+ *  CS 3357a Assignment 2
+ */
+
+#include "rftp-stream.h"
+#include "rftp-client.h"
+#include "rftp-protocol.h"
+#include "rftp-config.h"
+#include "rftp-busypoll.h"
+#include "rftp-crypto.h"
+#include "udp-client.h"
+#include "file.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Splits the priority and weight off a stream given as
+ * FILE[:PRIORITY[:WEIGHT]], and opens its file.
+ *
+ * Return a successful status if the stream was parsed and its file opened.
+ * Return a failure status if the stream is invalid, or its file could not
+ * be opened.
+ */
+int parse_stream (char *spec, send_stream *stream)
+{
+    char *fields[2];     // Trailing numeric fields, last one first
+    char *colon = NULL;  // Separator of a field
+    int count = 0;       // Number of numeric fields
+
+    memset(stream, 0, sizeof(send_stream));
+    stream->priority = DEFAULT_PRIORITY;
+    stream->weight = STREAM_WEIGHT;
+    if (!(stream->filename = strdup(spec)))
+    {
+        perror("Unable to allocate stream");
+        return FAILURE;
+    }
+
+    // Split off up to two numeric fields from the end.
+    while (count < 2 && (colon = strrchr(stream->filename, ':'))
+           && colon[1] && strspn(colon + 1, "0123456789") == strlen(colon + 1))
+    {
+        fields[count++] = colon + 1;
+        *colon = '\0';
+    }
+    if (count > 0) stream->priority = atoi(fields[count - 1]);
+    if (count > 1) stream->weight = atoi(fields[0]);
+    if (stream->priority > MAX_PRIORITY || stream->weight < 1
+            || stream->weight > MAX_STREAM_WEIGHT)
+    {
+        printf("ERROR: Invalid stream %s (priority 0 to %d, weight 1 to "
+               "%d).\n", spec, MAX_PRIORITY, MAX_STREAM_WEIGHT);
+        free(stream->filename);
+        return FAILURE;
+    }
+
+    // Open the file of the stream.
+    if (!(stream->file = get_file(stream->filename, "rb")))
+    {
+        free(stream->filename);
+        return FAILURE;
+    }
+    stream->filesize = get_filesize(stream->file);
+    return SUCCESS;
+}
+
+/*
+ * Checks that no two streams' files would be received under the same
+ * name, which is the filename without any directories.
+ *
+ * Return a successful status if the names are distinct.
+ * Return a failure status if two streams share a name.
+ */
+static int distinct_streams (send_stream *streams, int count)
+{
+    char *name = NULL;  // Name a stream's file is received under
+    char *other = NULL; // Name an earlier stream's file is received under
+    int i, j;
+
+    for (i = 1; i < count; i++)
+    {
+        name = strrchr(streams[i].filename, '/')
+               ? strrchr(streams[i].filename, '/') + 1 : streams[i].filename;
+        for (j = 0; j < i; j++)
+        {
+            other = strrchr(streams[j].filename, '/')
+                    ? strrchr(streams[j].filename, '/') + 1
+                    : streams[j].filename;
+            if (!strcmp(name, other))
+            {
+                printf("ERROR: %s and %s would be received as the same "
+                       "file.\n", streams[j].filename, streams[i].filename);
+                return FAILURE;
+            }
+        }
+    }
+    return SUCCESS;
+}
+
+/*
+ * Returns whether a stream should be sent ahead of another (see
+ * send_stream).
+ */
+static int stream_before (send_stream *a, send_stream *b)
+{
+    int left_a = a->filesize - a->bytes_sent; // Bytes left of the first
+    int left_b = b->filesize - b->bytes_sent; // Bytes left of the second
+
+    if (a->priority != b->priority) return a->priority < b->priority;
+    if ((left_a <= SMALL_STREAM) != (left_b <= SMALL_STREAM))
+    {
+        return left_a <= SMALL_STREAM;
+    }
+    if (left_a <= SMALL_STREAM) return left_a < left_b;
+    return a->pass < b->pass;
+}
+
+/*
+ * Schedules the next message of a multiplexed transfer session.
+ *
+ * Return the stream to send a message of next.
+ * Return NULL if every stream was sent.
+ */
+send_stream *next_stream (send_stream *streams, int count)
+{
+    send_stream *next = NULL; // Stream to send next
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        if (streams[i].opened && streams[i].bytes_sent == streams[i].filesize)
+        {
+            continue;
+        }
+        if (!next || stream_before(&streams[i], next)) next = &streams[i];
+    }
+
+    return next;
+}
+
+/*
+ * Sends the next message of a stream through the send window of the
+ * session: the open message of the stream, if it was not opened yet, or
+ * else its next data packet.
+ *
+ * Return a successful status if the message was sent.
+ * Return a failure status if the message could not be sent.
+ */
+static int send_stream_message (send_window *flight, send_stream *stream)
+{
+    uint8_t buffer[DATA_MSS];          // Buffer to hold data
+    int capacity = data_capacity();    // Data bytes per packet
+    int length = stream->filesize - stream->bytes_sent; // Bytes to send
+    char *name = strrchr(stream->filename, '/'); // Name of the file
+
+    // Open the stream, under the name of its file without directories.
+    // Either way, the message is the last one of the stream so far.
+    stream->last_seq = flight->next;
+    if (!stream->opened)
+    {
+        name = name ? name + 1 : stream->filename;
+        if (!window_send(flight, create_open_message(window_seq(flight),
+                                                     stream->id, name,
+                                                     stream->filesize),
+                         OPEN_MSG))
+        {
+            return FAILURE;
+        }
+        stream->opened = 1;
+        return SUCCESS;
+    }
+
+    // Read the next data of the file, and send it.
+    if (length > capacity) length = capacity;
+    if (pread(fileno(stream->file), buffer, length, stream->bytes_sent)
+            != length)
+    {
+        perror("Unable to read file");
+        return FAILURE;
+    }
+    if (!window_send(flight, create_stream_message(window_seq(flight),
+                                                   stream->id, length,
+                                                   buffer),
+                     STREAM_MSG))
+    {
+        return FAILURE;
+    }
+    stats_record_bytes(flight->stats, length);
+    stream->bytes_sent += length;
+    stream->pass += (uint64_t) length * MAX_STREAM_WEIGHT / stream->weight;
+    return SUCCESS;
+}
+
+/*
+ * Reports each stream whose messages were all acknowledged, with the time
+ * it took since the session began.
+ */
+static void report_streams (send_window *flight, send_stream *streams,
+        int count, uint64_t started_at)
+{
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        if (!streams[i].reported && streams[i].opened
+                && streams[i].bytes_sent == streams[i].filesize
+                && streams[i].last_seq < flight->base)
+        {
+            streams[i].reported = 1;
+            printf("%s was delivered (%d bytes in %.1f ms).\n",
+                   streams[i].filename, streams[i].filesize,
+                   (double) (stats_now() - started_at) / 1000);
+        }
+    }
+}
+
+/*
+ * Transfers many files to a RFTP server at once, in one multiplexed
+ * transfer session, using the Reliable File Transfer Protocol (RFTP).
+ * Each file is given as FILE[:PRIORITY[:WEIGHT]], and is sent as a stream
+ * of its own; the messages of the streams are interleaved through the send
+ * window of the session, as the streams are scheduled (see send_stream),
+ * so a small file is not held up behind a bulk one. A positive rate, in
+ * kilobits per second, paces the messages. Each file is reported once the
+ * server acknowledged all of it.
+ *
+ * Return a successful status code if every file was transferred.
+ * Return a failure status code if the transfer failed.
+ */
+int rftp_transfer_streams (char *server_name, char *port_number,
+        char **specs, int count, int timeout, long rate, int window,
+        int verbose)
+{
+    host_t server;                // Server host
+    send_stream *streams = NULL;  // Streams of the session
+    send_stream *stream = NULL;   // Stream to send a message of next
+    send_window *flight = NULL;   // Packets in flight
+    control_message *init = NULL; // Initialization message
+    session_stats *stats = NULL;  // Statistics of the transfer session
+    pacer *pacer = NULL;          // Pacer of the messages
+    int64_t total = 0;            // Total size of the files
+    int bytes_sent = 0;           // Total number of bytes sent
+    int sent_before = 0;          // Bytes of a stream sent before a message
+    int curr_mult = 0;            // The current percent multiple returned
+    int last_mult = OUTPUTTED;    // The last displayed percentage multiple
+    uint64_t started_at = 0;      // Time the session was initiated
+    int status = FAILURE;         // Status of the transfer
+    int opened = 0;               // Number of files opened
+    int stream_count = 0;         // Number of streams opened
+    int distinct = FAILURE;       // Whether the files have distinct names
+    int sockfd = -1;              // Socket of the session
+    int i;
+
+    // Open the file of each stream.
+    if (count > MAX_STREAMS)
+    {
+        printf("ERROR: At most %d files may be multiplexed.\n", MAX_STREAMS);
+        return FAILURE;
+    }
+    if (!(streams = (send_stream*) calloc(count, sizeof(send_stream))))
+    {
+        perror("Unable to allocate streams");
+        return FAILURE;
+    }
+    for (opened = 0; opened < count; opened++)
+    {
+        if (!parse_stream(specs[opened], &streams[opened])) break;
+        total += streams[opened].filesize;
+    }
+    if (opened == count && total > MAX_FSIZE)
+    {
+        printf("ERROR: The files exceed the maximum allowed size (%d GB).\n",
+               MAX_FSIZE / GB);
+    }
+    else if (opened == count)
+    {
+        distinct = distinct_streams(streams, count);
+    }
+
+    // Create a socket, and initiate a session for every file at once,
+    // which is named by none of them.
+    if (distinct)
+    {
+        sockfd = open_client_socket(server_name, port_number, &server);
+        if (sockfd == -1)
+        {
+            printf("ERROR: Unable to reach %s:%s (%s).\n", server_name,
+                   port_number, strerror(errno));
+        }
+    }
+    if (sockfd != -1)
+    {
+        busy_poll_socket(sockfd);
+        printf("Trying to initiate a multiplexed transfer with %s:%s ...\n",
+               server_name, port_number);
+        stats = stats_open_session(SEND, "", (int) total);
+        pacer = create_pacer(sockfd, rate, verbose);
+        init = initiate_session(sockfd, &server,
+                                create_control_message(INIT_MSG, 0, "",
+                                                       (int) total),
+                                timeout, stats, verbose);
+    }
+
+    // If the transfer was initialized, send the streams.
+    if (init && (flight = create_send_window(sockfd, &server, 1, window,
+                                             timeout, pacer, stats,
+                                             verbose)))
+    {
+        printf("File transfer initialized.\n\n");
+        printf("Sending %d files (%lld bytes) ...\n", count,
+               (long long) total);
+        stats_set_peer(stats, &server);
+        started_at = stats_now();
+
+        while ((stream = next_stream(streams, count)))
+        {
+            // Streams are numbered in the order they are opened.
+            if (!stream->opened) stream->id = stream_count++;
+            sent_before = stream->bytes_sent;
+            if (!send_stream_message(flight, stream)) break;
+
+            // Output the progress of the transfer, and the files delivered.
+            if (stream->bytes_sent > sent_before)
+            {
+                bytes_sent += stream->bytes_sent - sent_before;
+                curr_mult = output_progress(SEND, bytes_sent, (int) total,
+                                            last_mult);
+                if (curr_mult != OUTPUTTED) last_mult = curr_mult;
+            }
+            report_streams(flight, streams, count, started_at);
+        }
+
+        // Wait for the packets in flight, then terminate the session.
+        if (!stream && window_drain(flight))
+        {
+            report_streams(flight, streams, count, started_at);
+            status = end_transfer_session(flight, "", (int) total);
+        }
+        if (!status && flight->error == ETIMEDOUT)
+        {
+            report_peer_error(flight->error);
+        }
+        else if (!status && flight->error && flight->error != EIO)
+        {
+            printf("\nERROR: The server refused a file of the session "
+                   "(%s).\n", strerror(flight->error));
+        }
+    }
+    stats_close_session(stats, status);
+    end_cipher();
+    free_send_window(flight);
+
+    // Close the files, and return the status of the transfer.
+    for (i = 0; i < opened; i++)
+    {
+        fclose(streams[i].file);
+        free(streams[i].filename);
+    }
+    if (sockfd != -1) close(sockfd);
+    free(streams);
+    free(pacer);
+    free(init);
+    return status;
+}
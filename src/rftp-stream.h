@@ -0,0 +1,66 @@
+/*
+ *  Name        : rftp-stream.h
+ *  Author      : Edmund Luong <edmundvmluong@gmail.com>
+ *  Version     : 1.0
+ *  Copyright   : MIT 2014 © Edmund Luong
+ *  Date        : November 16, 2014
+ *  Description : Implementation of multiplexed transfers of the Reliable
+ *                File Transfer Protocol, which send many files to a RFTP
+ *                server at once, each as a prioritized stream within one
+ *                transfer session.
+ *
+ *  CS 3357a Assignment 2
+ */
+
+#ifndef RFTP_STREAM_H
+#define RFTP_STREAM_H
+
+#include "rftp-window.h"
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * Stream-oriented macros
+ */
+#define DEFAULT_PRIORITY 3      // Default priority of a stream
+#define MAX_PRIORITY 7          // Least urgent priority of a stream
+#define STREAM_WEIGHT 1         // Default weight of a stream
+#define MAX_STREAM_WEIGHT 256   // Largest weight of a stream
+#define SMALL_STREAM 65536      // Bytes left for a stream to count as small
+
+/*
+ * Send stream
+ *
+ * A file sent within a multiplexed transfer session. Streams of a more
+ * urgent priority (lower) are always sent first. Among streams of the same
+ * priority, small ones are sent first, shortest remaining first, so they
+ * are not held up behind bulk files; the others share the session by
+ * weight, the one with the fewest bytes sent per unit of weight going
+ * next.
+ */
+typedef struct send_stream
+{
+    char *filename;             // Pathname of the file
+    FILE *file;                 // The file being sent
+    int filesize;               // Size of the file, in bytes
+    int bytes_sent;             // Bytes of the file sent so far
+    int priority;               // Priority of the stream (0 = most urgent)
+    int weight;                 // Share of the stream within its priority
+    uint64_t pass;              // Bytes sent per unit of weight, scaled
+    int opened;                 // Whether the stream was opened
+    int id;                     // Number of the stream, once opened
+    int64_t last_seq;           // Sequence number of its last message
+    int reported;               // Whether its delivery was reported
+} send_stream;
+
+/*
+ * Function prototypes
+ */
+int parse_stream (char *spec, send_stream *stream);
+send_stream *next_stream (send_stream *streams, int count);
+int rftp_transfer_streams (char *server_name, char *port_number,
+        char **specs, int count, int timeout, long rate, int window,
+        int verbose);
+
+#endif /* RFTP_STREAM_H */
@@ -0,0 +1,256 @@
+/*
+ *  Name        : rftp-timer.c
+ *  Author      : Edmund Luong <edmundvmluong@gmail.com>
+ *  Version     : 1.0
+ *  Copyright   : MIT 2014 © Edmund Luong
+ *  Date        : November 16, 2014
+ *  Description : Implementation of a hierarchical timer wheel for the
+ *                Reliable File Transfer Protocol, which keeps the
+ *                retransmission and time-wait deadlines of the protocol
+ *                in O(1) per timer, driven by the monotonic clock.
+ *
+ *  CS 3357a Assignment 2
+ */
+
+#include "rftp-timer.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Returns the time on the monotonic clock, in microseconds.
+ */
+uint64_t timer_now ()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * Creates an empty timer wheel, with ticks of the given length in
+ * microseconds, starting now.
+ *
+ * Return a timer wheel.
+ * Return NULL if the timer wheel could not be allocated.
+ */
+timer_wheel *create_timer_wheel (int tick)
+{
+    timer_wheel *wheel = NULL; // Timer wheel
+
+    if ((wheel = (timer_wheel*) calloc(1, sizeof(timer_wheel))))
+    {
+        wheel->tick = (tick > 0) ? tick : TIMER_TICK;
+        wheel->start = timer_now();
+    }
+    return wheel;
+}
+
+/*
+ * Initializes a timer that is not yet scheduled.
+ */
+void timer_init (timer *timer, void (*callback) (struct timer*, void*),
+        void *arg)
+{
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->expires = 0;
+    timer->callback = callback;
+    timer->arg = arg;
+}
+
+/*
+ * Links a timer at the head of a list.
+ */
+static void link_timer (timer **head, timer *timer)
+{
+    timer->next = *head;
+    timer->pprev = head;
+    if (*head) (*head)->pprev = &timer->next;
+    *head = timer;
+}
+
+/*
+ * Unlinks a timer from its list.
+ */
+static void unlink_timer (timer *timer)
+{
+    *timer->pprev = timer->next;
+    if (timer->next) timer->next->pprev = timer->pprev;
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+/*
+ * Places a timer in the slot of the lowest level that spans its deadline.
+ * Timers that are already due are placed in the next tick's slot.
+ */
+static void place_timer (timer_wheel *wheel, timer *timer)
+{
+    uint64_t expires = timer->expires; // Tick at which the timer expires
+    uint64_t delta = 0;                // Ticks until the timer expires
+    int level = 0;                     // Level of the wheel
+
+    if (expires <= wheel->current) expires = wheel->current + 1;
+    delta = expires - wheel->current;
+    if (delta >= TIMER_RANGE)
+    {
+        expires = wheel->current + TIMER_RANGE - 1;
+        delta = TIMER_RANGE - 1;
+    }
+
+    while (delta >= ((uint64_t) 1 << (TIMER_BITS * (level + 1)))) level++;
+    link_timer(&wheel->slots[level][(expires >> (TIMER_BITS * level))
+                                    & TIMER_MASK], timer);
+}
+
+/*
+ * Schedules a timer to expire at a time on the monotonic clock, in
+ * microseconds. A pending timer is moved to the new deadline. The timer
+ * never expires early, but may expire up to a tick late.
+ */
+void timer_schedule (timer_wheel *wheel, timer *timer, uint64_t deadline)
+{
+    if (timer->pprev) timer_cancel(wheel, timer);
+
+    // Round the deadline up to the next tick.
+    timer->expires = (deadline > wheel->start)
+            ? (deadline - wheel->start + wheel->tick - 1) / wheel->tick : 0;
+    place_timer(wheel, timer);
+    wheel->count++;
+}
+
+/*
+ * Schedules a timer to expire a number of microseconds from now.
+ */
+void timer_schedule_after (timer_wheel *wheel, timer *timer, uint64_t usec)
+{
+    timer_schedule(wheel, timer, timer_now() + usec);
+}
+
+/*
+ * Cancels a pending timer. Cancelling a timer that is not pending
+ * does nothing.
+ */
+void timer_cancel (timer_wheel *wheel, timer *timer)
+{
+    if (!timer->pprev) return;
+
+    unlink_timer(timer);
+    wheel->count--;
+}
+
+/*
+ * Returns whether a timer is pending.
+ */
+int timer_pending (timer *timer)
+{
+    return timer->pprev != NULL;
+}
+
+/*
+ * Moves the timers of a slot down into the lower levels of the wheel.
+ */
+static void cascade (timer_wheel *wheel, int level, int index)
+{
+    timer *timer = wheel->slots[level][index]; // Timers of the slot
+    struct timer *next = NULL;                  // Next timer of the slot
+
+    wheel->slots[level][index] = NULL;
+    for (; timer; timer = next)
+    {
+        next = timer->next;
+        place_timer(wheel, timer);
+    }
+}
+
+/*
+ * Advances the wheel to a time on the monotonic clock, in microseconds,
+ * and expires every timer whose deadline has passed. Expired timers are
+ * first collected into a batch, then their callbacks are called, so that
+ * callbacks may schedule or cancel any timer (including ones in the batch).
+ *
+ * Return the number of timers that expired.
+ */
+int timer_advance (timer_wheel *wheel, uint64_t now)
+{
+    timer *batch = NULL;       // Expired timers
+    timer *timer = NULL;       // An expired timer
+    uint64_t target = 0;       // Tick to advance to
+    int expired = 0;           // Number of expired timers
+    int level = 0, index = 0;  // Level and slot being cascaded
+
+    target = (now > wheel->start) ? (now - wheel->start) / wheel->tick : 0;
+    while (wheel->current < target)
+    {
+        // Skip ahead while no timers are pending.
+        if (wheel->count == expired)
+        {
+            wheel->current = target;
+            break;
+        }
+        wheel->current++;
+
+        // Cascade the higher levels each time a lower level wraps around.
+        for (level = 1; level < TIMER_LEVELS; level++)
+        {
+            if (wheel->current & (((uint64_t) 1 << (TIMER_BITS * level)) - 1))
+            {
+                break;
+            }
+            index = (wheel->current >> (TIMER_BITS * level)) & TIMER_MASK;
+            cascade(wheel, level, index);
+        }
+
+        // Collect the timers of the tick into the batch.
+        index = wheel->current & TIMER_MASK;
+        while ((timer = wheel->slots[0][index]))
+        {
+            unlink_timer(timer);
+            link_timer(&batch, timer);
+            expired++;
+        }
+    }
+
+    // Expire the batch.
+    expired = 0;
+    while ((timer = batch))
+    {
+        unlink_timer(timer);
+        wheel->count--;
+        expired++;
+        if (timer->callback) timer->callback(timer, timer->arg);
+    }
+    return expired;
+}
+
+/*
+ * Returns the milliseconds from a time on the monotonic clock until the
+ * wheel next needs to be advanced, as a timeout for poll(). When only the
+ * higher levels hold timers, this is the next cascade, which may come
+ * before any timer expires.
+ *
+ * Return the timeout, in milliseconds.
+ * Return -1 if no timers are pending.
+ */
+int timer_next_timeout (timer_wheel *wheel, uint64_t now)
+{
+    uint64_t ticks = 0;    // Ticks until the next expiry or cascade
+    uint64_t deadline = 0; // Time of the next expiry or cascade
+    int i;
+
+    if (wheel->count == 0) return -1;
+
+    // Find the next timer of level 0, or else the next cascade.
+    for (i = 1; i <= TIMER_SLOTS && !ticks; i++)
+    {
+        if (wheel->slots[0][(wheel->current + i) & TIMER_MASK]) ticks = i;
+    }
+    if (!ticks) ticks = TIMER_SLOTS - (wheel->current & TIMER_MASK);
+
+    // Round the wait up to the next millisecond.
+    deadline = wheel->start + (wheel->current + ticks) * wheel->tick;
+    if (deadline <= now) return 0;
+    return (int) ((deadline - now + 999) / 1000);
+}
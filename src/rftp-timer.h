@@ -0,0 +1,77 @@
+/*
+ *  Name        : rftp-timer.h
+ *  Author      : Edmund Luong <edmundvmluong@gmail.com>
+ *  Version     : 1.0
+ *  Copyright   : MIT 2014 © Edmund Luong
+ *  Date        : November 16, 2014
+ *  Description : Implementation of a hierarchical timer wheel for the
+ *                Reliable File Transfer Protocol, which keeps the
+ *                retransmission and time-wait deadlines of the protocol
+ *                in O(1) per timer, driven by the monotonic clock.
+ *
+ *  CS 3357a Assignment 2
+ */
+
+#ifndef RFTP_TIMER_H
+#define RFTP_TIMER_H
+
+#include <stdint.h>
+
+/*
+ * Timer-oriented macros
+ */
+#define TIMER_TICK 1000         // Default length of a tick, in usec
+#define TIMER_LEVELS 4          // Levels of the wheel
+#define TIMER_BITS 8            // Log2 of the slots in each level
+#define TIMER_SLOTS (1 << TIMER_BITS)
+#define TIMER_MASK (TIMER_SLOTS - 1)
+#define TIMER_RANGE ((uint64_t) 1 << (TIMER_BITS * TIMER_LEVELS))
+
+/*
+ * Timer
+ *
+ * A deadline held in a slot of a timer wheel. Timers are embedded in
+ * their owners, and linked into their slot, so scheduling never
+ * allocates. The callback (which may be NULL) is called once the
+ * deadline has passed.
+ */
+typedef struct timer
+{
+    struct timer *next;                    // Next timer in the slot
+    struct timer **pprev;                  // Link to this timer in the slot
+    uint64_t expires;                      // Tick at which the timer expires
+    void (*callback) (struct timer*, void*); // Called when the timer expires
+    void *arg;                             // Argument of the callback
+} timer;
+
+/*
+ * Timer wheel
+ *
+ * Level 0 holds the timers due in the next 256 ticks, one slot per tick.
+ * Each higher level covers 256 times the span of the level below, and its
+ * timers are cascaded down into the lower levels as their time approaches.
+ */
+typedef struct timer_wheel
+{
+    timer *slots[TIMER_LEVELS][TIMER_SLOTS]; // Timers in each slot
+    uint64_t start;                          // Time of tick 0, in usec
+    uint64_t tick;                           // Length of a tick, in usec
+    uint64_t current;                        // Last tick processed
+    int count;                               // Number of pending timers
+} timer_wheel;
+
+/*
+ * Function prototypes
+ */
+uint64_t timer_now ();
+timer_wheel *create_timer_wheel (int tick);
+void timer_init (timer *timer, void (*callback) (struct timer*, void*),
+        void *arg);
+void timer_schedule (timer_wheel *wheel, timer *timer, uint64_t deadline);
+void timer_schedule_after (timer_wheel *wheel, timer *timer, uint64_t usec);
+void timer_cancel (timer_wheel *wheel, timer *timer);
+int timer_pending (timer *timer);
+int timer_advance (timer_wheel *wheel, uint64_t now);
+int timer_next_timeout (timer_wheel *wheel, uint64_t now);
+
+#endif /* RFTP_TIMER_H */
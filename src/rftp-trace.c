@@ -0,0 +1,163 @@
+/*
+ *  Name        : rftp-trace.c
+ *  Author      : Edmund Luong <edmundvmluong@gmail.com>
+ *  Version     : 1.0
+ *  Copyright   : MIT 2014 © Edmund Luong
+ *  Date        : November 16, 2014
+ *  Description : Implementation of a lock-free, in-memory ring of binary
+ *                packet events for the Reliable File Transfer Protocol,
+ *                which can be dumped to a trace file on demand or at exit.
+ *
+ *  CS 3357a Assignment 2
+ */
+
+#include "rftp-trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+static trace_event *ring = NULL;          // Ring of trace events
+static uint64_t head = 0;                 // Events recorded so far
+static uint64_t start_ns = 0;             // Monotonic start of the trace
+static uint64_t start_wall = 0;           // Wall clock start of the trace
+static char *trace_path = NULL;           // Pathname of the trace file
+static volatile sig_atomic_t dump_requested = 0; // Set by SIGUSR1
+
+/*
+ * Returns the time on a clock, in nanoseconds.
+ */
+static uint64_t clock_nsec (clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Requests a dump of the trace at the next recorded event.
+ */
+static void request_dump (int signum)
+{
+    (void) signum;
+    dump_requested = 1;
+}
+
+/*
+ * Starts tracing packet events into the ring. The ring is dumped to the
+ * trace file at the given pathname when SIGUSR1 is received, and when
+ * the trace is shut down.
+ *
+ * Return 1 if tracing was started.
+ * Return 0 if the ring could not be allocated.
+ */
+int trace_enable (char *path)
+{
+    if (!(ring = (trace_event*) calloc(TRACE_EVENTS, sizeof(trace_event))))
+    {
+        perror("Unable to allocate trace ring");
+        return 0;
+    }
+    trace_path = path;
+    start_ns = clock_nsec(CLOCK_MONOTONIC);
+    start_wall = clock_nsec(CLOCK_REALTIME);
+    signal(SIGUSR1, request_dump);
+    return 1;
+}
+
+/*
+ * Records a packet event in the ring, overwriting the oldest event when
+ * the ring is full. The message is NULL for timeouts. Slots are claimed
+ * with a single atomic increment, so recording never blocks and never
+ * allocates. Does nothing when tracing is not enabled.
+ */
+void trace_record (int event, int msg_type, rftp_message *msg)
+{
+    control_message *ctrl = (control_message*) msg; // Message as control
+    trace_event *slot = NULL;                       // Slot of the event
+    uint64_t index = 0;                             // Index of the event
+
+    if (!ring) return;
+
+    // Claim the next slot of the ring and fill it in.
+    index = __atomic_fetch_add(&head, 1, __ATOMIC_RELAXED);
+    slot = &ring[index & (TRACE_EVENTS - 1)];
+    slot->time = clock_nsec(CLOCK_MONOTONIC) - start_ns;
+    slot->event = event;
+    slot->type = msg_type;
+    if (msg)
+    {
+        slot->length = msg->length;
+        slot->seq_num = ntohs(ctrl->seq_num);
+        slot->ack = ctrl->ack;
+        slot->data_len = (msg_type == DATA_MSG)
+                         ? ntohl(((data_message*) msg)->data_len) : 0;
+    }
+    else
+    {
+        slot->length = slot->data_len = slot->seq_num = slot->ack = 0;
+    }
+
+    // Dump the trace if it was requested.
+    if (dump_requested)
+    {
+        dump_requested = 0;
+        trace_dump();
+    }
+}
+
+/*
+ * Writes the events held in the ring to the trace file, oldest first.
+ *
+ * Return 1 if the trace file was written.
+ * Return 0 if tracing is not enabled or the file could not be written.
+ */
+int trace_dump ()
+{
+    trace_header header;   // Header of the trace file
+    FILE *out = NULL;      // Trace file
+    uint64_t recorded = 0; // Events recorded so far
+    uint64_t first = 0;    // Index of the oldest held event
+    uint64_t i;
+
+    if (!ring) return 0;
+    if (!(out = fopen(trace_path, "wb")))
+    {
+        perror("Unable to write trace file");
+        return 0;
+    }
+
+    // Write the header, followed by the held events.
+    recorded = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    first = (recorded > TRACE_EVENTS) ? recorded - TRACE_EVENTS : 0;
+    memset(&header, 0, sizeof(header));
+    strncpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.event_size = sizeof(trace_event);
+    header.recorded = recorded;
+    header.held = recorded - first;
+    header.start = start_wall;
+    fwrite(&header, sizeof(header), 1, out);
+    for (i = first; i < recorded; i++)
+    {
+        fwrite(&ring[i & (TRACE_EVENTS - 1)], sizeof(trace_event), 1, out);
+    }
+
+    return fclose(out) == 0;
+}
+
+/*
+ * Dumps the trace a final time, and frees the ring.
+ */
+void trace_shutdown ()
+{
+    if (!ring) return;
+
+    trace_dump();
+    free(ring);
+    ring = NULL;
+}
@@ -0,0 +1,73 @@
+/*
+ *  Name        : rftp-trace.h
+ *  Author      : Edmund Luong <edmundvmluong@gmail.com>
+ *  Version     : 1.0
+ *  Copyright   : MIT 2014 © Edmund Luong
+ *  Date        : November 16, 2014
+ *  Description : Implementation of a lock-free, in-memory ring of binary
+ *                packet events for the Reliable File Transfer Protocol,
+ *                which can be dumped to a trace file on demand or at exit.
+ *
+ *  CS 3357a Assignment 2
+ */
+
+#ifndef RFTP_TRACE_H
+#define RFTP_TRACE_H
+
+#include "rftp-messages.h"
+
+#include <stdint.h>
+
+/*
+ * Trace-oriented macros
+ */
+#define TRACE_MAGIC "RFTPTRC"  // Magic string at the start of a trace file
+#define TRACE_VERSION 1        // Version of the trace file format
+#define TRACE_EVENTS 65536     // Events held in the ring (a power of two)
+#define TRACE_SEND 1           // A message was sent
+#define TRACE_RECV 2           // A message was received
+#define TRACE_TIMEOUT 3        // No message arrived before the timeout
+#define TRACE_RETRANSMIT 4     // A message is about to be sent again
+
+/*
+ * Trace event
+ *
+ * A compact record of a single packet event, 24 bytes long.
+ */
+typedef struct trace_event
+{
+    uint64_t time;       // Time since the trace started, in nsec
+    uint32_t length;     // Length of the datagram
+    uint32_t data_len;   // Length of the data carried by a data message
+    uint16_t seq_num;    // Sequence number of the message
+    uint8_t event;       // Kind of event (TRACE_SEND, ...)
+    uint8_t type;        // Type of the message
+    uint8_t ack;         // Acknowledgment of the message
+    uint8_t reserved[3]; // Padding, always zero
+} trace_event;
+
+/*
+ * Trace file header
+ *
+ * A trace file is this header followed by the held events, oldest first.
+ * Fields are in host byte order.
+ */
+typedef struct trace_header
+{
+    char magic[8];       // TRACE_MAGIC
+    uint32_t version;    // TRACE_VERSION
+    uint32_t event_size; // Size of each trace event
+    uint64_t recorded;   // Events recorded, including those overwritten
+    uint64_t held;       // Events that follow the header
+    uint64_t start;      // Wall clock time the trace started, in nsec
+} trace_header;
+
+/*
+ * Function prototypes
+ */
+int trace_enable (char *path);
+void trace_record (int event, int msg_type, rftp_message *msg);
+int trace_dump ();
+void trace_shutdown ();
+
+#endif /* RFTP_TRACE_H */
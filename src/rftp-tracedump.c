@@ -0,0 +1,327 @@
+/*
+ *  Name        : rftp-tracedump.c
+ *  Author      : Edmund Luong <edmundvmluong@gmail.com>
+ *  Version     : 1.0
+ *  Copyright   : MIT 2014 © Edmund Luong
+ *  Date        : November 16, 2014
+ *  Description : Offline decoder for RFTP packet trace files, which
+ *                renders a trace as a timeline of events, a sequence
+ *                plot, or CSV for plotting tools.
+ *
+ *  CS 3357a Assignment 2
+ */
+
+#include "rftp-trace.h"
+#include "rftp-messages.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#define TIMELINE 0       // Renders the trace as a timeline
+#define PLOT 1           // Renders the trace as a sequence plot
+#define CSV 2            // Renders the trace as CSV
+#define PLOT_WIDTH 72    // Default width of the sequence plot
+#define PLOT_HEIGHT 24   // Default height of the sequence plot
+#define SEQ_HALF 32768   // Half of the sequence number space
+
+/*
+ * Returns the name of a trace event.
+ */
+static char *event_name (int event)
+{
+    switch (event)
+    {
+        case TRACE_SEND: return "SEND";
+        case TRACE_RECV: return "RECV";
+        case TRACE_TIMEOUT: return "TIMEOUT";
+        case TRACE_RETRANSMIT: return "RETRANSMIT";
+        default: return "UNKNOWN";
+    }
+}
+
+/*
+ * Returns the name of a message type.
+ */
+static char *type_name (int type)
+{
+    switch (type)
+    {
+        case INIT_MSG: return "INIT";
+        case TERM_MSG: return "TERM";
+        case DATA_MSG: return "DATA";
+        case GET_MSG: return "GET";
+        case RANGE_MSG: return "RANGE";
+        case OFFER_MSG: return "OFFER";
+        case HOLE_MSG: return "HOLE";
+        case ZERO_MSG: return "ZERO";
+        case JOIN_MSG: return "JOIN";
+        case STREAM_MSG: return "STREAM";
+        case OPEN_MSG: return "OPEN";
+        case GAP_MSG: return "GAP";
+        default: return "-";
+    }
+}
+
+/*
+ * Returns the name of an acknowledgment.
+ */
+static char *ack_name (int ack)
+{
+    switch (ack)
+    {
+        case NAK: return "NAK";
+        case ACK: return "ACK";
+        case REJ: return "REJ";
+        default: return "-";
+    }
+}
+
+/*
+ * Reads a trace file into memory.
+ *
+ * Return the events of the trace, with its header filled in.
+ * Return NULL if the file could not be read or is not a trace file.
+ */
+static trace_event *read_trace (char *path, trace_header *header)
+{
+    trace_event *events = NULL; // Events of the trace
+    FILE *in = NULL;            // Trace file
+
+    if (!(in = fopen(path, "rb")))
+    {
+        perror("Unable to open trace file");
+        return NULL;
+    }
+
+    // Check the header, then read the events that follow it.
+    if (fread(header, sizeof(*header), 1, in) != 1
+            || strncmp(header->magic, TRACE_MAGIC, sizeof(header->magic))
+            || header->version != TRACE_VERSION
+            || header->event_size != sizeof(trace_event))
+    {
+        fprintf(stderr, "ERROR: %s is not a RFTP trace file.\n", path);
+    }
+    else if (!(events = calloc(header->held + 1, sizeof(trace_event))))
+    {
+        perror("Unable to allocate trace events");
+    }
+    else
+    {
+        header->held = fread(events, sizeof(trace_event), header->held, in);
+    }
+
+    fclose(in);
+    return events;
+}
+
+/*
+ * Outputs a trace as a timeline, with the time since the trace started
+ * and since the previous event.
+ */
+static void output_timeline (trace_header *header, trace_event *events)
+{
+    uint64_t prev = 0; // Time of the previous event
+    uint64_t i;
+
+    printf("Trace of %llu events (%llu recorded, %llu overwritten)\n\n",
+           (unsigned long long) header->held,
+           (unsigned long long) header->recorded,
+           (unsigned long long) (header->recorded - header->held));
+    printf("%14s %12s  %-10s %-5s %5s %6s %6s  %s\n", "TIME (ms)",
+           "DELTA (us)", "EVENT", "TYPE", "SEQ", "LEN", "DATA", "ACK");
+
+    for (i = 0; i < header->held; i++)
+    {
+        trace_event *e = &events[i];
+        if (i == 0) prev = e->time;
+
+        if (e->event == TRACE_TIMEOUT)
+        {
+            printf("%14.6f %12.3f  %-10s\n", e->time / 1e6,
+                   (e->time - prev) / 1e3, event_name(e->event));
+        }
+        else
+        {
+            printf("%14.6f %12.3f  %-10s %-5s %5u %6u %6u  %s\n",
+                   e->time / 1e6, (e->time - prev) / 1e3,
+                   event_name(e->event), type_name(e->type), e->seq_num,
+                   e->length, e->data_len, ack_name(e->ack));
+        }
+        prev = e->time;
+    }
+}
+
+/*
+ * Outputs a trace as CSV, one event per line.
+ */
+static void output_csv (trace_header *header, trace_event *events)
+{
+    uint64_t i;
+
+    printf("time_ns,event,type,seq,length,data_len,ack\n");
+    for (i = 0; i < header->held; i++)
+    {
+        trace_event *e = &events[i];
+        printf("%llu,%s,%s,%u,%u,%u,%s\n", (unsigned long long) e->time,
+               event_name(e->event), type_name(e->type), e->seq_num,
+               e->length, e->data_len, ack_name(e->ack));
+    }
+}
+
+/*
+ * Outputs a trace as a sequence plot of data messages over time. Sequence
+ * numbers are unwrapped, so that a long transfer plots as a single line.
+ * Sends are plotted as '+', received acknowledgments as 'a',
+ * retransmissions as 'R' and timeouts as 'x'.
+ */
+static void output_plot (trace_header *header, trace_event *events,
+        int width, int height)
+{
+    char *grid = NULL;     // Cells of the plot
+    int64_t *seqs = NULL;  // Unwrapped sequence number of each event
+    int64_t last = 0;      // Last unwrapped sequence number
+    int64_t max_seq = 0;   // Largest unwrapped sequence number
+    uint64_t first = 0, span = 1;
+    uint64_t i;
+    int row, col;
+    char mark;
+
+    if (header->held == 0)
+    {
+        printf("The trace holds no events.\n");
+        return;
+    }
+
+    // Unwrap the sequence numbers of the data messages. Timeouts are
+    // plotted at the last sequence number.
+    seqs = calloc(header->held, sizeof(int64_t));
+    for (i = 0; i < header->held; i++)
+    {
+        trace_event *e = &events[i];
+        if (e->type == DATA_MSG)
+        {
+            int64_t seq = (last & ~(int64_t) 0xFFFF) | e->seq_num;
+            if (seq < last - SEQ_HALF) seq += 0x10000;
+            else if (seq > last + SEQ_HALF && seq >= 0x10000) seq -= 0x10000;
+            last = seq;
+        }
+        seqs[i] = last;
+        if (last > max_seq) max_seq = last;
+    }
+    first = events[0].time;
+    if (events[header->held - 1].time > first)
+    {
+        span = events[header->held - 1].time - first;
+    }
+
+    // Mark each event in the grid, keeping the most notable mark.
+    grid = malloc(width * height);
+    memset(grid, ' ', width * height);
+    for (i = 0; i < header->held; i++)
+    {
+        trace_event *e = &events[i];
+        if (e->type != DATA_MSG && e->event != TRACE_TIMEOUT) continue;
+
+        col = (int) ((double) (e->time - first) / span * (width - 1));
+        row = (height - 1) - (int) ((max_seq > 0)
+                ? (double) seqs[i] / max_seq * (height - 1) : 0);
+        switch (e->event)
+        {
+            case TRACE_SEND: mark = '+'; break;
+            case TRACE_RECV: mark = 'a'; break;
+            case TRACE_RETRANSMIT: mark = 'R'; break;
+            default: mark = 'x'; break;
+        }
+        if (strchr(" a+Rx", grid[row * width + col]) < strchr(" a+Rx", mark))
+        {
+            grid[row * width + col] = mark;
+        }
+    }
+
+    // Draw the grid, with the sequence axis on the left and time below.
+    printf("Sequence plot of %llu events over %.3f ms\n\n",
+           (unsigned long long) header->held, span / 1e6);
+    for (row = 0; row < height; row++)
+    {
+        if (row == 0) printf("%10lld |", (long long) max_seq);
+        else if (row == height - 1) printf("%10d |", 0);
+        else printf("%10s |", "");
+        printf("%.*s\n", width, &grid[row * width]);
+    }
+    printf("%10s +", "");
+    for (col = 0; col < width; col++) putchar('-');
+    printf("\n%12s0%*.3f ms\n", "", width - 3, span / 1e6);
+    printf("\n  + sent   a acknowledged   R retransmitted   x timed out\n");
+
+    free(grid);
+    free(seqs);
+}
+
+// Main program.
+int main (int argc, char **argv)
+{
+    int mode = TIMELINE;        // Rendering of the trace
+    int width = PLOT_WIDTH;     // Width of the sequence plot
+    int height = PLOT_HEIGHT;   // Height of the sequence plot
+    char *path = NULL;          // Pathname of the trace file
+    trace_event *events = NULL; // Events of the trace
+    trace_header header;        // Header of the trace file
+
+    // Handle command line options.
+    int arg, option_index = 0;
+    static struct option long_options[] =
+    {
+            {"mode", required_argument, 0, 'm'},
+            {"width", required_argument, 0, 'w'},
+            {"height", required_argument, 0, 'h'},
+            {0, 0, 0, 0}
+    };
+    while ((arg = getopt_long(argc, argv, "m:w:h:", long_options,
+                              &option_index)) != EOF)
+    {
+        switch (arg)
+        {
+            case 'm':   // Sets the rendering of the trace
+                if (!strcmp(optarg, "timeline")) mode = TIMELINE;
+                else if (!strcmp(optarg, "plot")) mode = PLOT;
+                else if (!strcmp(optarg, "csv")) mode = CSV;
+                else
+                {
+                    printf("ERROR: Unknown mode %s.\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'w':   // Sets the width of the sequence plot
+                width = atoi(optarg);
+                break;
+            case 'h':   // Sets the height of the sequence plot
+                height = atoi(optarg);
+                break;
+            case '?':   // Failure
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (width < 8) width = 8;
+    if (height < 2) height = 2;
+
+    // Get the trace file from arguments.
+    if (optind < argc) path = argv[optind];
+    if (!path)
+    {
+        printf("ERROR:\n");
+        printf("- A trace file must be supplied.\n");
+        printf("Sample usage: %s [OPTIONS...] [TRACE FILE]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    // Read the trace, and render it.
+    if (!(events = read_trace(path, &header))) exit(EXIT_FAILURE);
+    if (mode == PLOT) output_plot(&header, events, width, height);
+    else if (mode == CSV) output_csv(&header, events);
+    else output_timeline(&header, events);
+
+    free(events);
+    exit(EXIT_SUCCESS);
+}
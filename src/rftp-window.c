@@ -0,0 +1,761 @@
+/*
+ *  Name        : rftp-window.c
+ *  Author      : Edmund Luong <edmundvmluong@gmail.com>
+ *  Version     : 1.0
+ *  Copyright   : MIT 2014 © Edmund Luong
+ *  Date        : November 16, 2014
+ *  Description : Implementation of the sliding windows of the Reliable File
+ *                Transfer Protocol: the send window, which keeps several
+ *                sequenced messages in flight, and the receive window, which
+ *                holds messages received out of order within a bounded
+ *                memory budget, and is advertised to the sender.
+ *
+ *  CS 3357a Assignment 2
+ */
+
+#include "rftp-window.h"
+#include "rftp-protocol.h"
+#include "rftp-config.h"
+#include "rftp-trace.h"
+#include "rftp-probes.h"
+#include "data.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+static size_t budget_slots =                 // Receive buffer budget,
+        (size_t) DEFAULT_RECEIVE_MB * MB     // in messages
+        / sizeof(rftp_message);
+static size_t reserved_slots = 0;            // Slots reserved by sessions
+
+/*
+ * Creates the send window of a session, which sends its first message
+ * with a sequence number. The window of the sender is rounded down to a
+ * power of two. Until the receiver advertises its window, one message
+ * is sent at a time.
+ *
+ * Return a send window.
+ * Return NULL if the window could not be allocated.
+ */
+send_window *create_send_window (int sockfd, host_t *dest, int first_seq,
+        int capacity, int timeout, pacer *pacer, session_stats *stats,
+        int verbose)
+{
+    send_window *window = NULL; // Send window
+    int slots = 1;              // Window of the sender
+
+    while (slots * 2 <= capacity && slots * 2 <= MAX_WINDOW) slots *= 2;
+    if (!(window = (send_window*) calloc(1, sizeof(send_window)))
+            || !(window->slots = (window_slot*) calloc(slots,
+                                                       sizeof(window_slot))))
+    {
+        perror("Unable to create send window");
+        free(window);
+        return NULL;
+    }
+
+    window->sockfd = sockfd;
+    window->dest = dest;
+    window->timeout = timeout;
+    window->pacer = pacer;
+    window->stats = stats;
+    window->verbose = verbose;
+    window->capacity = slots;
+    window->base = window->next = first_seq;
+    timer_init(&window->retransmit, NULL, NULL);
+    window->paths[0].sockfd = sockfd;
+    window->paths[0].dest = *dest;
+    window->path_count = 1;
+    return window;
+}
+
+/*
+ * Adds a path to the window, through which messages are striped along
+ * with the other paths. The receiver must have accepted the path.
+ *
+ * Return a successful status if the path was added.
+ * Return a failure status if the window has no room for another path.
+ */
+int window_add_path (send_window *window, int sockfd, host_t *dest,
+        char *name)
+{
+    window_path *path = &window->paths[window->path_count]; // New path
+
+    if (window->path_count == MAX_PATHS) return FAILURE;
+
+    memset(path, 0, sizeof(window_path));
+    path->sockfd = sockfd;
+    path->dest = *dest;
+    path->name = name;
+    window->path_count++;
+    return SUCCESS;
+}
+
+/*
+ * Outputs the messages sent, the messages lost and the smoothed round-trip
+ * time of each path of a window striped across several paths.
+ */
+void report_window_paths (send_window *window)
+{
+    window_path *path = NULL; // Path of the window
+    int i;
+
+    if (window->path_count < 2) return;
+
+    printf("\n");
+    for (i = 0; i < window->path_count; i++)
+    {
+        path = &window->paths[i];
+        printf("Path %d (%s): %ld packets sent, %ld lost, RTT %llu us\n",
+               i + 1, path->name ? path->name : "default", path->sent,
+               path->lost, (unsigned long long) path->srtt);
+    }
+}
+
+/*
+ * Picks the path expected to deliver the next message soonest: the one
+ * with the smallest round-trip time, weighed by the messages already in
+ * flight on it, and by its share of messages lost. A path without a
+ * round-trip time yet is taken to be as fast as the fastest one.
+ *
+ * Return the index of the path.
+ */
+static int pick_path (send_window *window)
+{
+    window_path *path = NULL; // Path of the window
+    uint64_t fastest = 0;     // Fastest round-trip time of any path
+    double cost = 0;          // Expected cost of sending on a path
+    double best = 0;          // Smallest cost of any path
+    int pick = 0;             // Index of the picked path
+    int i;
+
+    if (window->path_count == 1) return 0;
+
+    for (i = 0; i < window->path_count; i++)
+    {
+        if (window->paths[i].srtt && (!fastest
+                                      || window->paths[i].srtt < fastest))
+        {
+            fastest = window->paths[i].srtt;
+        }
+    }
+    for (i = 0; i < window->path_count; i++)
+    {
+        path = &window->paths[i];
+        cost = (double) (path->srtt ? path->srtt : fastest + 1)
+               * (path->in_flight + 1) * (path->sent + 1)
+               / (path->sent - path->lost + 1);
+        if (i == 0 || cost < best)
+        {
+            best = cost;
+            pick = i;
+        }
+    }
+
+    return pick;
+}
+
+/*
+ * Sends a message of the window on the path expected to deliver it
+ * soonest, and counts it on the path.
+ *
+ * Return the result of the send operation.
+ */
+static int send_on_path (send_window *window, window_slot *slot)
+{
+    window_path *path = &window->paths[pick_path(window)]; // Picked path
+
+    slot->path = path - window->paths;
+    path->in_flight++;
+    path->sent++;
+    return send_paced_rftp_message(path->sockfd, &path->dest, slot->msg,
+                                   slot->msg_type, window->pacer,
+                                   window->verbose);
+}
+
+/*
+ * Resends a message in flight, counting its earlier copy as lost on the
+ * path it was sent on.
+ *
+ * Return a successful status if the message was resent.
+ * Return a failure status if the message could not be resent.
+ */
+static int resend_on_path (send_window *window, window_slot *slot)
+{
+    window->paths[slot->path].lost++;
+    window->paths[slot->path].in_flight--;
+    trace_record(TRACE_RETRANSMIT, slot->msg_type, slot->msg);
+    RFTP_PROBE2(retransmit, slot->msg_type,
+                ntohs(((data_message*) slot->msg)->seq_num));
+    if (send_on_path(window, slot) == SEND_ERR) return FAILURE;
+    stats_record_sent(window->stats);
+    stats_record_retransmit(window->stats);
+    slot->resent = 1;
+    slot->last_sent_at = stats_now();
+    return SUCCESS;
+}
+
+/*
+ * Returns the sequence number of the next message to send.
+ */
+int window_seq (send_window *window)
+{
+    return (int) (window->next % SEQ_SPACE);
+}
+
+/*
+ * Returns the tail-loss probe timeout of a window, in microseconds: twice
+ * the smoothed round-trip time of its slowest path. A receiver that
+ * advertises less than the window of the sender may be throttling it to
+ * a rate, over 1/TAIL_PROBE_FRACTION of the retransmission timeout (see
+ * fair_window), so its probes wait no less than that. Returns 0 until a
+ * round-trip time has been sampled.
+ */
+uint64_t window_tail_timeout (send_window *window)
+{
+    uint64_t srtt = 0;  // Smoothed round-trip time of the slowest path
+    uint64_t least = 0; // Shortest probe timeout
+    int i;
+
+    for (i = 0; i < window->path_count; i++)
+    {
+        if (window->paths[i].srtt > srtt) srtt = window->paths[i].srtt;
+    }
+    if (!srtt) return 0;
+    if (window->peer_window + 1 < window->capacity)
+    {
+        least = (uint64_t) window->timeout * 1000 / TAIL_PROBE_FRACTION;
+    }
+    return (2 * srtt > least) ? 2 * srtt : least;
+}
+
+/*
+ * Starts the retransmission timer of the oldest message in flight. Unless
+ * the tail was probed since the last progress, the timer expires early,
+ * after the tail-loss probe timeout, to probe it.
+ */
+static void window_arm (send_window *window)
+{
+    uint64_t delay = (uint64_t) window->timeout * 1000; // Retransmission
+    uint64_t probe = window_tail_timeout(window);       // Tail-loss probe
+
+    window->tail_probing = !window->tail_probed && probe && probe < delay;
+    timer_schedule_after(protocol_timers(), &window->retransmit,
+                         window->tail_probing ? probe : delay);
+}
+
+/*
+ * Returns the number of messages that may be in flight: the window of
+ * the sender, or the next expected message and the ones the receiver
+ * can hold past it, whichever is smaller.
+ */
+static int window_limit (send_window *window)
+{
+    return (window->peer_window + 1 < window->capacity)
+           ? window->peer_window + 1 : window->capacity;
+}
+
+/*
+ * Resends the messages in flight that a gap report lists as missing. A
+ * message already resent is only resent again once a round-trip time has
+ * passed, so it is not resent by every later report. The
+ * retransmission timer restarts if the oldest message was resent.
+ *
+ * Return a successful status if the missing messages were resent.
+ * Return a failure status if a message could not be resent.
+ */
+static int window_resend_gaps (send_window *window, data_message *report)
+{
+    gap_range ranges[GAP_RANGES]; // Missing ranges of the report
+    window_slot *slot = NULL;     // Slot of a missing message
+    uint64_t now = stats_now();   // Time the report is handled
+    uint64_t guard = 0;           // Time before a message is resent again
+    int64_t ahead = 0;            // Distance of a message past the oldest
+    int count = 0;                // Number of missing ranges
+    int i, j;
+
+    if (ntohl(report->data_len) < sizeof(uint32_t)) return SUCCESS;
+    count = (ntohl(report->data_len) - sizeof(uint32_t)) / sizeof(gap_range);
+    if (count > GAP_RANGES) count = GAP_RANGES;
+    memcpy(ranges, report->data + sizeof(uint32_t),
+           count * sizeof(gap_range));
+
+    for (i = 0; i < count; i++)
+    {
+        for (j = 0; j < ntohs(ranges[i].count); j++)
+        {
+            ahead = (ntohs(ranges[i].start) + j
+                     - (int) (window->base % SEQ_SPACE)) & (SEQ_SPACE - 1);
+            if (ahead >= window->next - window->base) break;
+            slot = &window->slots[(window->base + ahead)
+                                  & (window->capacity - 1)];
+            guard = window->paths[slot->path].srtt;
+            guard = guard ? guard + guard / 4
+                          : (uint64_t) window->timeout * 1000;
+            if (slot->resent && now - slot->last_sent_at < guard) continue;
+            if (!resend_on_path(window, slot)) return FAILURE;
+            if (ahead == 0)
+            {
+                window->tail_probed = 1;
+                window_arm(window);
+            }
+        }
+    }
+
+    return SUCCESS;
+}
+
+/*
+ * Handles an acknowledgment of the sequenced messages. The messages up to
+ * the acknowledged one are released, and the round-trip time is sampled
+ * from the newest of them, unless it was resent. The retransmission timer
+ * restarts for the oldest message still in flight. A gap report
+ * acknowledges the messages the same way, and then has the missing
+ * messages it lists resent.
+ *
+ * Return a successful status if the acknowledgment was handled.
+ * Return a failure status if a missing message could not be resent.
+ */
+static int window_acknowledge (send_window *window, data_message *ack)
+{
+    timer_wheel *wheel = protocol_timers(); // Timers of the protocol
+    window_slot *slot = NULL;    // Slot of the acknowledged message
+    window_path *path = NULL;    // Path of the acknowledged message
+    uint64_t rtt = 0;            // Round-trip time of the message
+    uint32_t advertised = 0;     // Window advertised by the receiver
+    int64_t acked = 0;           // Acknowledged sequence number
+    int delta = 0;               // Messages acknowledged
+    int resent = 0;              // Whether an acknowledged message was resent
+    int gap = (ack->type == GAP_MSG && ack->ack == NAK); // Gap report
+
+    // A rejected stream ends the window, keeping the cause for the sender.
+    if (ack->type == OPEN_MSG && ack->ack == REJ)
+    {
+        window->error = ntohl(((stream_open_message*) ack)->fsize);
+        return FAILURE;
+    }
+    if (!gap && (ack->ack != ACK || (ack->type != DATA_MSG
+                                     && ack->type != HOLE_MSG
+                                     && ack->type != ZERO_MSG
+                                     && ack->type != STREAM_MSG
+                                     && ack->type != OPEN_MSG)))
+    {
+        return SUCCESS;
+    }
+
+    // Learn the window of the receiver.
+    if (ntohl(ack->data_len) >= sizeof(advertised))
+    {
+        memcpy(&advertised, ack->data, sizeof(advertised));
+        advertised = ntohl(advertised);
+        window->peer_window = (advertised < MAX_WINDOW)
+                              ? (int) advertised : MAX_WINDOW;
+    }
+
+    // Ignore duplicate acknowledgments of messages already released,
+    // though a gap report still lists the messages missing past them.
+    delta = (ntohs(ack->seq_num) - (int) ((window->base - 1) % SEQ_SPACE))
+            & (SEQ_SPACE - 1);
+    if (delta > window->next - window->base) return SUCCESS;
+    if (delta == 0) return gap ? window_resend_gaps(window, ack) : SUCCESS;
+    acked = window->base - 1 + delta;
+
+    // Sample the round-trip time of the newest acknowledged message, and
+    // release the acknowledged messages. If any of them was resent, the
+    // acknowledgment may have waited for the resent copy, not the newest
+    // message, so the sample is ambiguous and skipped (Karn's algorithm).
+    slot = &window->slots[acked & (window->capacity - 1)];
+    rtt = stats_now() - slot->sent_at;
+    path = &window->paths[slot->path];
+    for (; window->base <= acked; window->base++)
+    {
+        slot = &window->slots[window->base & (window->capacity - 1)];
+        window->paths[slot->path].in_flight--;
+        resent |= slot->resent;
+        free(slot->msg);
+        slot->msg = NULL;
+    }
+    if (!resent)
+    {
+        path->srtt = path->srtt ? (7 * path->srtt + rtt) / 8 : rtt;
+        stats_record_rtt(window->stats, rtt);
+    }
+    window->timeouts = 0;
+    window->tail_probed = 0;
+
+    // Restart the retransmission timer, if messages are still in flight.
+    if (window->base < window->next)
+    {
+        window_arm(window);
+    }
+    else
+    {
+        timer_cancel(wheel, &window->retransmit);
+    }
+
+    // Resend the messages missing past the acknowledged ones.
+    return gap ? window_resend_gaps(window, ack) : SUCCESS;
+}
+
+/*
+ * Handles a message received from the receiver of the window, which
+ * acknowledges the sequenced messages in flight, or reports the ones
+ * missing. Other messages, such as stale acknowledgments of control
+ * messages, are ignored.
+ *
+ * Return a successful status if the message was handled.
+ * Return a failure status if a missing message could not be resent.
+ */
+int window_receive (send_window *window, rftp_message *response)
+{
+    stats_record_received(window->stats);
+    return window_acknowledge(window, (data_message*) response);
+}
+
+/*
+ * Returns whether the window has room to send another message now,
+ * without waiting for an acknowledgment.
+ */
+int window_has_room (send_window *window)
+{
+    return window->next - window->base < window_limit(window);
+}
+
+/*
+ * Probes the tail of the window, once its tail-loss probe timeout
+ * expires: the newest message in flight is resent, and the timer restarts
+ * for a full retransmission timeout. A probe is sent before a loss could
+ * be told apart from a delay, so it is not counted as a loss or a
+ * retransmission; it is still not sampled for the round-trip time.
+ *
+ * Return a successful status if the message was resent.
+ * Return a failure status if the message could not be resent.
+ */
+static int window_probe_tail (send_window *window)
+{
+    window_slot *slot = &window->slots[(window->next - 1)
+                                       & (window->capacity - 1)];
+
+    window->tail_probed = 1;
+    window->paths[slot->path].in_flight--;
+    trace_record(TRACE_RETRANSMIT, slot->msg_type, slot->msg);
+    if (send_on_path(window, slot) == SEND_ERR) return FAILURE;
+    stats_record_sent(window->stats);
+    slot->resent = 1;
+    slot->last_sent_at = stats_now();
+    window_arm(window);
+    return SUCCESS;
+}
+
+/*
+ * Handles the expiry of the retransmission timer: the oldest message
+ * in flight is resent, and the timer restarts. If the timer expired
+ * early to probe the tail, the tail is probed instead.
+ *
+ * Return a successful status if the message was resent.
+ * Return a failure status if the message could not be resent, or the
+ * receiver stopped responding, which is kept as the error of the window.
+ */
+int window_expire (send_window *window)
+{
+    window_slot *slot = NULL;      // Slot of the oldest message
+
+    if (window->tail_probing && window->base < window->next)
+    {
+        return window_probe_tail(window);
+    }
+    stats_record_timeout(window->stats);
+    stats_poll();
+    if (window->base == window->next) return SUCCESS;
+
+    // Resend the oldest message, unless the receiver is considered gone.
+    if (retransmit_limit_reached(window->timeouts))
+    {
+        window->error = ETIMEDOUT;
+        return FAILURE;
+    }
+    slot = &window->slots[window->base & (window->capacity - 1)];
+    if (!resend_on_path(window, slot)) return FAILURE;
+    window->tail_probed = 1;
+    window_arm(window);
+    window->timeouts++;
+    return SUCCESS;
+}
+
+/*
+ * Waits for an acknowledgment from the receiver, or else for the
+ * retransmission timer to expire, and then resends the oldest message.
+ * Messages from any other host are ignored.
+ *
+ * Return a successful status if an acknowledgment or a timeout was handled.
+ * Return a failure status if the message could not be resent, or the
+ * receiver stopped responding.
+ */
+static int window_wait (send_window *window)
+{
+    rftp_message *response = NULL; // A received RFTP message
+    host_t source;                 // Source of the received message
+    int status = SUCCESS;          // Status of the handled message
+
+    // Handle an acknowledgment from the receiver.
+    response = receive_rftp_message_before(window->sockfd, &source,
+                                           protocol_timers(),
+                                           &window->retransmit,
+                                           window->verbose);
+    if (response)
+    {
+        if (same_host(&source, window->dest))
+        {
+            status = window_receive(window, response);
+        }
+        free(response);
+        stats_poll();
+        return status;
+    }
+
+    return window_expire(window);
+}
+
+/*
+ * Sends a sequenced message once the window has room for it, handling
+ * acknowledgments and retransmissions while it waits. The message must
+ * carry the sequence number from window_seq, and is freed by the window
+ * once it is acknowledged.
+ *
+ * Return a successful status if the message was sent.
+ * Return a failure status if the message could not be sent.
+ */
+int window_send (send_window *window, rftp_message *msg, int msg_type)
+{
+    window_slot *slot = NULL; // Slot of the message
+
+    if (!msg) return FAILURE;
+
+    // Wait for room in the window.
+    while (!window_has_room(window))
+    {
+        if (!window_wait(window))
+        {
+            free(msg);
+            return FAILURE;
+        }
+    }
+
+    // Send the message, and start the retransmission timer if it is the
+    // only message in flight.
+    slot = &window->slots[window->next & (window->capacity - 1)];
+    slot->msg = msg;
+    slot->msg_type = msg_type;
+    slot->resent = 0;
+    if (send_on_path(window, slot) == SEND_ERR)
+    {
+        window->paths[slot->path].in_flight--;
+        slot->msg = NULL;
+        free(msg);
+        return FAILURE;
+    }
+    slot->sent_at = slot->last_sent_at = stats_now();
+    stats_record_sent(window->stats);
+    if (window->base == window->next) window_arm(window);
+    window->next++;
+    return SUCCESS;
+}
+
+/*
+ * Waits until every message in flight is acknowledged.
+ *
+ * Return a successful status if the messages were acknowledged.
+ * Return a failure status if the messages could not be acknowledged.
+ */
+int window_drain (send_window *window)
+{
+    while (window->base < window->next)
+    {
+        if (!window_wait(window)) return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/*
+ * Sends a sequenced message that must be answered before anything else
+ * is sent, such as a chunk offer: the window is drained first, and the
+ * message is then sent with the Stop-and-Wait protocol. The message must
+ * carry the sequence number from window_seq, and is left to the caller,
+ * holding its acknowledgment.
+ *
+ * Return a successful status if the message was sent and acknowledged.
+ * Return a failure status if the message could not be acknowledged, with
+ * its cause kept as the error of the window.
+ */
+int window_exchange (send_window *window, rftp_message *msg, int msg_type)
+{
+    if (!msg || !window_drain(window)) return FAILURE;
+    if (!stop_and_wait_send(window->sockfd, window->dest, msg, msg_type,
+                            window->timeout, 0, window->pacer, window->stats,
+                            window->verbose))
+    {
+        window->error = errno;
+        return FAILURE;
+    }
+
+    window->base = ++window->next;
+    return SUCCESS;
+}
+
+/*
+ * Frees a send window, and any messages still in flight.
+ */
+void free_send_window (send_window *window)
+{
+    int i;
+
+    if (!window) return;
+
+    timer_cancel(protocol_timers(), &window->retransmit);
+    for (i = 0; i < window->capacity; i++) free(window->slots[i].msg);
+    free(window->slots);
+    free(window);
+}
+
+/*
+ * Sets the receive buffer budget of the process, which the receive
+ * windows of all sessions share.
+ */
+void set_receive_budget (size_t bytes)
+{
+    budget_slots = bytes / sizeof(rftp_message);
+}
+
+/*
+ * Opens the receive window of a session, reserving as many slots as the
+ * receive buffer budget has left, up to RECEIVE_WINDOW, rounded down to
+ * a power of two.
+ *
+ * Return a receive window.
+ * Return NULL if the window could not be allocated.
+ */
+receive_window *open_receive_window ()
+{
+    receive_window *window = NULL; // Receive window
+    int slots = RECEIVE_WINDOW;    // Slots of the window
+
+    if (!(window = (receive_window*) calloc(1, sizeof(receive_window))))
+    {
+        perror("Unable to create receive window");
+        return NULL;
+    }
+
+    // Reserve the slots from the budget.
+    while (slots > 0 && reserved_slots + slots > budget_slots) slots /= 2;
+    if (slots > 0 && !(window->held = (rftp_message**) calloc(
+            slots, sizeof(rftp_message*))))
+    {
+        slots = 0;
+    }
+    window->slots = slots;
+    reserved_slots += slots;
+    return window;
+}
+
+/*
+ * Holds a message received ahead of the next expected message, if it is
+ * within the window and not already held.
+ *
+ * Return 1 if the message is held, and now belongs to the window.
+ * Return 0 if the message is outside of the window or already held.
+ */
+int window_hold (receive_window *window, int next_seq, rftp_message *msg)
+{
+    int seq_num = ntohs(((data_message*) msg)->seq_num); // Sequence number
+    int ahead = (seq_num - next_seq) & (SEQ_SPACE - 1);   // Distance ahead
+    rftp_message **slot = NULL;                          // Slot of the message
+
+    if (ahead == 0 || ahead > window->slots) return 0;
+    slot = &window->held[seq_num & (window->slots - 1)];
+    if (*slot) return 0;
+
+    *slot = msg;
+    window->count++;
+    return 1;
+}
+
+/*
+ * Takes the message held with a sequence number out of the window.
+ *
+ * Return the message, if it is held.
+ * Return NULL if the message is not held.
+ */
+rftp_message *window_take (receive_window *window, int seq_num)
+{
+    rftp_message **slot = NULL; // Slot of the message
+    rftp_message *msg = NULL;   // Held message
+
+    if (window->count == 0) return NULL;
+    slot = &window->held[seq_num & (window->slots - 1)];
+    if (!*slot || ntohs(((data_message*) *slot)->seq_num) != seq_num)
+    {
+        return NULL;
+    }
+
+    msg = *slot;
+    *slot = NULL;
+    window->count--;
+    return msg;
+}
+
+/*
+ * Lists the ranges of messages missing from a receive window before the
+ * messages it holds, starting with the next expected message, up to a
+ * maximum number of ranges.
+ *
+ * Return the number of missing ranges listed.
+ */
+int window_gaps (receive_window *window, int next_seq, gap_range *ranges,
+        int max)
+{
+    rftp_message *held = NULL; // Message held in a slot
+    int count = 0;             // Number of missing ranges
+    int start = -1;            // Distance ahead of the current range
+    int seq_num = 0;           // Sequence number of a message
+    int ahead;
+
+    for (ahead = 0; ahead <= window->slots && count < max; ahead++)
+    {
+        seq_num = (next_seq + ahead) % SEQ_SPACE;
+        held = window->slots ? window->held[seq_num & (window->slots - 1)]
+                             : NULL;
+        if (!held || ntohs(((data_message*) held)->seq_num) != seq_num)
+        {
+            if (start < 0) start = ahead;
+        }
+        else if (start >= 0)
+        {
+            ranges[count].start = htons((uint16_t) ((next_seq + start)
+                                                    % SEQ_SPACE));
+            ranges[count].count = htons((uint16_t) (ahead - start));
+            count++;
+            start = -1;
+        }
+    }
+
+    return count;
+}
+
+/*
+ * Closes a receive window, freeing any messages it holds and returning
+ * its slots to the receive buffer budget.
+ */
+void close_receive_window (receive_window *window)
+{
+    int i;
+
+    if (!window) return;
+
+    for (i = 0; i < window->slots; i++) free(window->held[i]);
+    reserved_slots -= window->slots;
+    free(window->held);
+    free(window);
+}
@@ -0,0 +1,163 @@
+/*
+ *  Name        : rftp-window.h
+ *  Author      : Edmund Luong <edmundvmluong@gmail.com>
+ *  Version     : 1.0
+ *  Copyright   : MIT 2014 © Edmund Luong
+ *  Date        : November 16, 2014
+ *  Description : Implementation of the sliding windows of the Reliable File
+ *                Transfer Protocol: the send window, which keeps several
+ *                sequenced messages in flight, and the receive window, which
+ *                holds messages received out of order within a bounded
+ *                memory budget, and is advertised to the sender.
+ *
+ *  CS 3357a Assignment 2
+ */
+
+#ifndef RFTP_WINDOW_H
+#define RFTP_WINDOW_H
+
+#include "rftp-messages.h"
+#include "udp-sockets.h"
+#include "rftp-stats.h"
+#include "rftp-pacer.h"
+#include "rftp-timer.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Window-oriented macros
+ */
+#define DEFAULT_WINDOW 64         // Default messages in flight per session
+#define MAX_WINDOW 16384          // Most messages in flight per session
+#define RECEIVE_WINDOW 256        // Most messages held per receive window
+#define DEFAULT_RECEIVE_MB 64     // Default receive buffer budget, in MB
+#define MAX_PATHS 8               // Most paths per session
+#define TAIL_PROBE_FRACTION 2     // Probes of a throttled window wait at
+                                  // least 1/2 the timeout
+
+/*
+ * Window slot
+ *
+ * A sent message that has not been acknowledged yet.
+ */
+typedef struct window_slot
+{
+    rftp_message *msg;        // Sent message
+    int msg_type;             // Type of the message
+    uint64_t sent_at;         // Time the message was first sent
+    uint64_t last_sent_at;    // Time the message was last sent
+    int resent;               // Whether the message was resent
+    int path;                 // Path the message was last sent on
+} window_slot;
+
+/*
+ * Window path
+ *
+ * A socket bound to one local address, and the round-trip time and loss
+ * of the messages sent through it. Acknowledgments of every path return
+ * on the first path, so only the first socket is read from.
+ */
+typedef struct window_path
+{
+    int sockfd;               // Socket bound to the local address
+    host_t dest;              // Receiver, as reached through the path
+    char *name;               // Local address of the path
+    uint64_t srtt;            // Smoothed round-trip time, in usec (0 = none)
+    int in_flight;            // Messages in flight on the path
+    long sent;                // Messages sent on the path
+    long lost;                // Messages that timed out on the path
+} window_path;
+
+/*
+ * Send window
+ *
+ * The sequenced messages (data, hole, zero range and stream messages) a
+ * sender has in flight. The receiver acknowledges them cumulatively, with the
+ * sequence number of the last message it received in order, and
+ * advertises how many messages past that one it can hold. The sender
+ * never has more messages in flight than the receiver can hold, nor
+ * more than its own window. A single retransmission timer runs for the
+ * oldest unacknowledged message. When the receiver sees a gap, it reports
+ * the missing messages at once (see gap_range), and the sender resends
+ * them without waiting for the timer, unless they were sent again less
+ * than a round-trip time ago. A loss at the tail of the window leaves no
+ * later message to reveal it, so the timer first expires after the
+ * tail-loss probe timeout (see window_tail_timeout), two round-trip times
+ * unless the receiver throttles its window, and the newest message is
+ * resent as a tail-loss probe:
+ * its acknowledgment, or a gap report, recovers the tail without waiting
+ * for a full timeout. The tail is probed once per acknowledgment that
+ * makes progress.
+ *
+ * A window may stripe its messages across several paths. Each message
+ * goes out on the path expected to deliver it soonest, weighing the
+ * round-trip time of each path by its messages in flight and its loss.
+ */
+typedef struct send_window
+{
+    int sockfd;               // Socket of the session
+    host_t *dest;             // Receiver of the session
+    int timeout;              // Retransmission timeout, in milliseconds
+    pacer *pacer;             // Pacer of the messages, if any
+    session_stats *stats;     // Statistics of the session
+    int verbose;              // Verbose output
+    window_slot *slots;       // Messages in flight, by sequence number
+    int capacity;             // Window of the sender, a power of two
+    int peer_window;          // Window advertised by the receiver
+    int64_t base;             // Oldest unacknowledged sequence number
+    int64_t next;             // Next sequence number to send
+    timer retransmit;         // Retransmission timer of the oldest message
+    int tail_probing;         // Whether the timer expires to probe the tail
+    int tail_probed;          // Whether the tail was probed since progress
+    int timeouts;             // Timeouts in a row without progress
+    window_path paths[MAX_PATHS]; // Paths of the session, the first one
+                                  // being the socket of the session
+    int path_count;           // Number of paths
+    int error;                // Cause of a failure (errno value)
+} send_window;
+
+/*
+ * Receive window
+ *
+ * The messages received ahead of the next expected one, waiting for the
+ * messages before them. Its slots are reserved from the receive buffer
+ * budget of the process, which sessions share, so the advertised window
+ * is always backed by memory. A window with no slots only accepts the
+ * next expected message, like a Stop-and-Wait receiver. The gaps between
+ * the held messages are reported to the sender, to be resent.
+ */
+typedef struct receive_window
+{
+    rftp_message **held;      // Messages held, by sequence number
+    int slots;                // Number of slots, a power of two (or 0)
+    int count;                // Number of messages held
+} receive_window;
+
+/*
+ * Function prototypes
+ */
+send_window *create_send_window (int sockfd, host_t *dest, int first_seq,
+        int capacity, int timeout, pacer *pacer, session_stats *stats,
+        int verbose);
+int window_add_path (send_window *window, int sockfd, host_t *dest,
+        char *name);
+void report_window_paths (send_window *window);
+int window_seq (send_window *window);
+uint64_t window_tail_timeout (send_window *window);
+int window_receive (send_window *window, rftp_message *response);
+int window_has_room (send_window *window);
+int window_expire (send_window *window);
+int window_send (send_window *window, rftp_message *msg, int msg_type);
+int window_exchange (send_window *window, rftp_message *msg, int msg_type);
+int window_drain (send_window *window);
+void free_send_window (send_window *window);
+void set_receive_budget (size_t bytes);
+receive_window *open_receive_window ();
+int window_hold (receive_window *window, int next_seq, rftp_message *msg);
+rftp_message *window_take (receive_window *window, int seq_num);
+int window_gaps (receive_window *window, int next_seq, gap_range *ranges,
+        int max);
+void close_receive_window (receive_window *window);
+
+#endif /* RFTP_WINDOW_H */
@@ -0,0 +1,127 @@
+/*
+ *  Name        : rftp-zero.c
+ *  Author      : Edmund Luong <edmundvmluong@gmail.com>
+ *  Version     : 1.0
+ *  Copyright   : MIT 2014 © Edmund Luong
+ *  Date        : November 16, 2014
+ *  Description : Implementation of zero-block detection for the Reliable
+ *                File Transfer Protocol, which finds data packets holding
+ *                only zeros, so that they are sent as zero ranges instead.
+ *
+ *  CS 3357a Assignment 2
+ */
+
+#include "rftp-zero.h"
+
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/*
+ * Checks a block for zeros eight bytes at a time, with the last bytes
+ * checked one at a time.
+ *
+ * Return 1 if every byte of the block is zero.
+ * Return 0 otherwise.
+ */
+static int is_zero_words (const uint8_t *data, size_t length)
+{
+    uint64_t word = 0; // Bytes of the block being checked
+    uint64_t any = 0;  // Bits set anywhere in the block
+    size_t i = 0;
+
+    for (; i + sizeof(word) <= length; i += sizeof(word))
+    {
+        memcpy(&word, data + i, sizeof(word));
+        any |= word;
+    }
+    for (; i < length; i++) any |= data[i];
+
+    return any == 0;
+}
+
+#if defined(__x86_64__)
+
+/*
+ * Checks a block for zeros 64 bytes at a time (SSE2, which every x86-64
+ * CPU has), stopping at the first 64 bytes that are not all zero.
+ *
+ * Return 1 if every byte of the block is zero.
+ * Return 0 otherwise.
+ */
+static int is_zero_sse2 (const uint8_t *data, size_t length)
+{
+    __m128i zero = _mm_setzero_si128(); // Vector of zeros
+    const __m128i *block;               // 64 bytes being checked
+    __m128i any;                        // Bits set in the 64 bytes
+    size_t i = 0;
+
+    for (; i + 64 <= length; i += 64)
+    {
+        block = (const __m128i*) (data + i);
+        any = _mm_or_si128(_mm_or_si128(_mm_loadu_si128(block),
+                                        _mm_loadu_si128(block + 1)),
+                           _mm_or_si128(_mm_loadu_si128(block + 2),
+                                        _mm_loadu_si128(block + 3)));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(any, zero)) != 0xFFFF) return 0;
+    }
+
+    return is_zero_words(data + i, length - i);
+}
+
+/*
+ * Checks a block for zeros 128 bytes at a time (AVX2), stopping at the
+ * first 128 bytes that are not all zero.
+ *
+ * Return 1 if every byte of the block is zero.
+ * Return 0 otherwise.
+ */
+__attribute__((target("avx2")))
+static int is_zero_avx2 (const uint8_t *data, size_t length)
+{
+    const __m256i *block; // 128 bytes being checked
+    __m256i any;          // Bits set in the 128 bytes
+    size_t i = 0;
+
+    for (; i + 128 <= length; i += 128)
+    {
+        block = (const __m256i*) (data + i);
+        any = _mm256_or_si256(
+                _mm256_or_si256(_mm256_loadu_si256(block),
+                                _mm256_loadu_si256(block + 1)),
+                _mm256_or_si256(_mm256_loadu_si256(block + 2),
+                                _mm256_loadu_si256(block + 3)));
+        if (!_mm256_testz_si256(any, any)) return 0;
+    }
+
+    return is_zero_sse2(data + i, length - i);
+}
+
+#endif
+
+/*
+ * Checks whether a block holds only zeros, with the widest vector
+ * instructions the CPU supports. Blocks of data are usually rejected
+ * within their first bytes, so the check costs little on data that is
+ * not zero.
+ *
+ * Return 1 if every byte of the block is zero.
+ * Return 0 otherwise.
+ */
+int is_zero_block (const uint8_t *data, size_t length)
+{
+#if defined(__x86_64__)
+    static int (*check)(const uint8_t*, size_t) = NULL; // Chosen check
+
+    if (!check)
+    {
+        __builtin_cpu_init();
+        check = __builtin_cpu_supports("avx2") ? is_zero_avx2 : is_zero_sse2;
+    }
+    return check(data, length);
+#else
+    return is_zero_words(data, length);
+#endif
+}
@@ -0,0 +1,25 @@
+/*
+ *  Name        : rftp-zero.h
+ *  Author      : Edmund Luong <edmundvmluong@gmail.com>
+ *  Version     : 1.0
+ *  Copyright   : MIT 2014 © Edmund Luong
+ *  Date        : November 16, 2014
+ *  Description : Implementation of zero-block detection for the Reliable
+ *                File Transfer Protocol, which finds data packets holding
+ *                only zeros, so that they are sent as zero ranges instead.
+ *
+ *  CS 3357a Assignment 2
+ */
+
+#ifndef RFTP_ZERO_H
+#define RFTP_ZERO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Function prototypes
+ */
+int is_zero_block (const uint8_t *data, size_t length);
+
+#endif /* RFTP_ZERO_H */
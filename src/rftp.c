@@ -5,13 +5,21 @@
  *  Copyright   : MIT 2014 © Edmund Luong
  *  Date        : November 11, 2014
  *  Description : Executable client for the Reliable File Transfer Protocol,
- *                used to transfer a file to a RFTP server.
+ *                used to transfer a file to a RFTP server, or to fetch a
+ *                file from one.
  *
  *  CS 3357a Assignment 2
  */
 
 #include "rftp-client.h"
 #include "rftp-config.h"
+#include "rftp-trace.h"
+#include "rftp-busypoll.h"
+#include "rftp-window.h"
+#include "rftp-crypto.h"
+#include "rftp-batch.h"
+#include "rftp-stream.h"
+#include "file.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -25,6 +33,26 @@ int main (int argc, char **argv)
     char *port_number = DEFAULT_PORT; // RFTP server port number
     char *server = NULL;              // RFTP server name (IP address)
     char *filename = NULL;            // Name of file to be sent
+    long rate = 0;                    // Pacing rate in kbps (0 = unpaced)
+    int stats_interval = 0;           // Statistics report interval, in msec
+    char *stats_socket = NULL;        // Pathname of the statistics socket
+    char *trace_file = NULL;          // Pathname of the packet trace file
+    int busy_poll = 0;                // Busy-poll spin in usec (0 = off)
+    int cpu = NO_CPU;                 // CPU to pin the process to
+    static int get = 0;               // Fetches the file from the server
+    char *output_dir = ".";           // Directory to fetch the file into
+    int64_t offset = 0;               // Offset of the byte range to fetch
+    int64_t length = NO_RANGE;        // Length of the byte range to fetch
+    char *end = NULL;                 // End of the parsed byte range
+    static int dedup = 0;             // Sends only chunks the server lacks
+    int window = DEFAULT_WINDOW;      // Data packets in flight
+    char *sources[MAX_PATHS];         // Local addresses of the paths
+    int source_count = 0;             // Number of local addresses
+    char **hosts = NULL;              // Servers of a batch upload
+    int host_count = 0;               // Number of servers of the batch
+    int jobs = DEFAULT_JOBS;          // Servers of the batch sent at once
+    static int multiplex = 0;         // Sends the files at once, as streams
+    int keyed = 0;                    // Encrypts with a pre-shared key
 
     // Handle command line options.
     int arg, option_index = 0;
@@ -33,9 +61,25 @@ int main (int argc, char **argv)
             {"verbose", no_argument, &verbose, 1},
             {"timeout", optional_argument, 0, 't'},
             {"port", optional_argument, 0, 'p'},
+            {"rate", required_argument, 0, 'r'},
+            {"stats-interval", required_argument, 0, 'i'},
+            {"stats-socket", required_argument, 0, 'S'},
+            {"trace", required_argument, 0, 'T'},
+            {"busy-poll", required_argument, 0, 'b'},
+            {"cpu", required_argument, 0, 'c'},
+            {"get", no_argument, &get, 1},
+            {"output", required_argument, 0, 'o'},
+            {"range", required_argument, 0, 'R'},
+            {"dedup", no_argument, &dedup, 1},
+            {"window", required_argument, 0, 'w'},
+            {"bind", required_argument, 0, 'B'},
+            {"key", required_argument, 0, 'K'},
+            {"host", required_argument, 0, 'H'},
+            {"jobs", required_argument, 0, 'j'},
+            {"multiplex", no_argument, &multiplex, 1},
             {0, 0, 0, 0}
     };
-    while ((arg = getopt_long(argc, argv, "vt:p:", long_options,
+    while ((arg = getopt_long(argc, argv, "vt:p:r:i:S:T:b:c:go:R:Dw:B:K:H:j:m", long_options,
                               &option_index)) != EOF)
     {
         switch (arg)
@@ -49,11 +93,155 @@ int main (int argc, char **argv)
             case 'p':   // Sets port number to send messages to
                 port_number = optarg;
                 break;
+            case 'r':   // Sets the pacing rate, in kilobits per second
+                rate = atol(optarg);
+                break;
+            case 'i':   // Sets the statistics report interval, in milliseconds
+                stats_interval = atoi(optarg);
+                break;
+            case 'S':   // Sets the pathname of the statistics socket
+                stats_socket = optarg;
+                break;
+            case 'T':   // Traces packet events to a trace file
+                trace_file = optarg;
+                break;
+            case 'b':    // Spins for messages, up to the given microseconds
+                busy_poll = atoi(optarg);
+                break;
+            case 'c':    // Pins the process to a CPU
+                cpu = atoi(optarg);
+                break;
+            case 'g':   // Fetches the file from the server
+                get = 1;
+                break;
+            case 'o':   // Sets the directory to fetch the file into
+                output_dir = optarg;
+                break;
+            case 'R':   // Fetches the byte range OFFSET[:LENGTH] of the file
+                offset = strtoll(optarg, &end, 10);
+                length = (*end == ':') ? strtoll(end + 1, &end, 10) : 0;
+                if (*end || length < 0 || length > MAX_FSIZE)
+                {
+                    printf("ERROR: Invalid byte range %s.\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                get = 1;
+                break;
+            case 'D':   // Sends only the chunks of the file the server lacks
+                dedup = 1;
+                break;
+            case 'w':   // Sets the data packets in flight (1 = Stop-and-Wait)
+                window = atoi(optarg);
+                if (window < 1 || window > MAX_WINDOW)
+                {
+                    printf("ERROR: The window must be 1 to %d packets.\n",
+                           MAX_WINDOW);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'B':   // Adds a path from a local address, to stripe across
+                if (source_count == MAX_PATHS)
+                {
+                    printf("ERROR: At most %d paths may be used.\n",
+                           MAX_PATHS);
+                    exit(EXIT_FAILURE);
+                }
+                sources[source_count++] = optarg;
+                break;
+            case 'K':   // Encrypts the transfer with the pre-shared key of a file
+                if (!load_psk(optarg)) exit(EXIT_FAILURE);
+                keyed = 1;
+                break;
+            case 'H':   // Adds a server SERVER[:PORT] to send a batch of files
+                if (!hosts && !(hosts = malloc(argc * sizeof(char*))))
+                {
+                    perror("Unable to allocate servers");
+                    exit(EXIT_FAILURE);
+                }
+                hosts[host_count++] = optarg;
+                break;
+            case 'j':   // Sets the servers of a batch sent the files at once
+                jobs = atoi(optarg);
+                if (jobs < 1)
+                {
+                    printf("ERROR: At least 1 job must be run.\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'm':   // Sends the files at once, as streams of one session
+                multiplex = 1;
+                break;
             case '?':   // Failure
                 exit(EXIT_FAILURE);
         }
     }
 
+    // Send the files to every server of a batch, and exit the program.
+    if (host_count > 0)
+    {
+        if (optind == argc)
+        {
+            printf("ERROR: At least one file must be supplied.\n");
+            printf("Sample usage: %s -H [SERVER] [OPTIONS...] [FILES...]\n",
+                   argv[0]);
+            exit(EXIT_FAILURE);
+        }
+
+        // Batch sessions send files whole, unpaced and in the clear, from
+        // one socket per server, so refuse the options they cannot honour.
+        if (keyed || rate || dedup || source_count > 0 || busy_poll
+                || get || multiplex)
+        {
+            printf("ERROR: -K, -r, -D, -B, -b, -g, -R and -m cannot be "
+                   "used with -H.\n");
+            exit(EXIT_FAILURE);
+        }
+        if (!stats_configure(stats_interval, stats_socket)) exit(EXIT_FAILURE);
+        if (trace_file && !trace_enable(trace_file)) exit(EXIT_FAILURE);
+        if (!busy_poll_configure(0, cpu)) exit(EXIT_FAILURE);
+        if (rftp_upload_batch(hosts, host_count, port_number, argv + optind,
+                              argc - optind, jobs, timeout, window, verbose))
+        {
+            stats_shutdown();
+            trace_shutdown();
+            exit(EXIT_SUCCESS);
+        }
+        stats_shutdown();
+        trace_shutdown();
+        exit(EXIT_FAILURE);
+    }
+
+    // Send the files to the server at once, and exit the program.
+    if (multiplex)
+    {
+        if (argc - optind < 2)
+        {
+            printf("ERROR: A server name and at least one file must be "
+                   "supplied.\n");
+            printf("Sample usage: %s -m [OPTIONS...] [SERVER] "
+                   "[FILE[:PRIORITY[:WEIGHT]]...]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        if (!stats_configure(stats_interval, stats_socket)) exit(EXIT_FAILURE);
+        if (trace_file && !trace_enable(trace_file)) exit(EXIT_FAILURE);
+        if (!busy_poll_configure(busy_poll, cpu)) exit(EXIT_FAILURE);
+        if (rftp_transfer_streams(argv[optind], port_number, argv + optind + 1,
+                                  argc - optind - 1, timeout, rate, window,
+                                  verbose))
+        {
+            printf("\nThe files were successfully sent to %s.\n",
+                   argv[optind]);
+            stats_shutdown();
+            trace_shutdown();
+            exit(EXIT_SUCCESS);
+        }
+        printf("\nCould not successfully send the files to %s.\n",
+               argv[optind]);
+        stats_shutdown();
+        trace_shutdown();
+        exit(EXIT_FAILURE);
+    }
+
     // Handle non-option arguments.
     for (; optind < argc; ++optind)
     {
@@ -76,17 +264,53 @@ int main (int argc, char **argv)
         exit(EXIT_FAILURE);
     }
 
+    // Report the statistics of the transfer, if requested.
+    if (!stats_configure(stats_interval, stats_socket)) exit(EXIT_FAILURE);
+
+    // Trace packet events, if requested.
+    if (trace_file && !trace_enable(trace_file)) exit(EXIT_FAILURE);
+
+    // Trade a CPU for receive latency, if requested.
+    if (!busy_poll_configure(busy_poll, cpu)) exit(EXIT_FAILURE);
+
+    // Fetch the file from the server and exit the program.
+    if (get)
+    {
+        if (rftp_fetch_file(server, port_number, filename, output_dir,
+                            offset, length, timeout, verbose))
+        {
+            // Success.
+            printf("\n%s was successfully fetched from %s into %s.\n",
+                   filename, server, output_dir);
+            stats_shutdown();
+            trace_shutdown();
+            exit(EXIT_SUCCESS);
+        }
+
+        // Failure.
+        printf("\nCould not successfully fetch %s from %s.\n", filename,
+               server);
+        stats_shutdown();
+        trace_shutdown();
+        exit(EXIT_FAILURE);
+    }
+
     // Transfer the file to the server and exit the program.
-    if (rftp_transfer_file(server, port_number, filename, timeout, verbose))
+    if (rftp_transfer_file(server, port_number, filename, timeout, rate,
+                           window, dedup, sources, source_count, verbose))
     {
         // Success.
         printf("\n%s was successfully sent to %s.\n", filename, server);
+        stats_shutdown();
+        trace_shutdown();
         exit(EXIT_SUCCESS);
     }
     else
     {
         // Failure.
         printf("\nCould not successfully send %s to %s.\n", filename, server);
+        stats_shutdown();
+        trace_shutdown();
         exit(EXIT_FAILURE);
     }
 }
@@ -5,13 +5,22 @@
  *  Copyright   : MIT 2014 © Edmund Luong
  *  Date        : November 11, 2014
  *  Description : Executable server daemon for the Reliable File Transfer
- *                Protocol used to receive a file from a RFTP client.
+ *                Protocol used to receive a file from a RFTP client, or to
+ *                serve files to RFTP clients.
  *
  *  CS 3357a Assignment 2
  */
 
 #include "rftp-server.h"
 #include "rftp-config.h"
+#include "rftp-trace.h"
+#include "rftp-busypoll.h"
+#include "output-file.h"
+#include "rftp-cache.h"
+#include "rftp-window.h"
+#include "rftp-crypto.h"
+#include "rftp-fair.h"
+#include "data.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -21,9 +30,21 @@
 int main (int argc, char **argv)
 {
     static int verbose_flag = SILENT;  // Toggles verbose output
+    static int io_mode = BUFFERED_IO;  // Toggles direct I/O for the output
     int time_wait = DEFAULT_TIME_WAIT; // Transmission timeout in milliseconds
     char *port_number = DEFAULT_PORT;  // Port number to listen on
     char *output_dir = NULL;           // The transfer output directory
+    int stats_interval = 0;            // Statistics report interval, in msec
+    char *stats_socket = NULL;         // Pathname of the statistics socket
+    char *trace_file = NULL;           // Pathname of the packet trace file
+    int busy_poll = 0;                 // Busy-poll spin in usec (0 = off)
+    int cpu = NO_CPU;                  // CPU to pin the process to
+    char *root = NULL;                 // Directory of the served files
+    long cache_mb = DEFAULT_CACHE_MB;  // Size of the served file cache, in MB
+    long memory_mb = DEFAULT_RECEIVE_MB; // Receive buffer budget, in MB
+    long session_rate = 0;             // Rate limit of a session, in kbps
+    long client_rate = 0;              // Rate limit of a client, in kbps
+    int scheduled = 0;                 // Gave options of a serving server
 
     // Handle command line options.
     int arg, option_index = 0;
@@ -32,9 +53,22 @@ int main (int argc, char **argv)
             {"verbose", no_argument, &verbose_flag, 1},
             {"timewait", optional_argument, 0, 't'},
             {"port", optional_argument, 0, 'p'},
+            {"direct", no_argument, &io_mode, DIRECT_IO},
+            {"stats-interval", required_argument, 0, 'i'},
+            {"stats-socket", required_argument, 0, 'S'},
+            {"trace", required_argument, 0, 'T'},
+            {"busy-poll", required_argument, 0, 'b'},
+            {"cpu", required_argument, 0, 'c'},
+            {"serve", required_argument, 0, 's'},
+            {"cache", required_argument, 0, 'C'},
+            {"memory", required_argument, 0, 'M'},
+            {"key", required_argument, 0, 'K'},
+            {"session-rate", required_argument, 0, 'L'},
+            {"client-rate", required_argument, 0, 'A'},
+            {"weight", required_argument, 0, 'W'},
             {0, 0, 0, 0}
     };
-    while ((arg = getopt_long(argc, argv, "vt:p:", long_options,
+    while ((arg = getopt_long(argc, argv, "vt:p:di:S:T:b:c:s:C:M:K:L:A:W:", long_options,
                               &option_index)) != EOF)
     {
         switch (arg)
@@ -48,6 +82,49 @@ int main (int argc, char **argv)
             case 'p': // Sets port number to send messages to
                 port_number = optarg;
                 break;
+            case 'd': // Writes the output file with direct I/O
+                io_mode = DIRECT_IO;
+                break;
+            case 'i': // Sets the statistics report interval, in milliseconds
+                stats_interval = atoi(optarg);
+                break;
+            case 'S': // Sets the pathname of the statistics socket
+                stats_socket = optarg;
+                break;
+            case 'T': // Traces packet events to a trace file
+                trace_file = optarg;
+                break;
+            case 'b': // Spins for messages, up to the given microseconds
+                busy_poll = atoi(optarg);
+                break;
+            case 'c': // Pins the process to a CPU
+                cpu = atoi(optarg);
+                break;
+            case 's': // Serves the files under a directory
+                root = optarg;
+                break;
+            case 'C': // Sets the size of the served file cache, in MB
+                cache_mb = atol(optarg);
+                scheduled = 1;
+                break;
+            case 'M': // Sets the receive buffer budget of all sessions, in MB
+                memory_mb = atol(optarg);
+                break;
+            case 'K': // Encrypts transfers with the pre-shared key of a file
+                if (!load_psk(optarg)) exit(EXIT_FAILURE);
+                break;
+            case 'L': // Limits the rate of each session, in kilobits per second
+                session_rate = atol(optarg);
+                scheduled = 1;
+                break;
+            case 'A': // Limits the rate of each client, in kilobits per second
+                client_rate = atol(optarg);
+                scheduled = 1;
+                break;
+            case 'W': // Weighs the client of an address, as ADDRESS=WEIGHT
+                if (!add_fair_weight(optarg)) exit(EXIT_FAILURE);
+                scheduled = 1;
+                break;
             case '?': // Failure
                 exit(EXIT_FAILURE);
         }
@@ -61,21 +138,63 @@ int main (int argc, char **argv)
     }
 
     // If an output directory was not supplied, exit the program.
-    if (!output_dir)
+    // A serving server only receives files when one is supplied.
+    if (!output_dir && !root)
     {
         printf("ERROR:\n");
         printf("- A output directory must be supplied.\n");
         printf("Sample usage: %s [OPTIONS...] [OUTPUTDIR]\n", argv[0]);
+        printf("              %s [OPTIONS...] --serve ROOT [OUTPUTDIR]\n",
+               argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    // The cache, rate limits and weights only apply to a serving server.
+    if (scheduled && !root)
+    {
+        printf("ERROR: -C, -L, -A and -W can only be used with --serve.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Report the statistics of the transfer, if requested.
+    if (!stats_configure(stats_interval, stats_socket)) exit(EXIT_FAILURE);
+
+    // Trace packet events, if requested.
+    if (trace_file && !trace_enable(trace_file)) exit(EXIT_FAILURE);
+
+    // Trade a CPU for receive latency, if requested.
+    if (!busy_poll_configure(busy_poll, cpu)) exit(EXIT_FAILURE);
+
+    // Share the receive buffer budget among the transfer sessions.
+    if (memory_mb < 0) memory_mb = 0;
+    set_receive_budget((size_t) memory_mb * MB);
+
+    // Share the server fairly among clients, within their rate limits.
+    set_fair_limits(session_rate, client_rate);
+
+    // Serve files to clients until the process is stopped.
+    if (root)
+    {
+        if (cache_mb < 0) cache_mb = 0;
+        rftp_serve(port_number, root, output_dir, (size_t) cache_mb * MB,
+                   time_wait, io_mode, verbose_flag);
+        stats_shutdown();
+        trace_shutdown();
         exit(EXIT_FAILURE);
     }
 
     // Receive a file transfer from the client and exit the program.
-    if (rftp_receive_file(port_number, output_dir, time_wait, verbose_flag))
+    if (rftp_receive_file(port_number, output_dir, time_wait, io_mode,
+                          verbose_flag))
     {
+        stats_shutdown();
+        trace_shutdown();
         exit(EXIT_SUCCESS);
     }
     else
     {
+        stats_shutdown();
+        trace_shutdown();
         exit(EXIT_FAILURE);
     }
 }
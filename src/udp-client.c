@@ -11,22 +11,23 @@
 
 #include "udp-client.h"
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 /*
- * Creates a socket on the specified port number
- * for communications with a UDP server.
+ * Creates a socket to the first usable address of a list, and frees
+ * the list.
  *
  * Return a socket file descriptor, if successful.
- * Exit the program if a socket could not be binded.
+ * Return -1 if a socket could not be created, with errno set.
  */
-int create_client_socket (char *hostname, char *port, host_t *server)
+static int connect_client_socket (struct addrinfo *results, host_t *server)
 {
-    int sockfd;
+    int sockfd = -1;
     struct addrinfo *addr;
-    struct addrinfo *results = get_udp_sockaddr(hostname, port, 0);
 
     // Iterate through the address information list for a socket.
     for (addr = results; addr != NULL; addr = addr->ai_next)
@@ -49,9 +50,47 @@ int create_client_socket (char *hostname, char *port, host_t *server)
 
     // Free the memory allocated to the address information list.
     freeaddrinfo(results);
+    return sockfd;
+}
+
+/*
+ * Binds a socket to a local address, on any port.
+ *
+ * Return 0 if the socket was bound.
+ * Return -1 if the address is unknown or could not be bound, with errno set.
+ */
+static int bind_client_socket (int sockfd, char *local)
+{
+    struct addrinfo *results = find_udp_sockaddr(local, "0", AI_PASSIVE);
+    int retval = -1;
+
+    if (!results)
+    {
+        errno = EADDRNOTAVAIL;
+        return -1;
+    }
+
+    retval = bind(sockfd, results->ai_addr, results->ai_addrlen);
+
+    // Free the memory allocated to the address information list.
+    freeaddrinfo(results);
+    return retval;
+}
+
+/*
+ * Creates a socket on the specified port number
+ * for communications with a UDP server.
+ *
+ * Return a socket file descriptor, if successful.
+ * Exit the program if a socket could not be binded.
+ */
+int create_client_socket (char *hostname, char *port, host_t *server)
+{
+    int sockfd = connect_client_socket(get_udp_sockaddr(hostname, port, 0),
+                                       server);
 
     // If a socket could not be created, exit the program.
-    if (addr == NULL)
+    if (sockfd == -1)
     {
         perror("Unable to create socket");
         exit(EXIT_FAILURE);
@@ -62,3 +101,70 @@ int create_client_socket (char *hostname, char *port, host_t *server)
         return sockfd;
     }
 }
+
+/*
+ * Creates a socket bound to a local address, for communications with
+ * a UDP server through the interface that holds the address.
+ *
+ * Return a socket file descriptor, if successful.
+ * Exit the program if a socket could not be binded.
+ */
+int create_bound_client_socket (char *local, char *hostname, char *port,
+        host_t *server)
+{
+    int sockfd = create_client_socket(hostname, port, server);
+
+    // Bind the socket to the local address, on any port.
+    if (bind_client_socket(sockfd, local) == -1)
+    {
+        perror("Unable to bind socket");
+        exit(EXIT_FAILURE);
+    }
+    return sockfd;
+}
+
+/*
+ * Creates a socket for communications with a UDP server, like
+ * create_client_socket, but leaves the error to the caller instead of
+ * exiting the program. A host that cannot be resolved fails with
+ * EHOSTUNREACH.
+ *
+ * Return a socket file descriptor, if successful.
+ * Return -1 if a socket could not be created, with errno set.
+ */
+int open_client_socket (char *hostname, char *port, host_t *server)
+{
+    struct addrinfo *results = find_udp_sockaddr(hostname, port, 0);
+
+    if (!results)
+    {
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+    return connect_client_socket(results, server);
+}
+
+/*
+ * Creates a socket bound to a local address, like
+ * create_bound_client_socket, but leaves the error to the caller instead
+ * of exiting the program.
+ *
+ * Return a socket file descriptor, if successful.
+ * Return -1 if a socket could not be created or bound, with errno set.
+ */
+int open_bound_client_socket (char *local, char *hostname, char *port,
+        host_t *server)
+{
+    int sockfd = open_client_socket(hostname, port, server);
+    int error = 0; // Cause of a failure to bind
+
+    if (sockfd == -1) return -1;
+    if (bind_client_socket(sockfd, local) == -1)
+    {
+        error = errno;
+        close(sockfd);
+        errno = error;
+        return -1;
+    }
+    return sockfd;
+}
@@ -18,5 +18,10 @@
  * Function prototypes
  */
 int create_client_socket (char *hostname, char *port, host_t *server);
+int create_bound_client_socket (char *local, char *hostname, char *port,
+        host_t *server);
+int open_client_socket (char *hostname, char *port, host_t *server);
+int open_bound_client_socket (char *local, char *hostname, char *port,
+        host_t *server);
 
 #endif /* UDP_CLIENT_H */
@@ -0,0 +1,476 @@
+/*
+ *  Name        : udp-proxy.c
+ *  Author      : Edmund Luong <edmundvmluong@gmail.com>
+ *  Version     : 1.0
+ *  Copyright   : MIT 2014 © Edmund Luong
+ *  Date        : November 16, 2014
+ *  Description : Implementation of a UDP proxy which relays datagrams
+ *                between a client and a server over an impaired link,
+ *                with configurable delay, jitter, loss, duplication,
+ *                reordering and bandwidth.
+ *
+ *  CS 3357a Assignment 2
+ */
+
+#include "udp-proxy.h"
+#include "udp-client.h"
+#include "udp-server.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+/*
+ * A datagram waiting on the link to be released to its receiver.
+ */
+typedef struct pending
+{
+    uint64_t release; // Time at which the datagram is released, in usec
+    uint64_t order;   // Arrival order, to release ties first-in first-out
+    int direction;    // Direction the datagram travels in
+    int length;       // Length of the datagram
+    uint8_t *data;    // Contents of the datagram
+} pending;
+
+/*
+ * The state of a link in one direction.
+ */
+typedef struct link_state
+{
+    link_stats stats; // What happened to the datagrams on the link
+    int bursting;     // Whether the link is in a loss burst
+    int queued;       // Datagrams queued on the link
+    uint64_t free_at; // Time at which the link finishes transmitting
+} link_state;
+
+/*
+ * The state of the proxy.
+ */
+typedef struct proxy
+{
+    int sockfd[2];        // Sockets that receive each direction
+    host_t client;        // Client host, learned from its first datagram
+    host_t server;        // Server host
+    int have_client;      // Whether the client host is known
+    impairment *imp;      // Link impairment, applied in both directions
+    link_state link[2];   // State of the link in each direction
+    pending *queue;       // Binary min-heap of pending datagrams
+    int queue_len;        // Number of pending datagrams
+    int queue_cap;        // Capacity of the pending datagram heap
+    uint64_t order;       // Next arrival order
+    uint64_t rng;         // Pseudo-random number generator state
+} proxy;
+
+static volatile sig_atomic_t stopping = 0; // Set when the proxy should stop
+
+/*
+ * Stops the proxy on an interrupt or termination signal.
+ */
+static void stop_proxy (int signum)
+{
+    (void) signum;
+    stopping = 1;
+}
+
+/*
+ * Returns the time on the monotonic clock, in microseconds.
+ */
+static uint64_t now_usec ()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * Returns a uniformly distributed random number in [0, 1),
+ * from a seeded xorshift64* generator so runs can be reproduced.
+ */
+static double next_random (proxy *p)
+{
+    p->rng ^= p->rng >> 12;
+    p->rng ^= p->rng << 25;
+    p->rng ^= p->rng >> 27;
+    return ((p->rng * 0x2545F4914F6CDD1DULL) >> 11)
+           * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * Returns whether an event with the given percentage probability occurs.
+ */
+static int roll (proxy *p, double percent)
+{
+    return (percent > 0) && (next_random(p) * 100.0 < percent);
+}
+
+/*
+ * Decides whether a datagram is lost, using independent random loss
+ * and a two-state (Gilbert-Elliott) model for bursts of loss.
+ */
+static int is_lost (proxy *p, link_state *link)
+{
+    double mean = p->imp->burst_len; // Mean burst length
+    double rate = p->imp->burst_loss / 100.0; // Long-run burst loss rate
+    double enter = 0;                // Probability of entering a burst
+
+    // Move between the good and the bursting state.
+    if (rate > 0)
+    {
+        if (link->bursting)
+        {
+            if (next_random(p) < 1.0 / mean) link->bursting = 0;
+        }
+        else
+        {
+            enter = (rate >= 1) ? 1 : rate / (mean * (1 - rate));
+            if (next_random(p) < enter) link->bursting = 1;
+        }
+        if (link->bursting) return 1;
+    }
+
+    // Otherwise, lose the datagram at random.
+    return roll(p, p->imp->loss);
+}
+
+/*
+ * Restores the heap order by moving a pending datagram up the heap.
+ */
+static void sift_up (proxy *p, int i)
+{
+    pending tmp;
+    int parent;
+
+    while (i > 0)
+    {
+        parent = (i - 1) / 2;
+        if (p->queue[parent].release < p->queue[i].release
+                || (p->queue[parent].release == p->queue[i].release
+                    && p->queue[parent].order < p->queue[i].order))
+        {
+            break;
+        }
+        tmp = p->queue[parent];
+        p->queue[parent] = p->queue[i];
+        p->queue[i] = tmp;
+        i = parent;
+    }
+}
+
+/*
+ * Restores the heap order by moving a pending datagram down the heap.
+ */
+static void sift_down (proxy *p, int i)
+{
+    pending tmp;
+    int child;
+
+    while ((child = 2 * i + 1) < p->queue_len)
+    {
+        if (child + 1 < p->queue_len
+                && (p->queue[child + 1].release < p->queue[child].release
+                    || (p->queue[child + 1].release == p->queue[child].release
+                        && p->queue[child + 1].order < p->queue[child].order)))
+        {
+            child++;
+        }
+        if (p->queue[i].release < p->queue[child].release
+                || (p->queue[i].release == p->queue[child].release
+                    && p->queue[i].order < p->queue[child].order))
+        {
+            break;
+        }
+        tmp = p->queue[child];
+        p->queue[child] = p->queue[i];
+        p->queue[i] = tmp;
+        i = child;
+    }
+}
+
+/*
+ * Queues a copy of a datagram on the link, to be released at the given time.
+ *
+ * Return 1 if the datagram was queued.
+ * Return 0 if the datagram could not be queued.
+ */
+static int queue_datagram (proxy *p, int direction, uint8_t *data,
+        int length, uint64_t release)
+{
+    pending *grown = NULL; // Grown pending datagram heap
+    pending *entry = NULL; // The queued datagram
+
+    // Grow the heap, if it is full.
+    if (p->queue_len == p->queue_cap)
+    {
+        grown = realloc(p->queue, (p->queue_cap * 2 + 16) * sizeof(pending));
+        if (!grown) return 0;
+        p->queue = grown;
+        p->queue_cap = p->queue_cap * 2 + 16;
+    }
+
+    // Copy the datagram into the heap.
+    entry = &p->queue[p->queue_len];
+    if (!(entry->data = malloc(length))) return 0;
+    memcpy(entry->data, data, length);
+    entry->length = length;
+    entry->direction = direction;
+    entry->release = release;
+    entry->order = p->order++;
+    sift_up(p, p->queue_len++);
+    p->link[direction].queued++;
+
+    return 1;
+}
+
+/*
+ * Applies the link impairment to a received datagram, and queues
+ * each surviving copy for release.
+ */
+static void impair_datagram (proxy *p, int direction, uint8_t *data,
+        int length, int verbose)
+{
+    link_state *link = &p->link[direction]; // Link the datagram travels on
+    char *dir_t = (direction == UPSTREAM) ? "upstream" : "downstream";
+    uint64_t now = now_usec();              // Arrival time
+    uint64_t release = 0;                   // Release time of a copy
+    double delay = 0;                       // Delay of a copy, in usec
+    int copies = 1;                         // Copies of the datagram to send
+    int i;
+
+    link->stats.received++;
+
+    // Drop lost datagrams.
+    if (is_lost(p, link))
+    {
+        link->stats.lost++;
+        if (verbose) printf("Lost %s datagram (%d B)\n", dir_t, length);
+        return;
+    }
+
+    // Duplicate the datagram.
+    if (roll(p, p->imp->duplicate))
+    {
+        link->stats.duplicated++;
+        copies = 2;
+    }
+
+    for (i = 0; i < copies; i++)
+    {
+        // Drop the copy if the link queue is full.
+        if (link->queued >= p->imp->queue_limit)
+        {
+            link->stats.overflowed++;
+            if (verbose) printf("Overflowed %s datagram (%d B)\n", dir_t,
+                                length);
+            continue;
+        }
+
+        // Serialize the copy onto a rate-limited link.
+        release = now;
+        if (p->imp->rate > 0)
+        {
+            if (link->free_at > release) release = link->free_at;
+            release += (uint64_t) length * 8000 / p->imp->rate;
+            link->free_at = release;
+        }
+
+        // Delay the copy, unless it is reordered ahead of the others.
+        if (roll(p, p->imp->reorder))
+        {
+            link->stats.reordered++;
+        }
+        else
+        {
+            delay = p->imp->delay * 1000;
+            if (p->imp->jitter > 0)
+            {
+                delay += (next_random(p) * 2 - 1) * p->imp->jitter * 1000;
+            }
+            if (delay > 0) release += (uint64_t) delay;
+        }
+
+        queue_datagram(p, direction, data, length, release);
+    }
+}
+
+/*
+ * Releases every pending datagram whose release time has passed.
+ */
+static void release_datagrams (proxy *p, int verbose)
+{
+    pending entry;   // The released datagram
+    host_t *dest;    // Receiver of the released datagram
+    int sockfd;      // Socket to send the released datagram from
+
+    while (p->queue_len > 0 && p->queue[0].release <= now_usec())
+    {
+        // Remove the earliest datagram from the heap.
+        entry = p->queue[0];
+        p->queue[0] = p->queue[--p->queue_len];
+        sift_down(p, 0);
+        p->link[entry.direction].queued--;
+
+        // Send the datagram on to its receiver.
+        if (entry.direction == UPSTREAM)
+        {
+            dest = &p->server;
+            sockfd = p->sockfd[DOWNSTREAM];
+        }
+        else
+        {
+            dest = &p->client;
+            sockfd = p->sockfd[UPSTREAM];
+        }
+        if ((entry.direction == UPSTREAM || p->have_client)
+                && sendto(sockfd, entry.data, entry.length, 0,
+                          (struct sockaddr*) &dest->addr, dest->addr_len) > 0)
+        {
+            p->link[entry.direction].stats.forwarded++;
+            p->link[entry.direction].stats.bytes += entry.length;
+        }
+        else if (verbose)
+        {
+            printf("Could not forward %s datagram (%d B)\n",
+                   (entry.direction == UPSTREAM) ? "upstream" : "downstream",
+                   entry.length);
+        }
+        free(entry.data);
+    }
+}
+
+/*
+ * Receives a datagram from a socket, and puts it on the link.
+ */
+static void receive_datagram (proxy *p, int direction, uint8_t *buffer,
+        int verbose)
+{
+    host_t source; // Sender of the datagram
+    int length;    // Length of the datagram
+
+    // Read the datagram and its source address.
+    source.addr_len = sizeof(source.addr);
+    length = recvfrom(p->sockfd[direction], buffer, PROXY_MSS, 0,
+                      (struct sockaddr*) &source.addr, &source.addr_len);
+    if (length < 0) return;
+
+    // Remember the client, so that replies can be sent back to it.
+    if (direction == UPSTREAM)
+    {
+        if (!p->have_client
+                || memcmp(&p->client.addr, &source.addr,
+                          sizeof(source.addr)))
+        {
+            inet_ntop(source.addr.sin_family, &source.addr.sin_addr,
+                      source.friendly_ip, sizeof(source.friendly_ip));
+            printf("Relaying for client %s:%d\n", source.friendly_ip,
+                   ntohs(source.addr.sin_port));
+        }
+        p->client = source;
+        p->have_client = 1;
+    }
+
+    impair_datagram(p, direction, buffer, length, verbose);
+}
+
+/*
+ * Outputs the statistics of a link direction.
+ */
+void output_link_stats (int direction, link_stats *stats)
+{
+    printf("%-10s received %llu, forwarded %llu (%llu B), lost %llu, "
+           "overflowed %llu, duplicated %llu, reordered %llu\n",
+           (direction == UPSTREAM) ? "Upstream" : "Downstream",
+           (unsigned long long) stats->received,
+           (unsigned long long) stats->forwarded,
+           (unsigned long long) stats->bytes,
+           (unsigned long long) stats->lost,
+           (unsigned long long) stats->overflowed,
+           (unsigned long long) stats->duplicated,
+           (unsigned long long) stats->reordered);
+}
+
+/*
+ * Relays datagrams between a client and a server, impairing the link
+ * in both directions, until the proxy is interrupted or terminated.
+ * The link statistics are written out when the proxy stops.
+ *
+ * Return 1 once the proxy has stopped.
+ * Return 0 if the proxy could not be started.
+ */
+int run_udp_proxy (char *listen_port, char *server_name, char *server_port,
+        impairment *imp, uint64_t seed, int verbose)
+{
+    proxy p;                    // State of the proxy
+    struct sigaction action;    // Signal handler to stop the proxy
+    struct pollfd fds[2];       // Sockets polled for datagrams
+    uint8_t *buffer = NULL;     // Buffer to read datagrams into
+    uint64_t now = 0;           // Current time, in usec
+    int timeout = -1;           // Time to wait for a datagram, in msec
+    int i;
+
+    // Initialize the proxy and its sockets.
+    memset(&p, 0, sizeof(p));
+    p.imp = imp;
+    p.rng = seed ? seed : 1;
+    if (!(buffer = malloc(PROXY_MSS))) return 0;
+    p.sockfd[UPSTREAM] = create_server_socket(listen_port);
+    p.sockfd[DOWNSTREAM] = create_client_socket(server_name, server_port,
+                                                &p.server);
+    printf("Relaying port %s to %s:%s ...\n", listen_port, server_name,
+           server_port);
+
+    // Stop cleanly on an interrupt or termination signal.
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop_proxy;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    while (!stopping)
+    {
+        // Wait for a datagram, or until the next pending datagram is due.
+        timeout = -1;
+        if (p.queue_len > 0)
+        {
+            now = now_usec();
+            timeout = (p.queue[0].release <= now) ? 0
+                      : (int) ((p.queue[0].release - now + 999) / 1000);
+        }
+        for (i = 0; i < 2; i++)
+        {
+            fds[i].fd = p.sockfd[i];
+            fds[i].events = POLLIN;
+            fds[i].revents = 0;
+        }
+        if (poll(fds, 2, timeout) == -1 && errno != EINTR) break;
+
+        // Put received datagrams on the link, and release those due.
+        for (i = 0; i < 2; i++)
+        {
+            if (fds[i].revents & POLLIN)
+            {
+                receive_datagram(&p, i, buffer, verbose);
+            }
+        }
+        release_datagrams(&p, verbose);
+    }
+
+    // Output the link statistics.
+    printf("\n");
+    output_link_stats(UPSTREAM, &p.link[UPSTREAM].stats);
+    output_link_stats(DOWNSTREAM, &p.link[DOWNSTREAM].stats);
+    fflush(stdout);
+
+    // Free the pending datagrams and close the sockets.
+    for (i = 0; i < p.queue_len; i++) free(p.queue[i].data);
+    free(p.queue);
+    free(buffer);
+    close(p.sockfd[UPSTREAM]);
+    close(p.sockfd[DOWNSTREAM]);
+    return 1;
+}
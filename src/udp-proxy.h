@@ -0,0 +1,73 @@
+/*
+ *  Name        : udp-proxy.h
+ *  Author      : Edmund Luong <edmundvmluong@gmail.com>
+ *  Version     : 1.0
+ *  Copyright   : MIT 2014 © Edmund Luong
+ *  Date        : November 16, 2014
+ *  Description : Implementation of a UDP proxy which relays datagrams
+ *                between a client and a server over an impaired link,
+ *                with configurable delay, jitter, loss, duplication,
+ *                reordering and bandwidth.
+ *
+ *  CS 3357a Assignment 2
+ */
+
+#ifndef UDP_PROXY_H
+#define UDP_PROXY_H
+
+#include "udp-sockets.h"
+
+#include <stdint.h>
+
+/*
+ * Proxy-oriented macros
+ */
+#define UPSTREAM 0            // Datagrams from the client to the server
+#define DOWNSTREAM 1          // Datagrams from the server to the client
+#define PROXY_MSS 65507       // Largest datagram relayed by the proxy
+#define DEFAULT_BURST_LEN 4   // Default mean length of a loss burst
+#define DEFAULT_QUEUE 1000    // Default link queue limit, in datagrams
+
+/*
+ * Link impairment
+ *
+ * Describes how a link impairs each datagram sent across it.
+ * Probabilities are given as percentages.
+ */
+typedef struct impairment
+{
+    double delay;      // Fixed one-way delay, in milliseconds
+    double jitter;     // Uniform random delay variation, in milliseconds
+    double loss;       // Random (independent) loss probability
+    double burst_loss; // Long-run loss probability in bursts
+    double burst_len;  // Mean length of a loss burst, in datagrams
+    double duplicate;  // Duplication probability
+    double reorder;    // Probability a datagram skips the delay
+    long rate;         // Bandwidth cap, in kilobits per second (0 = none)
+    int queue_limit;   // Maximum datagrams queued on the link
+} impairment;
+
+/*
+ * Link statistics
+ *
+ * Counts what happened to the datagrams sent in one direction.
+ */
+typedef struct link_stats
+{
+    uint64_t received;   // Datagrams received from the sender
+    uint64_t forwarded;  // Datagrams forwarded to the receiver
+    uint64_t lost;       // Datagrams dropped by random or burst loss
+    uint64_t overflowed; // Datagrams dropped by a full link queue
+    uint64_t duplicated; // Extra copies of datagrams forwarded
+    uint64_t reordered;  // Datagrams that skipped the delay
+    uint64_t bytes;      // Bytes forwarded to the receiver
+} link_stats;
+
+/*
+ * Function prototypes
+ */
+int run_udp_proxy (char *listen_port, char *server_name, char *server_port,
+        impairment *imp, uint64_t seed, int verbose);
+void output_link_stats (int direction, link_stats *stats);
+
+#endif /* UDP_PROXY_H */
@@ -12,6 +12,7 @@
 #include "udp-server.h"
 #include "udp-sockets.h"
 
+#include <errno.h>
 #include <netdb.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -19,15 +20,16 @@
 #include <unistd.h>
 
 /*
- * Binds a socket to the specified address and port.
+ * Binds a socket to the first usable address of a list, and frees the list.
  *
- * Return a socket file description, if successful.
- * Exit the program if unable to bind the socket.
+ * Return a socket file descriptor, if successful.
+ * Return -1 if no socket could be bound, with errno set.
  */
-int bind_socket (struct addrinfo *addr_list)
+static int bind_first_socket (struct addrinfo *addr_list)
 {
     struct addrinfo *addr;
-    int sockfd;
+    int sockfd = -1;
+    int error = EADDRNOTAVAIL; // Cause of the last failure
 
     // Iterate through the address information list for a socket.
     for (addr = addr_list; addr != NULL; addr = addr->ai_next)
@@ -37,13 +39,19 @@ int bind_socket (struct addrinfo *addr_list)
                         addr->ai_protocol);
 
         // Try the next address if socket could not be created.
-        if (sockfd == -1) continue;
+        if (sockfd == -1)
+        {
+            error = errno;
+            continue;
+        }
 
         // Bind the socket to the address/port.
         if (bind(sockfd, addr->ai_addr, addr->ai_addrlen) == -1)
         {
             // If binding fails, close the socket, and try the next address.
+            error = errno;
             close(sockfd);
+            sockfd = -1;
             continue;
         }
         // Socket has been binded.
@@ -55,9 +63,22 @@ int bind_socket (struct addrinfo *addr_list)
 
     // Free the memory allocated to the address information list.
     freeaddrinfo(addr_list);
+    if (sockfd == -1) errno = error;
+    return sockfd;
+}
+
+/*
+ * Binds a socket to the specified address and port.
+ *
+ * Return a socket file description, if successful.
+ * Exit the program if unable to bind the socket.
+ */
+int bind_socket (struct addrinfo *addr_list)
+{
+    int sockfd = bind_first_socket(addr_list);
 
     // If a socket could not be binded, exit the program.
-    if (addr == NULL)
+    if (sockfd == -1)
     {
         perror("Unable to bind");
         exit(EXIT_FAILURE);
@@ -88,3 +109,23 @@ int create_server_socket (char *port)
     return sockfd;
 }
 
+/*
+ * Binds a UDP server socket on the specified port number, like
+ * create_server_socket, but leaves the error to the caller instead of
+ * exiting the program. A port that cannot be resolved fails with
+ * EADDRNOTAVAIL.
+ *
+ * Return a UDP server socket file descriptor, if successful.
+ * Return -1 if the socket could not be bound, with errno set.
+ */
+int open_server_socket (char *port)
+{
+    struct addrinfo *results = find_udp_sockaddr(NULL, port, AI_PASSIVE);
+
+    if (!results)
+    {
+        errno = EADDRNOTAVAIL;
+        return -1;
+    }
+    return bind_first_socket(results);
+}
@@ -19,5 +19,6 @@
  */
 int bind_socket (struct addrinfo *addr_list);
 int create_server_socket (char *port);
+int open_server_socket (char *port);
 
 #endif /* UDP_SERVER_H */
@@ -17,16 +17,15 @@
 #include <string.h>
 
 /*
- * Gets UDP socket information for the given port number.
+ * Looks up UDP socket information for the given port number.
  *
- * Return address information of a service provider.
+ * Return 0 with the address information of a service provider.
+ * Return a getaddrinfo error code if there was an error.
  */
-struct addrinfo *get_udp_sockaddr (const char *node, const char *port,
-        int flags)
+static int lookup_udp_sockaddr (const char *node, const char *port,
+        int flags, struct addrinfo **results)
 {
     struct addrinfo hints;
-    struct addrinfo *results;
-    int retval;
 
     memset(&hints, 0, sizeof(struct addrinfo));
 
@@ -36,8 +35,22 @@ struct addrinfo *get_udp_sockaddr (const char *node, const char *port,
     hints.ai_socktype = SOCK_DGRAM; // Return UDP socket addresses
     hints.ai_flags = flags;         // Return istening socket addresses
 
+    return getaddrinfo(node, port, &hints, results);
+}
+
+/*
+ * Gets UDP socket information for the given port number.
+ *
+ * Return address information of a service provider.
+ */
+struct addrinfo *get_udp_sockaddr (const char *node, const char *port,
+        int flags)
+{
+    struct addrinfo *results;
+    int retval;
+
     // Get the socket address, exit the program if there was an error.
-    if ((retval = getaddrinfo(node, port, &hints, &results)) != 0)
+    if ((retval = lookup_udp_sockaddr(node, port, flags, &results)) != 0)
     {
         fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(retval));
         exit(EXIT_FAILURE);
@@ -47,3 +60,18 @@ struct addrinfo *get_udp_sockaddr (const char *node, const char *port,
     return results;
 }
 
+/*
+ * Finds UDP socket information for the given port number, without exiting
+ * the program, for library code that reports its own errors.
+ *
+ * Return address information of a service provider.
+ * Return NULL if there was an error.
+ */
+struct addrinfo *find_udp_sockaddr (const char *node, const char *port,
+        int flags)
+{
+    struct addrinfo *results;
+
+    if (lookup_udp_sockaddr(node, port, flags, &results) != 0) return NULL;
+    return results;
+}
@@ -30,5 +30,7 @@ typedef struct
  */
 struct addrinfo *get_udp_sockaddr (const char *node, const char *port,
         int flags);
+struct addrinfo *find_udp_sockaddr (const char *node, const char *port,
+        int flags);
 
 #endif /* UDP_SOCKETS_H */